@@ -944,13 +944,17 @@ const uae_u8 *restore_audio (int i, const uae_u8 *src)
     return src;
 }
 
-uae_u8 *save_audio (int i, int *len)
+uae_u8 *save_audio (int i, int *len, uae_u8 *dstptr)
 {
     struct audio_channel_data *acd;
-    uae_u8 *dst = malloc (100);
-    uae_u8 *dstbak = dst;
+    uae_u8 *dst, *dstbak;
     uae_u16 p;
 
+    if (dstptr)
+	dstbak = dst = dstptr;
+    else
+	dstbak = dst = malloc (100);
+
     acd = audio_channel + i;
     save_u8 ((uae_u8)acd->state);
     save_u8 (acd->vol);
@@ -39,8 +39,9 @@
 #ifdef BSDSOCKET
 #include <sys/types.h>
 #include <sys/socket.h>
-#include <sys/select.h>
+#include <sys/epoll.h>
 #include <sys/ioctl.h>
+#include <sys/uio.h>
 #ifdef HAVE_SYS_FILIO_H
 # include <sys/filio.h>
 #endif
@@ -86,16 +87,50 @@
 
 uae_u32 bsdthr_Accept_2 (SB);
 uae_u32 bsdthr_Recv_2 (SB);
-uae_u32 bsdthr_blockingstuff (uae_u32 (*tryfunc)(SB), SB);
-uae_u32 bsdthr_SendRecvAcceptConnect (uae_u32 (*tryfunc)(SB), SB);
 uae_u32 bsdthr_Send_2 (SB);
 uae_u32 bsdthr_Connect_2 (SB);
-uae_u32 bsdthr_WaitSelect (SB);
-uae_u32 bsdthr_Wait (SB);
 void clearsockabort (SB);
 
 static uae_sem_t sem_queue;
 
+/*
+ * Blocking calls are not run on a thread of their own per SocketBase.
+ * They are queued for a small pool of workers, which try them without
+ * blocking.  A call that would block is handed to a single reactor
+ * thread, which waits for its socket in one epoll set and queues the call
+ * again once the socket is ready, its timeout expires or it is aborted.
+ */
+
+#define BSD_WORKERS 4
+#define BSD_RESOLVERS 2
+
+/* Segments a send or recv buffer may be split into.  */
+#define BSD_MAXIOV 16
+
+/* Why the reactor handed a call back to the workers.  */
+#define WAKE_READY 1
+#define WAKE_TIMEOUT 2
+#define WAKE_ABORT 3
+
+static int reactor_started;
+static int reactor_lock_ready;		/* the semaphores below are set up */
+static int reactor_epfd = -1;
+static int reactor_wake[2];
+static uae_sem_t reactor_lock;		/* guards the lists and the wait state of each base */
+static struct socketbase *waiters;	/* bases waiting in the reactor */
+static uae_thread_id reactor_threads[BSD_WORKERS + BSD_RESOLVERS + 1];
+
+struct bsd_jobs {
+    struct socketbase *head, *tail;
+    uae_sem_t avail;
+};
+
+static struct bsd_jobs jobs;		/* calls for the socket workers */
+static struct bsd_jobs lookups;		/* ...and for the resolvers */
+
+/* Host, service and protocol lookups are run by the resolvers.  */
+#define BSD_IS_LOOKUP(action) ((action) == 4 || (action) == 7 || (action) == 8)
+
 /**
  ** Helper functions
  **/
@@ -319,8 +354,6 @@ static void mapsockoptreturn(int level, int optname, uae_u32 optval, void *buf)
 		case SO_RCVBUF:
 		case SO_SNDLOWAT:
 		case SO_RCVLOWAT:
-		case SO_SNDTIMEO:
-		case SO_RCVTIMEO:
 		case SO_TYPE:
 		    put_long (optval, *(int *)buf);
 		    break;
@@ -372,6 +405,11 @@ static void mapsockoptreturn(int level, int optname, uae_u32 optval, void *buf)
     }
 }
 
+/* The send and receive timeouts are a timeval, which has two longs on the
+ * Amiga but not necessarily on the host.  */
+#define IS_TIMEO_OPT(level, optname) \
+    ((level) == SOL_SOCKET && ((optname) == SO_SNDTIMEO || (optname) == SO_RCVTIMEO))
+
 /*
  * Map amiga (s|g)etsockopt value from amiga to the appropriate value
  */
@@ -399,8 +437,6 @@ static void mapsockoptvalue(int level, int optname, uae_u32 optval, void *buf)
 		case SO_RCVBUF:
 		case SO_SNDLOWAT:
 		case SO_RCVLOWAT:
-		case SO_SNDTIMEO:
-		case SO_RCVTIMEO:
 		case SO_TYPE:
 		case SO_ERROR:
 		    *((int *)buf) = get_long (optval);
@@ -459,22 +495,16 @@ STATIC_INLINE void fd_zero (uae_u32 fdset, uae_u32 nfds)
 
 STATIC_INLINE int bsd_amigaside_FD_ISSET (int n, uae_u32 set)
 {
-    uae_u32 foo = get_long (set + (n / 32));
+    uae_u32 foo = get_long (set + (n / 32) * 4);
     if (foo & (1 << (n % 32)))
 	return 1;
     return 0;
 }
 
-STATIC_INLINE void bsd_amigaside_FD_ZERO (uae_u32 set)
+STATIC_INLINE void bsd_amigaside_FD_CLR (int n, uae_u32 set)
 {
-    put_long (set, 0);
-    put_long (set + 4, 0);
-}
-
-STATIC_INLINE void bsd_amigaside_FD_SET (int n, uae_u32 set)
-{
-    set = set + (n / 32);
-    put_long (set, get_long (set) | (1 << (n % 32)));
+    set = set + (n / 32) * 4;
+    put_long (set, get_long (set) & ~(1 << (n % 32)));
 }
 
 #ifdef DEBUG_BSDSOCKET
@@ -493,18 +523,22 @@ static void printSockAddr (struct sockaddr_in *in)
  */
 static int copysockaddr_a2n (struct sockaddr_in *addr, uae_u32 a_addr, unsigned int len)
 {
+    uae_u8 buf[sizeof (struct sockaddr_in)];
+
     if ((len > sizeof (struct sockaddr_in)) || (len < 8))
 	return 1;
 
     if (a_addr == 0)
 	return 0;
 
-    addr->sin_family      = get_byte (a_addr + 1);
-    addr->sin_port        = htons (get_word (a_addr + 2));
-    addr->sin_addr.s_addr = htonl (get_long (a_addr + 4));
+    /* The port and address are in network order already.  */
+    memcpyah (buf, a_addr, len);
+    addr->sin_family = buf[1];
+    memcpy (&addr->sin_port, buf + 2, 2);
+    memcpy (&addr->sin_addr.s_addr, buf + 4, 4);
 
     if (len > 8)
-	memcpy (&addr->sin_zero, get_real_address (a_addr + 8), len - 8);   /* Pointless? */
+	memcpy (&addr->sin_zero, buf + 8, len - 8);   /* Pointless? */
 
     return 0;
 }
@@ -514,23 +548,87 @@ static int copysockaddr_a2n (struct sockaddr_in *addr, uae_u32 a_addr, unsigned
  */
 static int copysockaddr_n2a (uae_u32 a_addr, const struct sockaddr_in *addr, unsigned int len)
 {
+    uae_u8 buf[sizeof (struct sockaddr_in)];
+
     if (len < 8)
 	return 1;
 
     if (a_addr == 0)
 	return 0;
 
-    put_byte (a_addr, 0);                       /* Anyone use this field? */
-    put_byte (a_addr + 1, addr->sin_family);
-    put_word (a_addr + 2, ntohs (addr->sin_port));
-    put_long (a_addr + 4, ntohl (addr->sin_addr.s_addr));
-
-    if (len > 8)
-	memset (get_real_address (a_addr + 8), 0, len - 8);
+    if (len > sizeof buf)
+	len = sizeof buf;
+    memset (buf, 0, sizeof buf);                /* buf[0]: anyone use this field? */
+    buf[1] = addr->sin_family;
+    memcpy (buf + 2, &addr->sin_port, 2);
+    memcpy (buf + 4, &addr->sin_addr.s_addr, 4);
+    memcpyha (a_addr, buf, len);
 
     return 0;
 }
 
+/*
+ * Point the iovec of a base at the Amiga buffer of a send or recv.  RAM
+ * is used in place, as one segment for each stretch of banks that is
+ * contiguous in host memory; a buffer that isn't all RAM, or is too
+ * scattered, goes through a bounce buffer.  Returns 0 if that can't be
+ * allocated.
+ */
+static int bsd_setbuf (SB, uae_u32 addr, uae_u32 len, int recv)
+{
+    struct iovec *iov = (struct iovec *)sb->iov;
+    uae_u32 a = addr, left = len;
+    int n = 0;
+
+    sb->bufaddr = addr;
+    sb->len = len;
+    sb->bounced = 0;
+
+    while (left > 0) {
+	addrbank *ab = &get_mem_bank (a);
+	uae_u32 chunk = 65536 - (a & 0xffff);
+	uae_u8 *p;
+
+	if (chunk > left)
+	    chunk = left;
+	if (!ab->dirty || !ab->check (a, chunk))
+	    break;
+	p = ab->xlateaddr (a);
+	if (n > 0 && (uae_u8 *)iov[n - 1].iov_base + iov[n - 1].iov_len == p)
+	    iov[n - 1].iov_len += chunk;
+	else if (n == BSD_MAXIOV)
+	    break;
+	else {
+	    iov[n].iov_base = p;
+	    iov[n].iov_len = chunk;
+	    n++;
+	}
+	if (recv)
+	    memory_dirty (a, chunk);
+	a += chunk;
+	left -= chunk;
+    }
+    if (left == 0) {
+	sb->niov = n;
+	return 1;
+    }
+
+    if (len > sb->bouncesize) {
+	uae_u8 *b = (uae_u8 *)realloc (sb->bounce, len);
+	if (b == NULL)
+	    return 0;
+	sb->bounce = b;
+	sb->bouncesize = len;
+    }
+    if (!recv)
+	memcpyah (sb->bounce, addr, len);
+    iov[0].iov_base = sb->bounce;
+    iov[0].iov_len = len;
+    sb->niov = 1;
+    sb->bounced = 1;
+    return 1;
+}
+
 /*
  * Copy a hostent object from native space to amiga space
  */
@@ -627,96 +725,676 @@ static void copyProtoent (TrapContext *context, SB, const struct protoent *p)
 
 
 
-uae_u32 bsdthr_WaitSelect (SB)
+/*
+ * The reactor
+ */
+
+static uae_u64 bsd_now (void)
 {
-    fd_set sets [3];
-    int i, s, set, a_s, max;
-    uae_u32 a_set;
     struct timeval tv;
-    int r;
 
-    DEBUG_LOG ("WaitSelect: %d 0x%x 0x%x 0x%x 0x%x 0x%x\n",
-	       sb->nfds, sb->sets [0], sb->sets [1], sb->sets [2], sb->timeout, sb->sigmp);
+    gettimeofday (&tv, NULL);
+    return (uae_u64)tv.tv_sec * 1000000 + tv.tv_usec;
+}
 
-    if (sb->timeout)
-	DEBUG_LOG ("WaitSelect: timeout %d %d\n", get_long (sb->timeout),
-		   get_long (sb->timeout + 4));
+static void bsd_lock (void)
+{
+    uae_sem_wait (&reactor_lock);
+}
 
-    FD_ZERO (&sets [0]);
-    FD_ZERO (&sets [1]);
-    FD_ZERO (&sets [2]);
+static void bsd_unlock (void)
+{
+    uae_sem_post (&reactor_lock);
+}
 
-    /* Set up the abort socket */
-    FD_SET (sb->sockabort[0], &sets[0]);
-    FD_SET (sb->sockabort[0], &sets[2]);
-    max = sb->sockabort[0];
+/* Queue a call for the workers.  Called with the lock held.  */
+static void bsd_queue (SB, int wake)
+{
+    struct bsd_jobs *q = BSD_IS_LOOKUP (sb->action) ? &lookups : &jobs;
 
-    for (set = 0; set < 3; set++) {
-	if (sb->sets [set] != 0) {
-	    a_set = sb->sets [set];
-	    for (i = 0; i < sb->nfds; i++) {
-		if (bsd_amigaside_FD_ISSET (i, a_set)) {
-		    s = getsock (sb, i + 1);
-		    DEBUG_LOG ("WaitSelect: AmigaSide %d set. NativeSide %d.\n", i, s);
-		    if (s == -1) {
-			write_log ("BSDSOCK: WaitSelect() called with invalid descriptor %d in set %d.\n", i, set);
-		    } else {
-			FD_SET (s, &sets [set]);
-			if (max < s) max = s;
-		    }
-		}
+    sb->wake = wake;
+    sb->nextjob = NULL;
+    if (q->tail)
+	q->tail->nextjob = sb;
+    else
+	q->head = sb;
+    q->tail = sb;
+    uae_sem_post (&q->avail);
+}
+
+static void bsd_submit (SB)
+{
+    bsd_lock ();
+    /* A call that was interrupted by a signal may still be finishing.  */
+    if (sb->busy)
+	sb->pending = 1;
+    else {
+	sb->busy = 1;
+	bsd_queue (sb, 0);
+    }
+    bsd_unlock ();
+}
+
+/* Take a base out of the reactor and queue its call again.  Called with
+ * the lock held.  */
+static void bsd_wake (SB, int wake)
+{
+    struct socketbase **p;
+    struct epoll_event ev;
+
+    if (!sb->waiting)
+	return;
+    for (p = &waiters; *p != sb; p = &(*p)->nextwait)
+	;
+    *p = sb->nextwait;
+    epoll_ctl (reactor_epfd, EPOLL_CTL_DEL, sb->waitfd, &ev);
+    sb->waiting = 0;
+    bsd_queue (sb, wake);
+}
+
+/*
+ * Hand a call that would block to the reactor, which queues it again once
+ * fd has one of events pending.  Returns 1 if the call now waits, 0 if it
+ * has been aborted already and -1 on error.
+ */
+static int bsd_wait (SB, int fd, uae_u32 events, int timed)
+{
+    struct epoll_event ev;
+    char c = 0;
+
+    ev.events = events | EPOLLONESHOT;
+    ev.data.ptr = sb;
+
+    bsd_lock ();
+    if (sb->abort) {
+	bsd_unlock ();
+	return 0;
+    }
+    if (epoll_ctl (reactor_epfd, EPOLL_CTL_ADD, fd, &ev) < 0
+	&& (errno != EEXIST || epoll_ctl (reactor_epfd, EPOLL_CTL_MOD, fd, &ev) < 0))
+    {
+	bsd_unlock ();
+	return -1;
+    }
+    sb->waitfd = fd;
+    sb->timed = timed;
+    sb->waiting = 1;
+    sb->nextwait = waiters;
+    waiters = sb;
+    bsd_unlock ();
+
+    /* Make the reactor recompute its timeout.  */
+    if (timed)
+	write (reactor_wake[1], &c, 1);
+    return 1;
+}
+
+/* Time out expired waits, and return the milliseconds until the next
+ * deadline, or -1.  */
+static int bsd_check_timeouts (void)
+{
+    struct socketbase *sb, *next;
+    uae_u64 now = bsd_now (), first = 0;
+
+    bsd_lock ();
+    for (sb = waiters; sb; sb = next) {
+	next = sb->nextwait;
+	if (!sb->timed)
+	    continue;
+	if (sb->deadline <= now)
+	    bsd_wake (sb, WAKE_TIMEOUT);
+	else if (first == 0 || sb->deadline < first)
+	    first = sb->deadline;
+    }
+    bsd_unlock ();
+    return first ? (int)((first - now + 999) / 1000) : -1;
+}
+
+static void *bsd_reactor (void *arg)
+{
+    struct epoll_event ev[64];
+
+    for (;;) {
+	int i, n = epoll_wait (reactor_epfd, ev, 64, bsd_check_timeouts ());
+
+	for (i = 0; i < n; i++) {
+	    struct socketbase *sb = (struct socketbase *)ev[i].data.ptr;
+	    if (sb == NULL) {
+		char buf[64];
+		while (read (reactor_wake[0], buf, sizeof buf) > 0)
+		    ;
+		continue;
 	    }
+	    bsd_lock ();
+	    bsd_wake (sb, WAKE_READY);
+	    bsd_unlock ();
 	}
     }
+    return NULL;
+}
+
+/*
+ * The resolver
+ *
+ * Host, service and protocol lookups can take seconds once they go out to
+ * a name server, so they are queued for threads of their own rather than
+ * for the socket workers.  Answers, and definite failures, are kept for a
+ * while, and a lookup that finds one is answered on the calling thread.
+ */
 
-    max++;
+#define DNS_CACHE_SIZE 128
+#define DNS_TTL 300			/* seconds an answer is kept */
+#define DNS_NEGATIVE_TTL 30		/* ...and a failure */
+
+#define DNS_HOSTNAME 1
+#define DNS_HOSTADDR 2
+#define DNS_SERVNAME 3
+#define DNS_SERVPORT 4
+#define DNS_PROTONAME 5
+#define DNS_PROTONUM 6
+
+struct dns_entry {
+    struct dns_entry *next;
+    int refs;
+    int type;
+    int keylen;
+    char key[MAXADDRLEN];
+    uae_u64 expires;
+    int err;			/* h_errno or errno of a failed lookup */
+    union {
+	struct hostent h;
+	struct servent s;
+	struct protoent p;
+    } u;
+    char *buf;			/* what the members of u point into */
+};
+
+static uae_sem_t dns_lock;
+static struct dns_entry *dns_cache;	/* most recently used first */
+static int dns_count;
+
+/* Set up the lookup of a base from a binary part and an optional string.
+ * Returns 0 if the key is too long.  */
+static int dns_key (SB, int type, const void *a, int alen, const char *b)
+{
+    int blen = b ? strlen (b) + 1 : 0;
+
+    if (alen + blen > MAXADDRLEN)
+	return 0;
+    sb->lookuptype = type;
+    sb->lookuplen = alen + blen;
+    memcpy (sb->lookupkey, a, alen);
+    if (b)
+	memcpy (sb->lookupkey + alen, b, blen);
+    return 1;
+}
 
-    if (sb->timeout) {
-	tv.tv_sec  = get_long (sb->timeout);
-	tv.tv_usec = get_long (sb->timeout + 4);
+/* Drop a reference to an entry.  Called with the cache locked.  */
+static void dns_unref (struct dns_entry *e)
+{
+    if (--e->refs == 0) {
+	free (e->buf);
+	free (e);
     }
+}
 
-    DEBUG_LOG("Select going to select\n");
-    r = select (max, &sets [0], &sets [1], &sets [2], (sb->timeout == 0) ? NULL : &tv);
-    DEBUG_LOG("Select returns %d, errno is %d\n", r, errno);
-    if( r > 0 ) {
-	/* Socket told us to abort */
-	if (FD_ISSET (sb->sockabort[0], &sets[0])) {
-	    /* read from the pipe to reset it */
-	    DEBUG_LOG ("WaitSelect aborted from signal\n");
-	    r = 0;
-	    for (set = 0; set < 3; set++)
-	    if (sb->sets [set] != 0)
-		bsd_amigaside_FD_ZERO (sb->sets [set]);
-	    clearsockabort (sb);
+static void dns_release (struct dns_entry *e)
+{
+    uae_sem_wait (&dns_lock);
+    dns_unref (e);
+    uae_sem_post (&dns_lock);
+}
+
+/* Look up a key in the cache, and take a reference to the entry found.  */
+static struct dns_entry *dns_find_key (int type, int keylen, const char *key)
+{
+    struct dns_entry **p, *e;
+    uae_u64 now = bsd_now ();
+
+    uae_sem_wait (&dns_lock);
+    for (p = &dns_cache; (e = *p) != NULL; ) {
+	if (e->expires <= now) {
+	    *p = e->next;
+	    dns_count--;
+	    dns_unref (e);
+	    continue;
 	}
-	else
-	/* This is perhaps slightly inefficient, but I don't care.. */
-	for (set = 0; set < 3; set++) {
-	    a_set = sb->sets [set];
-	    if (a_set != 0) {
-		bsd_amigaside_FD_ZERO (a_set);
-		for (i = 0; i < sb->nfds; i++) {
-		    a_s = getsock (sb, i + 1);
-		    if (a_s != -1) {
-			if (FD_ISSET (a_s, &sets [set])) {
-			    DEBUG_LOG ("WaitSelect: NativeSide %d set. AmigaSide %d.\n", a_s, i);
-
-			    bsd_amigaside_FD_SET (i, a_set);
-		    }
-		}
-	    }
+	if (e->type == type && e->keylen == keylen
+	    && memcmp (e->key, key, keylen) == 0)
+	{
+	    *p = e->next;
+	    e->next = dns_cache;
+	    dns_cache = e;
+	    e->refs++;
+	    break;
 	}
+	p = &e->next;
+    }
+    uae_sem_post (&dns_lock);
+    return e;
+}
+
+static struct dns_entry *dns_find (SB)
+{
+    return dns_find_key (sb->lookuptype, sb->lookuplen, sb->lookupkey);
+}
+
+/* A new entry, with a reference held, for the lookup of a base.  The
+ * resolvers only use this copy of the key, since the base's own may be
+ * set up for the next call before an interrupted lookup has finished.  */
+static struct dns_entry *dns_new (SB)
+{
+    struct dns_entry *e = (struct dns_entry *)calloc (1, sizeof *e);
+
+    if (e == NULL)
+	return NULL;
+    e->refs = 1;
+    e->type = sb->lookuptype;
+    e->keylen = sb->lookuplen;
+    memcpy (e->key, sb->lookupkey, e->keylen);
+    return e;
+}
+
+static void dns_insert (struct dns_entry *e)
+{
+    struct dns_entry **p, *old;
+
+    uae_sem_wait (&dns_lock);
+    /* Another resolver may have had the same lookup; when full, the least
+     * recently used entry makes room.  */
+    for (p = &dns_cache; (old = *p) != NULL; ) {
+	if ((old->type == e->type && old->keylen == e->keylen
+	     && memcmp (old->key, e->key, e->keylen) == 0)
+	    || (old->next == NULL && dns_count >= DNS_CACHE_SIZE))
+	{
+	    *p = old->next;
+	    dns_count--;
+	    dns_unref (old);
+	    continue;
+	}
+	p = &old->next;
+    }
+    e->refs++;
+    e->next = dns_cache;
+    dns_cache = e;
+    dns_count++;
+    uae_sem_post (&dns_lock);
+}
+
+/* Run the lookup for the key of E with the reentrant libc functions, and
+ * fill in the answer or the error.  */
+static void dns_resolve (struct dns_entry *e)
+{
+    const char *key = e->key;
+    const char *proto = NULL;
+    size_t size = 1024;
+    int r, found, herr = 0;
+
+    if (e->type == DNS_SERVNAME && (int)strlen (key) + 1 < e->keylen)
+	proto = key + strlen (key) + 1;
+    else if (e->type == DNS_SERVPORT && e->keylen > (int)sizeof (int))
+	proto = key + sizeof (int);
+
+    for (;;) {
+	struct hostent *h = NULL;
+	struct servent *s = NULL;
+	struct protoent *p = NULL;
+	char *nbuf = (char *)realloc (e->buf, size);
+
+	if (nbuf == NULL) {
+	    r = ENOMEM;
+	    herr = NETDB_INTERNAL;
+	    found = 0;
+	    break;
 	}
-    } else if (r == 0) {         /* Timeout. I think we're supposed to clear the sets.. */
+	e->buf = nbuf;
+	switch (e->type) {
+	 case DNS_HOSTNAME:
+	    r = gethostbyname_r (key, &e->u.h, e->buf, size, &h, &herr);
+	    break;
+	 case DNS_HOSTADDR:
+	    r = gethostbyaddr_r (key + sizeof (int), e->keylen - sizeof (int), *(const int *)key,
+				 &e->u.h, e->buf, size, &h, &herr);
+	    break;
+	 case DNS_SERVNAME:
+	    r = getservbyname_r (key, proto, &e->u.s, e->buf, size, &s);
+	    break;
+	 case DNS_SERVPORT:
+	    r = getservbyport_r (*(const int *)key, proto, &e->u.s, e->buf, size, &s);
+	    break;
+	 case DNS_PROTONAME:
+	    r = getprotobyname_r (key, &e->u.p, e->buf, size, &p);
+	    break;
+	 default:
+	    r = getprotobynumber_r (*(const int *)key, &e->u.p, e->buf, size, &p);
+	    break;
+	}
+	found = h != NULL || s != NULL || p != NULL;
+	if (r != ERANGE || found)
+	    break;
+	size *= 2;
+    }
+
+    if (!found) {
+	free (e->buf);
+	e->buf = NULL;
+	if (e->type <= DNS_HOSTADDR)
+	    e->err = herr ? herr : HOST_NOT_FOUND;
+	else
+	    e->err = r ? r : ENOENT;
+    }
+    e->expires = bsd_now () + (uae_u64)(found ? DNS_TTL : DNS_NEGATIVE_TTL) * 1000000;
+    DEBUG_LOG ("BSDSOCK: lookup type %d: %s (%d)\n", e->type, found ? "found" : "failed", e->err);
+}
+
+static void dns_copyhostent (struct dns_entry *e, SB)
+{
+    if (e->err)
+	bsdsocklib_setherrno (sb, e->err);
+    else {
+	copyHostent (&e->u.h, sb);
+	bsdsocklib_setherrno (sb, 0);
+    }
+}
+
+/* Run a lookup on a resolver.  Host entries are copied to the base right
+ * away; service and protocol entries are handed back to the caller, which
+ * has to allocate the Amiga memory for them.  */
+static void bsd_lookup (SB)
+{
+    struct dns_entry *job, *e;
+
+    bsd_lock ();
+    job = (struct dns_entry *)sb->lookupjob;
+    sb->lookupjob = NULL;
+    bsd_unlock ();
+    /* Taken by an earlier run that the caller had given up on.  */
+    if (job == NULL) {
+	errno = 0;
+	return;
+    }
+
+    e = dns_find_key (job->type, job->keylen, job->key);
+    if (e)
+	dns_release (job);
+    else {
+	e = job;
+	dns_resolve (e);
+	/* Temporary failures, as when the name server can't be reached,
+	 * are not remembered.  Host lookups fail with an h_errno, the
+	 * others with an errno.  */
+	if (e->type <= DNS_HOSTADDR
+	    ? e->err != TRY_AGAIN && e->err != NETDB_INTERNAL
+	    : e->err == 0 || e->err == ENOENT)
+	    dns_insert (e);
+    }
+
+    if (e->type > DNS_HOSTADDR) {
+	struct dns_entry *old;
+
+	bsd_lock ();
+	old = (struct dns_entry *)sb->lookup;
+	sb->lookup = e;
+	bsd_unlock ();
+	if (old)
+	    dns_release (old);
+    } else {
+	dns_copyhostent (e, sb);
+	dns_release (e);
+    }
+    errno = 0;
+}
+
+/* Hand the lookup of a base to the resolvers.  Returns 0 if out of
+ * memory.  */
+static int dns_submit (SB)
+{
+    struct dns_entry *job = dns_new (sb), *old;
+
+    if (job == NULL)
+	return 0;
+    /* A lookup that was given up on and hasn't started yet is dropped.  */
+    bsd_lock ();
+    old = (struct dns_entry *)sb->lookupjob;
+    sb->lookupjob = job;
+    bsd_unlock ();
+    if (old)
+	dns_release (old);
+    bsd_submit (sb);
+    return 1;
+}
+
+/* Look up a service or protocol entry for the caller, on a resolver
+ * unless it is cached.  Returns NULL if the call was interrupted or
+ * couldn't be made.  */
+static struct dns_entry *dns_lookup (TrapContext *context, SB)
+{
+    struct dns_entry *e = dns_find (sb);
+
+    if (e)
+	return e;
+
+    sb->action = 8;
+    if (!dns_submit (sb)) {
+	bsdsocklib_seterrno (sb, mapErrno (ENOMEM));
+	return NULL;
+    }
+
+    WAITSIGNAL;
+
+    bsd_lock ();
+    e = (struct dns_entry *)sb->lookup;
+    sb->lookup = NULL;
+    bsd_unlock ();
+    /* ...or left over from an earlier call that was interrupted.  */
+    if (e && (e->type != sb->lookuptype || e->keylen != sb->lookuplen
+	      || memcmp (e->key, sb->lookupkey, e->keylen) != 0))
+    {
+	dns_release (e);
+	e = NULL;
+    }
+    if (e == NULL)
+	bsdsocklib_seterrno (sb, mapErrno (EINTR));
+    return e;
+}
+
+/*
+ * WaitSelect
+ *
+ * Each base keeps its own epoll set, which the reactor waits on when the
+ * call blocks.  The Amiga-side fdsets are translated into registrations
+ * in it that persist between calls, so a server that keeps selecting on
+ * the same descriptors makes no system calls for them.
+ */
+
+#define SEL_READ 1
+#define SEL_WRITE 2
+#define SEL_EXCEPT 4
+
+/* Make the per-descriptor tables cover native descriptor s.  */
+static int bsd_ep_grow (SB, int s)
+{
+    int size = (s + 64) & ~63;
+    uae_u8 *mask = (uae_u8 *)realloc (sb->epmask, size);
+    uae_u8 *ready;
+    struct epoll_event *events;
+
+    if (mask == NULL)
+	return 0;
+    sb->epmask = mask;
+    ready = (uae_u8 *)realloc (sb->epready, size);
+    if (ready == NULL)
+	return 0;
+    sb->epready = ready;
+    events = (struct epoll_event *)realloc (sb->epevents, size * sizeof (struct epoll_event));
+    if (events == NULL)
+	return 0;
+    sb->epevents = events;
+    memset (mask + sb->epsize, 0, size - sb->epsize);
+    memset (ready + sb->epsize, 0, size - sb->epsize);
+    sb->epsize = size;
+    return 1;
+}
+
+static void bsd_ep_unwatch (SB, int s)
+{
+    struct epoll_event ev;
+
+    if (s < 0 || s >= sb->epsize || !sb->epmask[s])
+	return;
+    epoll_ctl (sb->epfd, EPOLL_CTL_DEL, s, &ev);
+    sb->epmask[s] = 0;
+}
+
+static void bsd_ep_watch_sets (SB)
+{
+    int i, s, set;
+
+    if (sb->epsize)
+	memset (sb->epready, 0, sb->epsize);
+    for (i = 0; i < sb->nfds; i++) {
+	int want = 0;
+
 	for (set = 0; set < 3; set++)
-	    if (sb->sets [set] != 0)
-		bsd_amigaside_FD_ZERO (sb->sets [set]);
+	    if (sb->sets [set] != 0 && bsd_amigaside_FD_ISSET (i, sb->sets [set]))
+		want |= 1 << set;
+	if (!want)
+	    continue;
+	s = getsock (sb, i + 1);
+	DEBUG_LOG ("WaitSelect: AmigaSide %d set. NativeSide %d.\n", i, s);
+	if (s == -1) {
+	    write_log ("BSDSOCK: WaitSelect() called with invalid descriptor %d.\n", i);
+	    continue;
+	}
+	if (s >= sb->epsize && !bsd_ep_grow (sb, s))
+	    continue;
+	sb->epready[s] |= want;
+    }
+
+    for (s = 0; s < sb->epsize; s++) {
+	int want = sb->epready[s];
+	struct epoll_event ev;
+
+	if (want == sb->epmask[s])
+	    continue;
+	if (!want) {
+	    bsd_ep_unwatch (sb, s);
+	    continue;
+	}
+	ev.events = ((want & SEL_READ ? EPOLLIN : 0)
+		     | (want & SEL_WRITE ? EPOLLOUT : 0)
+		     | (want & SEL_EXCEPT ? EPOLLPRI : 0));
+	ev.data.fd = s;
+	if (sb->epmask[s] == 0
+	    ? epoll_ctl (sb->epfd, EPOLL_CTL_ADD, s, &ev) < 0
+	      && (errno != EEXIST || epoll_ctl (sb->epfd, EPOLL_CTL_MOD, s, &ev) < 0)
+	    : epoll_ctl (sb->epfd, EPOLL_CTL_MOD, s, &ev) < 0
+	      && (errno != ENOENT || epoll_ctl (sb->epfd, EPOLL_CTL_ADD, s, &ev) < 0))
+	{
+	    write_log ("BSDSOCK: Can't watch descriptor %d (%d).\n", s, errno);
+	    want = 0;
+	}
+	sb->epmask[s] = want;
+    }
+}
+
+/* Copy the pending events into the Amiga-side fdsets.  Returns the number
+ * of descriptors that are ready; the sets are left alone if there are
+ * none.  */
+static int bsd_ep_collect (SB)
+{
+    struct epoll_event *ev = sb->epevents;
+    int i, n, set, r = 0;
+
+    if (sb->epsize == 0)
+	return 0;
+    memset (sb->epready, 0, sb->epsize);
+    n = epoll_wait (sb->epfd, ev, sb->epsize, 0);
+    if (n <= 0)
+	return n;
+    for (i = 0; i < n; i++) {
+	uae_u32 e = ev[i].events;
+	/* select() reports errors and hangups as readable and writable.  */
+	sb->epready[ev[i].data.fd] = sb->epmask[ev[i].data.fd]
+	    & ((e & (EPOLLIN | EPOLLERR | EPOLLHUP) ? SEL_READ : 0)
+	       | (e & (EPOLLOUT | EPOLLERR | EPOLLHUP) ? SEL_WRITE : 0)
+	       | (e & EPOLLPRI ? SEL_EXCEPT : 0));
+    }
+
+    for (set = 0; set < 3; set++) {
+	if (sb->sets [set] == 0)
+	    continue;
+	for (i = 0; i < sb->nfds; i++) {
+	    int s = i < sb->dtablesize ? sb->dtable[i] : -1;
+	    if (s >= 0 && s < sb->epsize
+		&& (sb->epready[s] & (1 << set))
+		&& bsd_amigaside_FD_ISSET (i, sb->sets [set]))
+		r++;
+	}
+    }
+    if (r == 0)
+	return 0;
+
+    for (set = 0; set < 3; set++) {
+	if (sb->sets [set] == 0)
+	    continue;
+	for (i = 0; i < sb->nfds; i++) {
+	    int s = i < sb->dtablesize ? sb->dtable[i] : -1;
+	    if (s < 0 || s >= sb->epsize || !(sb->epready[s] & (1 << set)))
+		if (bsd_amigaside_FD_ISSET (i, sb->sets [set]))
+		    bsd_amigaside_FD_CLR (i, sb->sets [set]);
+	}
     }
-    DEBUG_LOG ("WaitSelect: %d(%d)\n", r, errno);
     return r;
 }
 
+/* Returns 0 if the call was handed to the reactor.  */
+static int bsdthr_WaitSelect (SB, int wake)
+{
+    int r = 0, set;
+
+    DEBUG_LOG ("WaitSelect: %d 0x%x 0x%x 0x%x 0x%x 0x%x wake %d\n",
+	       sb->nfds, sb->sets [0], sb->sets [1], sb->sets [2], sb->timeout, sb->sigmp, wake);
+
+    if (wake == 0) {
+	bsd_ep_watch_sets (sb);
+	if (sb->timeout)
+	    sb->deadline = (bsd_now () + (uae_u64)get_long (sb->timeout) * 1000000
+			    + get_long (sb->timeout + 4));
+    }
+
+    errno = 0;
+    if (wake != WAKE_ABORT && wake != WAKE_TIMEOUT) {
+	r = bsd_ep_collect (sb);
+	if (r != 0) {
+	    sb->resultval = r;
+	    return 1;
+	}
+	if (sb->timeout == 0 || sb->deadline > bsd_now ()) {
+	    r = bsd_wait (sb, sb->epfd, EPOLLIN, sb->timeout != 0);
+	    if (r > 0)
+		return 0;
+	    if (r < 0) {
+		sb->resultval = -1;
+		return 1;
+	    }
+	    wake = WAKE_ABORT;
+	}
+    }
+
+    if (wake == WAKE_ABORT) {
+	DEBUG_LOG ("WaitSelect aborted from signal\n");
+	clearsockabort (sb);
+    }
+    /* Timeout or abort.  I think we're supposed to clear the sets.. */
+    for (set = 0; set < 3; set++)
+	if (sb->sets [set] != 0)
+	    fd_zero (sb->sets [set], sb->nfds);
+    errno = 0;
+    sb->resultval = 0;
+    return 1;
+}
+
 uae_u32 bsdthr_Accept_2 (SB)
 {
     int foo, s, s2;
@@ -745,21 +1423,25 @@ uae_u32 bsdthr_Accept_2 (SB)
 
 uae_u32 bsdthr_Recv_2 (SB)
 {
+    struct sockaddr_in addr;
+    struct msghdr msg;
     int foo;
-    int l, i;
-    if (sb->from == 0) {
-	foo = recv (sb->s, sb->buf, sb->len, sb->flags /*| MSG_NOSIGNAL*/);
-	DEBUG_LOG ("recv2, recv returns %d, errno is %d\n", foo, errno);
-    } else {
-	struct sockaddr_in addr;
-	socklen_t l = sizeof (struct sockaddr_in);
-	i = get_long (sb->fromlen);
-	copysockaddr_a2n (&addr, sb->from, i);
-	foo = recvfrom (sb->s, sb->buf, sb->len, sb->flags | MSG_NOSIGNAL, (struct sockaddr *)&addr, &l);
-	DEBUG_LOG ("recv2, recvfrom returns %d, errno is %d\n", foo, errno);
-	if (foo >= 0) {
-	    copysockaddr_n2a (sb->from, &addr, l);
-	    put_long (sb->fromlen, l);
+
+    memset (&msg, 0, sizeof msg);
+    msg.msg_iov = (struct iovec *)sb->iov;
+    msg.msg_iovlen = sb->niov;
+    if (sb->from) {
+	msg.msg_name = &addr;
+	msg.msg_namelen = sizeof addr;
+    }
+    foo = recvmsg (sb->s, &msg, sb->flags | MSG_NOSIGNAL);
+    DEBUG_LOG ("recv2, recvmsg returns %d, errno is %d\n", foo, errno);
+    if (foo >= 0) {
+	if (sb->bounced)
+	    memcpyha (sb->bufaddr, sb->bounce, foo);
+	if (sb->from) {
+	    copysockaddr_n2a (sb->from, &addr, msg.msg_namelen);
+	    put_long (sb->fromlen, msg.msg_namelen);
 	}
     }
     return foo;
@@ -767,30 +1449,29 @@ uae_u32 bsdthr_Recv_2 (SB)
 
 uae_u32 bsdthr_Send_2 (SB)
 {
-    if (sb->to == 0) {
-	return send (sb->s, sb->buf, sb->len, sb->flags | MSG_NOSIGNAL);
-    } else {
-	struct sockaddr_in addr;
-	int l = sizeof (struct sockaddr_in);
+    struct sockaddr_in addr;
+    struct msghdr msg;
+
+    memset (&msg, 0, sizeof msg);
+    msg.msg_iov = (struct iovec *)sb->iov;
+    msg.msg_iovlen = sb->niov;
+    if (sb->to) {
 	copysockaddr_a2n (&addr, sb->to, sb->tolen);
-	return sendto (sb->s, sb->buf, sb->len, sb->flags | MSG_NOSIGNAL,
-		       (struct sockaddr *)&addr, l);
+	msg.msg_name = &addr;
+	msg.msg_namelen = sizeof addr;
     }
+    return sendmsg (sb->s, &msg, sb->flags | MSG_NOSIGNAL);
 }
 
 uae_u32 bsdthr_Connect_2 (SB)
 {
-    if (sb->action == 1) {
+    if (!sb->again) {
 	struct sockaddr_in addr;
 	int len = sizeof (struct sockaddr_in);
 	int retval;
 	copysockaddr_a2n (&addr, sb->a_addr, sb->a_addrlen);
 	retval = connect (sb->s, (struct sockaddr *)&addr, len);
 	DEBUG_LOG ("Connect returns %d, errno is %d\n", retval, errno);
-	/* Hack: I need to set the action to something other than
-	 * 1 but I know action == 2 does the correct thing
-	 */
-	sb->action = 2;
 	if (retval == 0) {
 	     errno = 0;
 	}
@@ -808,140 +1489,194 @@ uae_u32 bsdthr_Connect_2 (SB)
     }
 }
 
-uae_u32 bsdthr_SendRecvAcceptConnect (uae_u32 (*tryfunc)(SB), SB)
-{
-    return bsdthr_blockingstuff (tryfunc, sb);
-}
-
-uae_u32 bsdthr_blockingstuff (uae_u32 (*tryfunc)(SB), SB)
+/*
+ * Try a call on the socket without blocking.  If it would block and the
+ * socket is a blocking one, hand it to the reactor to be retried once the
+ * socket is ready, or its SO_RCVTIMEO or SO_SNDTIMEO has passed.  Returns
+ * 0 in that case.
+ */
+static int bsdthr_blockingstuff (uae_u32 (*tryfunc)(SB), uae_u32 events, SB, int wake)
 {
-    int done = 0, foo;
+    int foo, err, r;
     long flags;
     int nonblock;
+
+    if (wake == WAKE_ABORT) {
+	DEBUG_LOG ("blocking call aborted from signal\n");
+	clearsockabort (sb);
+	errno = EINTR;
+	sb->resultval = -1;
+	return 1;
+    }
+    if (wake == WAKE_TIMEOUT) {
+	errno = EWOULDBLOCK;
+	sb->resultval = -1;
+	return 1;
+    }
+    if (wake == 0) {
+	struct timeval tv;
+	socklen_t len = sizeof tv;
+
+	sb->timed = 0;
+	if (getsockopt (sb->s, SOL_SOCKET, events == EPOLLIN ? SO_RCVTIMEO : SO_SNDTIMEO, &tv, &len) == 0
+	    && (tv.tv_sec || tv.tv_usec))
+	{
+	    sb->timed = 1;
+	    sb->deadline = bsd_now () + (uae_u64)tv.tv_sec * 1000000 + tv.tv_usec;
+	}
+    }
+
     if ((flags = fcntl (sb->s, F_GETFL)) == -1)
 	flags = 0;
     nonblock = (flags & O_NONBLOCK);
     fcntl (sb->s, F_SETFL, flags | O_NONBLOCK);
-    while (!done) {
-	done = 1;
-	foo = tryfunc (sb);
-	if (foo < 0 && !nonblock) {
-	    if ((errno == EAGAIN) || (errno == EWOULDBLOCK) || (errno == EINPROGRESS)) {
-		fd_set readset, writeset, exceptset;
-		int maxfd = (sb->s > sb->sockabort[0]) ? sb->s : sb->sockabort[0];
-		int num;
-
-		FD_ZERO (&readset);
-		FD_ZERO (&writeset);
-		FD_ZERO (&exceptset);
-
-		if (sb->action == 3 || sb->action == 6)
-		    FD_SET (sb->s, &readset);
-		if (sb->action == 2 || sb->action == 1 || sb->action == 4)
-		    FD_SET (sb->s, &writeset);
-		FD_SET (sb->sockabort[0], &readset);
-
-		num = select (maxfd + 1, &readset, &writeset, &exceptset, NULL);
-		if (num == -1) {
-		    DEBUG_LOG ("Blocking select(%d) returns -1,errno is %d\n", sb->sockabort[0],errno);
-		    fcntl (sb->s, F_SETFL, flags);
-		   return -1;
-		}
-
-		if (FD_ISSET (sb->sockabort[0], &readset) || FD_ISSET (sb->sockabort[0], &writeset)) {
-		    /* reset sock abort pipe */
-		    /* read from the pipe to reset it */
-		    DEBUG_LOG ("select aborted from signal\n");
+    sb->again = wake != 0;
+    foo = tryfunc (sb);
+    err = errno;
+    fcntl (sb->s, F_SETFL, flags);
 
-		    clearsockabort (sb);
-		    DEBUG_LOG ("Done read\n");
-		    errno = EINTR;
-		    done = 1;
-		} else {
-		    done = 0;
-		}
-	    } else if (errno == EINTR)
-		done = 1;
-	}
+    if (foo < 0 && !nonblock
+	&& (err == EAGAIN || err == EWOULDBLOCK || err == EINPROGRESS))
+    {
+	r = bsd_wait (sb, sb->s, events, sb->timed);
+	if (r > 0)
+	    return 0;
+	if (r == 0) {
+	    clearsockabort (sb);
+	    err = EINTR;
+	} else
+	    err = errno;
     }
-    fcntl (sb->s, F_SETFL, flags);
-    return foo;
+    errno = err;
+    sb->resultval = foo;
+    return 1;
 }
 
-
-static void *bsdlib_threadfunc (void *arg)
+/* Run or continue the call of a base.  */
+static void bsd_run (SB, int wake)
 {
-    struct socketbase *sb = (struct socketbase *) arg;
-
-    DEBUG_LOG ("THREAD_START\n");
-
-    while (1) {
-	uae_sem_wait (&sb->sem);
-
-	DEBUG_LOG ("Socket thread got action %d\n", sb->action);
-
-	switch (sb->action) {
-	    case 0:       /* kill thread (CloseLibrary) */
+    int done = 1;
 
-		DEBUG_LOG ("THREAD_END\n");
+    DEBUG_LOG ("Socket worker got action %d, wake %d\n", sb->action, wake);
 
-		uae_sem_destroy (&sb->sem);
-		return NULL;
-
-	    case 1:       /* Connect */
-		sb->resultval = bsdthr_SendRecvAcceptConnect (bsdthr_Connect_2, sb);
-		break;
+    switch (sb->action) {
+	case 1:       /* Connect */
+	    done = bsdthr_blockingstuff (bsdthr_Connect_2, EPOLLOUT, sb, wake);
+	    break;
 
-	    /* @@@ Should check (from|to)len so it's 16.. */
-	    case 2:       /* Send[to] */
-		sb->resultval = bsdthr_SendRecvAcceptConnect (bsdthr_Send_2, sb);
-		break;
+	/* @@@ Should check (from|to)len so it's 16.. */
+	case 2:       /* Send[to] */
+	    done = bsdthr_blockingstuff (bsdthr_Send_2, EPOLLOUT, sb, wake);
+	    break;
 
-	    case 3:       /* Recv[from] */
-		sb->resultval = bsdthr_SendRecvAcceptConnect (bsdthr_Recv_2, sb);
-		break;
+	case 3:       /* Recv[from] */
+	    done = bsdthr_blockingstuff (bsdthr_Recv_2, EPOLLIN, sb, wake);
+	    break;
 
-	    case 4: {     /* Gethostbyname */
-		struct hostent *tmphostent = gethostbyname ((char *)get_real_address (sb->name));
+	case 4:       /* Gethostbyname */
+	case 7:       /* Gethostbyaddr */
+	case 8:       /* Getservby*, getprotoby* */
+	    bsd_lookup (sb);
+	    break;
 
-		if (tmphostent) {
-		    copyHostent (tmphostent, sb);
-		    bsdsocklib_setherrno (sb, 0);
-		} else
-		    SETHERRNO;
+	case 5:       /* WaitSelect */
+	    done = bsdthr_WaitSelect (sb, wake);
+	    break;
 
-		break;
-	    }
+	case 6:       /* Accept */
+	    done = bsdthr_blockingstuff (bsdthr_Accept_2, EPOLLIN, sb, wake);
+	    break;
+    }
+    if (!done)
+	return;
+    SETERRNO;
+    SETSIGNAL;
 
-	    case 5:       /* WaitSelect */
-		sb->resultval = bsdthr_WaitSelect (sb);
-		break;
+    bsd_lock ();
+    sb->abort = 0;
+    if (sb->pending) {
+	sb->pending = 0;
+	bsd_queue (sb, 0);
+    } else {
+	sb->busy = 0;
+	if (sb->idlewait) {
+	    sb->idlewait = 0;
+	    uae_sem_post (&sb->idle);
+	}
+    }
+    bsd_unlock ();
+}
 
-	    case 6:       /* Accept */
-		sb->resultval = bsdthr_SendRecvAcceptConnect (bsdthr_Accept_2, sb);
-		break;
+static void *bsd_worker (void *arg)
+{
+    struct bsd_jobs *q = (struct bsd_jobs *)arg;
+
+    for (;;) {
+	struct socketbase *sb;
+	int wake;
+
+	uae_sem_wait (&q->avail);
+	bsd_lock ();
+	sb = q->head;
+	q->head = sb->nextjob;
+	if (q->head == NULL)
+	    q->tail = NULL;
+	wake = sb->wake;
+	bsd_unlock ();
+
+	bsd_run (sb, wake);
+    }
+    return NULL;
+}
 
-	    case 7: {
-		struct hostent *tmphostent = gethostbyaddr (get_real_address (sb->name), sb->a_addrlen, sb->flags);
+static int bsd_start_reactor (void)
+{
+    struct epoll_event ev;
+    int i;
 
-		if (tmphostent) {
-		    copyHostent (tmphostent, sb);
-		    bsdsocklib_setherrno (sb, 0);
-		} else
-		    SETHERRNO;
+    if (reactor_started)
+	return 1;
 
-		break;
-	    }
+    reactor_epfd = epoll_create (64);
+    if (reactor_epfd < 0)
+	return 0;
+    if (pipe (reactor_wake) < 0) {
+	close (reactor_epfd);
+	return 0;
+    }
+    fcntl (reactor_wake[0], F_SETFL, O_NONBLOCK);
+    ev.events = EPOLLIN;
+    ev.data.ptr = NULL;
+    epoll_ctl (reactor_epfd, EPOLL_CTL_ADD, reactor_wake[0], &ev);
+
+    /* Threads from an earlier attempt that failed half-way may use them.  */
+    if (!reactor_lock_ready) {
+	uae_sem_init (&reactor_lock, 0, 1);
+	uae_sem_init (&dns_lock, 0, 1);
+	uae_sem_init (&jobs.avail, 0, 0);
+	uae_sem_init (&lookups.avail, 0, 0);
+	reactor_lock_ready = 1;
+    }
+    /* The reactor, then one resolver, then the workers, then the other
+     * resolvers; the first three are needed.  */
+    for (i = 0; i < BSD_WORKERS + BSD_RESOLVERS + 1; i++) {
+	void *(*f) (void *) = bsd_worker;
+	struct bsd_jobs *q = i == 1 || i > BSD_WORKERS + 1 ? &lookups : &jobs;
+
+	if (i == 0)
+	    f = bsd_reactor;
+	if (uae_start_thread (f, q, &reactor_threads[i])) {
+	    write_log ("BSDSOCK: Failed to create thread.\n");
+	    if (i < 3)
+		return 0;
+	    break;
 	}
-	SETERRNO;
-	SETSIGNAL;
     }
-    return NULL;        /* Just to keep GCC happy.. */
+    reactor_started = 1;
+    return 1;
 }
 
 
-
-
 void host_connect (TrapContext *context, SB, uae_u32 sd, uae_u32 name, uae_u32 namelen)
 {
     sb->s = getsock (sb, sd + 1);
@@ -954,11 +1689,38 @@ void host_connect (TrapContext *context, SB, uae_u32 sd, uae_u32 name, uae_u32 n
     sb->a_addrlen = namelen;
     sb->action    = 1;
 
-    uae_sem_post (&sb->sem);
+    bsd_submit (sb);
 
     WAITSIGNAL;
 }
 
+/*
+ * Try a send or recv right away on the calling thread, which saves the
+ * round trip through a worker when the socket is ready.  Returns 0 if the
+ * call would block, and has to be queued after all.
+ */
+static int bsd_try_now (uae_u32 (*tryfunc)(SB), SB)
+{
+    uae_u32 flags = sb->flags;
+    int busy, foo;
+
+    bsd_lock ();
+    busy = sb->busy;
+    bsd_unlock ();
+    /* An interrupted call may still be running for this base.  */
+    if (busy)
+	return 0;
+
+    sb->flags |= MSG_DONTWAIT;
+    foo = tryfunc (sb);
+    sb->flags = flags;
+    if (foo < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+	return 0;
+    sb->resultval = foo;
+    SETERRNO;
+    return 1;
+}
+
 void host_sendto (TrapContext *context, SB, uae_u32 sd, uae_u32 msg, uae_u32 len, uae_u32 flags, uae_u32 to, uae_u32 tolen)
 {
     sb->s = getsock (sb, sd + 1);
@@ -967,14 +1729,20 @@ void host_sendto (TrapContext *context, SB, uae_u32 sd, uae_u32 msg, uae_u32 len
 	bsdsocklib_seterrno (sb, 9); /* EBADF */
 	return;
     }
-    sb->buf    = get_real_address (msg);
-    sb->len    = len;
+    if (!bsd_setbuf (sb, msg, len, 0)) {
+	sb->resultval = -1;
+	bsdsocklib_seterrno (sb, 55); /* ENOBUFS */
+	return;
+    }
     sb->flags  = flags;
     sb->to     = to;
     sb->tolen  = tolen;
     sb->action = 2;
 
-    uae_sem_post (&sb->sem);
+    if (bsd_try_now (bsdthr_Send_2, sb))
+	return;
+
+    bsd_submit (sb);
 
     WAITSIGNAL;
 }
@@ -993,14 +1761,20 @@ void host_recvfrom (TrapContext *context, SB, uae_u32 sd, uae_u32 msg, uae_u32 l
     }
 
     sb->s      = s;
-    sb->buf    = get_real_address (msg);
-    sb->len    = len;
+    if (!bsd_setbuf (sb, msg, len, 1)) {
+	sb->resultval = -1;
+	bsdsocklib_seterrno (sb, 55); /* ENOBUFS */
+	return;
+    }
     sb->flags  = flags;
     sb->from   = addr;
     sb->fromlen= addrlen;
     sb->action = 3;
 
-    uae_sem_post (&sb->sem);
+    if (bsd_try_now (bsdthr_Recv_2, sb))
+	return;
+
+    bsd_submit (sb);
 
     WAITSIGNAL;
 }
@@ -1017,6 +1791,16 @@ void host_setsockopt (SB, uae_u32 sd, uae_u32 level, uae_u32 optname, uae_u32 op
 	return;
     }
 
+    if (optval && IS_TIMEO_OPT (nativelevel, nativeoptname)) {
+	struct timeval tv;
+
+	tv.tv_sec = get_long (optval);
+	tv.tv_usec = optlen >= 8 ? get_long (optval + 4) : 0;
+	sb->resultval = setsockopt (s, nativelevel, nativeoptname, &tv, sizeof tv);
+	SETERRNO;
+	return;
+    }
+
     if (optval) {
 	buf = malloc(optlen);
 	mapsockoptvalue(nativelevel, nativeoptname, optval, buf);
@@ -1091,15 +1875,36 @@ uae_u32 host_getpeername (SB, uae_u32 sd, uae_u32 name, uae_u32 namelen)
 
 void host_gethostbynameaddr (TrapContext *context, SB, uae_u32 name, uae_u32 namelen, long addrtype)
 {
-    sb->name      = name;
-    sb->a_addrlen = namelen;
-    sb->flags     = addrtype;
-    if (addrtype == -1)
-	sb->action  = 4;
-    else
+    struct dns_entry *e;
+    int ok, type = addrtype;
+
+    if (addrtype == -1) {
+	sb->action = 4;
+	ok = dns_key (sb, DNS_HOSTNAME, get_real_address (name), strlen ((char *)get_real_address (name)) + 1, NULL);
+    } else {
 	sb->action = 7;
+	ok = dns_key (sb, DNS_HOSTADDR, &type, sizeof type, NULL)
+	     && namelen <= MAXADDRLEN - sizeof type;
+	if (ok) {
+	    memcpy (sb->lookupkey + sizeof type, get_real_address (name), namelen);
+	    sb->lookuplen += namelen;
+	}
+    }
+    if (!ok) {
+	bsdsocklib_setherrno (sb, HOST_NOT_FOUND);
+	return;
+    }
+
+    if ((e = dns_find (sb)) != NULL) {
+	dns_copyhostent (e, sb);
+	dns_release (e);
+	return;
+    }
 
-    uae_sem_post (&sb->sem);
+    if (!dns_submit (sb)) {
+	bsdsocklib_setherrno (sb, NETDB_INTERNAL);
+	return;
+    }
 
     WAITSIGNAL;
 }
@@ -1150,7 +1955,7 @@ void host_WaitSelect (TrapContext *context, SB, uae_u32 nfds, uae_u32 readfds, u
     sb->sigmp    = wssigs;
     sb->action   = 5;
 
-    uae_sem_post (&sb->sem);
+    bsd_submit (sb);
 
     m68k_dreg (regs, 0) = (((uae_u32)1) << sb->signal) | sb->eintrsigs | wssigs;
     sigs = CallLib (context, get_long (4), -0x13e); // Wait()
@@ -1205,7 +2010,7 @@ void host_accept (TrapContext *context, SB, uae_u32 sd, uae_u32 name, uae_u32 na
     sb->action    = 6;
     sb->len       = sd;
 
-    uae_sem_post (&sb->sem);
+    bsd_submit (sb);
 
     WAITSIGNAL;
     DEBUG_LOG ("Accept returns %d\n", sb->resultval);
@@ -1285,53 +2090,77 @@ uae_u32 host_listen (SB, uae_u32 sd, uae_u32 backlog)
 
 void host_getprotobyname (TrapContext *context, SB, uae_u32 name)
 {
-    struct protoent *p = getprotobyname ((char *)get_real_address (name));
+    struct dns_entry *e;
+    char *n = (char *)get_real_address (name);
 
-    DEBUG_LOG ("Getprotobyname(%s)=%lx\n", get_real_address (name), p);
+    DEBUG_LOG ("Getprotobyname(%s)\n", n);
 
-    if (p == NULL) {
-	SETERRNO;
+    if (!dns_key (sb, DNS_PROTONAME, n, strlen (n) + 1, NULL)) {
+	bsdsocklib_seterrno (sb, mapErrno (ENOENT));
 	return;
     }
-
-    copyProtoent (context, sb, p);
-    TRACE (("OK (%s, %d)\n", p->p_name, p->p_proto));
+    if ((e = dns_lookup (context, sb)) == NULL)
+	return;
+    if (e->err)
+	bsdsocklib_seterrno (sb, mapErrno (e->err));
+    else {
+	copyProtoent (context, sb, &e->u.p);
+	TRACE (("OK (%s, %d)\n", e->u.p.p_name, e->u.p.p_proto));
+    }
+    dns_release (e);
 }
 
 void host_getprotobynumber (TrapContext *context, SB, uae_u32 number)
 {
-    struct protoent *p = getprotobynumber(number);
-    DEBUG_LOG("getprotobynumber(%d)=%lx\n", number, p);
+    struct dns_entry *e;
+    int n = number;
 
-    if (p == NULL) {
-	SETERRNO;
+    DEBUG_LOG("getprotobynumber(%d)\n", number);
+
+    dns_key (sb, DNS_PROTONUM, &n, sizeof n, NULL);
+    if ((e = dns_lookup (context, sb)) == NULL)
 	return;
+    if (e->err)
+	bsdsocklib_seterrno (sb, mapErrno (e->err));
+    else {
+	copyProtoent (context, sb, &e->u.p);
+	TRACE (("OK (%s, %d)\n", e->u.p.p_name, e->u.p.p_proto));
     }
-
-    copyProtoent (context, sb, p);
-    TRACE (("OK (%s, %d)\n", p->p_name, p->p_proto));
+    dns_release (e);
 }
 
 void host_getservbynameport (TrapContext *context, SB, uae_u32 name, uae_u32 proto, uae_u32 type)
 {
-    struct servent *s = (type) ?
-	getservbyport (name, (char *)get_real_address (proto)) :
-	getservbyname ((char *)get_real_address (name), (char *)get_real_address (proto));
+    struct dns_entry *e;
+    struct servent *s;
+    char *p = proto ? (char *)get_real_address (proto) : NULL;
     size_t size = 20;
     int numaliases = 0;
     uae_u32 aptr;
-    int i;
+    int i, ok;
 
     if (type) {
-	DEBUG_LOG("Getservbyport(%d, %s) = %lx\n", name, get_real_address (proto), s);
+	int port = name;
+	DEBUG_LOG("Getservbyport(%d, %s)\n", name, p ? p : "(null)");
+	ok = dns_key (sb, DNS_SERVPORT, &port, sizeof port, p);
     } else {
-	DEBUG_LOG("Getservbyname(%s, %s) = %lx\n", get_real_address (name), get_real_address (proto), s);
+	char *n = (char *)get_real_address (name);
+	DEBUG_LOG("Getservbyname(%s, %s)\n", n, p ? p : "(null)");
+	ok = dns_key (sb, DNS_SERVNAME, n, strlen (n) + 1, p);
+    }
+    if (!ok) {
+	bsdsocklib_seterrno (sb, mapErrno (ENOENT));
+	return;
     }
 
-    if (s == NULL) {
-	SETERRNO;
+    if ((e = dns_lookup (context, sb)) == NULL)
+	return;
+    if (e->err) {
+	bsdsocklib_seterrno (sb, mapErrno (e->err));
+	dns_release (e);
 	return;
     }
+    s = &e->u.s;
 
     // compute total size of servent
     if (s->s_name != NULL)
@@ -1353,6 +2182,7 @@ void host_getservbynameport (TrapContext *context, SB, uae_u32 name, uae_u32 pro
     if (!sb->servent) {
 	write_log ("BSDSOCK: WARNING - getservby%s() ran out of Amiga memory (couldn't allocate %d bytes)\n",type ? "port" : "name", size);
 	bsdsocklib_seterrno (sb, 12); // ENOMEM
+	dns_release (e);
 	return;
     }
 
@@ -1374,39 +2204,43 @@ void host_getservbynameport (TrapContext *context, SB, uae_u32 name, uae_u32 pro
 
     TRACE (("OK (%s, %d)\n", s->s_name, (unsigned short)htons (s->s_port)));
     bsdsocklib_seterrno (sb,0);
+    dns_release (e);
 }
 
 int host_sbinit (TrapContext *context, SB)
 {
-    if (pipe (sb->sockabort) < 0) {
+    /* host_sbcleanup runs even if this fails, so everything it looks at
+     * is set up first.  */
+    sb->idlewait = 0;
+    uae_sem_init (&sb->idle, 0, 0);
+    sb->epfd = -1;
+    sb->epsize = 0;
+    sb->epmask = sb->epready = NULL;
+    sb->epevents = NULL;
+    sb->busy = sb->pending = sb->waiting = sb->abort = 0;
+    sb->lookup = sb->lookupjob = NULL;
+    sb->iov = NULL;
+    sb->bounce = NULL;
+    sb->bouncesize = 0;
+
+    if (!bsd_start_reactor ()) {
+	write_log ("BSDSOCK: Failed to start the socket reactor.\n");
 	return 0;
     }
 
-    if (fcntl (sb->sockabort[0], F_SETFL, O_NONBLOCK) < 0) {
-	    write_log ("Set nonblock failed %d\n", errno);
-    }
-
-    uae_sem_init (&sb->sem, 0, 0);
-    if (0) {
-	write_log ("BSDSOCK: Failed to create semaphore.\n");
-	close (sb->sockabort[0]);
-	close (sb->sockabort[1]);
+    sb->epfd = epoll_create (64);
+    if (sb->epfd < 0) {
+	write_log ("BSDSOCK: Failed to create epoll set.\n");
 	return 0;
     }
+    sb->iov = malloc (BSD_MAXIOV * sizeof (struct iovec));
+    if (sb->iov == NULL)
+	return 0;
 
     /* Alloc hostent buffer */
     sb->hostent = uae_AllocMem (context, 1024, 0);
     sb->hostentsize = 1024;
 
-    /* @@@ The thread should be PTHREAD_CREATE_DETACHED */
-    if (uae_start_thread (bsdlib_threadfunc, (void *)sb, &sb->thread)) {
-	write_log ("BSDSOCK: Failed to create thread.\n");
-	uae_sem_destroy (&sb->sem);
-	close (sb->sockabort[0]);
-	close (sb->sockabort[1]);
-
-	return 0;
-    }
     return 1;
 }
 
@@ -1414,24 +2248,36 @@ void host_sbcleanup (SB)
 {
     int i;
 
-    uae_thread_id thread = sb->thread;
-    close (sb->sockabort[0]);
-    close (sb->sockabort[1]);
+    /* Wait for a call that was interrupted by a signal to finish.  There
+     * can't be one if the reactor never got going.  */
+    if (reactor_lock_ready) {
+	sockabort (sb);
+	bsd_lock ();
+	if (sb->busy) {
+	    sb->idlewait = 1;
+	    bsd_unlock ();
+	    uae_sem_wait (&sb->idle);
+	} else
+	    bsd_unlock ();
+    }
+    uae_sem_destroy (&sb->idle);
+
+    if (sb->lookup)
+	dns_release ((struct dns_entry *)sb->lookup);
+    if (sb->lookupjob)
+	dns_release ((struct dns_entry *)sb->lookupjob);
+    if (sb->epfd >= 0)
+	close (sb->epfd);
+    free (sb->epmask);
+    free (sb->epready);
+    free (sb->epevents);
+    free (sb->iov);
+    free (sb->bounce);
     for (i = 0; i < sb->dtablesize; i++) {
 	if (sb->dtable[i] != -1) {
 	    close(sb->dtable[i]);
 	}
     }
-    sb->action = 0;
-
-    uae_sem_post (&sb->sem); /* destroy happens on socket thread */
-
-    /* We need to join with the socket thread to allow the thread to die
-     * and clean up resources when the underlying thread layer is pthreads.
-     * Ideally, this shouldn't be necessary, but, for example, when SDL uses
-     * pthreads, it always creates joinable threads - and we can't do anything
-     * about that. */
-    uae_wait_thread (thread);
 }
 
 void host_sbreset (void)
@@ -1512,6 +2358,7 @@ int host_dup2socket (SB, int fd1, int fd2) {
 	    fd2++;
 	    s2 = getsock (sb, fd2);
 	    if (s2 != -1) {
+		bsd_ep_unwatch (sb, s2);
 		close (s2);
 	    }
 	    setsd (sb, fd2, dup (s1));
@@ -1549,6 +2396,20 @@ uae_u32 host_getsockopt (SB, uae_u32 sd, uae_u32 level, uae_u32 optname,
 	return -1;
     }
 
+    if (optval && optlen && IS_TIMEO_OPT (nativelevel, nativeoptname)) {
+	struct timeval tv;
+
+	len = sizeof tv;
+	r = getsockopt (s, nativelevel, nativeoptname, &tv, &len);
+	SETERRNO;
+	if (r == 0 && get_long (optlen) >= 8) {
+	    put_long (optval, tv.tv_sec);
+	    put_long (optval + 4, tv.tv_usec);
+	    put_long (optlen, 8);
+	}
+	return r;
+    }
+
     if (optlen) {
 	len = get_long (optlen);
 	buf = malloc(len);
@@ -1655,6 +2516,7 @@ int host_CloseSocket (SB, int sd)
     }
     */
     DEBUG_LOG ("CloseSocket Amiga: %d, NativeSide %d\n", sd, s);
+    bsd_ep_unwatch (sb, s);
     retval = close (s);
     SETERRNO;
     releasesock (sb, sd + 1);
@@ -1674,6 +2536,7 @@ void host_closesocketquick (int s)
 
 uae_u32 host_gethostname (uae_u32 name, uae_u32 namelen)
 {
+    memory_dirty (name, namelen);
     return gethostname ((char *)get_real_address (name), namelen);
 }
 
@@ -1690,20 +2553,22 @@ int init_socket_layer(void)
 
 void clearsockabort (SB)
 {
-    int chr;
-    int num;
-
-    while ((num = read (sb->sockabort[0], &chr, sizeof(chr))) >= 0) {
-	DEBUG_LOG ("Sockabort got %d bytes\n", num);
-	;
-    }
+    bsd_lock ();
+    sb->abort = 0;
+    bsd_unlock ();
 }
 
+/* Abort the blocking call of a base, or the next one if it hasn't
+ * reached the reactor yet.  */
 void sockabort (SB)
 {
-    int chr = 1;
     DEBUG_LOG ("Sock abort!!\n");
-    write (sb->sockabort[1], &chr, sizeof (chr));
+    bsd_lock ();
+    if (sb->busy) {
+	sb->abort = 1;
+	bsd_wake (sb, WAKE_ABORT);
+    }
+    bsd_unlock ();
 }
 
 void locksigqueue (void)
@@ -41,6 +41,13 @@ static struct cfg_lines opttable[] =
     {"config_description", "" },
     {"use_gui", "Enable the GUI?  If no, then goes straight to emulator" },
     {"use_debugger", "Enable the debugger?" },
+    {"headless", "Run without display, sound or speed throttling?" },
+    {"headless_frames", "Number of frames a headless run lasts, 0 to run until the program quits" },
+    {"statefile", "Statefile to restore at startup" },
+    {"stats_file", "File to map the per-frame emulation counters into" },
+    {"hardfile_overlay", "Directory for copy-on-write hardfile deltas" },
+    {"ide0_hardfile", "Image for the IDE master drive" },
+    {"ide1_hardfile", "Image for the IDE slave drive" },
     {"cpu_speed", "can be max, real, or a number between 1 and 20" },
     {"cpu_type", "Can be 68000, 68010, 68020, 68020/68881" },
     {"cpu_24bit_addressing", "must be set to 'no' in order for Z3mem or P96mem to work" },
@@ -246,6 +253,14 @@ void save_options (FILE *f, const struct uae_prefs *p)
 
     cfgfile_write (f, "bsdsocket_emu=%s\n", p->socket_emu ? "true" : "false");
 
+    cfgfile_write (f, "state_rewind_size=%d\n", p->rewind_size);
+    cfgfile_write (f, "state_rewind_interval=%d\n", p->rewind_interval);
+    cfgfile_write (f, "state_compression=%s\n", p->statefile_compress ? "true" : "false");
+    cfgfile_write (f, "statefile=%s\n", p->statefile);
+    cfgfile_write (f, "headless=%s\n", p->headless ? "true" : "false");
+    cfgfile_write (f, "headless_frames=%d\n", p->headless_frames);
+    cfgfile_write (f, "stats_file=%s\n", p->stats_file);
+
     cfgfile_write (f, "gfx_framerate=%d\n", p->gfx_framerate);
     write_gfx_params (f, &p->gfx_w, "windowed");
     write_gfx_params (f, &p->gfx_f, "fullscreen");
@@ -268,6 +283,8 @@ void save_options (FILE *f, const struct uae_prefs *p)
     cfgfile_write (f, "collision_level=%s\n", collmode[p->collision_level]);
 
     cfgfile_write (f, "ide=%s\n", p->cs_ide == 1 ? "a600/a1200" : (p->cs_ide == 2 ? "a4000" : "none"));
+    cfgfile_write (f, "ide0_hardfile=%s\n", p->ide_hardfile[0]);
+    cfgfile_write (f, "ide1_hardfile=%s\n", p->ide_hardfile[1]);
     cfgfile_write (f, "a1000ram=%s\n", p->cs_a1000ram ? "true" : "false");
     cfgfile_write (f, "fatgary=%d\n", p->cs_fatgaryrev);
     cfgfile_write (f, "ramsey=%d\n", p->cs_ramseyrev);
@@ -302,6 +319,7 @@ void save_options (FILE *f, const struct uae_prefs *p)
 					: p->keyboard_lang == KBD_LANG_IT ? "it"
 					: "FOO"));
 
+    cfgfile_write (f, "hardfile_overlay=%s\n", p->hardfile_overlay);
     write_filesys_config (p->mountinfo, UNEXPANDED, p->path_hardfile, f);
 
     /* Don't write gfxlib/gfx_test_speed options.  */
@@ -491,12 +509,17 @@ static int cfgfile_parse_host (struct uae_prefs *p, char *option, char *value)
 
 	|| cfgfile_yesno (option, value, "gfx_fullscreen_amiga", &p->gfx_afullscreen)
 	|| cfgfile_yesno (option, value, "gfx_fullscreen_picasso", &p->gfx_pfullscreen)
-	|| cfgfile_yesno (option, value, "log_illegal_mem", &p->illegal_mem))
+	|| cfgfile_yesno (option, value, "log_illegal_mem", &p->illegal_mem)
+	|| cfgfile_yesno (option, value, "state_compression", &p->statefile_compress)
+	|| cfgfile_yesno (option, value, "headless", &p->headless))
 	return 1;
     if (cfgfile_intval (option, value, "sound_max_buff", &p->sound_maxbsiz, 1)
 	|| cfgfile_intval (option, value, "sound_frequency", &p->sound_freq, 1)
 	|| cfgfile_intval (option, value, "sound_stereo_separation", &p->sound_stereo_separation, 1)
 	|| cfgfile_intval (option, value, "sound_stereo_mixing_delay", &p->sound_mixed_stereo_delay, 1)
+	|| cfgfile_intval (option, value, "state_rewind_size", &p->rewind_size, 1)
+	|| cfgfile_intval (option, value, "state_rewind_interval", &p->rewind_interval, 1)
+	|| cfgfile_intval (option, value, "headless_frames", &p->headless_frames, 1)
 
 	|| cfgfile_intval (option, value, "gfx_framerate", &p->gfx_framerate, 1)
 	|| (cfgfile_intval (option, value, "gfx_width", &p->gfx_w.width, 1)
@@ -577,7 +600,12 @@ static int cfgfile_parse_host (struct uae_prefs *p, char *option, char *value)
     }
 
     if (cfgfile_string (option, value, "config_description", p->description, 256)
-	|| cfgfile_string (option, value, "config_sortstr", p->sortstr, 256))
+	|| cfgfile_string (option, value, "config_sortstr", p->sortstr, 256)
+	|| cfgfile_string (option, value, "statefile", p->statefile, 256)
+	|| cfgfile_string (option, value, "stats_file", p->stats_file, 256)
+	|| cfgfile_string (option, value, "hardfile_overlay", p->hardfile_overlay, 256)
+	|| cfgfile_string (option, value, "ide0_hardfile", p->ide_hardfile[0], 256)
+	|| cfgfile_string (option, value, "ide1_hardfile", p->ide_hardfile[1], 256))
 	return 1;
 
     /* Tricky ones... */
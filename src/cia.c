@@ -825,7 +825,7 @@ static void cia_bput (uaecptr, uae_u32) REGPARAM;
 addrbank cia_bank = {
     cia_lget, cia_wget, cia_bget,
     cia_lput, cia_wput, cia_bput,
-    default_xlate, default_check, NULL, "CIA"
+    default_xlate, default_check, NULL, "CIA", NULL
 };
 
 static void cia_wait (void)
@@ -935,7 +935,7 @@ static void clock_bput (uaecptr, uae_u32) REGPARAM;
 addrbank clock_bank = {
     clock_lget, clock_wget, clock_bget,
     clock_lput, clock_wput, clock_bput,
-    default_xlate, default_check, NULL, "Battery backed up clock"
+    default_xlate, default_check, NULL, "Battery backed up clock", NULL
 };
 
 uae_u32 REGPARAM2 clock_lget (uaecptr addr)
@@ -950,10 +950,10 @@ uae_u32 REGPARAM2 clock_wget (uaecptr addr)
 
 uae_u32 REGPARAM2 clock_bget (uaecptr addr)
 {
-    time_t t = time(0);
+    time_t t = get_rtc_time ();
     struct tm *ct;
 
-    ct = localtime (&t);
+    ct = currprefs.headless ? gmtime (&t) : localtime (&t);
 
     switch (addr & 0x3f) {
     case 0x03: return ct->tm_sec % 10;
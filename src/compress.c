@@ -0,0 +1,175 @@
+ /*
+  * UAE - The Un*x Amiga Emulator
+  *
+  * Simple LZ77 block compression
+  *
+  * The format is a sequence of
+  *
+  *   token          high nibble literal count, low nibble match length - 4
+  *   [count]        if the nibble is 15: more bytes added to the literal
+  *                  count, until one that isn't 255
+  *   literals
+  *   offset         2 bytes, little endian
+  *   [length]       if the nibble is 15: more match length bytes
+  *
+  * The last sequence stops after its literals.  This is the same layout
+  * LZ4 uses, which makes both sides fast and simple; the compressor is
+  * tuned for speed rather than ratio, since it runs while the emulation
+  * is stopped.
+  */
+
+#include "sysconfig.h"
+#include "sysdeps.h"
+
+#include "compress.h"
+
+#define MIN_MATCH 4
+#define HASH_BITS 12
+/* Matches must leave this many literals at the end of the block, and
+   can't start in the last MF_LIMIT bytes.  */
+#define LAST_LITERALS 5
+#define MF_LIMIT 12
+
+STATIC_INLINE uae_u32 read32 (const uae_u8 *p)
+{
+    uae_u32 v;
+    memcpy (&v, p, 4);
+    return v;
+}
+
+STATIC_INLINE int hash4 (const uae_u8 *p)
+{
+    return (read32 (p) * 2654435761u) >> (32 - HASH_BITS);
+}
+
+static uae_u8 *put_length (uae_u8 *op, int n)
+{
+    while (n >= 255) {
+	*op++ = 255;
+	n -= 255;
+    }
+    *op++ = n;
+    return op;
+}
+
+/* Worst case output size of a sequence.  */
+#define SEQ_SIZE(lit, match) (1 + (lit) / 255 + 1 + (lit) + 2 + (match) / 255 + 1)
+
+/* Compress LEN bytes from SRC into at most DSTLEN bytes at DST.  Returns
+   the compressed size, or 0 if it doesn't fit.  */
+int lz_compress (const uae_u8 *src, int len, uae_u8 *dst, int dstlen)
+{
+    uae_u16 table[1 << HASH_BITS];
+    int ip = 0, anchor = 0;
+    uae_u8 *op = dst, *oend = dst + dstlen, *token;
+    int litlen, mlen;
+
+    if (len > LZ_MAX_BLOCK)
+	return 0;
+    memset (table, 0, sizeof table);
+    while (ip < len - MF_LIMIT) {
+	int h = hash4 (src + ip);
+	int ref = table[h];
+
+	table[h] = ip;
+	if (ref >= ip || read32 (src + ref) != read32 (src + ip)) {
+	    /* Skip faster through data that doesn't compress.  */
+	    ip += 1 + ((ip - anchor) >> 6);
+	    continue;
+	}
+	mlen = MIN_MATCH;
+	while (ip + mlen < len - LAST_LITERALS && src[ref + mlen] == src[ip + mlen])
+	    mlen++;
+
+	litlen = ip - anchor;
+	if (SEQ_SIZE (litlen, mlen) > oend - op)
+	    return 0;
+	token = op++;
+	*token = (litlen >= 15 ? 15 : litlen) << 4;
+	if (litlen >= 15)
+	    op = put_length (op, litlen - 15);
+	memcpy (op, src + anchor, litlen);
+	op += litlen;
+	*op++ = (ip - ref) & 0xff;
+	*op++ = (ip - ref) >> 8;
+	mlen -= MIN_MATCH;
+	*token |= mlen >= 15 ? 15 : mlen;
+	if (mlen >= 15)
+	    op = put_length (op, mlen - 15);
+	ip += mlen + MIN_MATCH;
+	anchor = ip;
+    }
+
+    litlen = len - anchor;
+    if (SEQ_SIZE (litlen, 0) > oend - op)
+	return 0;
+    token = op++;
+    *token = (litlen >= 15 ? 15 : litlen) << 4;
+    if (litlen >= 15)
+	op = put_length (op, litlen - 15);
+    memcpy (op, src + anchor, litlen);
+    op += litlen;
+    return op - dst;
+}
+
+/* Decompress SRCLEN bytes from SRC into at most DSTLEN bytes at DST.
+   Returns the decompressed size, or -1 if the data is corrupt.  */
+int lz_decompress (const uae_u8 *src, int srclen, uae_u8 *dst, int dstlen)
+{
+    const uae_u8 *ip = src, *iend = src + srclen;
+    uae_u8 *op = dst, *oend = dst + dstlen;
+
+    for (;;) {
+	int token, len, offset, b;
+	const uae_u8 *ref;
+
+	if (ip >= iend)
+	    return -1;
+	token = *ip++;
+	len = token >> 4;
+	if (len == 15) {
+	    do {
+		if (ip >= iend)
+		    return -1;
+		b = *ip++;
+		len += b;
+	    } while (b == 255);
+	}
+	if (len > iend - ip || len > oend - op)
+	    return -1;
+	memcpy (op, ip, len);
+	op += len;
+	ip += len;
+	if (ip == iend)
+	    break;
+
+	if (iend - ip < 2)
+	    return -1;
+	offset = ip[0] | (ip[1] << 8);
+	ip += 2;
+	if (offset == 0 || offset > op - dst)
+	    return -1;
+	len = token & 15;
+	if (len == 15) {
+	    do {
+		if (ip >= iend)
+		    return -1;
+		b = *ip++;
+		len += b;
+	    } while (b == 255);
+	}
+	len += MIN_MATCH;
+	if (len > oend - op)
+	    return -1;
+	ref = op - offset;
+	if (offset >= len) {
+	    memcpy (op, ref, len);
+	    op += len;
+	} else {
+	    /* Overlapping match, e.g. a run of the same byte.  */
+	    while (len-- > 0)
+		*op++ = *ref++;
+	}
+    }
+    return op - dst;
+}
@@ -0,0 +1,441 @@
+ /*
+  * UAE - The Un*x Amiga Emulator
+  *
+  * CPU execution trace recorder
+  *
+  * While a trace is running, SPCFLAG_CPUTRACE makes do_specialties call
+  * cputrace_record () before every instruction.  Each record is a few
+  * longwords:
+  *
+  *   PC
+  *   cycle stamp (get_cycles () / CYCLE_UNIT, low 32 bits)
+  *   opcode << 16 | mask of D0-D7/A0-A7 that changed since the last record
+  *   the new value of each register in the mask, D0 first
+  *
+  * The mask is always 0 unless the trace was started with registers.
+  * Records go into a ring of 64 KB chunks.  The CPU fills one chunk
+  * without any locking and hands it to a writer thread when it is full;
+  * the writer compresses it with lz_compress and appends it to the file.
+  * Only if the writer falls a whole ring behind does the CPU wait.
+  *
+  * File layout: "UAETRACE", version, flags, then blocks of
+  *
+  *   raw length (| TRACE_STORED if not compressed), data length, data
+  *
+  * where the raw data is the records as big-endian longwords.  Records
+  * never cross a block.
+  */
+
+#include "sysconfig.h"
+#include "sysdeps.h"
+
+#include "options.h"
+#include "threaddep/thread.h"
+#include "uae.h"
+#include "memory.h"
+#include "custom.h"
+#include "events.h"
+#include "newcpu.h"
+#include "compress.h"
+#include "cputrace.h"
+
+#define TRACE_MAGIC "UAETRACE"
+#define TRACE_VERSION 1
+#define TRACE_REGS 1
+#define TRACE_STORED 0x80000000
+
+#define TRACE_CHUNK_WORDS (LZ_MAX_BLOCK / 4)
+#define TRACE_CHUNKS 16
+#define TRACE_MAXREC (3 + 16)
+
+struct trace_chunk {
+    uae_u32 data[TRACE_CHUNK_WORDS];
+    /* -1 tells the writer to stop */
+    int used;
+};
+
+static FILE *trace_file;
+static struct trace_chunk *chunks, *trace_cur;
+static int trace_curidx, trace_with_regs, trace_allregs, trace_error, trace_starting;
+static unsigned long trace_records, trace_bytes;
+static uae_u32 trace_lastregs[16];
+/* Only used by whoever writes chunks out: the writer thread, or the CPU
+   if there is none.  */
+static uae_u8 trace_raw[LZ_MAX_BLOCK], trace_comp[LZ_MAX_BLOCK];
+
+#ifdef SUPPORT_THREADS
+static uae_sem_t trace_full, trace_free;
+static uae_thread_id trace_tid;
+static int trace_threaded;
+#endif
+
+static void put_u32 (uae_u8 *p, uae_u32 v)
+{
+    p[0] = v >> 24;
+    p[1] = v >> 16;
+    p[2] = v >> 8;
+    p[3] = v;
+}
+
+static uae_u32 get_u32 (const uae_u8 *p)
+{
+    return (p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+static void write_chunk (struct trace_chunk *c)
+{
+    uae_u8 hdr[8];
+    int i, len = c->used * 4, clen;
+
+    for (i = 0; i < c->used; i++)
+	put_u32 (trace_raw + i * 4, c->data[i]);
+    clen = lz_compress (trace_raw, len, trace_comp, len - 1);
+    put_u32 (hdr, clen ? (uae_u32)len : len | TRACE_STORED);
+    put_u32 (hdr + 4, clen ? clen : len);
+    if (fwrite (hdr, 8, 1, trace_file) != 1
+	|| fwrite (clen ? trace_comp : trace_raw, clen ? clen : len, 1, trace_file) != 1)
+	trace_error = 1;
+    trace_bytes += 8 + (clen ? clen : len);
+}
+
+#ifdef SUPPORT_THREADS
+static void *trace_writer (void *unused)
+{
+    int n = 0;
+
+    for (;;) {
+	struct trace_chunk *c;
+
+	uae_sem_wait (&trace_full);
+	c = &chunks[n];
+	n = (n + 1) % TRACE_CHUNKS;
+	if (c->used < 0)
+	    break;
+	write_chunk (c);
+	uae_sem_post (&trace_free);
+    }
+    return 0;
+}
+#endif
+
+/* Pass the current chunk on to be written and start filling another.  */
+static void next_chunk (void)
+{
+#ifdef SUPPORT_THREADS
+    if (trace_threaded) {
+	uae_sem_post (&trace_full);
+	trace_curidx = (trace_curidx + 1) % TRACE_CHUNKS;
+	uae_sem_wait (&trace_free);
+	trace_cur = &chunks[trace_curidx];
+	trace_cur->used = 0;
+	return;
+    }
+#endif
+    write_chunk (trace_cur);
+    trace_cur->used = 0;
+}
+
+void cputrace_record (void)
+{
+    uae_u32 *p;
+    uae_u32 opcode, mask = 0;
+    int i, n = 3;
+
+    if (trace_cur->used > TRACE_CHUNK_WORDS - TRACE_MAXREC)
+	next_chunk ();
+    p = trace_cur->data + trace_cur->used;
+    opcode = currprefs.cpu_model == 68000 ? regs.ir : get_iword (0);
+    p[0] = m68k_getpc ();
+    p[1] = (uae_u32)(get_cycles () / CYCLE_UNIT);
+    if (trace_with_regs) {
+	for (i = 0; i < 16; i++) {
+	    if (regs.regs[i] != trace_lastregs[i] || trace_allregs) {
+		mask |= 1 << i;
+		p[n++] = trace_lastregs[i] = regs.regs[i];
+	    }
+	}
+	trace_allregs = 0;
+    }
+    p[2] = (opcode << 16) | mask;
+    trace_cur->used += n;
+    trace_records++;
+}
+
+int cputrace_active (void)
+{
+    return trace_file != 0;
+}
+
+int cputrace_start (const char *name, int with_regs)
+{
+    uae_u8 hdr[16];
+
+    if (trace_file) {
+	write_log ("CPU trace is already running\n");
+	return 0;
+    }
+    trace_file = fopen (name, "wb");
+    if (!trace_file) {
+	write_log ("Couldn't open CPU trace file '%s'\n", name);
+	return 0;
+    }
+    memcpy (hdr, TRACE_MAGIC, 8);
+    put_u32 (hdr + 8, TRACE_VERSION);
+    put_u32 (hdr + 12, with_regs ? TRACE_REGS : 0);
+    fwrite (hdr, sizeof hdr, 1, trace_file);
+
+    chunks = xmalloc (TRACE_CHUNKS * sizeof *chunks);
+    trace_curidx = 0;
+    trace_cur = &chunks[0];
+    trace_cur->used = 0;
+    trace_with_regs = with_regs;
+    trace_allregs = 1;
+    trace_error = 0;
+    trace_records = 0;
+    trace_bytes = sizeof hdr;
+
+#ifdef SUPPORT_THREADS
+    uae_sem_init (&trace_full, 0, 0);
+    uae_sem_init (&trace_free, 0, TRACE_CHUNKS - 1);
+    trace_threaded = uae_start_thread (trace_writer, 0, &trace_tid) == 0;
+#endif
+    write_log ("CPU trace to '%s' started\n", name);
+    trace_starting = 1;
+    set_special (SPCFLAG_CPUTRACE);
+    return 1;
+}
+
+/* Called when the CPU loop is entered.  The first instruction it runs
+   comes before any do_specialties call, so record it here - but only
+   right after starting, since otherwise it has been recorded already.  */
+void cputrace_enter (void)
+{
+    if (!trace_starting)
+	return;
+    trace_starting = 0;
+    cputrace_record ();
+}
+
+void cputrace_stop (void)
+{
+    if (!trace_file)
+	return;
+    unset_special (SPCFLAG_CPUTRACE);
+    trace_starting = 0;
+    if (trace_cur->used > 0)
+	next_chunk ();
+#ifdef SUPPORT_THREADS
+    if (trace_threaded) {
+	trace_cur->used = -1;
+	uae_sem_post (&trace_full);
+	uae_wait_thread (trace_tid);
+	trace_threaded = 0;
+    }
+    uae_sem_destroy (&trace_full);
+    uae_sem_destroy (&trace_free);
+#endif
+    if (fclose (trace_file) != 0)
+	trace_error = 1;
+    trace_file = 0;
+    free (chunks);
+    chunks = trace_cur = 0;
+    write_log ("CPU trace stopped: %lu instructions, %lu bytes%s\n",
+	       trace_records, trace_bytes, trace_error ? ", WRITE ERRORS" : "");
+}
+
+/* Reading traces back.  */
+
+struct trace_reader {
+    FILE *f;
+    int flags;
+    uae_u8 *raw, *comp;
+    int len, pos;
+};
+
+struct trace_rec {
+    uae_u32 pc, cycles;
+    uae_u16 opcode, mask;
+    uae_u32 regs[16];
+};
+
+static int reader_open (struct trace_reader *r, const char *name)
+{
+    uae_u8 hdr[16];
+
+    r->f = fopen (name, "rb");
+    if (!r->f) {
+	write_log ("Couldn't open CPU trace file '%s'\n", name);
+	return 0;
+    }
+    if (fread (hdr, sizeof hdr, 1, r->f) != 1 || memcmp (hdr, TRACE_MAGIC, 8) != 0
+	|| get_u32 (hdr + 8) != TRACE_VERSION)
+    {
+	write_log ("'%s' is not a CPU trace file\n", name);
+	fclose (r->f);
+	return 0;
+    }
+    r->flags = get_u32 (hdr + 12);
+    r->raw = xmalloc (LZ_MAX_BLOCK);
+    r->comp = xmalloc (LZ_MAX_BLOCK);
+    r->len = r->pos = 0;
+    return 1;
+}
+
+static void reader_close (struct trace_reader *r)
+{
+    fclose (r->f);
+    free (r->raw);
+    free (r->comp);
+}
+
+static int reader_fill (struct trace_reader *r)
+{
+    uae_u8 hdr[8];
+    uae_u32 rawlen, len;
+
+    if (fread (hdr, 8, 1, r->f) != 1)
+	return 0;
+    rawlen = get_u32 (hdr);
+    len = get_u32 (hdr + 4);
+    if ((rawlen & ~TRACE_STORED) > LZ_MAX_BLOCK || len > LZ_MAX_BLOCK)
+	goto bad;
+    if (rawlen & TRACE_STORED) {
+	if (fread (r->raw, len, 1, r->f) != 1)
+	    goto bad;
+	r->len = len;
+    } else {
+	if (fread (r->comp, len, 1, r->f) != 1
+	    || lz_decompress (r->comp, len, r->raw, rawlen) != (int)rawlen)
+	    goto bad;
+	r->len = rawlen;
+    }
+    r->pos = 0;
+    return 1;
+
+  bad:
+    write_log ("CPU trace file is truncated or corrupt\n");
+    return 0;
+}
+
+static int reader_next (struct trace_reader *r, struct trace_rec *rec)
+{
+    uae_u32 w;
+    int i;
+
+    while (r->pos + 12 > r->len) {
+	if (!reader_fill (r))
+	    return 0;
+    }
+    rec->pc = get_u32 (r->raw + r->pos);
+    rec->cycles = get_u32 (r->raw + r->pos + 4);
+    w = get_u32 (r->raw + r->pos + 8);
+    rec->opcode = w >> 16;
+    rec->mask = w;
+    r->pos += 12;
+    for (i = 0; i < 16; i++) {
+	if (!(rec->mask & (1 << i)))
+	    continue;
+	if (r->pos + 4 > r->len)
+	    return 0;
+	rec->regs[i] = get_u32 (r->raw + r->pos);
+	r->pos += 4;
+    }
+    return 1;
+}
+
+/* Disassemble COUNT records starting with record FIRST.  The disassembly
+   comes from the current memory contents; when the opcode there differs
+   from the recorded one, the recorded opcode is shown as well.  */
+void cputrace_decode (const char *name, uae_u32 first, uae_u32 count)
+{
+    struct trace_reader r;
+    struct trace_rec rec;
+    uae_u32 n = 0, lastcycles = 0;
+    int i;
+
+    if (!reader_open (&r, name))
+	return;
+    while (count > 0 && reader_next (&r, &rec)) {
+	if (n++ < first) {
+	    lastcycles = rec.cycles;
+	    continue;
+	}
+	printf ("%8lu %+6ld ", (unsigned long)(n - 1), n > 1 ? (long)(uae_s32)(rec.cycles - lastcycles) : 0L);
+	lastcycles = rec.cycles;
+	m68k_disasm (stdout, rec.pc, NULL, 1);
+	if (valid_address (rec.pc, 2) && get_word (rec.pc) != rec.opcode)
+	    printf ("                (recorded opcode %04x, memory has changed)\n", rec.opcode);
+	if (rec.mask) {
+	    printf ("               ");
+	    for (i = 0; i < 16; i++) {
+		if (rec.mask & (1 << i))
+		    printf (" %c%d=%08x", i < 8 ? 'D' : 'A', i & 7, rec.regs[i]);
+	    }
+	    printf ("\n");
+	}
+	count--;
+    }
+    reader_close (&r);
+}
+
+struct pc_count {
+    uae_u32 pc;
+    unsigned long count;
+};
+
+static int pc_count_cmp (const void *a, const void *b)
+{
+    unsigned long ca = ((const struct pc_count *)a)->count;
+    unsigned long cb = ((const struct pc_count *)b)->count;
+    return ca < cb ? 1 : ca > cb ? -1 : 0;
+}
+
+/* Show the COUNT most frequently executed PCs in a trace.  */
+void cputrace_histogram (const char *name, int count)
+{
+    struct trace_reader r;
+    struct trace_rec rec;
+    struct pc_count *tab, *t;
+    unsigned long total = 0;
+    int size = 4096, used = 0, i, j;
+
+    if (!reader_open (&r, name))
+	return;
+    tab = xcalloc (size, sizeof *tab);
+    while (reader_next (&r, &rec)) {
+	total++;
+	for (i = (rec.pc * 0x9E3779B1u) >> 8 & (size - 1); tab[i].count && tab[i].pc != rec.pc; i = (i + 1) & (size - 1))
+	    ;
+	if (!tab[i].count)
+	    used++;
+	tab[i].pc = rec.pc;
+	tab[i].count++;
+	if (used * 2 <= size)
+	    continue;
+	/* Rehash into a table twice the size.  */
+	t = xcalloc (size * 2, sizeof *t);
+	for (j = 0; j < size; j++) {
+	    if (!tab[j].count)
+		continue;
+	    for (i = (tab[j].pc * 0x9E3779B1u) >> 8 & (size * 2 - 1); t[i].count; i = (i + 1) & (size * 2 - 1))
+		;
+	    t[i] = tab[j];
+	}
+	free (tab);
+	tab = t;
+	size *= 2;
+    }
+    reader_close (&r);
+
+    for (i = j = 0; i < size; i++) {
+	if (tab[i].count)
+	    tab[j++] = tab[i];
+    }
+    qsort (tab, used, sizeof *tab, pc_count_cmp);
+    printf ("%lu instructions, %d different PCs\n", total, used);
+    for (i = 0; i < used && i < count; i++) {
+	printf ("%10lu %5.1f%% ", tab[i].count, tab[i].count * 100.0 / total);
+	m68k_disasm (stdout, tab[i].pc, NULL, 1);
+    }
+    free (tab);
+}
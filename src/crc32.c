@@ -13,33 +13,162 @@
 
 #include "crc32.h"
 
-static unsigned long crc_table32[256];
+/* crc_table32[0] is the usual byte table; entry k of table n is the CRC
+ * of byte k followed by n zero bytes, so that get_crc32 can do eight
+ * bytes per step (slicing-by-8).  */
+static uae_u32 crc_table32[8][256];
 static unsigned short crc_table16[256];
 static void make_crc_table()
 {
-    unsigned long c;
+    uae_u32 c;
     unsigned short w;
     int n, k;
     for (n = 0; n < 256; n++) {
-	c = (unsigned long)n;
+	c = n;
 	w = n << 8;
 	for (k = 0; k < 8; k++) {
 	    c = (c >> 1) ^ (c & 1 ? 0xedb88320 : 0);
 	    w = (w << 1) ^ ((w & 0x8000) ? 0x1021 : 0);
 	}
-	crc_table32[n] = c;
+	crc_table32[0][n] = c;
 	crc_table16[n] = w;
     }
+    for (n = 0; n < 256; n++) {
+	c = crc_table32[0][n];
+	for (k = 1; k < 8; k++) {
+	    c = crc_table32[0][c & 0xff] ^ (c >> 8);
+	    crc_table32[k][n] = c;
+	}
+    }
 }
 
+/* On x86, CRC32 can fold 16 bytes at a time with carry-less multiplies
+ * (PCLMULQDQ), and SHA1 has its own instructions on newer CPUs.  Both are
+ * only used if CPUID says they are there.  */
+#if (defined __i386__ || defined __x86_64__) \
+    && (defined __clang__ || __GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))
+#define CRC_X86
+#include <cpuid.h>
+#include <immintrin.h>
+
+static int have_pclmul, have_shani;
+
+static void check_cpu (void)
+{
+    static int checked;
+    unsigned int a, b, c, d;
+
+    if (checked)
+	return;
+    checked = 1;
+    if (!__get_cpuid (1, &a, &b, &c, &d))
+	return;
+    /* SSE4.1 is needed as well, and SSSE3 for the SHA1 byte swap.  */
+    have_pclmul = (c & bit_PCLMUL) && (c & bit_SSE4_1);
+    if (__get_cpuid_max (0, 0) >= 7 && (c & bit_SSSE3) && (c & bit_SSE4_1)) {
+	__cpuid_count (7, 0, a, b, c, d);
+	have_shani = (b >> 29) & 1;
+    }
+}
+
+/* CRC of LEN bytes, LEN >= 64 and a multiple of 16, with the constants
+ * of Intel's "Fast CRC Computation for Generic Polynomials Using PCLMULQDQ
+ * Instruction" for the bit-reflected polynomial.  CRC is not inverted
+ * here.  */
+__attribute__ ((target ("pclmul,sse4.1")))
+static uae_u32 crc32_pclmul (const uae_u8 *buf, int len, uae_u32 crc)
+{
+    __m128i k, x1, x2, x3, x4, x5, x6, x7, x8, mask;
+
+    x1 = _mm_loadu_si128 ((const __m128i *)(buf + 0x00));
+    x2 = _mm_loadu_si128 ((const __m128i *)(buf + 0x10));
+    x3 = _mm_loadu_si128 ((const __m128i *)(buf + 0x20));
+    x4 = _mm_loadu_si128 ((const __m128i *)(buf + 0x30));
+    x1 = _mm_xor_si128 (x1, _mm_cvtsi32_si128 (crc));
+    buf += 64;
+    len -= 64;
+
+    /* Fold 64 bytes at a time into four accumulators.  */
+    k = _mm_set_epi64x (0x01c6e41596LL, 0x0154442bd4LL);
+    while (len >= 64) {
+	x5 = _mm_clmulepi64_si128 (x1, k, 0x00);
+	x6 = _mm_clmulepi64_si128 (x2, k, 0x00);
+	x7 = _mm_clmulepi64_si128 (x3, k, 0x00);
+	x8 = _mm_clmulepi64_si128 (x4, k, 0x00);
+	x1 = _mm_clmulepi64_si128 (x1, k, 0x11);
+	x2 = _mm_clmulepi64_si128 (x2, k, 0x11);
+	x3 = _mm_clmulepi64_si128 (x3, k, 0x11);
+	x4 = _mm_clmulepi64_si128 (x4, k, 0x11);
+	x1 = _mm_xor_si128 (_mm_xor_si128 (x1, x5), _mm_loadu_si128 ((const __m128i *)(buf + 0x00)));
+	x2 = _mm_xor_si128 (_mm_xor_si128 (x2, x6), _mm_loadu_si128 ((const __m128i *)(buf + 0x10)));
+	x3 = _mm_xor_si128 (_mm_xor_si128 (x3, x7), _mm_loadu_si128 ((const __m128i *)(buf + 0x20)));
+	x4 = _mm_xor_si128 (_mm_xor_si128 (x4, x8), _mm_loadu_si128 ((const __m128i *)(buf + 0x30)));
+	buf += 64;
+	len -= 64;
+    }
+
+    /* Fold them into one, then the remaining 16 byte blocks.  */
+    k = _mm_set_epi64x (0x00ccaa009eLL, 0x01751997d0LL);
+    x5 = _mm_clmulepi64_si128 (x1, k, 0x00);
+    x1 = _mm_clmulepi64_si128 (x1, k, 0x11);
+    x1 = _mm_xor_si128 (_mm_xor_si128 (x1, x2), x5);
+    x5 = _mm_clmulepi64_si128 (x1, k, 0x00);
+    x1 = _mm_clmulepi64_si128 (x1, k, 0x11);
+    x1 = _mm_xor_si128 (_mm_xor_si128 (x1, x3), x5);
+    x5 = _mm_clmulepi64_si128 (x1, k, 0x00);
+    x1 = _mm_clmulepi64_si128 (x1, k, 0x11);
+    x1 = _mm_xor_si128 (_mm_xor_si128 (x1, x4), x5);
+    while (len >= 16) {
+	x5 = _mm_clmulepi64_si128 (x1, k, 0x00);
+	x1 = _mm_clmulepi64_si128 (x1, k, 0x11);
+	x1 = _mm_xor_si128 (_mm_xor_si128 (x1, _mm_loadu_si128 ((const __m128i *)buf)), x5);
+	buf += 16;
+	len -= 16;
+    }
+
+    /* 128 to 64 bits.  */
+    mask = _mm_setr_epi32 (~0, 0, ~0, 0);
+    x2 = _mm_clmulepi64_si128 (x1, k, 0x10);
+    x1 = _mm_xor_si128 (_mm_srli_si128 (x1, 8), x2);
+    k = _mm_set_epi64x (0, 0x0163cd6124LL);
+    x2 = _mm_srli_si128 (x1, 4);
+    x1 = _mm_clmulepi64_si128 (_mm_and_si128 (x1, mask), k, 0x00);
+    x1 = _mm_xor_si128 (x1, x2);
+
+    /* Barrett reduction to 32 bits.  */
+    k = _mm_set_epi64x (0x01f7011641LL, 0x01db710641LL);
+    x2 = _mm_clmulepi64_si128 (_mm_and_si128 (x1, mask), k, 0x10);
+    x2 = _mm_clmulepi64_si128 (_mm_and_si128 (x2, mask), k, 0x00);
+    x1 = _mm_xor_si128 (x1, x2);
+    return _mm_extract_epi32 (x1, 1);
+}
+#endif
+
 uae_u32 get_crc32 (uae_u8 *buf, int len)
 {
     uae_u32 crc;
-    if (!crc_table32[1])
+    if (!crc_table32[0][1])
 	make_crc_table ();
     crc = 0xffffffff;
+#ifdef CRC_X86
+    check_cpu ();
+    if (have_pclmul && len >= 64) {
+	crc = crc32_pclmul (buf, len & ~15, crc);
+	buf += len & ~15;
+	len &= 15;
+    }
+#endif
+    while (len >= 8) {
+	uae_u32 lo = crc ^ (buf[0] | (buf[1] << 8) | (buf[2] << 16) | ((uae_u32)buf[3] << 24));
+	crc = crc_table32[7][lo & 0xff] ^ crc_table32[6][(lo >> 8) & 0xff]
+	    ^ crc_table32[5][(lo >> 16) & 0xff] ^ crc_table32[4][lo >> 24]
+	    ^ crc_table32[3][buf[4]] ^ crc_table32[2][buf[5]]
+	    ^ crc_table32[1][buf[6]] ^ crc_table32[0][buf[7]];
+	buf += 8;
+	len -= 8;
+    }
     while (len-- > 0) {
-	crc = crc_table32[(crc ^ (*buf++)) & 0xff] ^ (crc >> 8);
+	crc = crc_table32[0][(crc ^ (*buf++)) & 0xff] ^ (crc >> 8);
     }
     return crc ^ 0xffffffff;
 }
@@ -47,7 +176,7 @@ uae_u32 get_crc32 (uae_u8 *buf, int len)
 uae_u16 get_crc16 (uae_u8 *buf, int len)
 {
     uae_u16 crc;
-    if (!crc_table32[1])
+    if (!crc_table32[0][1])
 	make_crc_table ();
     crc = 0xffff;
     while (len-- > 0)
@@ -58,10 +187,10 @@ uae_u16 get_crc16 (uae_u8 *buf, int len)
 #ifndef GET_UINT32_BE
 #define GET_UINT32_BE(n,b,i)                            \
 {                                                       \
-    (n) = ( (unsigned long) (b)[(i)    ] << 24 )        \
-	| ( (unsigned long) (b)[(i) + 1] << 16 )        \
-	| ( (unsigned long) (b)[(i) + 2] <<  8 )        \
-	| ( (unsigned long) (b)[(i) + 3]       );       \
+    (n) = ( (uae_u32) (b)[(i)    ] << 24 )              \
+	| ( (uae_u32) (b)[(i) + 1] << 16 )              \
+	| ( (uae_u32) (b)[(i) + 2] <<  8 )              \
+	| ( (uae_u32) (b)[(i) + 3]       );             \
 }
 #endif
 #ifndef PUT_UINT32_BE
@@ -76,8 +205,8 @@ uae_u16 get_crc16 (uae_u8 *buf, int len)
 
 typedef struct
 {
-    unsigned long total[2];     /*!< number of bytes processed  */
-    unsigned long state[5];     /*!< intermediate digest state  */
+    uae_u32 total[2];           /*!< number of bytes processed  */
+    uae_u32 state[5];           /*!< intermediate digest state  */
     unsigned char buffer[64];   /*!< data block being processed */
 }
 sha1_context;
@@ -96,7 +225,7 @@ static void sha1_starts( sha1_context *ctx )
 
 static void sha1_process( sha1_context *ctx, unsigned char data[64] )
 {
-    unsigned long temp, W[16], A, B, C, D, E;
+    uae_u32 temp, W[16], A, B, C, D, E;
 
     GET_UINT32_BE( W[0],  data,  0 );
     GET_UINT32_BE( W[1],  data,  4 );
@@ -115,7 +244,7 @@ static void sha1_process( sha1_context *ctx, unsigned char data[64] )
     GET_UINT32_BE( W[14], data, 56 );
     GET_UINT32_BE( W[15], data, 60 );
 
-#define S(x,n) ((x << n) | ((x & 0xFFFFFFFF) >> (32 - n)))
+#define S(x,n) ((x << n) | (x >> (32 - n)))
 
 #define R(t)                                            \
 (                                                       \
@@ -250,6 +379,103 @@ static void sha1_process( sha1_context *ctx, unsigned char data[64] )
     ctx->state[4] += E;
 }
 
+#ifdef CRC_X86
+/*
+ * SHA-1 process NBLOCKS blocks with the SHA extensions
+ */
+#define SHA1_NI_ROUNDS(e, eo, msg, f)                   \
+{                                                       \
+    e = _mm_sha1nexte_epu32( e, msg );                  \
+    eo = abcd;                                          \
+    abcd = _mm_sha1rnds4_epu32( abcd, e, f );           \
+}
+/* The schedule of the message words of the next three groups of four.  */
+#define SHA1_NI_MSG(m0, m1, m2, m3)                     \
+{                                                       \
+    m1 = _mm_sha1msg2_epu32( m1, m0 );                  \
+    m2 = _mm_xor_si128( m2, m0 );                       \
+    m3 = _mm_sha1msg1_epu32( m3, m0 );                  \
+}
+
+__attribute__ ((target ("sha,ssse3,sse4.1")))
+static void sha1_process_ni( sha1_context *ctx, const unsigned char *data, int nblocks )
+{
+    __m128i abcd, abcd_save, e0, e0_save, e1, m0, m1, m2, m3;
+    const __m128i bswap = _mm_set_epi64x( 0x0001020304050607LL, 0x08090a0b0c0d0e0fLL );
+
+    abcd = _mm_loadu_si128( (const __m128i *) ctx->state );
+    abcd = _mm_shuffle_epi32( abcd, 0x1B );
+    e0 = _mm_set_epi32( ctx->state[4], 0, 0, 0 );
+
+    while( nblocks-- > 0 )
+    {
+	abcd_save = abcd;
+	e0_save = e0;
+
+	m0 = _mm_shuffle_epi8( _mm_loadu_si128( (const __m128i *) (data +  0) ), bswap );
+	m1 = _mm_shuffle_epi8( _mm_loadu_si128( (const __m128i *) (data + 16) ), bswap );
+	m2 = _mm_shuffle_epi8( _mm_loadu_si128( (const __m128i *) (data + 32) ), bswap );
+	m3 = _mm_shuffle_epi8( _mm_loadu_si128( (const __m128i *) (data + 48) ), bswap );
+
+	/* Rounds 0-15 */
+	e0 = _mm_add_epi32( e0, m0 );
+	e1 = abcd;
+	abcd = _mm_sha1rnds4_epu32( abcd, e0, 0 );
+	SHA1_NI_ROUNDS( e1, e0, m1, 0 );
+	m0 = _mm_sha1msg1_epu32( m0, m1 );
+	SHA1_NI_ROUNDS( e0, e1, m2, 0 );
+	m1 = _mm_sha1msg1_epu32( m1, m2 );
+	m0 = _mm_xor_si128( m0, m2 );
+	SHA1_NI_ROUNDS( e1, e0, m3, 0 );
+	SHA1_NI_MSG( m3, m0, m1, m2 );
+
+	/* Rounds 16-63 */
+	SHA1_NI_ROUNDS( e0, e1, m0, 0 );
+	SHA1_NI_MSG( m0, m1, m2, m3 );
+	SHA1_NI_ROUNDS( e1, e0, m1, 1 );
+	SHA1_NI_MSG( m1, m2, m3, m0 );
+	SHA1_NI_ROUNDS( e0, e1, m2, 1 );
+	SHA1_NI_MSG( m2, m3, m0, m1 );
+	SHA1_NI_ROUNDS( e1, e0, m3, 1 );
+	SHA1_NI_MSG( m3, m0, m1, m2 );
+	SHA1_NI_ROUNDS( e0, e1, m0, 1 );
+	SHA1_NI_MSG( m0, m1, m2, m3 );
+	SHA1_NI_ROUNDS( e1, e0, m1, 1 );
+	SHA1_NI_MSG( m1, m2, m3, m0 );
+	SHA1_NI_ROUNDS( e0, e1, m2, 2 );
+	SHA1_NI_MSG( m2, m3, m0, m1 );
+	SHA1_NI_ROUNDS( e1, e0, m3, 2 );
+	SHA1_NI_MSG( m3, m0, m1, m2 );
+	SHA1_NI_ROUNDS( e0, e1, m0, 2 );
+	SHA1_NI_MSG( m0, m1, m2, m3 );
+	SHA1_NI_ROUNDS( e1, e0, m1, 2 );
+	SHA1_NI_MSG( m1, m2, m3, m0 );
+	SHA1_NI_ROUNDS( e0, e1, m2, 2 );
+	SHA1_NI_MSG( m2, m3, m0, m1 );
+	SHA1_NI_ROUNDS( e1, e0, m3, 3 );
+	SHA1_NI_MSG( m3, m0, m1, m2 );
+
+	/* Rounds 64-79, the schedule winds down */
+	SHA1_NI_ROUNDS( e0, e1, m0, 3 );
+	SHA1_NI_MSG( m0, m1, m2, m3 );
+	SHA1_NI_ROUNDS( e1, e0, m1, 3 );
+	m2 = _mm_sha1msg2_epu32( m2, m1 );
+	m3 = _mm_xor_si128( m3, m1 );
+	SHA1_NI_ROUNDS( e0, e1, m2, 3 );
+	m3 = _mm_sha1msg2_epu32( m3, m2 );
+	SHA1_NI_ROUNDS( e1, e0, m3, 3 );
+
+	e0 = _mm_sha1nexte_epu32( e0, e0_save );
+	abcd = _mm_add_epi32( abcd, abcd_save );
+	data += 64;
+    }
+
+    abcd = _mm_shuffle_epi32( abcd, 0x1B );
+    _mm_storeu_si128( (__m128i *) ctx->state, abcd );
+    ctx->state[4] = _mm_extract_epi32( e0, 3 );
+}
+#endif
+
 /*
  * SHA-1 process buffer
  */
@@ -280,6 +506,15 @@ static void sha1_update( sha1_context *ctx, unsigned char *input, int ilen )
 	left = 0;
     }
 
+#ifdef CRC_X86
+    check_cpu ();
+    if( have_shani && ilen >= 64 )
+    {
+	sha1_process_ni( ctx, input, ilen / 64 );
+	input += ilen & ~0x3F;
+	ilen  &= 0x3F;
+    }
+#endif
     while( ilen >= 64 )
     {
 	sha1_process( ctx, input );
@@ -39,6 +39,8 @@
 #include "drawing.h"
 #include "savestate.h"
 #include "gayle.h"
+#include "profiler.h"
+#include "stats.h"
 
 #define SPR0_HPOS 0x15
 
@@ -2044,7 +2046,11 @@ static uae_u32 timehack_helper (TrapContext *dummy)
 
     timehack_alive = 10;
 
-    gettimeofday (&tv, NULL);
+    if (currprefs.headless) {
+	tv.tv_sec = get_rtc_time ();
+	tv.tv_usec = 0;
+    } else
+	gettimeofday (&tv, NULL);
     put_long (m68k_areg (regs, 0), tv.tv_sec - (((365 * 8 + 2) * 24 - 2) * 60 * 60));
     put_long (m68k_areg (regs, 0) + 4, tv.tv_usec);
     return 0;
@@ -3335,15 +3341,19 @@ static void do_savestate(void);
 
 static void vsync_handler (void)
 {
+    uae_u64 t;
     int i;
     for (i = 0; i < MAX_SPRITES; i++)
 	spr[i].state = SPR_waiting_start;
 
     n_frames++;
 
+    t = stats_ticks ();
     time_vsync ();
+    stats_frame.wait_ticks += stats_ticks () - t;
 
-    handle_events ();
+    if (! currprefs.headless)
+	handle_events ();
 
     INTREQ (0x8020);
     if (bplcon0 & 4)
@@ -3353,7 +3363,9 @@ static void vsync_handler (void)
     if (picasso_on)
 	picasso_handle_vsync ();
 #endif
+    t = stats_ticks ();
     vsync_handle_redraw (lof, lof_changed);
+    stats_frame.draw_ticks += stats_ticks () - t;
 
     if (quit_program > 0)
 	return;
@@ -3388,7 +3400,7 @@ static void vsync_handler (void)
     init_hardware_frame ();
 
 #ifdef HAVE_GETTIMEOFDAY
-    {
+    if (! currprefs.headless) {
 	struct timeval tv;
 	unsigned long int newtime;
 
@@ -3412,6 +3424,7 @@ static void vsync_handler (void)
 	timehack_alive--;
     inputdevice_vsync ();
     CIA_vsync_handler ();
+    stats_vsync ();
 }
 
 static void hsync_handler (void)
@@ -3508,6 +3521,8 @@ void init_eventtab (void)
     eventtab[ev_disk].active = 0;
     eventtab[ev_audio].handler = audio_evhandler;
     eventtab[ev_audio].active = 0;
+    eventtab[ev_profile].handler = profiler_handler;
+    eventtab[ev_profile].active = 0;
     events_schedule ();
 }
 
@@ -3521,7 +3536,8 @@ void customreset (void)
 
     /* If we're in a loop of quick successive resets, we should give
        the GUI some time to respond to a "Quit" event.  */
-    handle_events ();
+    if (! currprefs.headless)
+	handle_events ();
 
     if (! savestate_state) {
 	if ((currprefs.chipset_mask & CSMASK_AGA) == 0) {
@@ -3564,7 +3580,8 @@ void customreset (void)
     a1000_reset ();
     DISK_reset ();
     CIA_reset ();
-    unset_special (~(SPCFLAG_BRK | SPCFLAG_MODE_CHANGE));
+    /* Keep the debugger's breakpoint checks and CPU trace going.  */
+    unset_special (~(SPCFLAG_BRK | SPCFLAG_MODE_CHANGE | SPCFLAG_BPCHECK | SPCFLAG_CPUTRACE));
 
     vpos = 0;
 
@@ -3585,6 +3602,7 @@ void customreset (void)
     diwstate = DIW_waiting_start;
     hdiwstate = DIW_waiting_start;
     currcycle = 0;
+    profiler_reset ();
 
     currprefs.ntscmode = changed_prefs.ntscmode;
     new_beamcon0 = currprefs.ntscmode ? 0x00 : 0x20;
@@ -3754,7 +3772,7 @@ static void custom_bput (uaecptr, uae_u32) REGPARAM;
 addrbank custom_bank = {
     custom_lget, custom_wget, custom_bget,
     custom_lput, custom_wput, custom_bput,
-    default_xlate, default_check, NULL, "Custom chipset"
+    default_xlate, default_check, NULL, "Custom chipset", NULL
 };
 
 STATIC_INLINE uae_u32 REGPARAM2 custom_wget_1 (uaecptr addr)
@@ -4360,11 +4378,14 @@ const uae_u8 *restore_custom_sprite (int num, const uae_u8 *src)
     return src;
 }
 
-uae_u8 *save_custom_sprite(int num, int *len)
+uae_u8 *save_custom_sprite(int num, int *len, uae_u8 *dstptr)
 {
     uae_u8 *dstbak, *dst;
 
-    dstbak = dst = malloc (25);
+    if (dstptr)
+	dstbak = dst = dstptr;
+    else
+	dstbak = dst = malloc (25);
     SL (spr[num].pt);		/* 120-13E SPRxPT */
     SW (sprpos[num]);		/* 1x0 SPRxPOS */
     SW (sprctl[num]);		/* 1x2 SPRxPOS */
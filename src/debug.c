@@ -27,6 +27,10 @@
 #include "identify.h"
 #include "disk.h"
 #include "autoconf.h"
+#include "savestate.h"
+#include "cputrace.h"
+#include "profiler.h"
+#include "stats.h"
 
 static int debugger_active;
 static uaecptr skipaddr_start, skipaddr_end;
@@ -73,11 +77,18 @@ static char help[] = {
     "  t [instructions]      Step one or more instructions\n"
     "  z                     Step through one instruction - useful for JSR, DBRA etc\n"
     "  f                     Step forward until PC in RAM\n"
-    "  f <address>           Add/remove breakpoint\n"
+    "  f <address> [if <condition>]\n"
+    "                        Add/remove breakpoint, stopping only if <condition> holds\n"
     "  fi                    Step forward until PC points to RTS/RTD or RTE\n"
     "  fi <opcode>           Step forward until PC points to <opcode>\n"
     "  fl                    List breakpoints\n"
     "  fd                    Remove all breakpoints\n"
+    "  fp <address> [if <condition>]\n"
+    "                        Add/remove tracepoint, which logs the registers and goes on\n"
+    "  ft [<count>]          Show the last <count> tracepoint log entries\n"
+    "                        Conditions are C-like expressions of d0-d7, a0-a7, sp, pc,\n"
+    "                        sr, hits (times the address was reached), [addr].b/.w/.l\n"
+    "                        and numbers, which are hex like addresses\n"
     "  f <addr1> <addr2>     Step forward until <addr1> <= PC <= <addr2>\n"
     "  e                     Dump contents of all custom registers\n"
     "  i                     Dump contents of interrupt and trap vectors\n"
@@ -95,6 +106,25 @@ static char help[] = {
     "  s <string>/<values> [<addr>] [<length>]\n"
     "                        Search for string/bytes\n"
     "  T                     Show exec tasks and their PCs\n"
+    "  ys <file>             Save state at the next vsync\n"
+    "  yd <file>             Save incremental state at the next vsync\n"
+    "  yr <file>             Restore state at the next vsync\n"
+    "  yf <file> <outfile>   Write incremental statefile as a complete one\n"
+    "  yb [<n>]              Go back <n> snapshots in the rewind buffer\n"
+    "  xs <file> [r]         Record an execution trace to <file>, r adds registers\n"
+    "  xe                    Stop recording the execution trace\n"
+    "  xd <file> [<first>] [<count>]\n"
+    "                        Disassemble <count> trace records from record <first>\n"
+    "  xh <file> [<count>]   Show the <count> most executed PCs in a trace\n"
+    "  ps [<cycles>]         Start profiling, one sample every <cycles> cycles\n"
+    "  pe                    Stop profiling\n"
+    "  pf [<count>]          Show the <count> functions with the most samples\n"
+    "  pg <file>             Write the sampled call stacks to <file>\n"
+    "  pl <file> <process|seglist>\n"
+    "                        Load symbols of hunk executable <file> for a process\n"
+    "  stats                 Show the counters of the last frames\n"
+    "  stats r               Restart the averages\n"
+    "  stats b               Turn counting of memory bank accesses on or off\n"
     "  h,?                   Show this help page\n"
     "  q                     Quit the emulator. You don't want to use this command.\n\n"
 };
@@ -468,12 +498,293 @@ static void cheatsearch (char **c)
     }
 }
 
-#define BREAKPOINT_TOTAL 8
+#define BREAKPOINT_TOTAL 32
+
+/* Conditions are compiled to code for a small stack machine.  */
+#define BP_CODE_SIZE 64
+#define BP_STACK 16
+
+enum bp_op {
+    BPO_END, BPO_NUM, BPO_REG, BPO_PC, BPO_SR, BPO_HITS,
+    BPO_LOADB, BPO_LOADW, BPO_LOADL, BPO_NEG, BPO_NOT,
+    BPO_MUL, BPO_ADD, BPO_SUB, BPO_AND, BPO_XOR, BPO_OR,
+    BPO_EQ, BPO_NE, BPO_LT, BPO_LE, BPO_GT, BPO_GE, BPO_LAND, BPO_LOR
+};
+
 struct breakpoint_node {
     uaecptr addr;
     int enabled;
+    int trace;			/* log to the trace buffer instead of stopping */
+    uae_u32 hits;
+    uae_u32 code[BP_CODE_SIZE];	/* condition, empty if just BPO_END */
+    char cond[80];
+    struct breakpoint_node *next;	/* in bphash */
 };
 static struct breakpoint_node bpnodes[BREAKPOINT_TOTAL];
+static struct breakpoint_node *bphit;
+
+/* Enabled breakpoints by address, looked up by do_specialties after each
+ * instruction while any are set.  */
+#define BP_HASH_SIZE 64
+#define BP_HASH(pc) (((pc) >> 1) & (BP_HASH_SIZE - 1))
+static struct breakpoint_node *bphash[BP_HASH_SIZE];
+
+/* What tracepoints log.  */
+#define BP_TRACE_SIZE 1024
+struct bp_trace {
+    uaecptr pc;
+    uae_u32 regs[16];
+    uae_u16 sr;
+    int bp;
+    uae_u32 hits;
+};
+static struct bp_trace bptrace[BP_TRACE_SIZE];
+static unsigned int bptrace_count;
+
+struct bp_compile {
+    char *p;
+    uae_u32 *code;
+    int len, depth, err;
+};
+
+static const struct {
+    const char *s;
+    int level, op;
+} bp_binops[] = {
+    /* Longer operators first, so "&&" isn't taken for "&".  */
+    { "||", 0, BPO_LOR }, { "&&", 1, BPO_LAND },
+    { "==", 5, BPO_EQ }, { "!=", 5, BPO_NE }, { "<=", 6, BPO_LE }, { ">=", 6, BPO_GE },
+    { "|", 2, BPO_OR }, { "^", 3, BPO_XOR }, { "&", 4, BPO_AND },
+    { "<", 6, BPO_LT }, { ">", 6, BPO_GT },
+    { "+", 7, BPO_ADD }, { "-", 7, BPO_SUB }, { "*", 8, BPO_MUL },
+    { NULL, 0, 0 }
+};
+#define BP_LEVELS 9
+
+static void bpc_emit (struct bp_compile *c, uae_u32 op, int push)
+{
+    if (c->len >= BP_CODE_SIZE - 1) {
+	c->err = 1;
+	return;
+    }
+    c->code[c->len++] = op;
+    c->depth += push;
+    if (c->depth > BP_STACK)
+	c->err = 1;
+}
+
+static void bpc_binary (struct bp_compile *c, int level);
+
+static void bpc_primary (struct bp_compile *c)
+{
+    char name[16];
+    int n = 0;
+
+    ignore_ws (&c->p);
+    if (*c->p == '(' || *c->p == '[') {
+	char close = *c->p == '(' ? ')' : ']';
+	c->p++;
+	bpc_binary (c, 0);
+	ignore_ws (&c->p);
+	if (*c->p != close) {
+	    c->err = 1;
+	    return;
+	}
+	c->p++;
+	if (close == ']') {
+	    int op = BPO_LOADL;
+	    if (c->p[0] == '.' && toupper (c->p[1]) == 'B')
+		op = BPO_LOADB;
+	    else if (c->p[0] == '.' && toupper (c->p[1]) == 'W')
+		op = BPO_LOADW;
+	    if (c->p[0] == '.')
+		c->p += 2;
+	    bpc_emit (c, op, 0);
+	}
+	return;
+    }
+    if (*c->p == '$') {
+	c->p++;
+    } else if (*c->p != '!' && *c->p != '_') {
+	while (isalnum (c->p[n]) && n < (int)sizeof name - 1) {
+	    name[n] = tolower (c->p[n]);
+	    n++;
+	}
+	name[n] = 0;
+	if (n == 2 && (name[0] == 'd' || name[0] == 'a') && name[1] >= '0' && name[1] <= '7') {
+	    bpc_emit (c, BPO_REG, 1);
+	    bpc_emit (c, (name[0] == 'a' ? 8 : 0) + name[1] - '0', 0);
+	} else if (!strcmp (name, "sp")) {
+	    bpc_emit (c, BPO_REG, 1);
+	    bpc_emit (c, 15, 0);
+	} else if (!strcmp (name, "pc")) {
+	    bpc_emit (c, BPO_PC, 1);
+	} else if (!strcmp (name, "sr")) {
+	    bpc_emit (c, BPO_SR, 1);
+	} else if (!strcmp (name, "hits")) {
+	    bpc_emit (c, BPO_HITS, 1);
+	} else
+	    n = 0;
+	if (n) {
+	    c->p += n;
+	    return;
+	}
+	if (!isxdigit (*c->p)) {
+	    c->err = 1;
+	    return;
+	}
+    }
+    bpc_emit (c, BPO_NUM, 1);
+    bpc_emit (c, readhex (&c->p), 0);
+}
+
+static void bpc_unary (struct bp_compile *c)
+{
+    ignore_ws (&c->p);
+    if (*c->p == '-' || *c->p == '~') {
+	int op = *c->p++ == '-' ? BPO_NEG : BPO_NOT;
+	bpc_unary (c);
+	bpc_emit (c, op, 0);
+    } else
+	bpc_primary (c);
+}
+
+static void bpc_binary (struct bp_compile *c, int level)
+{
+    if (level == BP_LEVELS) {
+	bpc_unary (c);
+	return;
+    }
+    bpc_binary (c, level + 1);
+    while (!c->err) {
+	int i;
+
+	ignore_ws (&c->p);
+	for (i = 0; bp_binops[i].s; i++) {
+	    if (!strncmp (c->p, bp_binops[i].s, strlen (bp_binops[i].s)))
+		break;
+	}
+	if (!bp_binops[i].s || bp_binops[i].level != level)
+	    return;
+	c->p += strlen (bp_binops[i].s);
+	bpc_binary (c, level + 1);
+	bpc_emit (c, bp_binops[i].op, -1);
+    }
+}
+
+/* Compile the condition at *p into code.  Returns 0 on a syntax error.  */
+static int bp_compile (char **p, uae_u32 *code)
+{
+    struct bp_compile c;
+
+    c.p = *p;
+    c.code = code;
+    c.len = c.depth = c.err = 0;
+    bpc_binary (&c, 0);
+    ignore_ws (&c.p);
+    if (c.err || *c.p) {
+	*p = c.p;
+	code[0] = BPO_END;
+	return 0;
+    }
+    code[c.len] = BPO_END;
+    *p = c.p;
+    return 1;
+}
+
+static uae_u32 bp_eval (struct breakpoint_node *bpn)
+{
+    uae_u32 stack[BP_STACK + 1], *sp = stack;
+    const uae_u32 *ip = bpn->code;
+
+    for (;;) {
+	uae_u32 op = *ip++, a, b;
+
+	switch (op) {
+	case BPO_END:
+	    return sp > stack ? sp[-1] : 1;
+	case BPO_NUM: *sp++ = *ip++; break;
+	case BPO_REG: *sp++ = regs.regs[*ip++]; break;
+	case BPO_PC: *sp++ = m68k_getpc (); break;
+	case BPO_SR: MakeSR (); *sp++ = regs.sr; break;
+	case BPO_HITS: *sp++ = bpn->hits; break;
+	case BPO_LOADB: sp[-1] = get_byte (sp[-1]); break;
+	case BPO_LOADW: sp[-1] = get_word (sp[-1]); break;
+	case BPO_LOADL: sp[-1] = get_long (sp[-1]); break;
+	case BPO_NEG: sp[-1] = -sp[-1]; break;
+	case BPO_NOT: sp[-1] = ~sp[-1]; break;
+	default:
+	    b = *--sp;
+	    a = sp[-1];
+	    switch (op) {
+	    case BPO_MUL: a *= b; break;
+	    case BPO_ADD: a += b; break;
+	    case BPO_SUB: a -= b; break;
+	    case BPO_AND: a &= b; break;
+	    case BPO_XOR: a ^= b; break;
+	    case BPO_OR: a |= b; break;
+	    case BPO_EQ: a = a == b; break;
+	    case BPO_NE: a = a != b; break;
+	    case BPO_LT: a = a < b; break;
+	    case BPO_LE: a = a <= b; break;
+	    case BPO_GT: a = a > b; break;
+	    case BPO_GE: a = a >= b; break;
+	    case BPO_LAND: a = a && b; break;
+	    case BPO_LOR: a = a || b; break;
+	    }
+	    sp[-1] = a;
+	    break;
+	}
+    }
+}
+
+/* Rebuild the hash after breakpoints changed, and have do_specialties
+ * look them up only while there are any.  */
+static void bp_rehash (void)
+{
+    int i, any = 0;
+
+    memset (bphash, 0, sizeof bphash);
+    for (i = BREAKPOINT_TOTAL - 1; i >= 0; i--) {
+	struct breakpoint_node *bpn = &bpnodes[i];
+	if (!bpn->enabled)
+	    continue;
+	bpn->next = bphash[BP_HASH (bpn->addr)];
+	bphash[BP_HASH (bpn->addr)] = bpn;
+	any = 1;
+    }
+    if (any)
+	set_special (SPCFLAG_BPCHECK);
+    else
+	unset_special (SPCFLAG_BPCHECK);
+}
+
+int debug_bpcheck (void)
+{
+    uaecptr pc = munge24 (m68k_getpc ());
+    struct breakpoint_node *bpn;
+
+    for (bpn = bphash[BP_HASH (pc)]; bpn; bpn = bpn->next) {
+	if (bpn->addr != pc)
+	    continue;
+	bpn->hits++;
+	if (!bp_eval (bpn))
+	    continue;
+	if (bpn->trace) {
+	    struct bp_trace *t = &bptrace[bptrace_count++ % BP_TRACE_SIZE];
+	    t->pc = pc;
+	    memcpy (t->regs, regs.regs, sizeof t->regs);
+	    MakeSR ();
+	    t->sr = regs.sr;
+	    t->bp = bpn - bpnodes;
+	    t->hits = bpn->hits;
+	    continue;
+	}
+	bphit = bpn;
+	return 1;
+    }
+    return 0;
+}
 
 static addrbank **debug_mem_banks;
 #define MEMWATCH_TOTAL 4
@@ -489,6 +800,14 @@ struct memwatch_node {
 static struct memwatch_node mwnodes[MEMWATCH_TOTAL];
 static struct memwatch_node mwhit;
 
+/* Only the banks holding a watchpoint go through the debug handlers.
+ * Those first look up the 256 byte page of an access in a bitmap of the
+ * pages that hold one, and only check the watchpoints of the bank when
+ * its bit is set.  */
+#define MW_PAGE_SHIFT 8
+static uae_u32 mwpages[(0x1000000 >> MW_PAGE_SHIFT) / 32];
+static int mwbanknodes[256];	/* watchpoints in each bank, as a mask */
+
 static uae_u8 *illgdebug;
 static int illgdebug_break;
 extern int cdtv_enabled, cd32_enabled;
@@ -576,20 +895,35 @@ static int debug_mem_off (uaecptr addr)
     return (munge24 (addr) >> 16) & 0xff;
 }
 
+STATIC_INLINE int memwatch_page (uaecptr addr, int size)
+{
+    uae_u32 p1, p2;
+
+    if (illgdebug)
+	return 1;
+    /* munge24 doesn't clamp without 24-bit addressing; the tables only
+     * cover the banks.  */
+    addr = munge24 (addr);
+    p1 = (addr & 0xffffff) >> MW_PAGE_SHIFT;
+    p2 = ((addr + size - 1) & 0xffffff) >> MW_PAGE_SHIFT;
+    return ((mwpages[p1 >> 5] >> (p1 & 31)) | (mwpages[p2 >> 5] >> (p2 & 31))) & 1;
+}
+
 static void memwatch_func (uaecptr addr, int rw, int size, uae_u32 val)
 {
-    int i, brk;
+    int i, brk, nodes;
 
     if (illgdebug)
 	illg_debug_do (addr, rw, size, val);
     addr = munge24 (addr);
+    nodes = mwbanknodes[(addr >> 16) & 0xff] | mwbanknodes[((addr + size - 1) >> 16) & 0xff];
     for (i = 0; i < MEMWATCH_TOTAL; i++) {
 	uaecptr addr2 = mwnodes[i].addr;
 	uaecptr addr3 = addr2 + mwnodes[i].size;
 	int rw2 = mwnodes[i].rw;
 
 	brk = 0;
-	if (mwnodes[i].size == 0)
+	if (!(nodes & (1 << i)))
 	    continue;
 	if (mwnodes[i].val_enabled && mwnodes[i].val != val)
 	    continue;
@@ -632,7 +966,8 @@ static uae_u32 REGPARAM2 debug_lget (uaecptr addr)
     int off = debug_mem_off (addr);
     uae_u32 v;
     v = debug_mem_banks[off]->lget (addr);
-    memwatch_func (addr, 0, 4, v);
+    if (memwatch_page (addr, 4))
+	memwatch_func (addr, 0, 4, v);
     return v;
 }
 static uae_u32 REGPARAM2 debug_wget (uaecptr addr)
@@ -640,7 +975,8 @@ static uae_u32 REGPARAM2 debug_wget (uaecptr addr)
     int off = debug_mem_off (addr);
     uae_u32 v;
     v = debug_mem_banks[off]->wget (addr);
-    memwatch_func (addr, 0, 2, v);
+    if (memwatch_page (addr, 2))
+	memwatch_func (addr, 0, 2, v);
     return v;
 }
 static uae_u32 REGPARAM2 debug_bget (uaecptr addr)
@@ -648,25 +984,29 @@ static uae_u32 REGPARAM2 debug_bget (uaecptr addr)
     int off = debug_mem_off (addr);
     uae_u32 v;
     v = debug_mem_banks[off]->bget (addr);
-    memwatch_func (addr, 0, 1, v);
+    if (memwatch_page (addr, 1))
+	memwatch_func (addr, 0, 1, v);
     return v;
 }
 static void REGPARAM2 debug_lput (uaecptr addr, uae_u32 v)
 {
     int off = debug_mem_off (addr);
-    memwatch_func (addr, 1, 4, v);
+    if (memwatch_page (addr, 4))
+	memwatch_func (addr, 1, 4, v);
     debug_mem_banks[off]->lput (addr, v);
 }
 static void REGPARAM2 debug_wput (uaecptr addr, uae_u32 v)
 {
     int off = debug_mem_off (addr);
-    memwatch_func (addr, 1, 2, v);
+    if (memwatch_page (addr, 2))
+	memwatch_func (addr, 1, 2, v);
     debug_mem_banks[off]->wput (addr, v);
 }
 static void REGPARAM2 debug_bput (uaecptr addr, uae_u32 v)
 {
     int off = debug_mem_off (addr);
-    memwatch_func (addr, 1, 1, v);
+    if (memwatch_page (addr, 1))
+	memwatch_func (addr, 1, 1, v);
     debug_mem_banks[off]->bput (addr, v);
 }
 static int REGPARAM2 debug_check (uaecptr addr, uae_u32 size)
@@ -678,19 +1018,74 @@ static uae_u8 *REGPARAM2 debug_xlate (uaecptr addr)
     return debug_mem_banks[munge24 (addr) >> 16]->xlateaddr (addr);
 }
 
+static void memwatch_unhook (addrbank *a2, const addrbank *a1)
+{
+    a2->bget = a1->bget;
+    a2->wget = a1->wget;
+    a2->lget = a1->lget;
+    a2->bput = a1->bput;
+    a2->wput = a1->wput;
+    a2->lput = a1->lput;
+    a2->check = a1->check;
+    a2->xlateaddr = a1->xlateaddr;
+}
+
+static void memwatch_hook (addrbank *a2)
+{
+    a2->bget = debug_bget;
+    a2->wget = debug_wget;
+    a2->lget = debug_lget;
+    a2->bput = debug_bput;
+    a2->wput = debug_wput;
+    a2->lput = debug_lput;
+    a2->check = debug_check;
+    a2->xlateaddr = debug_xlate;
+}
+
+/* Rebuild the page map after the watchpoints changed, and hook the banks
+ * that hold one - all of them while illegal accesses are logged.  Banks
+ * share an addrbank, so the others the hooked ones are mapped at are
+ * only slowed down by the bitmap lookup.  */
+static void memwatch_remap (void)
+{
+    int i;
+
+    memset (mwpages, 0, sizeof mwpages);
+    memset (mwbanknodes, 0, sizeof mwbanknodes);
+    for (i = 0; i < MEMWATCH_TOTAL; i++) {
+	struct memwatch_node *mwn = &mwnodes[i];
+	uae_u32 p, first, last;
+
+	if (mwn->size == 0)
+	    continue;
+	first = mwn->addr & 0xffffff;
+	last = first + (uae_u32)(mwn->size - 1);
+	if (last > 0xffffff || last < first)
+	    last = 0xffffff;
+	for (p = first >> MW_PAGE_SHIFT; p <= last >> MW_PAGE_SHIFT; p++) {
+	    mwpages[p >> 5] |= 1 << (p & 31);
+	    mwbanknodes[p >> (16 - MW_PAGE_SHIFT)] |= 1 << i;
+	}
+    }
+
+    for (i = 0; i < 256; i++)
+	memwatch_unhook (mem_banks[i], debug_mem_banks[i]);
+    for (i = 0; i < 256; i++) {
+	if (illgdebug || mwbanknodes[i])
+	    memwatch_hook (mem_banks[i]);
+    }
+}
+
 static void deinitialize_memwatch (void)
 {
     int i;
-    addrbank *a1, *a2;
 
     if (!memwatch_enabled)
 	return;
-    for (i = 0; i < 256; i++) {
-	a1 = debug_mem_banks[i];
-	a2 = mem_banks[i];
-	memcpy (a2, a1, sizeof (addrbank));
-	free (a1);
-    }
+    for (i = 0; i < 256; i++)
+	memwatch_unhook (mem_banks[i], debug_mem_banks[i]);
+    for (i = 0; i < 256; i++)
+	free (debug_mem_banks[i]);
     free (debug_mem_banks);
     debug_mem_banks = 0;
     memwatch_enabled = 0;
@@ -711,18 +1106,8 @@ static int initialize_memwatch (void)
 	a2 = mem_banks[i];
 	memcpy (a1, a2, sizeof (addrbank));
     }
-    for (i = 0; i < 256; i++) {
-	a2 = mem_banks[i];
-	a2->bget = debug_bget;
-	a2->wget = debug_wget;
-	a2->lget = debug_lget;
-	a2->bput = debug_bput;
-	a2->wput = debug_wput;
-	a2->lput = debug_lput;
-	a2->check = debug_check;
-	a2->xlateaddr = debug_xlate;
-    }
     memwatch_enabled = 1;
+    memwatch_remap ();
     return 1;
 }
 
@@ -754,6 +1139,10 @@ static void memwatch (char **c)
     char nc;
 
     if (!memwatch_enabled) {
+	if (stats_banks_active ()) {
+	    console_out ("Turn off bank counting (stats b) first\n");
+	    return;
+	}
 	if (!initialize_memwatch ()) {
 	    console_out ("Memwatch breakpoints require 24-bit address space\n");
 	    return;
@@ -790,6 +1179,7 @@ static void memwatch (char **c)
 	    }
 	} else {
 	    illg_init ();
+	    memwatch_remap ();
 	    console_out ("Illegal memory access logging enabled\n");
 	    ignore_ws (c);
 	    illgdebug_break = 0;
@@ -805,6 +1195,7 @@ static void memwatch (char **c)
     mwn->size = 0;
     ignore_ws (c);
     if (!more_params (c)) {
+	memwatch_remap ();
 	console_out ("Memwatch %d removed\n", num);
 	return;
     }
@@ -836,6 +1227,7 @@ static void memwatch (char **c)
 	    }
 	}
     }
+    memwatch_remap ();
     memwatch_dump (num);
 }
 
@@ -893,6 +1285,83 @@ static uae_u8 trace_insn_copy[10];
 static struct regstruct trace_prev_regs;
 static uaecptr nextpc;
 
+/* Add a breakpoint, or a tracepoint, with the condition following "if"
+ * at *c.  Without a condition an existing one is removed instead.  */
+static void add_breakpoint (uaecptr addr, int trace, char **c)
+{
+    struct breakpoint_node *bpn, *free_bpn = NULL;
+    uae_u32 code[BP_CODE_SIZE];
+    char *cond = NULL;
+    int i;
+
+    ignore_ws (c);
+    if (toupper ((*c)[0]) == 'I' && toupper ((*c)[1]) == 'F') {
+	(*c) += 2;
+	ignore_ws (c);
+	cond = *c;
+	if (!bp_compile (c, code)) {
+	    console_out ("Syntax error in condition at '%s'\n", *c);
+	    return;
+	}
+    } else
+	code[0] = BPO_END;
+
+    for (i = 0; i < BREAKPOINT_TOTAL; i++) {
+	bpn = &bpnodes[i];
+	if (!bpn->enabled) {
+	    if (!free_bpn)
+		free_bpn = bpn;
+	    continue;
+	}
+	if (bpn->addr == addr && bpn->trace == trace) {
+	    if (!cond) {
+		bpn->enabled = 0;
+		console_out ("%s removed\n", trace ? "Tracepoint" : "Breakpoint");
+		bp_rehash ();
+		return;
+	    }
+	    free_bpn = bpn;
+	    break;
+	}
+    }
+    if (!free_bpn) {
+	console_out ("No more breakpoints\n");
+	return;
+    }
+    bpn = free_bpn;
+    bpn->addr = addr;
+    bpn->trace = trace;
+    bpn->hits = 0;
+    memcpy (bpn->code, code, sizeof code);
+    strncpy (bpn->cond, cond ? cond : "", sizeof bpn->cond - 1);
+    bpn->cond[sizeof bpn->cond - 1] = 0;
+    for (i = strlen (bpn->cond); i > 0 && isspace (bpn->cond[i - 1]); i--)
+	bpn->cond[i - 1] = 0;
+    bpn->enabled = 1;
+    console_out ("%s added\n", trace ? "Tracepoint" : "Breakpoint");
+    bp_rehash ();
+}
+
+static void dump_tracepoints (int count)
+{
+    unsigned int i = bptrace_count;
+
+    if ((unsigned int)count > bptrace_count)
+	count = bptrace_count;
+    if (count > BP_TRACE_SIZE)
+	count = BP_TRACE_SIZE;
+    for (i = bptrace_count - count; i != bptrace_count; i++) {
+	struct bp_trace *t = &bptrace[i % BP_TRACE_SIZE];
+	int j;
+
+	console_out ("%d: tracepoint %d hit %d at %08.8X SR=%04.4X\n", i, t->bp, t->hits, t->pc, t->sr);
+	for (j = 0; j < 16; j++)
+	    console_out ("%c%d=%08.8X%s", j < 8 ? 'D' : 'A', j & 7, t->regs[j], (j & 7) == 7 ? "\n" : " ");
+    }
+    if (!bptrace_count)
+	console_out ("Tracepoint log is empty\n");
+}
+
 static int instruction_breakpoint (char **c)
 {
     struct breakpoint_node *bpn;
@@ -909,9 +1378,10 @@ static int instruction_breakpoint (char **c)
 	    do_skip = 1;
 	    skipaddr_doskip = 1;
 	    return 1;
-	} else if (nc == 'D' && (*c)[1] == 0) {
+	} else if (nc == 'D' && ((*c)[1] == 0 || isspace ((*c)[1]))) {
 	    for (i = 0; i < BREAKPOINT_TOTAL; i++)
 		bpnodes[i].enabled = 0;
+	    bp_rehash ();
 	    console_out ("All breakpoints removed\n");
 	    return 0;
 	} else if (nc == 'L') {
@@ -920,41 +1390,34 @@ static int instruction_breakpoint (char **c)
 		bpn = &bpnodes[i];
 		if (!bpn->enabled)
 		    continue;
-		console_out ("%8X ", bpn->addr);
+		console_out ("%d: %s %08.8X hits %d%s%s\n", i, bpn->trace ? "trace" : "break",
+			     bpn->addr, bpn->hits, bpn->cond[0] ? " if " : "", bpn->cond);
 		got = 1;
 	    }
 	    if (!got)
 		console_out ("No breakpoints\n");
-	    else
-		console_out ("\n");
+	    return 0;
+	} else if (nc == 'P') {
+	    next_char (c);
+	    if (more_params (c)) {
+		uaecptr addr = readhex (c);
+		add_breakpoint (addr, 1, c);
+	    }
+	    return 0;
+	} else if (nc == 'T') {
+	    next_char (c);
+	    dump_tracepoints (more_params (c) ? readhex (c) : 10);
 	    return 0;
 	}
 	skipaddr_doskip = 1;
 	skipaddr_start = readhex (c);
-	if (more_params (c)) {
+	ignore_ws (c);
+	if (more_params (c) && toupper ((*c)[0]) != 'I') {
 	    skipaddr_end = readhex (c);
 	} else {
-	    for (i = 0; i < BREAKPOINT_TOTAL; i++) {
-		bpn = &bpnodes[i];
-		if (bpn->enabled && bpn->addr == skipaddr_start) {
-		    bpn->enabled = 0;
-		    console_out ("Breakpoint removed\n");
-		    skipaddr_start = 0xffffffff;
-		    skipaddr_doskip = 0;
-		    return 0;
-		}
-	    }
-	    for (i = 0; i < BREAKPOINT_TOTAL; i++) {
-		bpn = &bpnodes[i];
-		if (bpn->enabled)
-		    continue;
-		bpn->addr = skipaddr_start;
-		bpn->enabled = 1;
-		console_out ("Breakpoint added\n");
-		skipaddr_start = 0xffffffff;
-		skipaddr_doskip = 0;
-		break;
-	    }
+	    add_breakpoint (skipaddr_start, 0, c);
+	    skipaddr_start = 0xffffffff;
+	    skipaddr_doskip = 0;
 	    return 0;
 	}
     }
@@ -1016,6 +1479,179 @@ S_argh:
     console_out ("S-command needs more arguments!\n");
 }
 
+static char *read_filename (char **cc)
+{
+    char *name;
+
+    if (!more_params (cc))
+	return 0;
+    name = *cc;
+    while (**cc != '\0' && !isspace (**cc))
+	(*cc)++;
+    if (**cc != '\0') {
+	**cc = '\0';
+	(*cc)++;
+    }
+    return name;
+}
+
+static char statefile[256];
+
+static void statecmd (char **cc)
+{
+    char cmd = next_char (cc);
+    char *name, *name2;
+
+    if (cmd == 'b') {
+	int n = more_params (cc) ? readint (cc) : 1;
+	if (savestate_dorewind (n))
+	    console_out ("Rewinding at the next vsync\n");
+	else
+	    console_out ("Can't go back %d snapshots, %d available\n", n, savestate_rewind_count ());
+	return;
+    }
+    name = read_filename (cc);
+    if (!name) {
+	console_out ("y-command needs a file name!\n");
+	return;
+    }
+    switch (cmd) {
+    case 's':
+    case 'd':
+    case 'r':
+	if (savestate_state) {
+	    console_out ("A savestate operation is already pending\n");
+	    return;
+	}
+	strncpy (statefile, name, sizeof statefile - 1);
+	savestate_filename = statefile;
+	savestate_state = cmd == 's' ? STATE_DOSAVE : cmd == 'd' ? STATE_DOSAVEDELTA : STATE_DORESTORE;
+	console_out ("'%s' will be %s at the next vsync\n", name, cmd == 'r' ? "restored" : "saved");
+	break;
+    case 'f':
+	name2 = read_filename (cc);
+	if (!name2) {
+	    console_out ("yf-command needs an output file name!\n");
+	    return;
+	}
+	if (savestate_flatten (name, name2))
+	    console_out ("Wrote '%s'\n", name2);
+	else
+	    console_out ("Couldn't flatten '%s'\n", name);
+	break;
+    default:
+	console_out ("Unknown y-command\n");
+	break;
+    }
+}
+
+static void tracecmd (char **cc)
+{
+    char cmd = next_char (cc);
+    char *name;
+    uae_u32 first, count;
+
+    if (cmd == 'e') {
+	if (!cputrace_active ())
+	    console_out ("No trace is being recorded\n");
+	cputrace_stop ();
+	return;
+    }
+    name = read_filename (cc);
+    if (!name) {
+	console_out ("x-command needs a file name!\n");
+	return;
+    }
+    switch (cmd) {
+    case 's':
+	ignore_ws (cc);
+	if (cputrace_start (name, toupper (**cc) == 'R'))
+	    console_out ("Recording trace to '%s'\n", name);
+	break;
+    case 'd':
+	first = more_params (cc) ? readint (cc) : 0;
+	count = more_params (cc) ? readint (cc) : 20;
+	cputrace_decode (name, first, count);
+	break;
+    case 'h':
+	cputrace_histogram (name, more_params (cc) ? readint (cc) : 20);
+	break;
+    default:
+	console_out ("Unknown x-command\n");
+	break;
+    }
+}
+
+static void profilecmd (char **cc)
+{
+    char cmd = next_char (cc);
+    char *name, *seg;
+
+    switch (cmd) {
+    case 's':
+	profiler_start (more_params (cc) ? readint (cc) : 1000);
+	break;
+    case 'e':
+	profiler_stop ();
+	break;
+    case 'f':
+	profiler_flat (more_params (cc) ? readint (cc) : 20);
+	break;
+    case 'g':
+	name = read_filename (cc);
+	if (!name) {
+	    console_out ("pg-command needs a file name!\n");
+	    return;
+	}
+	if (profiler_write_stacks (name))
+	    console_out ("Wrote '%s'\n", name);
+	break;
+    case 'l':
+	name = read_filename (cc);
+	ignore_ws (cc);
+	/* The rest of the line, so that names with spaces work.  */
+	seg = *cc;
+	seg[strcspn (seg, "\r\n")] = 0;
+	if (!name || !*seg) {
+	    console_out ("pl-command needs a file and a process name or seglist!\n");
+	    return;
+	}
+	profiler_load_symbols (name, seg);
+	break;
+    default:
+	console_out ("Unknown p-command\n");
+	break;
+    }
+}
+
+static void statscmd (char **cc)
+{
+    ignore_ws (cc);
+    switch (more_params (cc) ? next_char (cc) : 0) {
+    case 0:
+	stats_show ();
+	break;
+    case 'r':
+	stats_reset ();
+	console_out ("Stats reset\n");
+	break;
+    case 'b':
+	if (stats_banks_active ()) {
+	    stats_banks_off ();
+	    console_out ("Bank counting off\n");
+	} else if (memwatch_enabled) {
+	    console_out ("Bank counting can't be used with memwatch breakpoints\n");
+	} else {
+	    stats_banks_on ();
+	    console_out ("Bank counting on\n");
+	}
+	break;
+    default:
+	console_out ("Unknown stats command\n");
+	break;
+    }
+}
+
 static void searchmem (char **cc)
 {
     int i, sslen, got, val, stringmode;
@@ -1154,7 +1790,13 @@ static void debug_1 (void)
 	case 'W': writeintomem (&inptr); break;
 	case 'w': memwatch (&inptr); break;
 	case 'S': savemem (&inptr); break;
-	case 's': searchmem (&inptr); break;
+	case 's':
+	    if (strncmp (inptr, "tats", 4) == 0) {
+		inptr += 4;
+		statscmd (&inptr);
+	    } else
+		searchmem (&inptr);
+	    break;
 	case 'd':
 	{
 	    uae_u32 daddr;
@@ -1172,6 +1814,9 @@ static void debug_1 (void)
 	}
 	break;
 	case 'T': show_exec_tasks (); break;
+	case 'y': statecmd (&inptr); break;
+	case 'x': tracecmd (&inptr); break;
+	case 'p': profilecmd (&inptr); break;
 	case 't':
 	    if (more_params (&inptr))
 		skipaddr_doskip = readint (&inptr);
@@ -1328,14 +1973,10 @@ void debug (void)
 	    uae_u16 opcode = currprefs.cpu_model == 68000 ? regs.ir : get_word (pc);
 	    int bp = 0;
 
-	    for (i = 0; i < BREAKPOINT_TOTAL; i++) {
-		if (!bpnodes[i].enabled)
-		    continue;
-		if (bpnodes[i].addr == pc) {
-		    bp = 1;
-		    console_out ("Breakpoint at %08.8X\n", pc);
-		    break;
-		}
+	    if (bphit) {
+		bp = 1;
+		console_out ("Breakpoint %d at %08.8X\n", bphit - bpnodes, pc);
+		bphit = NULL;
 	    }
 	    if (skipaddr_doskip) {
 		if (skipaddr_start == pc)
@@ -1357,7 +1998,11 @@ void debug (void)
 		}
 	    }
 	    if (!bp) {
-		set_special (SPCFLAG_BRK);
+		/* Breakpoints alone are looked up by do_specialties; only
+		 * stepping needs to come here after every instruction.  */
+		if (skipaddr_doskip)
+		    set_special (SPCFLAG_BRK);
+		bp_rehash ();
 		return;
 	    }
 	}
@@ -1394,13 +2039,16 @@ void debug (void)
     skipins = 0xffffffff;
     skipaddr_doskip = 0;
     exception_debugging = 0;
+    bphit = NULL;
     debug_1 ();
     for (i = 0; i < BREAKPOINT_TOTAL; i++) {
 	if (bpnodes[i].enabled)
 	    do_skip = 1;
     }
     if (do_skip) {
-	set_special (SPCFLAG_BRK);
+	if (skipaddr_doskip)
+	    set_special (SPCFLAG_BRK);
+	bp_rehash ();
 	debugging = 1;
     }
 #if 0
@@ -907,6 +907,7 @@ static void drive_eject (drive * drv)
 void DISK_ersatz_read (int tr, int sec, uaecptr dest)
 {
     uae_u8 *dptr = get_real_address (dest);
+    memory_dirty (dest, 512);
     zfile_fseek (floppy[0].diskfile, floppy[0].trackdata[tr].offs + sec * 512, SEEK_SET);
     zfile_fread (dptr, 1, 512, floppy[0].diskfile);
 }
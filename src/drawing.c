@@ -44,6 +44,7 @@
 #include "picasso96.h"
 #include "drawing.h"
 #include "savestate.h"
+#include "stats.h"
 
 int lores_factor, lores_shift;
 
@@ -1239,6 +1240,7 @@ STATIC_INLINE void pfield_draw_line (int lineno, int gfx_ypos, int follow_ypos)
     case LINE_REMEMBERED_AS_PREVIOUS:
 	if (!warned)
 	    write_log ("Shouldn't get here... this is a bug.\n"), warned++;
+	stats_frame.lines_skipped++;
 	return;
 
     case LINE_BLACK:
@@ -1247,6 +1249,7 @@ STATIC_INLINE void pfield_draw_line (int lineno, int gfx_ypos, int follow_ypos)
 	break;
 
     case LINE_REMEMBERED_AS_BLACK:
+	stats_frame.lines_skipped++;
 	return;
 
     case LINE_AS_PREVIOUS:
@@ -1260,6 +1263,7 @@ STATIC_INLINE void pfield_draw_line (int lineno, int gfx_ypos, int follow_ypos)
     case LINE_DONE_AS_PREVIOUS:
 	/* fall through */
     case LINE_DONE:
+	stats_frame.lines_skipped++;
 	return;
 
     case LINE_DECIDED_DOUBLE:
@@ -1276,6 +1280,7 @@ STATIC_INLINE void pfield_draw_line (int lineno, int gfx_ypos, int follow_ypos)
 	linestate[lineno] = LINE_DONE;
 	break;
     }
+    stats_frame.lines_drawn++;
 
     dh = dh_line;
     xlinebuffer = gfxvidinfo.linemem;
@@ -1725,6 +1730,9 @@ int check_prefs_changed_gfx (void)
     int params_changed = 0, screen_changed = 0;
     int old_x, old_y;
 
+    if (currprefs.headless)
+	return 0;
+
     if (!screen_is_picasso) {
 	if (curr_gfx == &currprefs.gfx_w
 	    && memcmp (&changed_prefs.gfx_w, &currprefs.gfx_w, sizeof (struct gfx_params)) != 0)
@@ -1779,6 +1787,8 @@ void vsync_handle_redraw (int long_frame, int lof_changed)
 
 	if (framecnt == 0)
 	    finish_drawing_frame ();
+	else
+	    stats_frame.frames_skipped = 1;
 
 	/* At this point, we have finished both the hardware and the
 	 * drawing frame. Essentially, we are outside of all loops and
@@ -1786,14 +1796,23 @@ void vsync_handle_redraw (int long_frame, int lof_changed)
 	 * done at other times.
 	 */
 
-	if (savestate_state == STATE_DOSAVE) {
+	if (savestate_state == STATE_DOSAVE || savestate_state == STATE_DOSAVEDELTA) {
+	    int delta = savestate_state == STATE_DOSAVEDELTA;
 	    custom_prepare_savestate ();
 	    savestate_state = STATE_SAVE;
-	    save_state (savestate_filename, "Description!");
+	    if (delta)
+		save_state_delta (savestate_filename, "Description!");
+	    else
+		save_state (savestate_filename, "Description!");
 	    savestate_state = 0;
 	} else if (savestate_state == STATE_DORESTORE) {
 	    savestate_state = STATE_RESTORE;
 	    uae_reset (0);
+	} else if (savestate_state == STATE_DOREWIND) {
+	    savestate_state = STATE_REWIND;
+	    uae_reset (0);
+	} else if (currprefs.rewind_size) {
+	    savestate_capture ();
 	}
 
 	if (quit_program < 0) {
@@ -1908,6 +1927,13 @@ void reset_drawing (void)
 
 void init_drawing_at_reset (void)
 {
+    if (currprefs.headless) {
+	/* There's no screen, so never draw a frame.  */
+	inhibit_frame = 0;
+	set_inhibit_frame (IHF_HEADLESS);
+	framecnt = 1;
+	return;
+    }
     InitPicasso96 ();
     picasso_requested_on = 0;
     picasso_on = 0;
@@ -19,6 +19,12 @@
 #include "picasso96.h"
 #include "savestate.h"
 
+#if defined PICASSO96 && defined HAVE_SYS_SHM_H && !defined NATMEM_OFFSET
+#include <sys/ipc.h>
+#include <sys/shm.h>
+#define GFXMEM_SHM
+#endif
+
 #define MAX_EXPANSION_BOARDS	8
 
 /* ********************************************************** */
@@ -186,7 +192,7 @@ static void expamem_bput (uaecptr, uae_u32) REGPARAM;
 addrbank expamem_bank = {
     expamem_lget, expamem_wget, expamem_bget,
     expamem_lput, expamem_wput, expamem_bput,
-    default_xlate, default_check, NULL, "Autoconfig"
+    default_xlate, default_check, NULL, "Autoconfig", NULL
 };
 
 static uae_u32 REGPARAM2 expamem_lget (uaecptr addr)
@@ -342,6 +348,7 @@ void REGPARAM2 fastmem_lput (uaecptr addr, uae_u32 l)
     addr -= fastmem_start & fastmem_mask;
     addr &= fastmem_mask;
     m = fastmemory + addr;
+    mark_dirty (fastmem_bank.dirty, addr, 4);
     do_put_mem_long ((uae_u32 *)m, l);
 }
 
@@ -351,6 +358,7 @@ void REGPARAM2 fastmem_wput (uaecptr addr, uae_u32 w)
     addr -= fastmem_start & fastmem_mask;
     addr &= fastmem_mask;
     m = fastmemory + addr;
+    mark_dirty (fastmem_bank.dirty, addr, 2);
     do_put_mem_word ((uae_u16 *)m, w);
 }
 
@@ -358,6 +366,7 @@ void REGPARAM2 fastmem_bput (uaecptr addr, uae_u32 b)
 {
     addr -= fastmem_start & fastmem_mask;
     addr &= fastmem_mask;
+    mark_dirty (fastmem_bank.dirty, addr, 1);
     fastmemory[addr] = b;
 }
 
@@ -378,7 +387,7 @@ static uae_u8 REGPARAM2 *fastmem_xlate (uaecptr addr)
 addrbank fastmem_bank = {
     fastmem_lget, fastmem_wget, fastmem_bget,
     fastmem_lput, fastmem_wput, fastmem_bput,
-    fastmem_xlate, fastmem_check, NULL, "Fast memory"
+    fastmem_xlate, fastmem_check, NULL, "Fast memory", NULL
 };
 
 
@@ -445,7 +454,7 @@ static void REGPARAM2 filesys_bput (uaecptr addr, uae_u32 b)
 addrbank filesys_bank = {
     filesys_lget, filesys_wget, filesys_bget,
     filesys_lput, filesys_wput, filesys_bput,
-    default_xlate, default_check, NULL, "Filesystem Autoconfig Area"
+    default_xlate, default_check, NULL, "Filesystem Autoconfig Area", NULL
 };
 
 /*
@@ -498,6 +507,7 @@ void REGPARAM2 z3fastmem_lput (uaecptr addr, uae_u32 l)
     addr -= z3fastmem_start & z3fastmem_mask;
     addr &= z3fastmem_mask;
     m = z3fastmem + addr;
+    mark_dirty (z3fastmem_bank.dirty, addr, 4);
     do_put_mem_long ((uae_u32 *)m, l);
 }
 
@@ -507,6 +517,7 @@ void REGPARAM2 z3fastmem_wput (uaecptr addr, uae_u32 w)
     addr -= z3fastmem_start & z3fastmem_mask;
     addr &= z3fastmem_mask;
     m = z3fastmem + addr;
+    mark_dirty (z3fastmem_bank.dirty, addr, 2);
     do_put_mem_word ((uae_u16 *)m, w);
 }
 
@@ -514,6 +525,7 @@ void REGPARAM2 z3fastmem_bput (uaecptr addr, uae_u32 b)
 {
     addr -= z3fastmem_start & z3fastmem_mask;
     addr &= z3fastmem_mask;
+    mark_dirty (z3fastmem_bank.dirty, addr, 1);
     z3fastmem[addr] = b;
 }
 
@@ -534,13 +546,61 @@ static uae_u8 REGPARAM2 *z3fastmem_xlate (uaecptr addr)
 addrbank z3fastmem_bank = {
     z3fastmem_lget, z3fastmem_wget, z3fastmem_bget,
     z3fastmem_lput, z3fastmem_wput, z3fastmem_bput,
-    z3fastmem_xlate, z3fastmem_check, NULL, "ZorroIII Fast RAM"
+    z3fastmem_xlate, z3fastmem_check, NULL, "ZorroIII Fast RAM", NULL
 };
 
 /* Z3-based UAEGFX-card */
 uae_u32 gfxmem_mask; /* for memory.c */
 uae_u8 *gfxmemory;
 uae_u32 gfxmem_start;
+/* SysV segment that holds gfxmemory, or -1.  */
+int gfxmem_shmid = -1;
+
+/*
+ * Board memory is allocated as a shared memory segment if possible, so
+ * that the display code can let the X server read the visible screen
+ * from it directly.
+ */
+static uae_u8 *gfxmem_alloc (uae_u32 size)
+{
+#ifdef GFXMEM_SHM
+    int id = shmget (IPC_PRIVATE, size, IPC_CREAT | 0600);
+
+    if (id != -1) {
+	uae_u8 *p = (uae_u8 *)shmat (id, 0, 0);
+	if (p != (uae_u8 *)-1) {
+#ifdef __linux__
+	    /* Linux lets removed segments be attached until the last user
+	       detaches, so nothing is left behind if we crash.  */
+	    shmctl (id, IPC_RMID, 0);
+#endif
+	    gfxmem_shmid = id;
+	    return p;
+	}
+	shmctl (id, IPC_RMID, 0);
+    }
+#endif
+    return mapped_malloc (size, "gfx");
+}
+
+static void gfxmem_free (void)
+{
+    if (!gfxmemory)
+	return;
+#ifdef GFXMEM_SHM
+    if (gfxmem_shmid != -1) {
+	shmdt (gfxmemory);
+#ifndef __linux__
+	shmctl (gfxmem_shmid, IPC_RMID, 0);
+#endif
+	gfxmem_shmid = -1;
+	gfxmemory = 0;
+	return;
+    }
+#endif
+    mapped_free (gfxmemory);
+    gfxmemory = 0;
+}
 
 /* ********************************************************** */
 
@@ -757,11 +817,14 @@ static void allocate_expamem (void)
 	if (fastmemory)
 	    mapped_free (fastmemory);
 	fastmemory = 0;
+	free (fastmem_bank.dirty);
+	fastmem_bank.dirty = 0;
 	allocated_fastmem = currprefs.fastmem_size;
 	fastmem_mask = allocated_fastmem - 1;
 
 	if (allocated_fastmem) {
 	    fastmemory = mapped_malloc (allocated_fastmem, "fast");
+	    fastmem_bank.dirty = alloc_dirty_map (allocated_fastmem);
 	    if (fastmemory == 0) {
 		write_log ("Out of memory for fastmem card.\n");
 		allocated_fastmem = 0;
@@ -772,22 +835,25 @@ static void allocate_expamem (void)
 	if (z3fastmem)
 	    mapped_free (z3fastmem);
 	z3fastmem = 0;
+	free (z3fastmem_bank.dirty);
+	z3fastmem_bank.dirty = 0;
 	allocated_z3fastmem = 0;
-	if (gfxmemory)
-	    mapped_free (gfxmemory);
-	gfxmemory = 0;
+	gfxmem_free ();
 	allocated_gfxmem = 0;
     } else {
 	if (allocated_z3fastmem != currprefs.z3fastmem_size) {
 	    if (z3fastmem)
 		mapped_free (z3fastmem);
 	    z3fastmem = 0;
+	    free (z3fastmem_bank.dirty);
+	    z3fastmem_bank.dirty = 0;
 
 	    allocated_z3fastmem = currprefs.z3fastmem_size;
 	    z3fastmem_mask = allocated_z3fastmem - 1;
 
 	    if (allocated_z3fastmem) {
 		z3fastmem = mapped_malloc (allocated_z3fastmem, "z3");
+		z3fastmem_bank.dirty = alloc_dirty_map (allocated_z3fastmem);
 		if (z3fastmem == 0) {
 		    write_log ("Out of memory for 32 bit fast memory.\n");
 		    allocated_z3fastmem = 0;
@@ -795,15 +861,13 @@ static void allocate_expamem (void)
 	    }
 	}
 	if (allocated_gfxmem != currprefs.gfxmem_size) {
-	    if (gfxmemory)
-		mapped_free (gfxmemory);
-	    gfxmemory = 0;
+	    gfxmem_free ();
 
 	    allocated_gfxmem = currprefs.gfxmem_size;
 	    gfxmem_mask = allocated_gfxmem - 1;
 
 	    if (allocated_gfxmem) {
-		gfxmemory = mapped_malloc (allocated_gfxmem, "gfx");
+		gfxmemory = gfxmem_alloc (allocated_gfxmem);
 		if (gfxmemory == 0) {
 		    write_log ("Out of memory for graphics card memory\n");
 		    allocated_gfxmem = 0;
@@ -903,10 +967,12 @@ void expansion_cleanup (void)
 	mapped_free (fastmemory);
     if (z3fastmem)
 	mapped_free (z3fastmem);
-    if (gfxmemory)
-	mapped_free (gfxmemory);
+    gfxmem_free ();
     if (filesysory)
 	mapped_free (filesysory);
+    free (fastmem_bank.dirty);
+    free (z3fastmem_bank.dirty);
+    fastmem_bank.dirty = z3fastmem_bank.dirty = 0;
     fastmemory = 0;
     z3fastmem = 0;
     gfxmemory = 0;
@@ -915,25 +981,32 @@ void expansion_cleanup (void)
 
 void expansion_clear(void)
 {
-    if (fastmemory)
+    if (fastmemory) {
 	memset (fastmemory, 0, allocated_fastmem);
-    if (z3fastmem)
-	memset (z3fastmem, 0, allocated_z3fastmem > 0x800000 ? 0x800000 : allocated_z3fastmem);
+	memset (fastmem_bank.dirty, DIRTY_ALL, dirty_pages (allocated_fastmem));
+    }
+    if (z3fastmem) {
+	uae_u32 size = allocated_z3fastmem > 0x800000 ? 0x800000 : allocated_z3fastmem;
+	memset (z3fastmem, 0, size);
+	memset (z3fastmem_bank.dirty, DIRTY_ALL, dirty_pages (size));
+    }
     if (gfxmemory)
 	memset (gfxmemory, 0, allocated_gfxmem);
 }
 
 /* State save/restore code.  */
 
-uae_u8 *save_fram (int *len)
+uae_u8 *save_fram (int *len, uae_u8 **dirty)
 {
     *len = allocated_fastmem;
+    *dirty = fastmem_bank.dirty;
     return fastmemory;
 }
 
-uae_u8 *save_zram (int *len)
+uae_u8 *save_zram (int *len, uae_u8 **dirty)
 {
     *len = allocated_z3fastmem;
+    *dirty = z3fastmem_bank.dirty;
     return z3fastmem;
 }
 
@@ -27,6 +27,8 @@
 #include "sysconfig.h"
 #include "sysdeps.h"
 
+#include <ctype.h>
+
 #include "threaddep/thread.h"
 #include "options.h"
 #include "uae.h"
@@ -42,6 +44,11 @@
 #include "scsidev.h"
 #include "fsdb.h"
 
+#ifdef __linux__
+#define UAE_FILESYS_NOTIFY
+#include <sys/inotify.h>
+#endif
+
 /* Count the number of FS packets waiting to be serviced, for the benefit
  * of the idle on STOP code.  */
 int active_fs_packets;
@@ -180,6 +187,8 @@ int hardfile_fs_type (struct uaedev_mount_info *mountinfo, int unit_no)
 
 static void close_filesys_unit (UnitInfo *uip)
 {
+    hdf_overlay_close (&uip->hf);
+    hdf_unmap (&uip->hf);
     if (uip->hf.fd != 0)
 	fclose (uip->hf.fd);
     if (uip->volname != 0)
@@ -237,6 +246,8 @@ static char *set_filesys_unit_1 (struct uaedev_mount_info *mountinfo, int nr,
 	return "No slot allocated for this unit";
 
     ui->hf.fd = 0;
+    ui->hf.overlay = 0;
+    ui->hf.map = 0;
     ui->devname = 0;
     ui->volname = 0;
     ui->rootdir = 0;
@@ -537,14 +548,53 @@ typedef struct key {
     uae_u32 uniq;
     int fd;
     off_t file_pos;
+    /* A worker thread is reading or writing through this key.  Both are
+     * only set, cleared and tested under the unit's io_lock, so that the
+     * worker's changes to the key are visible once busy reads 0.  */
+    int busy;
+    int busy_write;
+    /* Readahead: ra_len bytes from file offset ra_pos, trusted while
+     * ra_gen matches the a_inode's data_gen.  ra_size grows while the
+     * file is read sequentially.  */
+    uae_u8 *rabuf;
+    off_t ra_pos;
+    int ra_len, ra_size;
+    unsigned int ra_gen;
+    /* Small writes are collected here and written out in one go: wlen
+     * bytes for file offset wpos.  werr holds the errno of a failed
+     * write-behind, reported on the next write.  */
+    uae_u8 *wbuf;
+    off_t wpos;
+    int wlen;
+    int werr;
 } Key;
 
+#define FS_RA_MIN 16384
+#define FS_RA_MAX 262144
+#define FS_WBUF_SIZE 65536
+#define FS_WBUF_SMALL 4096
+
 /* Since ACTION_EXAMINE_NEXT is so braindamaged, we have to keep
  * some of these around
  */
 
 #define EXKEYS 100
-#define MAX_AINO_HASH 128
+#define MIN_AINO_HASH 256
+
+#ifdef UAE_FILESYS_THREADS
+/* ACTION_READ and ACTION_WRITE run on a few worker threads per unit, so
+ * that a large transfer doesn't hold up every other packet for the
+ * volume.  Everything else, including all lock and a_inode handling,
+ * stays on the unit's own thread.  */
+#define FS_IO_THREADS 2
+#define FS_IO_QUEUE 16
+
+struct fs_iorequest {
+    uae_u8 *pck;
+    uae_u8 *msg;
+    struct key *k;
+};
+#endif
 
 /* handler state info */
 
@@ -580,9 +630,31 @@ typedef struct _unit {
 
     a_inode rootnode;
     unsigned long aino_cache_size;
-    a_inode *aino_hash[MAX_AINO_HASH];
+    /* All a_inodes except the root, hashed by uniq, by parent and
+     * case-folded aname, and by parent and host name.  The three tables
+     * share one size, which is a power of two.  */
+    a_inode **aino_hash;
+    a_inode **aname_hash;
+    a_inode **nname_hash;
+    unsigned int aino_hash_size;
+    unsigned long nr_hashed_ainos;
     unsigned long nr_cache_hits;
     unsigned long nr_cache_lookups;
+
+    /* Host change notification, used to keep cached metadata coherent.
+     * watched_dirs maps watch descriptors to directory a_inodes.  */
+    int notify_fd;
+    a_inode **watched_dirs;
+    int nr_watched_dirs;
+
+#ifdef UAE_FILESYS_THREADS
+    struct fs_iorequest ioqueue[FS_IO_QUEUE];
+    int io_rdp, io_wrp;
+    int io_inflight;
+    uae_sem_t io_lock, io_queued, io_free, io_done;
+    uae_thread_id io_tid[FS_IO_THREADS];
+    int io_threads;
+#endif
 } Unit;
 
 typedef uae_u8 *dpacket;
@@ -679,11 +751,272 @@ static void de_recycle_aino (Unit *unit, a_inode *aino)
     unit->aino_cache_size--;
 }
 
+/* Hash the last path component of NAME (separated by SEP) together
+ * with the uniq of the parent directory.  Folding case keeps names
+ * which same_aname considers equal in one chain.  */
+static unsigned int name_hashval (uae_u32 parent, const char *name, int sep, int fold)
+{
+    const char *p = strrchr (name, sep);
+    unsigned int h = parent * 2654435761u;
+
+    if (p != 0)
+	name = p + 1;
+    while (*name) {
+	int c = (unsigned char)*name++;
+	if (fold)
+	    c = tolower (c);
+	h = (h ^ c) * 16777619;
+    }
+    return h;
+}
+
+#define UNIQ_HASH(unit, uniq) (((uniq) * 2654435761u) & ((unit)->aino_hash_size - 1))
+#define ANAME_HASH(unit, parent, name) \
+    (name_hashval ((parent)->uniq, (name), '/', 1) & ((unit)->aino_hash_size - 1))
+#define NNAME_HASH(unit, parent, name) \
+    (name_hashval ((parent)->uniq, (name), FSDB_DIR_SEPARATOR, 0) & ((unit)->aino_hash_size - 1))
+
+static void link_aino_hash (Unit *unit, a_inode *aino)
+{
+    unsigned int h;
+
+    h = UNIQ_HASH (unit, aino->uniq);
+    aino->uniq_hnext = unit->aino_hash[h];
+    unit->aino_hash[h] = aino;
+    h = ANAME_HASH (unit, aino->parent, aino->aname);
+    aino->aname_hnext = unit->aname_hash[h];
+    unit->aname_hash[h] = aino;
+    h = NNAME_HASH (unit, aino->parent, aino->nname);
+    aino->nname_hnext = unit->nname_hash[h];
+    unit->nname_hash[h] = aino;
+}
+
+static void alloc_aino_hash (Unit *unit, unsigned int size)
+{
+    a_inode **old = unit->aino_hash;
+    unsigned int oldsize = unit->aino_hash_size;
+    unsigned int i;
+
+    unit->aino_hash = (a_inode **) xcalloc (size, sizeof (a_inode *));
+    free (unit->aname_hash);
+    unit->aname_hash = (a_inode **) xcalloc (size, sizeof (a_inode *));
+    free (unit->nname_hash);
+    unit->nname_hash = (a_inode **) xcalloc (size, sizeof (a_inode *));
+    unit->aino_hash_size = size;
+
+    for (i = 0; i < oldsize; i++) {
+	a_inode *a = old[i];
+	while (a != 0) {
+	    a_inode *next = a->uniq_hnext;
+	    link_aino_hash (unit, a);
+	    a = next;
+	}
+    }
+    free (old);
+}
+
+static void free_aino_hash (Unit *unit)
+{
+    free (unit->aino_hash);
+    free (unit->aname_hash);
+    free (unit->nname_hash);
+    unit->aino_hash = unit->aname_hash = unit->nname_hash = 0;
+    unit->aino_hash_size = 0;
+    unit->nr_hashed_ainos = 0;
+}
+
+static void hash_aino (Unit *unit, a_inode *aino)
+{
+    if (unit->nr_hashed_ainos >= 2 * unit->aino_hash_size)
+	alloc_aino_hash (unit, 2 * unit->aino_hash_size);
+    link_aino_hash (unit, aino);
+    unit->nr_hashed_ainos++;
+}
+
+static void unhash_aino (Unit *unit, a_inode *aino)
+{
+    a_inode **aip;
+
+    for (aip = &unit->aino_hash[UNIQ_HASH (unit, aino->uniq)]; *aip; aip = &(*aip)->uniq_hnext)
+	if (*aip == aino) {
+	    *aip = aino->uniq_hnext;
+	    break;
+	}
+    for (aip = &unit->aname_hash[ANAME_HASH (unit, aino->parent, aino->aname)]; *aip; aip = &(*aip)->aname_hnext)
+	if (*aip == aino) {
+	    *aip = aino->aname_hnext;
+	    break;
+	}
+    for (aip = &unit->nname_hash[NNAME_HASH (unit, aino->parent, aino->nname)]; *aip; aip = &(*aip)->nname_hnext)
+	if (*aip == aino) {
+	    *aip = aino->nname_hnext;
+	    break;
+	}
+    unit->nr_hashed_ainos--;
+}
+
+/* Cached host metadata.  Directory listings, stat results and the
+ * absence of a database file are cached only for directories which
+ * are watched for host changes; poll_host_changes drops whatever the
+ * host has modified since.  Without notification support nothing is
+ * cached.  */
+
+static int watch_dir (Unit *unit, a_inode *dir)
+{
+#ifdef UAE_FILESYS_NOTIFY
+    int wd;
+
+    if (dir->watch > 0)
+	return 1;
+    if (unit->notify_fd < 0)
+	return 0;
+    wd = inotify_add_watch (unit->notify_fd, dir->nname,
+			    IN_ATTRIB | IN_MODIFY | IN_CREATE | IN_DELETE | IN_MOVED_FROM
+			    | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR);
+    if (wd < 0)
+	return 0;
+    /* Another a_inode for the same host directory already owns this
+     * watch; don't let the two share it.  */
+    if (wd < unit->nr_watched_dirs && unit->watched_dirs[wd] != 0)
+	return 0;
+    if (wd >= unit->nr_watched_dirs) {
+	int n = wd + 64;
+	unit->watched_dirs = (a_inode **) realloc (unit->watched_dirs, n * sizeof (a_inode *));
+	memset (unit->watched_dirs + unit->nr_watched_dirs, 0,
+		(n - unit->nr_watched_dirs) * sizeof (a_inode *));
+	unit->nr_watched_dirs = n;
+    }
+    unit->watched_dirs[wd] = dir;
+    dir->watch = wd;
+    return 1;
+#else
+    return 0;
+#endif
+}
+
+#ifdef UAE_FILESYS_NOTIFY
+/* Nothing cached under DIR can be trusted once its watch is gone.  */
+static void lose_watch (Unit *unit, a_inode *dir)
+{
+    a_inode *c;
+
+    unit->watched_dirs[dir->watch] = 0;
+    dir->watch = 0;
+    dir->listed = 0;
+    dir->fsdb_absent = 0;
+    for (c = dir->child; c != 0; c = c->sibling)
+	c->stat_cached = 0;
+}
+
+#endif
+
+static void unwatch_dir (Unit *unit, a_inode *dir)
+{
+#ifdef UAE_FILESYS_NOTIFY
+    if (dir->watch <= 0)
+	return;
+    inotify_rm_watch (unit->notify_fd, dir->watch);
+    lose_watch (unit, dir);
+#endif
+}
+
+#ifdef UAE_FILESYS_NOTIFY
+static void flush_metadata (Unit *unit)
+{
+    unsigned int i;
+    a_inode *a;
+
+    unit->rootnode.stat_cached = unit->rootnode.listed = unit->rootnode.fsdb_absent = 0;
+    for (i = 0; i < unit->aino_hash_size; i++)
+	for (a = unit->aino_hash[i]; a != 0; a = a->uniq_hnext)
+	    a->stat_cached = a->listed = a->fsdb_absent = 0;
+}
+#endif
+
+static void poll_host_changes (Unit *unit)
+{
+#ifdef UAE_FILESYS_NOTIFY
+    char buf[4096] __attribute__ ((aligned (__alignof__ (struct inotify_event))));
+    ssize_t len;
+
+    if (unit->notify_fd < 0)
+	return;
+    while ((len = read (unit->notify_fd, buf, sizeof buf)) > 0) {
+	char *p;
+	for (p = buf; p < buf + len; p += sizeof (struct inotify_event) + ((struct inotify_event *)p)->len) {
+	    struct inotify_event *ev = (struct inotify_event *)p;
+	    a_inode *dir, *c;
+
+	    if (ev->mask & IN_Q_OVERFLOW) {
+		flush_metadata (unit);
+		continue;
+	    }
+	    if (ev->wd <= 0 || ev->wd >= unit->nr_watched_dirs
+		|| (dir = unit->watched_dirs[ev->wd]) == 0)
+		continue;
+	    if (ev->mask & IN_IGNORED) {
+		lose_watch (unit, dir);
+		continue;
+	    }
+	    if (ev->len == 0 || ev->name[0] == '\0') {
+		/* The directory itself changed.  */
+		dir->stat_cached = 0;
+		dir->listed = 0;
+		continue;
+	    }
+	    if (strcmp (ev->name, FSDB_FILE) == 0) {
+		dir->fsdb_absent = 0;
+		continue;
+	    }
+	    if (ev->mask & (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO)) {
+		/* The directory's own mtime and size changed too, and those
+		   were cached through its parent's watch, which doesn't
+		   report them.  */
+		dir->listed = 0;
+		dir->stat_cached = 0;
+	    }
+	    for (c = unit->nname_hash[NNAME_HASH (unit, dir, ev->name)]; c != 0; c = c->nname_hnext)
+		if (c->parent == dir && strcmp (nname_begin (c->nname), ev->name) == 0) {
+		    c->stat_cached = 0;
+		    c->data_gen++;
+		}
+	}
+    }
+#endif
+}
+
+/* Fill in the cached_* fields of AINO, using the host only if they are
+ * not known to be current.  */
+static void cache_stat (Unit *unit, a_inode *aino)
+{
+    struct stat statbuf;
+    a_inode *dir = aino->parent ? aino->parent : aino;
+
+    if (aino->stat_cached && dir->watch > 0)
+	return;
+    /* Watch before looking, so that no change can slip in between.  */
+    aino->stat_cached = watch_dir (unit, dir);
+    if (stat (aino->nname, &statbuf) == -1) {
+	aino->stat_cached = 0;
+	memset (&statbuf, 0, sizeof statbuf);
+    }
+    aino->cached_size = statbuf.st_size;
+#ifdef HAVE_ST_BLOCKS
+    aino->cached_blocks = statbuf.st_blocks;
+#else
+    aino->cached_blocks = statbuf.st_size / 512 + 1;
+#endif
+    aino->cached_mtime = statbuf.st_mtime;
+}
+
 static void dispose_aino (Unit *unit, a_inode **aip, a_inode *aino)
 {
-    int hash = aino->uniq % MAX_AINO_HASH;
-    if (unit->aino_hash[hash] == aino)
-	unit->aino_hash[hash] = 0;
+    unhash_aino (unit, aino);
+    unwatch_dir (unit, aino);
+    /* If this was reaped, the parent's children no longer cover the
+     * host directory.  */
+    if (aino->parent)
+	aino->parent->listed = 0;
 
     if (aino->dirty && aino->parent)
 	fsdb_dir_writeback (aino->parent);
@@ -836,54 +1169,19 @@ static void delete_aino (Unit *unit, a_inode *aino)
     dispose_aino (unit, aip, aino);
 }
 
-static a_inode *lookup_sub (a_inode *dir, uae_u32 uniq)
-{
-    a_inode **cp = &dir->child;
-    a_inode *c, *retval;
-
-    for (;;) {
-	c = *cp;
-	if (c == 0)
-	    return 0;
-
-	if (c->uniq == uniq) {
-	    retval = c;
-	    break;
-	}
-	if (c->dir) {
-	    a_inode *a = lookup_sub (c, uniq);
-	    if (a != 0) {
-		retval = a;
-		break;
-	    }
-	}
-	cp = &c->sibling;
-    }
-    if (! dir->locked_children) {
-	/* Move to the front to speed up repeated lookups.  Don't do this if
-	   an ExNext is going on in this directory, or we'll terminally
-	   confuse it.  */
-	*cp = c->sibling;
-	c->sibling = dir->child;
-	dir->child = c;
-    }
-    return retval;
-}
-
 static a_inode *lookup_aino (Unit *unit, uae_u32 uniq)
 {
     a_inode *a;
-    int hash = uniq % MAX_AINO_HASH;
 
     if (uniq == 0)
 	return &unit->rootnode;
-    a = unit->aino_hash[hash];
-    if (a == 0 || a->uniq != uniq)
-	a = lookup_sub (&unit->rootnode, uniq);
-    else
-	unit->nr_cache_hits++;
     unit->nr_cache_lookups++;
-    unit->aino_hash[hash] = a;
+    for (a = unit->aino_hash[UNIQ_HASH (unit, uniq)]; a != 0; a = a->uniq_hnext) {
+	if (a->uniq == uniq) {
+	    unit->nr_cache_hits++;
+	    break;
+	}
+    }
     return a;
 }
 
@@ -995,6 +1293,12 @@ static void init_child_aino (Unit *unit, a_inode *base, a_inode *aino)
     aino->dirty = 0;
     aino->deleted = 0;
 
+    aino->data_gen = 0;
+    aino->watch = 0;
+    aino->stat_cached = 0;
+    aino->listed = 0;
+    aino->fsdb_absent = 0;
+
     /* For directories - this one isn't being ExNext()ed yet.  */
     aino->locked_children = 0;
     aino->exnext_count = 0;
@@ -1009,6 +1313,7 @@ static void init_child_aino (Unit *unit, a_inode *base, a_inode *aino)
     aino->sibling = base->child;
     base->child = aino;
     aino->next = aino->prev = 0;
+    hash_aino (unit, aino);
 }
 
 static a_inode *new_child_aino (Unit *unit, a_inode *base, char *rel)
@@ -1069,7 +1374,7 @@ static a_inode *create_child_aino (Unit *unit, a_inode *base, char *rel, int isd
 
 static a_inode *lookup_child_aino (Unit *unit, a_inode *base, char *rel, uae_u32 *err)
 {
-    a_inode *c = base->child;
+    a_inode *c;
     int l0 = strlen (rel);
 
     if (base->dir == 0) {
@@ -1077,12 +1382,14 @@ static a_inode *lookup_child_aino (Unit *unit, a_inode *base, char *rel, uae_u32
 	return 0;
     }
 
-    while (c != 0) {
-	int l1 = strlen (c->aname);
+    for (c = unit->aname_hash[ANAME_HASH (unit, base, rel)]; c != 0; c = c->aname_hnext) {
+	int l1;
+	if (c->parent != base)
+	    continue;
+	l1 = strlen (c->aname);
 	if (l0 <= l1 && same_aname (rel, c->aname + l1 - l0)
 	    && (l0 == l1 || c->aname[l1-l0-1] == '/'))
 	    break;
-	c = c->sibling;
     }
     if (c != 0)
 	return c;
@@ -1095,17 +1402,19 @@ static a_inode *lookup_child_aino (Unit *unit, a_inode *base, char *rel, uae_u32
 /* Different version because for this one, REL is an nname.  */
 static a_inode *lookup_child_aino_for_exnext (Unit *unit, a_inode *base, char *rel, uae_u32 *err)
 {
-    a_inode *c = base->child;
+    a_inode *c;
     int l0 = strlen (rel);
 
     *err = 0;
-    while (c != 0) {
-	int l1 = strlen (c->nname);
+    for (c = unit->nname_hash[NNAME_HASH (unit, base, rel)]; c != 0; c = c->nname_hnext) {
+	int l1;
+	if (c->parent != base)
+	    continue;
+	l1 = strlen (c->nname);
 	/* Note: using strcmp here.  */
 	if (l0 <= l1 && strcmp (rel, c->nname + l1 - l0) == 0
 	    && (l0 == l1 || c->nname[l1-l0-1] == FSDB_DIR_SEPARATOR))
 	    break;
-	c = c->sibling;
     }
     if (c != 0)
 	return c;
@@ -1267,9 +1576,21 @@ static uae_u32 startup_handler (TrapContext *dummy)
     unit->rootnode.elock = 0;
     unit->rootnode.comment = 0;
     unit->rootnode.has_dbentry = 0;
+    unit->rootnode.watch = 0;
+    unit->rootnode.stat_cached = 0;
+    unit->rootnode.listed = 0;
+    unit->rootnode.fsdb_absent = 0;
+#ifdef UAE_FILESYS_NOTIFY
+    unit->notify_fd = inotify_init ();
+    if (unit->notify_fd >= 0)
+	fcntl (unit->notify_fd, F_SETFL, O_NONBLOCK);
+    else
+	write_log ("Host change notification unavailable, not caching metadata for %s\n", unit->ui.volname);
+#else
+    unit->notify_fd = -1;
+#endif
     unit->aino_cache_size = 0;
-    for (i = 0; i < MAX_AINO_HASH; i++)
-	unit->aino_hash[i] = 0;
+    alloc_aino_hash (unit, MIN_AINO_HASH);
 
 /*    write_comm_pipe_int (unit->ui.unit_pipe, -1, 1);*/
 
@@ -1355,6 +1676,37 @@ action_info (Unit *unit, dpacket packet)
     do_info(unit, packet, GET_PCK_ARG2 (packet) << 2);
 }
 
+static void flush_key (Key *k)
+{
+    int done = 0;
+
+    while (done < k->wlen) {
+	int t = pwrite (k->fd, k->wbuf + done, k->wlen - done, k->wpos + done);
+	if (t <= 0) {
+	    k->werr = t < 0 ? errno : ENOSPC;
+	    write_log ("unixfs: delayed write to %s failed\n", k->aino->nname);
+	    break;
+	}
+	done += t;
+    }
+    k->wlen = 0;
+}
+
+/* Flush K and fail PACKET with RES1 if any collected write to it was
+ * lost, now or by an earlier flush that no packet could report.  */
+static int key_write_failed (Key *k, dpacket packet, uae_u32 res1)
+{
+    if (k->wlen)
+	flush_key (k);
+    if (k->werr == 0)
+	return 0;
+    errno = k->werr;
+    k->werr = 0;
+    PUT_PCK_RES1 (packet, res1);
+    PUT_PCK_RES2 (packet, dos_errno ());
+    return 1;
+}
+
 static void free_key (Unit *unit, Key *k)
 {
     Key *k1;
@@ -1370,9 +1722,13 @@ static void free_key (Unit *unit, Key *k)
 	prev = k1;
     }
 
+    if (k->wlen)
+	flush_key (k);
     if (k->fd >= 0)
 	close (k->fd);
 
+    free (k->rabuf);
+    free (k->wbuf);
     free(k);
 }
 
@@ -1402,6 +1758,14 @@ static Key *new_key (Unit *unit)
     k->uniq = ++unit->key_uniq;
     k->fd = -1;
     k->file_pos = 0;
+    k->busy = 0;
+    k->busy_write = 0;
+    k->rabuf = 0;
+    k->ra_len = 0;
+    k->ra_size = FS_RA_MIN;
+    k->wbuf = 0;
+    k->wlen = 0;
+    k->werr = 0;
     k->next = unit->keys;
     unit->keys = k;
 
@@ -1711,13 +2075,12 @@ static void move_exkeys (Unit *unit, a_inode *from, a_inode *to)
 static void
 get_fileinfo (Unit *unit, dpacket packet, uaecptr info, a_inode *aino)
 {
-    struct stat statbuf;
     long days, mins, ticks;
     int i, n;
     char *x;
 
     /* No error checks - this had better work. */
-    stat (aino->nname, &statbuf);
+    cache_stat (unit, aino);
 
     if (aino->parent == 0) {
 	x = unit->ui.volname;
@@ -1741,13 +2104,9 @@ get_fileinfo (Unit *unit, dpacket packet, uaecptr info, a_inode *aino)
 	put_byte (info + i, 0), i++;
 
     put_long (info + 116, aino->amigaos_mode);
-    put_long (info + 124, statbuf.st_size);
-#ifdef HAVE_ST_BLOCKS
-    put_long (info + 128, statbuf.st_blocks);
-#else
-    put_long (info + 128, statbuf.st_size / 512 + 1);
-#endif
-    get_time (statbuf.st_mtime, &days, &mins, &ticks);
+    put_long (info + 124, aino->cached_size);
+    put_long (info + 128, aino->cached_blocks);
+    get_time (aino->cached_mtime, &days, &mins, &ticks);
     put_long (info + 132, days);
     put_long (info + 136, mins);
     put_long (info + 140, ticks);
@@ -1801,8 +2160,9 @@ static void action_examine_object (Unit *unit, dpacket packet)
 
 static void populate_directory (Unit *unit, a_inode *base)
 {
-    DIR *d = opendir (base->nname);
+    DIR *d;
     a_inode *aino;
+    int watched;
 
     for (aino = base->child; aino; aino = aino->sibling) {
 	base->locked_children++;
@@ -1810,6 +2170,12 @@ static void populate_directory (Unit *unit, a_inode *base)
     }
     TRACE(("Populating directory, child %p, locked_children %d\n",
 	   base->child, base->locked_children));
+    if (base->listed)
+	return;
+    watched = watch_dir (unit, base);
+    d = opendir (base->nname);
+    if (d == 0)
+	return;
     for (;;) {
 	struct dirent de_space;
 	struct dirent *de;
@@ -1827,6 +2193,7 @@ static void populate_directory (Unit *unit, a_inode *base)
 	aino = lookup_child_aino_for_exnext (unit, base, de->d_name, &err);
     }
     closedir (d);
+    base->listed = watched;
 }
 
 static void do_examine (Unit *unit, dpacket packet, ExamineKey *ek, uaecptr info)
@@ -2100,24 +2467,49 @@ action_end (Unit *unit, dpacket packet)
 
     k = lookup_key (unit, GET_PCK_ARG1 (packet));
     if (k != 0) {
+	int failed = key_write_failed (k, packet, DOS_FALSE);
 	if (k->aino->elock)
 	    k->aino->elock = 0;
 	else
 	    k->aino->shlock--;
 	recycle_aino (unit, k->aino);
 	free_key (unit, k);
+	if (failed)
+	    return;
     }
     PUT_PCK_RES1 (packet, DOS_TRUE);
     PUT_PCK_RES2 (packet, 0);
 }
 
+/* Read straight into Amiga memory where possible.  */
+static int read_to_amiga (Key *k, uaecptr addr, int size, off_t pos)
+{
+    int actual;
+
+    if (valid_address (addr, size)) {
+	actual = pread (k->fd, get_real_address (addr), size, pos);
+	if (actual > 0)
+	    memory_dirty (addr, actual);
+    } else {
+	uae_u8 *buf = (uae_u8 *)malloc (size);
+	if (!buf) {
+	    errno = ENOMEM;
+	    return -1;
+	}
+	actual = pread (k->fd, buf, size, pos);
+	if (actual > 0)
+	    memcpyha (addr, buf, actual);
+	free (buf);
+    }
+    return actual;
+}
+
 static void
-action_read (Unit *unit, dpacket packet)
+do_read (Unit *unit, dpacket packet, Key *k)
 {
-    Key *k = lookup_key (unit, GET_PCK_ARG1 (packet));
     uaecptr addr = GET_PCK_ARG2 (packet);
     long size = (uae_s32)GET_PCK_ARG3 (packet);
-    int actual;
+    int actual = 0, t = 0;
 
     if (k == 0) {
 	PUT_PCK_RES1 (packet, DOS_FALSE);
@@ -2130,62 +2522,82 @@ action_read (Unit *unit, dpacket packet)
      * Try to detect a LoadSeg() */
     if (k->file_pos == 0 && size >= 4) {
 	unsigned char buf[4];
-	off_t currpos = lseek(k->fd, 0, SEEK_CUR);
-	read(k->fd, buf, 4);
-	lseek(k->fd, currpos, SEEK_SET);
+	pread (k->fd, buf, 4, 0);
 	if (buf[0] == 0 && buf[1] == 0 && buf[2] == 3 && buf[3] == 0xF3)
 	    possible_loadseg();
     }
 #endif
-    if (valid_address (addr, size)) {
-	uae_u8 *realpt;
-	realpt = get_real_address (addr);
-	actual = read(k->fd, realpt, size);
-
-	if (actual == 0) {
-	    PUT_PCK_RES1 (packet, 0);
-	    PUT_PCK_RES2 (packet, 0);
-	} else if (actual < 0) {
-	    PUT_PCK_RES1 (packet, 0);
-	    PUT_PCK_RES2 (packet, dos_errno());
-	} else {
-	    PUT_PCK_RES1 (packet, actual);
-	    k->file_pos += actual;
-	}
-    } else {
-	char *buf;
-	write_log ("unixfs warning: Bad pointer passed for read: %08x\n", addr);
-	/* ugh this is inefficient but easy */
-	buf = (char *)malloc(size);
-	if (!buf) {
-	    PUT_PCK_RES1 (packet, -1);
-	    PUT_PCK_RES2 (packet, ERROR_NO_FREE_STORE);
-	    return;
-	}
-	actual = read(k->fd, buf, size);
+    if (key_write_failed (k, packet, -1))
+	return;
 
-	if (actual < 0) {
-	    PUT_PCK_RES1 (packet, 0);
-	    PUT_PCK_RES2 (packet, dos_errno());
+    /* Whatever the readahead buffer already has.  */
+    if (k->ra_len > 0 && k->ra_gen == k->aino->data_gen
+	&& k->file_pos >= k->ra_pos && k->file_pos < k->ra_pos + k->ra_len)
+    {
+	actual = k->ra_pos + k->ra_len - k->file_pos;
+	if (actual > size)
+	    actual = size;
+	memcpyha (addr, k->rabuf + (k->file_pos - k->ra_pos), actual);
+    }
+
+    if (actual < size) {
+	off_t pos = k->file_pos + actual;
+	int want = size - actual;
+
+	/* Grow the readahead while the file is read sequentially.  */
+	if (k->ra_len > 0 && pos == k->ra_pos + k->ra_len) {
+	    if (k->ra_size < FS_RA_MAX) {
+		k->ra_size *= 2;
+#ifdef POSIX_FADV_SEQUENTIAL
+		if (k->ra_size == FS_RA_MAX)
+		    posix_fadvise (k->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+	    }
+	} else
+	    k->ra_size = FS_RA_MIN;
+
+	if (want >= k->ra_size) {
+	    t = read_to_amiga (k, addr + actual, want, pos);
+	    if (t > 0)
+		actual += t;
+	    k->ra_len = 0;
 	} else {
-	    int i;
-	    PUT_PCK_RES1 (packet, actual);
-	    for (i = 0; i < actual; i++)
-		put_byte (addr + i, buf[i]);
-	    k->file_pos += actual;
+	    if (k->rabuf == 0)
+		k->rabuf = (uae_u8 *)xmalloc (FS_RA_MAX);
+	    k->ra_gen = k->aino->data_gen;
+	    t = pread (k->fd, k->rabuf, k->ra_size, pos);
+	    k->ra_pos = pos;
+	    k->ra_len = t > 0 ? t : 0;
+	    if (want > k->ra_len)
+		want = k->ra_len;
+	    memcpyha (addr + actual, k->rabuf, want);
+	    actual += want;
 	}
-	free (buf);
+    }
+
+    if (actual == 0 && t < 0) {
+	PUT_PCK_RES1 (packet, 0);
+	PUT_PCK_RES2 (packet, dos_errno());
+    } else {
+	PUT_PCK_RES1 (packet, actual);
+	PUT_PCK_RES2 (packet, 0);
+	k->file_pos += actual;
     }
 }
 
 static void
-action_write (Unit *unit, dpacket packet)
+action_read (Unit *unit, dpacket packet)
+{
+    do_read (unit, packet, lookup_key (unit, GET_PCK_ARG1 (packet)));
+}
+
+static void
+do_write (Unit *unit, dpacket packet, Key *k)
 {
-    Key *k = lookup_key (unit, GET_PCK_ARG1 (packet));
     uaecptr addr = GET_PCK_ARG2 (packet);
     long size = GET_PCK_ARG3 (packet);
-    char *buf;
-    int i;
+    uae_u8 *buf;
+    int actual;
 
     if (k == 0) {
 	PUT_PCK_RES1 (packet, DOS_FALSE);
@@ -2201,24 +2613,54 @@ action_write (Unit *unit, dpacket packet)
 	return;
     }
 
-    /* ugh this is inefficient but easy */
-    buf = (char *)malloc(size);
-    if (!buf) {
-	PUT_PCK_RES1 (packet, -1);
-	PUT_PCK_RES2 (packet, ERROR_NO_FREE_STORE);
-	return;
+    k->aino->data_gen++;
+    k->aino->stat_cached = 0;
+
+    /* Collect small sequential writes.  */
+    if (size > 0 && size < FS_WBUF_SMALL && k->werr == 0) {
+	if (k->wlen > 0
+	    && (k->wpos + k->wlen != k->file_pos || k->wlen + size > FS_WBUF_SIZE))
+	    flush_key (k);
+	if (k->werr == 0) {
+	    if (k->wbuf == 0)
+		k->wbuf = (uae_u8 *)xmalloc (FS_WBUF_SIZE);
+	    if (k->wlen == 0)
+		k->wpos = k->file_pos;
+	    memcpyah (k->wbuf + k->wlen, addr, size);
+	    k->wlen += size;
+	    k->file_pos += size;
+	    PUT_PCK_RES1 (packet, size);
+	    return;
+	}
     }
+    if (key_write_failed (k, packet, -1))
+	return;
 
-    for (i = 0; i < size; i++)
-	buf[i] = get_byte (addr + i);
+    if (valid_address (addr, size)) {
+	actual = pwrite (k->fd, get_real_address (addr), size, k->file_pos);
+    } else {
+	buf = (uae_u8 *)malloc (size);
+	if (!buf) {
+	    PUT_PCK_RES1 (packet, -1);
+	    PUT_PCK_RES2 (packet, ERROR_NO_FREE_STORE);
+	    return;
+	}
+	memcpyah (buf, addr, size);
+	actual = pwrite (k->fd, buf, size, k->file_pos);
+	free (buf);
+    }
 
-    PUT_PCK_RES1 (packet, write(k->fd, buf, size));
-    if (GET_PCK_RES1 (packet) != size)
+    PUT_PCK_RES1 (packet, actual);
+    if (actual != size)
 	PUT_PCK_RES2 (packet, dos_errno ());
-    if (GET_PCK_RES1 (packet) >= 0)
-	k->file_pos += GET_PCK_RES1 (packet);
+    if (actual >= 0)
+	k->file_pos += actual;
+}
 
-    free (buf);
+static void
+action_write (Unit *unit, dpacket packet)
+{
+    do_write (unit, packet, lookup_key (unit, GET_PCK_ARG1 (packet)));
 }
 
 static void
@@ -2230,42 +2672,40 @@ action_seek (Unit *unit, dpacket packet)
     off_t res;
     long old;
     int whence = SEEK_CUR;
+    struct stat statbuf;
 
     if (k == 0) {
 	PUT_PCK_RES1 (packet, -1);
 	PUT_PCK_RES2 (packet, ERROR_INVALID_LOCK);
 	return;
     }
+    if (key_write_failed (k, packet, -1))
+	return;
 
     if (mode > 0) whence = SEEK_END;
     if (mode < 0) whence = SEEK_SET;
 
     TRACE(("ACTION_SEEK(%s,%d,%d)\n", k->aino->nname, pos, mode));
 
-    old = lseek (k->fd, 0, SEEK_CUR);
-    {
-	uae_s32 temppos;
-	long filesize = lseek (k->fd, 0, SEEK_END);
-	lseek (k->fd, old, SEEK_SET);
-
-	if (whence == SEEK_CUR) temppos = old + pos;
-	if (whence == SEEK_SET) temppos = pos;
-	if (whence == SEEK_END) temppos = filesize + pos;
-	if (filesize < temppos) {
-	    res = -1;
-	    PUT_PCK_RES1 (packet,res);
-	    PUT_PCK_RES2 (packet, ERROR_SEEK_ERROR);
-	    return;
-	}
+    /* Reads and writes are positional, so file_pos is the only file
+     * position there is.  */
+    old = k->file_pos;
+    if (fstat (k->fd, &statbuf) == -1) {
+	PUT_PCK_RES1 (packet, -1);
+	PUT_PCK_RES2 (packet, ERROR_SEEK_ERROR);
+	return;
     }
-
-    res = lseek (k->fd, pos, whence);
-
-    if (-1 == res) {
-	PUT_PCK_RES1 (packet, res);
+    res = old;
+    if (whence == SEEK_CUR) res = old + pos;
+    if (whence == SEEK_SET) res = pos;
+    if (whence == SEEK_END) res = statbuf.st_size + pos;
+    if (res < 0 || statbuf.st_size < res) {
+	PUT_PCK_RES1 (packet, -1);
 	PUT_PCK_RES2 (packet, ERROR_SEEK_ERROR);
-    } else
-	PUT_PCK_RES1 (packet, old);
+	return;
+    }
+
+    PUT_PCK_RES1 (packet, old);
     k->file_pos = res;
 }
 
@@ -2573,6 +3013,13 @@ action_set_file_size (Unit *unit, dpacket packet)
 	PUT_PCK_RES2 (packet, ERROR_OBJECT_NOT_AROUND);
 	return;
     }
+    if (key_write_failed (k, packet, DOS_FALSE))
+	return;
+    /* The descriptor's own position isn't used for reads and writes.  */
+    if (whence == SEEK_CUR) {
+	offset += k->file_pos;
+	whence = SEEK_SET;
+    }
 
     /* If any open files have file pointers beyond this size, truncate only
      * so far that these pointers do not become invalid.  */
@@ -2583,6 +3030,8 @@ action_set_file_size (Unit *unit, dpacket packet)
 	}
     }
 
+    k->aino->data_gen++;
+    k->aino->stat_cached = 0;
     /* Write one then truncate: that should give the right size in all cases.  */
     offset = lseek (k->fd, offset, whence);
     write (k->fd, /* whatever */(char *)&k1, 1);
@@ -2747,10 +3196,14 @@ action_rename_object (Unit *unit, dpacket packet)
     a2->comment = a1->comment;
     a1->comment = 0;
     a2->amigaos_mode = a1->amigaos_mode;
+    /* a2 takes over a1's uniq, so it must not be found under either
+     * number until a1 is gone.  */
+    unhash_aino (unit, a2);
     a2->uniq = a1->uniq;
     move_exkeys (unit, a1, a2);
     move_aino_children (unit, a1, a2);
     delete_aino (unit, a1);
+    hash_aino (unit, a2);
     PUT_PCK_RES1 (packet, DOS_TRUE);
 }
 
@@ -2921,10 +3374,55 @@ static uae_u32 exter_int_helper (TrapContext *dummy)
     return 0;
 }
 
+#ifdef UAE_FILESYS_THREADS
+/* 0 if K is idle, else 1 for a read or 2 for a write in progress.  */
+static int key_busy (Unit *unit, Key *k)
+{
+    int busy;
+
+    uae_sem_wait (&unit->io_lock);
+    busy = k->busy ? 1 + k->busy_write : 0;
+    uae_sem_post (&unit->io_lock);
+    return busy;
+}
+#endif
+
+/* Collected writes must reach the file before anything can look at it:
+ * before any packet other than a read or write, and before a read or
+ * write through another handle on the same file.  A failure stays in
+ * the key's werr for the next packet on that key to report.  */
+static void flush_writes (Unit *unit, dpacket pck)
+{
+    uae_s32 type = GET_PCK_TYPE (pck);
+    Key *k, *k1 = 0;
+
+    if (type == ACTION_READ || type == ACTION_WRITE) {
+	k1 = lookup_key (unit, GET_PCK_ARG1 (pck));
+	if (k1 == 0)
+	    return;
+    }
+    for (k = unit->keys; k; k = k->next) {
+	if (k == k1 || (k1 != 0 && k->aino != k1->aino))
+	    continue;
+#ifdef UAE_FILESYS_THREADS
+	/* A read in progress flushes its own key.  */
+	if (key_busy (unit, k) == 1)
+	    continue;
+	while (key_busy (unit, k))
+	    uae_sem_wait (&unit->io_done);
+#endif
+	if (k->wlen)
+	    flush_key (k);
+    }
+}
+
 static int handle_packet (Unit *unit, dpacket pck)
 {
     uae_s32 type = GET_PCK_TYPE (pck);
     PUT_PCK_RES2 (pck, 0);
+    /* Our own writes must reach the host before its changes are read.  */
+    flush_writes (unit, pck);
+    poll_host_changes (unit);
     switch (type) {
      case ACTION_LOCATE_OBJECT: action_lock (unit, pck); break;
      case ACTION_FREE_LOCK: action_free_lock (unit, pck); break;
@@ -2978,6 +3476,130 @@ static int handle_packet (Unit *unit, dpacket pck)
 }
 
 #ifdef UAE_FILESYS_THREADS
+/* Mark a packet as processed and get the interrupt handler to reply it.
+ * This can be called from the unit thread and its workers at once.  */
+static void packet_done (Unit *unit, uae_u8 *msg)
+{
+    /* Mark the packet as processed for the list scan in the assembly code. */
+    do_put_mem_long ((uae_u32 *)(msg + 4), -1);
+    uae_sem_wait (&packet_counter_sem);
+    /* Acquire the message lock, so that we know we can safely send the
+     * message. */
+    unit->cmds_sent++;
+    active_fs_packets--;
+    uae_sem_post (&packet_counter_sem);
+    /* The message is sent by our interrupt handler, so make sure an interrupt
+     * happens. */
+    uae_int_requested = 1;
+}
+
+static void *filesys_io_thread (void *unit_v)
+{
+    Unit *unit = (Unit *)unit_v;
+
+    for (;;) {
+	struct fs_iorequest r;
+
+	uae_sem_wait (&unit->io_queued);
+	uae_sem_wait (&unit->io_lock);
+	r = unit->ioqueue[unit->io_rdp];
+	unit->io_rdp = (unit->io_rdp + 1) % FS_IO_QUEUE;
+	uae_sem_post (&unit->io_lock);
+	uae_sem_post (&unit->io_free);
+	if (r.pck == 0)
+	    return 0;
+
+	PUT_PCK_RES2 (r.pck, 0);
+	if (GET_PCK_TYPE (r.pck) == ACTION_READ)
+	    do_read (unit, r.pck, r.k);
+	else
+	    do_write (unit, r.pck, r.k);
+
+	uae_sem_wait (&unit->io_lock);
+	r.k->busy = 0;
+	unit->io_inflight--;
+	uae_sem_post (&unit->io_lock);
+	uae_sem_post (&unit->io_done);
+	packet_done (unit, r.msg);
+    }
+}
+
+static void queue_iorequest (Unit *unit, uae_u8 *pck, uae_u8 *msg, Key *k)
+{
+    uae_sem_wait (&unit->io_free);
+    uae_sem_wait (&unit->io_lock);
+    unit->ioqueue[unit->io_wrp].pck = pck;
+    unit->ioqueue[unit->io_wrp].msg = msg;
+    unit->ioqueue[unit->io_wrp].k = k;
+    unit->io_wrp = (unit->io_wrp + 1) % FS_IO_QUEUE;
+    if (pck != 0) {
+	k->busy = 1;
+	k->busy_write = GET_PCK_TYPE (pck) == ACTION_WRITE;
+	unit->io_inflight++;
+    }
+    uae_sem_post (&unit->io_lock);
+    uae_sem_post (&unit->io_queued);
+}
+
+static void start_io_threads (Unit *unit)
+{
+    uae_sem_init (&unit->io_lock, 0, 1);
+    uae_sem_init (&unit->io_queued, 0, 0);
+    uae_sem_init (&unit->io_free, 0, FS_IO_QUEUE);
+    uae_sem_init (&unit->io_done, 0, 0);
+    while (unit->io_threads < FS_IO_THREADS
+	   && uae_start_thread (filesys_io_thread, unit, &unit->io_tid[unit->io_threads]) == 0)
+	unit->io_threads++;
+}
+
+static void stop_io_threads (Unit *unit)
+{
+    int i;
+
+    for (i = 0; i < unit->io_threads; i++)
+	queue_iorequest (unit, 0, 0, 0);
+    for (i = 0; i < unit->io_threads; i++)
+	uae_wait_thread (unit->io_tid[i]);
+    unit->io_threads = 0;
+}
+
+static int io_busy (Unit *unit)
+{
+    int busy;
+
+    uae_sem_wait (&unit->io_lock);
+    busy = unit->io_inflight;
+    uae_sem_post (&unit->io_lock);
+    return busy;
+}
+
+/* Packets that use a file handle must see the results of earlier reads
+ * and writes through it; a few others look at every open handle.  */
+static void wait_for_io (Unit *unit, dpacket pck)
+{
+    Key *k;
+
+    if (unit->io_threads == 0)
+	return;
+    switch (GET_PCK_TYPE (pck)) {
+     case ACTION_READ:
+     case ACTION_WRITE:
+     case ACTION_SEEK:
+     case ACTION_END:
+     case ACTION_EXAMINE_FH:
+     case ACTION_PARENT_FH:
+	k = lookup_key (unit, GET_PCK_ARG1 (pck));
+	while (k != 0 && key_busy (unit, k))
+	    uae_sem_wait (&unit->io_done);
+	break;
+     case ACTION_SET_FILE_SIZE:
+     case ACTION_CHANGE_MODE:
+	while (io_busy (unit))
+	    uae_sem_wait (&unit->io_done);
+	break;
+    }
+}
+
 static void *filesys_thread (void *unit_v)
 {
     UnitInfo *ui = (UnitInfo *)unit_v;
@@ -2985,7 +3607,9 @@ static void *filesys_thread (void *unit_v)
 	uae_u8 *pck;
 	uae_u8 *msg;
 	uae_u32 morelocks;
-	int i;
+	Unit *unit;
+	uae_s32 type;
+	Key *k;
 
 	pck = (uae_u8 *)read_comm_pipe_pvoid_blocking (ui->unit_pipe);
 	msg = (uae_u8 *)read_comm_pipe_pvoid_blocking (ui->unit_pipe);
@@ -2994,35 +3618,47 @@ static void *filesys_thread (void *unit_v)
 	if (ui->reset_state == FS_GO_DOWN) {
 	    if (pck != 0)
 		continue;
-	    /* Death message received. */
+	    /* Death message received.  Let outstanding transfers finish
+	     * first, so that nothing touches the unit after we're gone.  */
+	    if (ui->self != 0 && ui->self->io_threads != 0) {
+		while (io_busy (ui->self))
+		    uae_sem_wait (&ui->self->io_done);
+		stop_io_threads (ui->self);
+	    }
 	    uae_sem_post (&ui->reset_sync_sem);
 	    /* Die.  */
 	    return 0;
 	}
 
-	put_long (get_long (morelocks), get_long (ui->self->locklist));
-	put_long (ui->self->locklist, morelocks);
-	if (! handle_packet (ui->self, pck)) {
-	    PUT_PCK_RES1 (pck, DOS_FALSE);
-	    PUT_PCK_RES2 (pck, ERROR_ACTION_NOT_KNOWN);
+	unit = ui->self;
+	/* Only this thread hands out or takes back locks, so the lock list
+	 * needs no protection from the workers.  */
+	put_long (get_long (morelocks), get_long (unit->locklist));
+	put_long (unit->locklist, morelocks);
+
+	if (unit->io_threads == 0)
+	    start_io_threads (unit);
+	wait_for_io (unit, pck);
+
+	type = GET_PCK_TYPE (pck);
+	if (unit->io_threads != 0
+	    && (type == ACTION_READ || type == ACTION_WRITE)
+	    && (k = lookup_key (unit, GET_PCK_ARG1 (pck))) != 0)
+	{
+	    flush_writes (unit, pck);
+	    queue_iorequest (unit, pck, msg, k);
+	} else {
+	    if (! handle_packet (unit, pck)) {
+		PUT_PCK_RES1 (pck, DOS_FALSE);
+		PUT_PCK_RES2 (pck, ERROR_ACTION_NOT_KNOWN);
+	    }
+	    packet_done (unit, msg);
 	}
-	/* Mark the packet as processed for the list scan in the assembly code. */
-	do_put_mem_long ((uae_u32 *)(msg + 4), -1);
-	/* Acquire the message lock, so that we know we can safely send the
-	 * message. */
-	ui->self->cmds_sent++;
-	/* The message is sent by our interrupt handler, so make sure an interrupt
-	 * happens. */
-	uae_int_requested = 1;
- 
-	uae_sem_wait (&packet_counter_sem);
-	active_fs_packets--;
-	uae_sem_post (&packet_counter_sem);
 
 	/* Send back the locks. */
-	if (get_long (ui->self->locklist) != 0)
-	    write_comm_pipe_int (ui->back_pipe, (int)(get_long (ui->self->locklist)), 0);
-	put_long (ui->self->locklist, 0);
+	if (get_long (unit->locklist) != 0)
+	    write_comm_pipe_int (ui->back_pipe, (int)(get_long (unit->locklist)), 0);
+	put_long (unit->locklist, 0);
     }
     return 0;
 }
@@ -3042,6 +3678,9 @@ static uae_u32 filesys_handler (TrapContext *dummy)
     }
     pck = get_real_address (packet_addr);
     msg = get_real_address (message_addr);
+    /* The replies are written through these pointers.  */
+    memory_dirty (packet_addr, 36);
+    memory_dirty (message_addr, 14);
 
 #if 0
     if (unit->reset_state == FS_GO_DOWN)
@@ -3119,6 +3758,18 @@ void filesys_start_threads (void)
 	UnitInfo *ui = &uip[i];
 	ui->unit_pipe = 0;
 
+	/* With an overlay the image itself must never be written; if the
+	 * delta can't be set up, the unit becomes read-only.  */
+	if (ui->hf.fd != 0 && ! ui->readonly && currprefs.hardfile_overlay[0]
+	    && ! hdf_overlay_open (&ui->hf, ui->rootdir, currprefs.hardfile_overlay))
+	{
+	    write_log ("Mounting %s read-only\n", ui->rootdir);
+	    ui->readonly = 1;
+	    fclose (ui->hf.fd);
+	    ui->hf.fd = fopen (ui->rootdir, "rb");
+	}
+	hdf_map (&ui->hf);
+
 #ifdef UAE_FILESYS_THREADS
 	if (hardfile_fs_type (current_mountinfo, i) == FILESYS_VIRTUAL) {
 	    uip[i].unit_pipe = (smp_comm_pipe *)xmalloc (sizeof (smp_comm_pipe));
@@ -3142,6 +3793,10 @@ void filesys_reset (void)
 
     for (u = units; u; u = u1) {
 	u1 = u->next;
+	free_aino_hash (u);
+	if (u->notify_fd >= 0)
+	    close (u->notify_fd);
+	free (u->watched_dirs);
 	free (u);
     }
     unit_num = 0;
@@ -3182,6 +3837,10 @@ void filesys_prepare_reset (void)
 #endif
     u = units;
     while (u != 0) {
+	Key *k;
+	for (k = u->keys; k; k = k->next)
+	    if (k->wlen)
+		flush_key (k);
 	free_all_ainos (u, &u->rootnode);
 	u->rootnode.next = u->rootnode.prev = &u->rootnode;
 	u->aino_cache_size = 0;
@@ -3722,7 +4381,7 @@ void filesys_install (void)
 
     org (loop);
 
-    uae_sem_init (&packet_counter_sem, 0, 0);
+    uae_sem_init (&packet_counter_sem, 0, 1);
 }
 
 void filesys_install_code (void)
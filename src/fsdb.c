@@ -10,6 +10,8 @@
 #include "sysconfig.h"
 #include "sysdeps.h"
 
+#include <ctype.h>
+
 #include "threaddep/thread.h"
 #include "options.h"
 #include "uae.h"
@@ -47,8 +49,35 @@ char *fsdb_search_dir (const char *dirname, char *rel)
 {
     char *p = 0;
     struct dirent *de;
-    DIR *dir = opendir (dirname);
+    struct stat statbuf, st2;
+    DIR *dir;
+
+    /* The common case is an exact match, which needs no directory scan.
+     * That only holds on a case-sensitive host filesystem, though: if the
+     * name with its case swapped is the same file, REL may not be the
+     * spelling on disk.  */
+    p = build_nname (dirname, rel);
+    if (stat (p, &statbuf) == 0) {
+	char *q = nname_begin (p);
+	int swapped = 0;
+
+	for (; *q; q++) {
+	    if (isupper ((unsigned char)*q))
+		*q = tolower ((unsigned char)*q), swapped = 1;
+	    else if (islower ((unsigned char)*q))
+		*q = toupper ((unsigned char)*q), swapped = 1;
+	}
+	if (! swapped || stat (p, &st2) != 0
+	    || st2.st_ino != statbuf.st_ino || st2.st_dev != statbuf.st_dev)
+	{
+	    free (p);
+	    return rel;
+	}
+    }
+    free (p);
+    p = 0;
 
+    dir = opendir (dirname);
     /* This really shouldn't happen...  */
     if (! dir)
 	return 0;
@@ -63,19 +92,32 @@ char *fsdb_search_dir (const char *dirname, char *rel)
     return p;
 }
 
+/* While a directory is watched for host changes, remember that it has
+ * no database file so that lookups don't keep trying to open it.  */
 static FILE *get_fsdb (a_inode *dir, const char *mode)
 {
-    char *n = build_nname (dir->nname, FSDB_FILE);
-    FILE *f = fopen (n, mode);
+    char *n;
+    FILE *f;
+
+    if (mode[0] == 'r' && dir->fsdb_absent)
+	return 0;
+    n = build_nname (dir->nname, FSDB_FILE);
+    f = fopen (n, mode);
     free (n);
+    dir->fsdb_absent = f == 0 && dir->watch > 0;
     return f;
 }
 
 static void kill_fsdb (a_inode *dir)
 {
-    char *n = build_nname (dir->nname, FSDB_FILE);
+    char *n;
+
+    if (dir->fsdb_absent)
+	return;
+    n = build_nname (dir->nname, FSDB_FILE);
     unlink (n);
     free (n);
+    dir->fsdb_absent = dir->watch > 0;
 }
 
 /* Prune the db file the first time this directory is opened in a session.  */
@@ -103,6 +103,8 @@ DE0000 to DEFFFF		64 KB Motherboard resources
 #define IDE_STATUS_BSY 0x80
 /* ERROR bits */
 #define IDE_ERR_ABRT 0x04
+#define IDE_ERR_IDNF 0x10
+#define IDE_ERR_UNC 0x40
 
 /*
  *  These are at different offsets from the base
@@ -124,9 +126,24 @@ DE0000 to DEFFFF		64 KB Motherboard resources
 #define GAYLE_IRQ_IDEACK1 0x02
 #define GAYLE_IRQ_IDEACK0 0x01
 
+/* Largest block READ/WRITE MULTIPLE may ask for.  */
+#define MAX_IDE_MULTIPLE_SECTORS 128
+
 struct ide_hdf
 {
+    struct hardfiledata hfd;
+    int readonly;
+    int cyls, heads, secspertrack;
+
+    /* A whole command's worth of sectors is read into, or collected in,
+       secbuf; the data port only walks over it.  */
     uae_u8 secbuf[512 * 256];
+    int data_offset;
+    int data_size;
+    int data_multi;
+    int direction;
+    uae_u64 data_lba;
+
     uae_u8 multiple_mode;
     uae_u8 status;
     int irq_delay;
@@ -164,6 +181,11 @@ static void ps (int offset, char *s, int max)
     }
 }
 
+static int isdrive (struct ide_hdf *ide)
+{
+    return ide->hfd.size != 0;
+}
+
 static void ide_interrupt(void)
 {
     ide->status |= IDE_STATUS_BSY;
@@ -173,23 +195,66 @@ static void ide_interrupt(void)
 static void ide_interrupt_do(struct ide_hdf *ide)
 {
     ide->status &= ~IDE_STATUS_BSY;
+    ide->status |= IDE_STATUS_DRDY;
+    if (ide_devcon & 2) /* nIEN */
+	return;
     if (gayle_intena & GAYLE_IRQ_IDE) {
 	gayle_irq |= GAYLE_IRQ_IDE;
 	INTREQ (0x8000 | 0x0008);
     }
 }
 
-static void ide_fail(void)
+static void ide_fail_err(uae_u8 err)
 {
-    ide_error |= IDE_ERR_ABRT;
-#if 0
-    if (ide_drv == 1 && idedrive[ide2 + 1].hdhfd.size == 0)
-	idedrive[ide2].status |= IDE_STATUS_ERR;
-#endif
+    ide_error |= err;
+    ide->data_size = 0;
+    ide->status &= ~IDE_STATUS_DRQ;
     ide->status |= IDE_STATUS_ERR;
     ide_interrupt();
 }
 
+static void ide_fail(void)
+{
+    ide_fail_err (IDE_ERR_ABRT);
+}
+
+/* Start a PIO transfer of SIZE bytes through secbuf, MULTI sectors per
+   DRQ block.  */
+static void ide_data_ready(int size, int multi, int direction)
+{
+    ide->data_offset = 0;
+    ide->data_size = size;
+    ide->data_multi = multi;
+    ide->direction = direction;
+    ide->status |= IDE_STATUS_DRQ;
+}
+
+static uae_u64 get_lba(void)
+{
+    if (ide_select & 0x40)
+	return ((ide_select & 15) << 24) | (ide_hcyl << 16) | (ide_lcyl << 8) | ide_sector;
+    return (((ide_hcyl << 8) | ide_lcyl) * ide->heads + (ide_select & 15)) * ide->secspertrack
+	+ ide_sector - 1;
+}
+
+/* After a transfer the registers point at the last sector done.  */
+static void put_lba(uae_u64 lba)
+{
+    if (ide_select & 0x40) {
+	ide_sector = lba;
+	ide_lcyl = lba >> 8;
+	ide_hcyl = lba >> 16;
+	ide_select = (ide_select & ~15) | ((lba >> 24) & 15);
+    } else {
+	int cyl = lba / (ide->heads * ide->secspertrack);
+	int rem = lba % (ide->heads * ide->secspertrack);
+	ide_lcyl = cyl;
+	ide_hcyl = cyl >> 8;
+	ide_select = (ide_select & ~15) | (rem / ide->secspertrack);
+	ide_sector = rem % ide->secspertrack + 1;
+    }
+}
+
 static void ide_recalibrate(void)
 {
     write_log ("IDE%d recalibrate\n", ide->num);
@@ -203,20 +268,62 @@ static void ide_identify_drive(void)
     int totalsecs;
     int v;
 
-    ide_fail();
-    return;
+    if (!isdrive (ide)) {
+	ide_fail();
+	return;
+    }
+    memset (ide->secbuf, 0, 512);
+    pw (0, 1 << 6); /* fixed drive */
+    pw (1, ide->cyls);
+    pw (3, ide->heads);
+    pw (4, 512 * ide->secspertrack);
+    pw (5, 512);
+    pw (6, ide->secspertrack);
+    ps (10, "68000", 20); /* serial */
+    pw (20, 3);
+    pw (21, 512);
+    ps (23, "0.4", 8); /* firmware revision */
+    ps (27, "UAE-IDE", 40); /* model */
+    pw (47, 0x8000 | MAX_IDE_MULTIPLE_SECTORS);
+    pw (49, 1 << 9); /* LBA */
+    pw (51, 0x200); /* PIO cycles */
+    pw (53, 1);
+    pw (54, ide->cyls);
+    pw (55, ide->heads);
+    pw (56, ide->secspertrack);
+    totalsecs = ide->cyls * ide->heads * ide->secspertrack;
+    pw (57, totalsecs);
+    pw (58, totalsecs >> 16);
+    v = ide->multiple_mode;
+    pw (59, (v > 0 ? 0x100 : 0) | v);
+    totalsecs = ide->hfd.size / 512 > 0x0fffffff ? 0x0fffffff : ide->hfd.size / 512;
+    pw (60, totalsecs);
+    pw (61, totalsecs >> 16);
+    ide_data_ready (512, 1, 0);
+    ide_interrupt();
 }
 
 static void ide_initialize_drive_parameters(void)
 {
-    ide_error |= IDE_ERR_ABRT;
-    ide->status |= IDE_STATUS_ERR;
+    if (!isdrive (ide)) {
+	ide_fail();
+	return;
+    }
+    /* Only the geometry the drive reports is supported.  */
+    if (ide_nsector != ide->secspertrack || (ide_select & 15) + 1 != ide->heads) {
+	ide_fail();
+	return;
+    }
     ide_interrupt();
 }
 
 static void ide_set_multiple_mode(void)
 {
     write_log ("IDE%d drive multiple mode = %d\n", ide->num, ide_nsector);
+    if (ide_nsector > MAX_IDE_MULTIPLE_SECTORS || (ide_nsector & (ide_nsector - 1))) {
+	ide_fail();
+	return;
+    }
     ide->multiple_mode = ide_nsector;
     ide_interrupt();
 }
@@ -227,20 +334,78 @@ static void ide_set_features(void)
     ide_fail();
 }
 
+/* Check a read or write command and return its sector count, or 0 if
+   it has failed.  */
+static int ide_rw_start(int multi)
+{
+    int nsec = ide_nsector == 0 ? 256 : ide_nsector;
+
+    if (!isdrive (ide) || (multi && ide->multiple_mode == 0)) {
+	ide_fail();
+	return 0;
+    }
+    ide->data_lba = get_lba ();
+    if ((ide->data_lba + nsec) * 512 > ide->hfd.size) {
+	ide_fail_err (IDE_ERR_IDNF);
+	return 0;
+    }
+    return nsec;
+}
+
+/* The whole request is read in one go; the guest then only pulls words
+   out of secbuf.  */
 static void ide_read_sectors(int multi)
 {
-    ide_fail();
+    int nsec = ide_rw_start (multi);
+
+    if (nsec == 0)
+	return;
+    if (IDE_LOG > 0)
+	write_log ("IDE%d read %d sectors at %llu\n", ide->num, nsec, ide->data_lba);
+    if (hdf_read (&ide->hfd, ide->secbuf, ide->data_lba * 512, nsec * 512) != nsec * 512) {
+	ide_fail_err (IDE_ERR_UNC);
+	return;
+    }
+    put_lba (ide->data_lba + nsec - 1);
+    ide_data_ready (nsec * 512, multi ? ide->multiple_mode : 1, 0);
+    ide_interrupt();
 }
 
+/* Written data is collected in secbuf and goes out in one go when the
+   last block has arrived.  */
 static void ide_write_sectors(int multi)
 {
-    ide_fail();
+    int nsec = ide_rw_start (multi);
+
+    if (nsec == 0)
+	return;
+    if (ide->readonly) {
+	ide_fail();
+	return;
+    }
+    if (IDE_LOG > 0)
+	write_log ("IDE%d write %d sectors at %llu\n", ide->num, nsec, ide->data_lba);
+    ide_data_ready (nsec * 512, multi ? ide->multiple_mode : 1, 1);
+    ide->status |= IDE_STATUS_DRDY;
+}
+
+static void ide_write_done(void)
+{
+    if (hdf_write (&ide->hfd, ide->secbuf, ide->data_lba * 512, ide->data_size) != ide->data_size) {
+	ide_fail_err (IDE_ERR_UNC);
+	return;
+    }
+    put_lba (ide->data_lba + ide->data_size / 512 - 1);
+    ide->data_size = 0;
+    ide_interrupt();
 }
 
 static void ide_do_command(uae_u8 cmd)
 {
     if (IDE_LOG > 1)
 	write_log ("**** IDE%d command %02.2X\n", ide->num, cmd);
+    if (!isdrive (ide))
+	return;
     ide->status &= ~(IDE_STATUS_DRDY | IDE_STATUS_DRQ | IDE_STATUS_ERR);
     ide_error = 0;
 
@@ -266,23 +431,107 @@ static void ide_do_command(uae_u8 cmd)
 	ide_fail();
     } else if (cmd == 0xef) { /* set features  */
 	ide_set_features();
+    } else if (cmd == 0xe7 || cmd == 0x00) { /* flush cache, nop */
+	ide_interrupt();
     } else {
 	ide_fail();
 	write_log ("IDE: unknown command %x\n", cmd);
     }
 }
 
+static void ide_soft_reset(void)
+{
+    int i;
+
+    for (i = 0; i < 2; i++) {
+	struct ide_hdf *d = &idedrive[ide2 + i];
+	d->data_size = 0;
+	d->irq_delay = 0;
+	d->status = isdrive (d) ? IDE_STATUS_DRDY | IDE_STATUS_DSC : 0;
+    }
+    ide_error = 1;
+    ide_sector = ide_nsector = 1;
+    ide_lcyl = ide_hcyl = 0;
+}
+
+/* Move the data pointer on after LEN bytes went through the data port:
+   finish the transfer, or signal the next DRQ block.  */
+STATIC_INLINE void ide_data_advance (int len)
+{
+    ide->data_offset += len;
+    if (ide->data_offset == ide->data_size) {
+	ide->status &= ~IDE_STATUS_DRQ;
+	if (ide->direction)
+	    ide_write_done ();
+	else
+	    ide->data_size = 0;
+    } else if ((ide->data_offset & (ide->data_multi * 512 - 1)) == 0) {
+	ide_interrupt ();
+    }
+}
+
 static uae_u16 ide_get_data (void)
 {
-    if (IDE_LOG > 0)
-	write_log ("IDE%d DATA read without DRQ!?\n", ide->num);
-    return 0xffff;
+    uae_u16 v;
+
+    if (ide->data_size == 0 || ide->direction) {
+	if (IDE_LOG > 0)
+	    write_log ("IDE%d DATA read without DRQ!?\n", ide->num);
+	return 0xffff;
+    }
+    v = (ide->secbuf[ide->data_offset] << 8) | ide->secbuf[ide->data_offset + 1];
+    ide_data_advance (2);
+    return v;
 }
 
 static void ide_put_data (uae_u16 v)
 {
-    if (IDE_LOG > 0)
-	write_log ("IDE%d DATA write without DRQ!?\n", ide->num);
+    if (ide->data_size == 0 || !ide->direction) {
+	if (IDE_LOG > 0)
+	    write_log ("IDE%d DATA write without DRQ!?\n", ide->num);
+	return;
+    }
+    ide->secbuf[ide->data_offset] = v >> 8;
+    ide->secbuf[ide->data_offset + 1] = v;
+    ide_data_advance (2);
+}
+
+/* Drivers mostly move data with MOVE.L, so take longwords in one piece
+   unless they straddle the end of a DRQ block.  */
+STATIC_INLINE int ide_data_long_ok (void)
+{
+    int left = ide->data_multi * 512 - (ide->data_offset & (ide->data_multi * 512 - 1));
+    return ide->data_size != 0 && left >= 4;
+}
+
+static uae_u32 ide_get_data_long (void)
+{
+    uae_u8 *p;
+
+    if (!ide_data_long_ok () || ide->direction) {
+	uae_u32 v = ide_get_data () << 16;
+	return v | ide_get_data ();
+    }
+    p = ide->secbuf + ide->data_offset;
+    ide_data_advance (4);
+    return (p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+static void ide_put_data_long (uae_u32 v)
+{
+    uae_u8 *p;
+
+    if (!ide_data_long_ok () || !ide->direction) {
+	ide_put_data (v >> 16);
+	ide_put_data (v);
+	return;
+    }
+    p = ide->secbuf + ide->data_offset;
+    p[0] = v >> 24;
+    p[1] = v >> 16;
+    p[2] = v >> 8;
+    p[3] = v;
+    ide_data_advance (4);
 }
 
 static int get_ide_reg (uaecptr addr)
@@ -335,11 +584,44 @@ static uae_u32 ide_read (uaecptr addr)
 	return 0;
     }
     ide_reg = get_ide_reg(addr);
-    /* Emulated "ide killer". Prevents long KS boot delay if no drives installed */
-    if (ide_reg == IDE_STATUS)
-	return 0x7f;
-    return 0xff;
-
+    if (!isdrive (ide)) {
+	/* Emulated "ide killer". Prevents long KS boot delay if no drives installed */
+	if (ide_reg == IDE_STATUS)
+	    return isdrive (&idedrive[ide2 + (ide_drv ^ 1)]) ? 0 : 0x7f;
+	return 0xff;
+    }
+    switch (ide_reg)
+    {
+	case IDE_DATA:
+	    v = ide_get_data () >> 8;
+	break;
+	case IDE_ERROR:
+	    v = ide_error;
+	break;
+	case IDE_NSECTOR:
+	    v = ide_nsector;
+	break;
+	case IDE_SECTOR:
+	    v = ide_sector;
+	break;
+	case IDE_LCYL:
+	    v = ide_lcyl;
+	break;
+	case IDE_HCYL:
+	    v = ide_hcyl;
+	break;
+	case IDE_SELECT:
+	    v = ide_select;
+	break;
+	case IDE_STATUS:
+	case IDE_DEVCON:
+	    v = ide->status;
+	break;
+	default:
+	    v = 0xff;
+	break;
+    }
+    return v;
 }
 
 static void ide_write (uaecptr addr, uae_u32 val)
@@ -372,6 +654,8 @@ static void ide_write (uaecptr addr, uae_u32 val)
 	case IDE_DRVADDR:
 	break;
 	case IDE_DEVCON:
+	    if ((val & 4) && !(ide_devcon & 4))
+		ide_soft_reset ();
 	    ide_devcon = val;
 	break;
 	case IDE_DATA:
@@ -438,7 +722,7 @@ static void gayle_bput (uaecptr, uae_u32) REGPARAM;
 addrbank gayle_bank = {
     gayle_lget, gayle_wget, gayle_bget,
     gayle_lput, gayle_wput, gayle_bput,
-    default_xlate, default_check, NULL, "Gayle (low)"
+    default_xlate, default_check, NULL, "Gayle (low)", NULL
 };
 
 #if 0
@@ -458,6 +742,8 @@ static uae_u32 REGPARAM2 gayle_lget (uaecptr addr)
 #ifdef JIT
     special_mem |= S_READ;
 #endif
+    if (get_ide_reg (addr) == IDE_DATA)
+	return ide_get_data_long ();
     v = gayle_wget (addr) << 16;
     v |= gayle_wget (addr + 2);
     return v;
@@ -501,6 +787,10 @@ static void REGPARAM2 gayle_lput (uaecptr addr, uae_u32 value)
 #ifdef JIT
     special_mem |= S_WRITE;
 #endif
+    if (get_ide_reg (addr) == IDE_DATA) {
+	ide_put_data_long (value);
+	return;
+    }
     gayle_wput (addr, value >> 16);
     gayle_wput (addr + 2, value & 0xffff);
 }
@@ -572,7 +862,7 @@ static void gayle2_bput (uaecptr, uae_u32) REGPARAM;
 addrbank gayle2_bank = {
     gayle2_lget, gayle2_wget, gayle2_bget,
     gayle2_lput, gayle2_wput, gayle2_bput,
-    default_xlate, default_check, NULL, "Gayle (high)"
+    default_xlate, default_check, NULL, "Gayle (high)", NULL
 };
 
 static uae_u32 REGPARAM2 gayle2_lget (uaecptr addr)
@@ -755,7 +1045,7 @@ static void REGPARAM2 mbres_bput (uaecptr addr, uae_u32 value)
 addrbank mbres_bank = {
     mbres_lget, mbres_wget, mbres_bget,
     mbres_lput, mbres_wput, mbres_bput,
-    default_xlate, default_check, NULL, "Motherboard Resources"
+    default_xlate, default_check, NULL, "Motherboard Resources", NULL
 };
 
 void gayle_hsync (void)
@@ -813,7 +1103,7 @@ static void gayle_attr_bput (uaecptr, uae_u32) REGPARAM;
 addrbank gayle_attr_bank = {
     gayle_attr_lget, gayle_attr_wget, gayle_attr_bget,
     gayle_attr_lput, gayle_attr_wput, gayle_attr_bput,
-    default_xlate, default_check, NULL, "Gayle PCMCIA attribute"
+    default_xlate, default_check, NULL, "Gayle PCMCIA attribute", NULL
 };
 
 static uae_u32 REGPARAM2 gayle_attr_lget (uaecptr addr)
@@ -888,11 +1178,92 @@ static void initide (void)
 
 }
 
+void gayle_free_ide_units (void)
+{
+    int i;
+
+    for (i = 0; i < 4; i++) {
+	struct ide_hdf *ide = &idedrive[i];
+	if (ide->hfd.fd == 0)
+	    continue;
+	hdf_overlay_close (&ide->hfd);
+	hdf_unmap (&ide->hfd);
+	fclose (ide->hfd.fd);
+	memset (&ide->hfd, 0, sizeof ide->hfd);
+	ide->data_size = 0;
+	ide->status = 0;
+    }
+}
+
+/* Attach the image PATH as IDE drive CH.  If SECTORS and SURFACES are 0,
+   a 16 head, 63 sector geometry is made up.  The other arguments are
+   for hardfile-style configurations and are ignored.  */
+int gayle_add_ide_unit (int ch, char *path, int blocksize, int readonly,
+			char *devname, int sectors, int surfaces, int reserved,
+			int bootpri, char *filesys)
+{
+    struct ide_hdf *ide;
+    FILE *f;
+
+    if (ch < 0 || ch >= 4)
+	return -1;
+    ide = &idedrive[ch];
+    f = fopen (path, readonly ? "rb" : "r+b");
+    if (f == 0 && !readonly) {
+	f = fopen (path, "rb");
+	readonly = 1;
+    }
+    if (f == 0) {
+	write_log ("IDE%d: can't open %s\n", ch, path);
+	return -1;
+    }
+    memset (&ide->hfd, 0, sizeof ide->hfd);
+    ide->hfd.fd = f;
+    fseek (f, 0, SEEK_END);
+    ide->hfd.size = ftell (f) & ~511;
+    ide->hfd.blocksize = 512;
+    if (ide->hfd.size == 0) {
+	write_log ("IDE%d: %s is empty\n", ch, path);
+	fclose (f);
+	ide->hfd.fd = 0;
+	return -1;
+    }
+    if (!readonly && currprefs.hardfile_overlay[0]
+	&& !hdf_overlay_open (&ide->hfd, path, currprefs.hardfile_overlay))
+    {
+	readonly = 1;
+	fclose (ide->hfd.fd);
+	ide->hfd.fd = fopen (path, "rb");
+    }
+    hdf_map (&ide->hfd);
+
+    ide->secspertrack = sectors && surfaces ? sectors : 63;
+    ide->heads = sectors && surfaces ? surfaces : 16;
+    ide->cyls = ide->hfd.size / 512 / (ide->heads * ide->secspertrack);
+    if (ide->cyls > 65535)
+	ide->cyls = 65535;
+    ide->readonly = readonly;
+    ide->multiple_mode = 0;
+    ide->data_size = 0;
+    ide->status = IDE_STATUS_DRDY | IDE_STATUS_DSC;
+    ide->num = ch;
+    write_log ("IDE%d: %s, %d cylinders, %d heads, %d sectors%s\n", ch, path,
+	       ide->cyls, ide->heads, ide->secspertrack, readonly ? ", read-only" : "");
+    return 1;
+}
+
 void gayle_reset (int hardreset)
 {
     static char bankname[100];
+    int i;
+
     initide ();
     if (hardreset) {
+	gayle_free_ide_units ();
+	for (i = 0; i < 2; i++) {
+	    if (currprefs.ide_hardfile[i][0])
+		gayle_add_ide_unit (i, currprefs.ide_hardfile[i], 512, 0, "", 0, 0, 0, 0, "");
+	}
 	ramsey_config = 0;
 	gary_coldboot = 1;
 	gary_timeout = 0;
@@ -9,6 +9,7 @@
 #include "sysconfig.h"
 #include "sysdeps.h"
 
+#include "threaddep/thread.h"
 #include "options.h"
 #include "memory.h"
 #include "custom.h"
@@ -18,6 +19,17 @@
 #include "autoconf.h"
 #include "execlib.h"
 #include "filesys.h"
+#include "native2amiga.h"
+
+#if defined _POSIX_MAPPED_FILES && _POSIX_MAPPED_FILES > 0
+#include <sys/mman.h>
+#define HDF_MMAP
+#endif
+
+/* Like scsidev.c, we only use threads if the filesystem does.  */
+#ifdef UAE_FILESYS_THREADS
+#define UAE_HARDFILE_THREADS
+#endif
 
 #define CMD_INVALID	0
 #define CMD_RESET	1
@@ -59,10 +71,90 @@ static int opencount = 0;
 
 static uae_u32 nscmd_cmd;
 
-int hdf_read (struct hardfiledata *hfd, void *buffer, uae_u64 offset, int len)
+/* Where the host allows it, the image is mapped read-only and reads are
+   a memcpy from the mapping.  Writes still go through the file; the
+   mapping is shared, so it sees them at once.  */
+
+static int hdf_read_map (struct hardfiledata *hfd, void *buffer, uae_u64 offset, int len)
+{
+    if (offset >= hfd->size)
+	return 0;
+    if (offset + len > hfd->size)
+	len = hfd->size - offset;
+    memcpy (buffer, hfd->map + offset, len);
+    return len;
+}
+
+void hdf_map (struct hardfiledata *hfd)
+{
+#ifdef HDF_MMAP
+    void *p;
+
+    if (hfd->fd == 0 || hfd->map != 0 || hfd->size == 0 || (size_t)hfd->size != hfd->size)
+	return;
+    p = mmap (0, hfd->size, PROT_READ, MAP_SHARED, fileno (hfd->fd), 0);
+    if (p == MAP_FAILED) {
+	write_log ("Can't map hardfile, using file I/O\n");
+	return;
+    }
+    hfd->map = (uae_u8 *)p;
+#endif
+}
+
+void hdf_unmap (struct hardfiledata *hfd)
+{
+#ifdef HDF_MMAP
+    if (hfd->map)
+	munmap (hfd->map, hfd->size);
+#endif
+    hfd->map = 0;
+}
+
+#ifdef UAE_HARDFILE_THREADS
+
+/* pread and pwrite leave the file position alone, so several threads can
+   access the same hardfile at once.  */
+
+static int hdf_read_image (struct hardfiledata *hfd, void *buffer, uae_u64 offset, int len)
+{
+    int fd = fileno (hfd->fd);
+    int result = 0;
+
+    if (hfd->map)
+	return hdf_read_map (hfd, buffer, offset, len);
+    while (len > 0) {
+	int t = pread (fd, (uae_u8 *)buffer + result, len, offset + result);
+	if (t <= 0)
+	    break;
+	result += t;
+	len -= t;
+    }
+    return result;
+}
+
+static int hdf_write_image (struct hardfiledata *hfd, void *buffer, uae_u64 offset, int len)
+{
+    int fd = fileno (hfd->fd);
+    int result = 0;
+
+    while (len > 0) {
+	int t = pwrite (fd, (uae_u8 *)buffer + result, len, offset + result);
+	if (t <= 0)
+	    break;
+	result += t;
+	len -= t;
+    }
+    return result;
+}
+
+#else
+
+static int hdf_read_image (struct hardfiledata *hfd, void *buffer, uae_u64 offset, int len)
 {
     int result = 0;
 
+    if (hfd->map)
+	return hdf_read_map (hfd, buffer, offset, len);
     if (fseek (hfd->fd, offset, SEEK_SET) != 0)
 	return 0;
     do {
@@ -75,7 +167,7 @@ int hdf_read (struct hardfiledata *hfd, void *buffer, uae_u64 offset, int len)
     return result;
 }
 
-int hdf_write (struct hardfiledata *hfd, void *buffer, uae_u64 offset, int len)
+static int hdf_write_image (struct hardfiledata *hfd, void *buffer, uae_u64 offset, int len)
 {
     int result = 0;
 
@@ -86,11 +178,240 @@ int hdf_write (struct hardfiledata *hfd, void *buffer, uae_u64 offset, int len)
 	result += t;
 	len -= t;
 	if (t == 0)
-	    return result;
+	    break;
     } while (len > 0);
+    /* Reads come from the mapping, which doesn't see the stdio buffer.  */
+    if (hfd->map)
+	fflush (hfd->fd);
     return result;
 }
 
+#endif
+
+/* Copy-on-write overlay.  The image is only ever read; written blocks
+   live in a delta file (see filesys.h).  Writes are serialized so that
+   two of them can't fill in the same partial block at once.  A block's
+   data is always on disk before its bitmap bit, so readers never see a
+   set bit without the data.  */
+
+struct hdf_overlay {
+    int fd;
+    uae_u64 data_offset;
+    uae_u8 *bitmap;
+    uae_sem_t sem;
+};
+
+#define DELTA_BIT(ov, blk) ((ov)->bitmap[(blk) >> 3] & (1 << ((blk) & 7)))
+
+static int delta_io (int fd, uae_u8 *buf, int len, uae_u64 offset, int write)
+{
+    int done = 0;
+
+    while (done < len) {
+	int t = (write ? pwrite (fd, buf + done, len - done, offset + done)
+		 : pread (fd, buf + done, len - done, offset + done));
+	if (t <= 0)
+	    break;
+	done += t;
+    }
+    return done;
+}
+
+static int overlay_read (struct hardfiledata *hfd, uae_u8 *buf, uae_u64 offset, int len)
+{
+    struct hdf_overlay *ov = hfd->overlay;
+    int done = 0;
+
+    if (offset >= hfd->size)
+	return 0;
+    if (offset + len > hfd->size)
+	len = hfd->size - offset;
+    while (done < len) {
+	uae_u64 blk = (offset + done) / HDF_DELTA_BLOCK;
+	int set = DELTA_BIT (ov, blk) != 0;
+	int n = 0, t;
+
+	/* Take the longest run of blocks that come from the same place.  */
+	do {
+	    int in_blk = HDF_DELTA_BLOCK - (offset + done + n) % HDF_DELTA_BLOCK;
+	    n += in_blk;
+	    blk++;
+	} while (done + n < len && (DELTA_BIT (ov, blk) != 0) == set);
+	if (n > len - done)
+	    n = len - done;
+
+	if (set)
+	    t = delta_io (ov->fd, buf + done, n, ov->data_offset + offset + done, 0);
+	else
+	    t = hdf_read_image (hfd, buf + done, offset + done, n);
+	done += t;
+	if (t < n)
+	    break;
+    }
+    return done;
+}
+
+static int overlay_write (struct hardfiledata *hfd, uae_u8 *buf, uae_u64 offset, int len)
+{
+    struct hdf_overlay *ov = hfd->overlay;
+    int done = 0;
+
+    if (offset >= hfd->size)
+	return 0;
+    if (offset + len > hfd->size)
+	len = hfd->size - offset;
+    uae_sem_wait (&ov->sem);
+    while (done < len) {
+	uae_u64 pos = offset + done;
+	uae_u64 blk = pos / HDF_DELTA_BLOCK;
+	int in_blk = pos % HDF_DELTA_BLOCK;
+	int n = HDF_DELTA_BLOCK - in_blk;
+	uae_u8 bit = 1 << (blk & 7);
+
+	if (n > len - done)
+	    n = len - done;
+	if (n < HDF_DELTA_BLOCK && ! DELTA_BIT (ov, blk)) {
+	    /* Partial block written for the first time: start from the image.  */
+	    uae_u8 tmp[HDF_DELTA_BLOCK];
+	    uae_u64 start = blk * HDF_DELTA_BLOCK;
+	    memset (tmp, 0, sizeof tmp);
+	    hdf_read_image (hfd, tmp, start, HDF_DELTA_BLOCK);
+	    memcpy (tmp + in_blk, buf + done, n);
+	    if (delta_io (ov->fd, tmp, HDF_DELTA_BLOCK, ov->data_offset + start, 1) != HDF_DELTA_BLOCK)
+		break;
+	} else if (delta_io (ov->fd, buf + done, n, ov->data_offset + pos, 1) != n)
+	    break;
+	if (! (ov->bitmap[blk >> 3] & bit)) {
+	    ov->bitmap[blk >> 3] |= bit;
+	    if (delta_io (ov->fd, ov->bitmap + (blk >> 3), 1, HDF_DELTA_HEADER + (blk >> 3), 1) != 1)
+		break;
+	}
+	done += n;
+    }
+    uae_sem_post (&ov->sem);
+    return done;
+}
+
+int hdf_read (struct hardfiledata *hfd, void *buffer, uae_u64 offset, int len)
+{
+    if (hfd->overlay)
+	return overlay_read (hfd, (uae_u8 *)buffer, offset, len);
+    return hdf_read_image (hfd, buffer, offset, len);
+}
+
+int hdf_write (struct hardfiledata *hfd, void *buffer, uae_u64 offset, int len)
+{
+    if (hfd->overlay)
+	return overlay_write (hfd, (uae_u8 *)buffer, offset, len);
+    return hdf_write_image (hfd, buffer, offset, len);
+}
+
+/* Switch HFD over to a delta file in DIR.  An existing delta for an image
+   of the same size is continued.  */
+int hdf_overlay_open (struct hardfiledata *hfd, const char *image, const char *dir)
+{
+    struct hdf_overlay *ov;
+    uae_u8 header[HDF_DELTA_HEADER];
+    const char *base = strrchr (image, '/');
+    char *name;
+    FILE *f;
+    int fd, i;
+    int bmsize = hdf_delta_bitmap_size (hfd->size);
+
+    base = base ? base + 1 : image;
+    name = (char *)xmalloc (strlen (dir) + strlen (base) + 8);
+    sprintf (name, "%s/%s.delta", dir, base);
+    fd = open (name, O_RDWR | O_CREAT | O_BINARY, 0666);
+    if (fd < 0) {
+	write_log ("Can't open hardfile delta %s\n", name);
+	free (name);
+	return 0;
+    }
+    ov = (struct hdf_overlay *)xcalloc (sizeof *ov, 1);
+    ov->fd = fd;
+    ov->data_offset = hdf_delta_data_offset (hfd->size);
+    ov->bitmap = (uae_u8 *)xcalloc (bmsize, 1);
+
+    if (delta_io (fd, header, HDF_DELTA_HEADER, 0, 0) == HDF_DELTA_HEADER) {
+	uae_u64 size = 0;
+	for (i = 0; i < 8; i++)
+	    size = (size << 8) | header[16 + i];
+	if (memcmp (header, HDF_DELTA_MAGIC, 8) != 0
+	    || ((header[8] << 24) | (header[9] << 16) | (header[10] << 8) | header[11]) != HDF_DELTA_BLOCK
+	    || size != hfd->size
+	    || delta_io (fd, ov->bitmap, bmsize, HDF_DELTA_HEADER, 0) != bmsize)
+	{
+	    write_log ("%s doesn't belong to %s\n", name, image);
+	    goto fail;
+	}
+    } else {
+	memset (header, 0, sizeof header);
+	memcpy (header, HDF_DELTA_MAGIC, 8);
+	header[10] = HDF_DELTA_BLOCK >> 8;
+	header[11] = HDF_DELTA_BLOCK & 255;
+	for (i = 0; i < 8; i++)
+	    header[16 + i] = hfd->size >> (56 - 8 * i);
+	if (ftruncate (fd, ov->data_offset + hfd->size) != 0
+	    || delta_io (fd, header, HDF_DELTA_HEADER, 0, 1) != HDF_DELTA_HEADER
+	    || delta_io (fd, ov->bitmap, bmsize, HDF_DELTA_HEADER, 1) != bmsize)
+	{
+	    write_log ("Can't create hardfile delta %s\n", name);
+	    goto fail;
+	}
+    }
+
+    /* The image itself is never written again.  */
+    f = fopen (image, "rb");
+    if (f == 0)
+	goto fail;
+    hdf_unmap (hfd);
+    fclose (hfd->fd);
+    hfd->fd = f;
+    uae_sem_init (&ov->sem, 0, 1);
+    hfd->overlay = ov;
+    write_log ("Hardfile %s: writes go to %s\n", image, name);
+    free (name);
+    return 1;
+
+  fail:
+    close (fd);
+    free (ov->bitmap);
+    free (ov);
+    free (name);
+    return 0;
+}
+
+void hdf_overlay_close (struct hardfiledata *hfd)
+{
+    struct hdf_overlay *ov = hfd->overlay;
+
+    if (ov == 0)
+	return;
+    close (ov->fd);
+    free (ov->bitmap);
+    uae_sem_destroy (&ov->sem);
+    free (ov);
+    hfd->overlay = 0;
+}
+
+/* CMD_UPDATE: get written data onto the disk.  With an overlay, that is
+   the delta file.  */
+static void hdf_flush (struct hardfiledata *hfd)
+{
+    if (hfd->overlay) {
+#if defined _POSIX_FSYNC && _POSIX_FSYNC > 0
+	fsync (hfd->overlay->fd);
+#endif
+	return;
+    }
+    if (hfd->fd == 0)
+	return;
+    fflush (hfd->fd);
+#if defined _POSIX_FSYNC && _POSIX_FSYNC > 0
+    fsync (fileno (hfd->fd));
+#endif
+}
+
 static uae_u64 cmd_readx (struct hardfiledata *hfd, uae_u8 *dataptr, uae_u64 offset, uae_u64 len)
 {
     return hdf_read (hfd, dataptr, offset, len);
@@ -100,6 +421,7 @@ static uae_u64 cmd_read (struct hardfiledata *hfd, uaecptr dataptr, uae_u64 offs
     addrbank *bank_data = &get_mem_bank (dataptr);
     if (!bank_data || !bank_data->check (dataptr, len))
 	return 0;
+    memory_dirty (dataptr, len);
     return cmd_readx (hfd, bank_data->xlateaddr (dataptr), offset, len);
 }
 static uae_u64 cmd_writex (struct hardfiledata *hfd, uae_u8 *dataptr, uae_u64 offset, uae_u64 len)
@@ -115,6 +437,254 @@ static uae_u64 cmd_write (struct hardfiledata *hfd, uaecptr dataptr, uae_u64 off
     return cmd_writex (hfd, bank_data->xlateaddr (dataptr), offset, len);
 }
 
+#ifdef UAE_HARDFILE_THREADS
+
+/* CMD_READ and CMD_WRITE requests are queued and carried out by a pool of
+   threads, which reply them with uae_ReplyMsg.  Requests may complete in
+   any order, except that a request never starts while an older one that
+   overlaps it is still queued or running, if either of them writes.  */
+
+#define HARDFILE_THREADS 4
+#define MAX_HF_REQUESTS 64
+
+enum { HFR_FREE, HFR_QUEUED, HFR_RUNNING };
+
+struct hfrequest {
+    int state;
+    unsigned int seq;
+    unsigned int generation;
+    uaecptr request;
+    struct hardfiledata *hfd;
+    int write;
+    uae_u8 *data;
+    uae_u64 offset;
+    uae_u32 len;
+};
+
+static struct hfrequest hfrequests[MAX_HF_REQUESTS];
+/* Protects everything below.  */
+static uae_sem_t hfreq_sem;
+/* Posted whenever a request may have become ready to run.  */
+static uae_sem_t hfreq_avail;
+/* Posted when a request finishes while the main thread waits for one.  */
+static uae_sem_t hfreq_done;
+static int hfreq_waiting;
+static int hfreq_running;
+static unsigned int hfreq_seq;
+/* Bumped on reset; requests from an older generation aren't replied.  */
+static unsigned int hfreq_generation;
+static int hf_threads_started;
+
+static int hfreq_overlap (struct hfrequest *a, struct hfrequest *b)
+{
+    return (a->hfd == b->hfd && (a->write || b->write)
+	    && a->offset < b->offset + b->len
+	    && b->offset < a->offset + a->len);
+}
+
+/* Find the oldest request that can run now.  */
+static struct hfrequest *next_hfrequest (void)
+{
+    struct hfrequest *best = 0;
+    int i, j;
+
+    for (i = 0; i < MAX_HF_REQUESTS; i++) {
+	struct hfrequest *r = hfrequests + i;
+
+	if (r->state != HFR_QUEUED || (best && (int)(r->seq - best->seq) > 0))
+	    continue;
+	for (j = 0; j < MAX_HF_REQUESTS; j++) {
+	    struct hfrequest *o = hfrequests + j;
+	    if (o->state != HFR_FREE && (int)(o->seq - r->seq) < 0 && hfreq_overlap (o, r))
+		break;
+	}
+	if (j == MAX_HF_REQUESTS)
+	    best = r;
+    }
+    return best;
+}
+
+static void *hardfile_thread (void *dummy)
+{
+    for (;;) {
+	struct hfrequest *r;
+	uaecptr request;
+	uae_u32 actual;
+	int stale;
+
+	uae_sem_wait (&hfreq_avail);
+	uae_sem_wait (&hfreq_sem);
+	r = next_hfrequest ();
+	if (r) {
+	    r->state = HFR_RUNNING;
+	    hfreq_running++;
+	}
+	uae_sem_post (&hfreq_sem);
+	if (!r)
+	    continue;
+	/* There may be more for the other threads.  */
+	uae_sem_post (&hfreq_avail);
+
+	if (r->write)
+	    actual = hdf_write (r->hfd, r->data, r->offset, r->len);
+	else
+	    actual = hdf_read (r->hfd, r->data, r->offset, r->len);
+
+	uae_sem_wait (&hfreq_sem);
+	request = r->request;
+	stale = r->generation != hfreq_generation;
+	r->state = HFR_FREE;
+	hfreq_running--;
+	if (hfreq_waiting) {
+	    hfreq_waiting = 0;
+	    uae_sem_post (&hfreq_done);
+	}
+	uae_sem_post (&hfreq_sem);
+	/* Requests that overlapped this one can start now.  */
+	uae_sem_post (&hfreq_avail);
+
+	if (!stale) {
+	    put_long (request + 32, actual); /* io_Actual */
+	    uae_ReplyMsg (request);
+	}
+    }
+    return 0;
+}
+
+static void start_hardfile_threads (void)
+{
+    int i;
+
+    if (hf_threads_started)
+	return;
+    for (i = 0; i < HARDFILE_THREADS; i++) {
+	uae_thread_id tid;
+	if (uae_start_thread (hardfile_thread, 0, &tid) == 0)
+	    hf_threads_started++;
+    }
+    if (!hf_threads_started)
+	write_log ("hardfile: can't start I/O threads\n");
+}
+
+/* Queue a read or write for the thread pool.  Returns 0 if it has to be
+   done synchronously instead.  */
+static int queue_hfrequest (uaecptr request, struct hardfiledata *hfd, int write,
+			    uaecptr dataptr, uae_u64 offset, uae_u32 len)
+{
+    addrbank *bank_data = &get_mem_bank (dataptr);
+    struct hfrequest *r;
+    int i;
+
+    start_hardfile_threads ();
+    if (!hf_threads_started)
+	return 0;
+    if (!bank_data || !bank_data->check (dataptr, len))
+	return 0;
+    if (!write)
+	memory_dirty (dataptr, len);
+
+    for (;;) {
+	uae_sem_wait (&hfreq_sem);
+	for (i = 0; i < MAX_HF_REQUESTS; i++)
+	    if (hfrequests[i].state == HFR_FREE)
+		break;
+	if (i < MAX_HF_REQUESTS)
+	    break;
+	/* All slots busy.  The threads free them before replying, so
+	   this can't deadlock on the native2amiga pipe.  */
+	hfreq_waiting = 1;
+	uae_sem_post (&hfreq_sem);
+	uae_sem_wait (&hfreq_done);
+    }
+    r = hfrequests + i;
+    r->state = HFR_QUEUED;
+    r->seq = hfreq_seq++;
+    r->generation = hfreq_generation;
+    r->request = request;
+    r->hfd = hfd;
+    r->write = write;
+    r->data = bank_data->xlateaddr (dataptr);
+    r->offset = offset;
+    r->len = len;
+    uae_sem_post (&hfreq_sem);
+
+    /* clear IOF_QUICK, we'll reply later */
+    put_byte (request + 30, get_byte (request + 30) & ~1);
+    uae_sem_post (&hfreq_avail);
+    return 1;
+}
+
+/* Wait until no request for HFD is queued or running, so that a request
+   done synchronously can't overtake an older one.  */
+static void drain_hfrequests (struct hardfiledata *hfd)
+{
+    for (;;) {
+	int i, busy = 0;
+
+	uae_sem_wait (&hfreq_sem);
+	for (i = 0; i < MAX_HF_REQUESTS; i++)
+	    if (hfrequests[i].state != HFR_FREE && hfrequests[i].hfd == hfd)
+		busy = 1;
+	if (busy)
+	    hfreq_waiting = 1;
+	uae_sem_post (&hfreq_sem);
+	if (!busy)
+	    break;
+	uae_sem_wait (&hfreq_done);
+    }
+}
+
+/* Remove REQUEST from the queue if it hasn't started yet.  */
+static int abort_hfrequest (uaecptr request)
+{
+    int i, found = 0;
+
+    uae_sem_wait (&hfreq_sem);
+    for (i = 0; i < MAX_HF_REQUESTS; i++) {
+	struct hfrequest *r = hfrequests + i;
+	if (r->state == HFR_QUEUED && r->request == request) {
+	    r->state = HFR_FREE;
+	    found = 1;
+	    break;
+	}
+    }
+    uae_sem_post (&hfreq_sem);
+    return found;
+}
+
+#endif
+
+void hardfile_reset (void)
+{
+#ifdef UAE_HARDFILE_THREADS
+    int i;
+
+    if (!hf_threads_started)
+	return;
+
+    uae_sem_wait (&hfreq_sem);
+    hfreq_generation++;
+    for (i = 0; i < MAX_HF_REQUESTS; i++)
+	if (hfrequests[i].state == HFR_QUEUED)
+	    hfrequests[i].state = HFR_FREE;
+    uae_sem_post (&hfreq_sem);
+
+    /* Requests already running may still write to Amiga memory.  */
+    for (;;) {
+	int running;
+
+	uae_sem_wait (&hfreq_sem);
+	running = hfreq_running;
+	if (running)
+	    hfreq_waiting = 1;
+	uae_sem_post (&hfreq_sem);
+	if (!running)
+	    break;
+	uae_sem_wait (&hfreq_done);
+    }
+#endif
+}
+
 static uae_u32 hardfile_open (TrapContext *dummy)
 {
     uaecptr tmp1 = m68k_areg (regs, 1); /* IOReq */
@@ -147,10 +717,11 @@ static uae_u32 hardfile_expunge (TrapContext *dummy)
     return 0; /* Simply ignore this one... */
 }
 
+/* Returns nonzero if the request was queued, and will be replied by one
+   of the I/O threads.  */
 static uae_u32 hardfile_beginio (TrapContext *dummy)
 {
     uae_u32 request, len, dataptr, offset, actual = 0, cmd;
-    uae_u32 retval = m68k_dreg (regs, 0);
     int unit;
     struct hardfiledata *hfd;
 
@@ -183,6 +754,11 @@ static uae_u32 hardfile_beginio (TrapContext *dummy)
 	if (len + offset > (uae_u32)hfd->size)
 	    goto bad_command;
 
+#ifdef UAE_HARDFILE_THREADS
+	if (queue_hfrequest (request, hfd, 0, dataptr, offset, len))
+	    return 1;
+	drain_hfrequests (hfd);
+#endif
 	actual = (uae_u32)cmd_read (hfd, dataptr, offset, len);
 	put_long (request + 32, actual);
 	break;
@@ -200,6 +776,11 @@ static uae_u32 hardfile_beginio (TrapContext *dummy)
 	if (len + offset > (uae_u32)hfd->size)
 	    goto bad_command;
 
+#ifdef UAE_HARDFILE_THREADS
+	if (queue_hfrequest (request, hfd, 1, dataptr, offset, len))
+	    return 1;
+	drain_hfrequests (hfd);
+#endif
 	actual = (uae_u32)cmd_write (hfd, dataptr, offset, len);
 	put_long (request + 32, actual); /* set io_Actual */
 	break;
@@ -225,8 +806,16 @@ static uae_u32 hardfile_beginio (TrapContext *dummy)
 	put_long (request + 32, 0);
 	break;
 
-	/* Some commands that just do nothing and return zero */
      case CMD_UPDATE:
+#ifdef UAE_HARDFILE_THREADS
+	/* Earlier writes may still be in the thread pool.  */
+	drain_hfrequests (hfd);
+#endif
+	hdf_flush (hfd);
+	put_long (request + 32, 0);
+	break;
+
+	/* Some commands that just do nothing and return zero */
      case CMD_CLEAR:
      case 9: /* Motor */
      case 10: /* Seek */
@@ -237,13 +826,11 @@ static uae_u32 hardfile_beginio (TrapContext *dummy)
      case 20: /* AddChangeInt */
      case 21: /* RemChangeInt */
 	put_long (request + 32, 0); /* io_Actual */
-	retval = 0;
 	break;
 
      default:
 	/* Command not understood. */
 	put_byte (request + 31, (uae_u8)-3); /* io_Error */
-	retval = 0;
 	break;
     }
 #if 0
@@ -253,11 +840,21 @@ static uae_u32 hardfile_beginio (TrapContext *dummy)
 	CallLib (get_long (4), -378);
     }
 #endif
-    return retval;
+    return 0;
 }
 
+/* Returns 0 if the request was aborted and has to be replied.  */
 static uae_u32 hardfile_abortio (TrapContext *dummy)
 {
+#ifdef UAE_HARDFILE_THREADS
+    uaecptr request = m68k_areg (regs, 1);
+
+    if (abort_hfrequest (request)) {
+	put_byte (request + 31, (uae_u8)-2); /* IOERR_ABORTED */
+	put_long (request + 32, 0); /* io_Actual */
+	return 0;
+    }
+#endif
     return (uae_u32)-3;
 }
 
@@ -267,6 +864,12 @@ void hardfile_install (void)
     uae_u32 initcode, openfunc, closefunc, expungefunc;
     uae_u32 beginiofunc, abortiofunc;
 
+#ifdef UAE_HARDFILE_THREADS
+    uae_sem_init (&hfreq_sem, 0, 1);
+    uae_sem_init (&hfreq_avail, 0, 0);
+    uae_sem_init (&hfreq_done, 0, 0);
+#endif
+
     ROM_hardfile_resname = ds ("uaehf.device");
     ROM_hardfile_resid = ds ("UAE hardfile.device 0.2");
 
@@ -309,6 +912,8 @@ void hardfile_install (void)
     /* BeginIO */
     beginiofunc = here ();
     calltrap (deftrap (hardfile_beginio));
+    dw (0x4A80); /* tst.l d0 */
+    dw (0x6618); /* bne.b +24 */
     dw (0x48E7); dw (0x8002); /* movem.l d0/a6,-(a7) */
     dw (0x0829); dw (0); dw (30); /* btst #0,30(a1) */
     dw (0x6608); /* bne.b +8 */
@@ -319,7 +924,14 @@ void hardfile_install (void)
 
     /* AbortIO */
     abortiofunc = here ();
-    calltrap (deftrap (hardfile_abortio)); dw (RTS);
+    calltrap (deftrap (hardfile_abortio));
+    dw (0x4A80); /* tst.l d0 */
+    dw (0x6610); /* bne.b +16 */
+    dw (0x48E7); dw (0x8002); /* movem.l d0/a6,-(a7) */
+    dw (0x2C78); dw (0x0004); /* move.l 4,a6 */
+    dw (0x4EAE); dw (-378); /* jsr ReplyMsg(a6) */
+    dw (0x4CDF); dw (0x4001); /* movem.l (a7)+,d0/a6 */
+    dw (RTS);
 
     /* FuncTable */
     functable = here ();
@@ -0,0 +1,135 @@
+/*
+ * hdfdelta
+ *
+ * Commit or discard the copy-on-write delta of a hardfile
+ * (see hardfile_overlay in docs/README)
+ */
+
+#include "sysconfig.h"
+#include "sysdeps.h"
+
+#include "uae.h"
+#include "filesys.h"
+
+void write_log (const char *s,...)
+{
+    fprintf (stderr, "%s", s);
+}
+
+static uae_u64 image_size;
+static uae_u8 *bitmap;
+
+static int load_delta (FILE *delta, const char *name)
+{
+    uae_u8 header[HDF_DELTA_HEADER];
+    uae_u64 size = 0;
+    int i;
+
+    if (fread (header, 1, sizeof header, delta) != sizeof header
+	|| memcmp (header, HDF_DELTA_MAGIC, 8) != 0
+	|| ((header[8] << 24) | (header[9] << 16) | (header[10] << 8) | header[11]) != HDF_DELTA_BLOCK)
+    {
+	fprintf (stderr, "%s is not a hardfile delta.\n", name);
+	return 0;
+    }
+    for (i = 0; i < 8; i++)
+	size = (size << 8) | header[16 + i];
+    if (size != image_size) {
+	fprintf (stderr, "%s was made for an image of a different size.\n", name);
+	return 0;
+    }
+    bitmap = (uae_u8 *)xmalloc (hdf_delta_bitmap_size (size));
+    if (fread (bitmap, 1, hdf_delta_bitmap_size (size), delta) != hdf_delta_bitmap_size (size)) {
+	fprintf (stderr, "%s is truncated.\n", name);
+	return 0;
+    }
+    return 1;
+}
+
+static int commit (FILE *image, FILE *delta)
+{
+    uae_u64 blk, n = 0;
+    uae_u8 buf[HDF_DELTA_BLOCK];
+
+    for (blk = 0; blk < hdf_delta_blocks (image_size); blk++) {
+	size_t len = HDF_DELTA_BLOCK;
+
+	if (! (bitmap[blk >> 3] & (1 << (blk & 7))))
+	    continue;
+	if (blk * HDF_DELTA_BLOCK + len > image_size)
+	    len = image_size - blk * HDF_DELTA_BLOCK;
+	if (fseeko (delta, hdf_delta_data_offset (image_size) + blk * HDF_DELTA_BLOCK, SEEK_SET) != 0
+	    || fread (buf, 1, len, delta) != len
+	    || fseeko (image, blk * HDF_DELTA_BLOCK, SEEK_SET) != 0
+	    || fwrite (buf, 1, len, image) != len)
+	{
+	    fprintf (stderr, "I/O error at block %lu.\n", (unsigned long)blk);
+	    return 0;
+	}
+	n++;
+    }
+    /* The delta is removed next, so its blocks must be safe in the image.  */
+    if (fflush (image) != 0 || fsync (fileno (image)) != 0) {
+	fprintf (stderr, "Can't write image.\n");
+	return 0;
+    }
+    printf ("%lu blocks written.\n", (unsigned long)n);
+    return 1;
+}
+
+static void hdfdelta_usage (void)
+{
+    fprintf (stderr, "Usage: hdfdelta commit|discard|info image delta\n");
+    exit (1);
+}
+
+int main (int argc, char **argv)
+{
+    FILE *image, *delta;
+    int do_commit = 0, ok;
+
+    if (argc != 4)
+	hdfdelta_usage ();
+    if (strcmp (argv[1], "commit") == 0)
+	do_commit = 1;
+    else if (strcmp (argv[1], "discard") != 0 && strcmp (argv[1], "info") != 0)
+	hdfdelta_usage ();
+
+    image = fopen (argv[2], do_commit ? "r+b" : "rb");
+    if (image == 0) {
+	fprintf (stderr, "Can't open %s.\n", argv[2]);
+	return 1;
+    }
+    fseeko (image, 0, SEEK_END);
+    image_size = ftello (image);
+
+    delta = fopen (argv[3], "rb");
+    if (delta == 0) {
+	fprintf (stderr, "Can't open %s.\n", argv[3]);
+	return 1;
+    }
+    if (! load_delta (delta, argv[3]))
+	return 1;
+
+    if (strcmp (argv[1], "info") == 0) {
+	uae_u64 blk, n = 0;
+	for (blk = 0; blk < hdf_delta_blocks (image_size); blk++)
+	    if (bitmap[blk >> 3] & (1 << (blk & 7)))
+		n++;
+	printf ("%lu of %lu blocks changed.\n", (unsigned long)n,
+		(unsigned long)hdf_delta_blocks (image_size));
+	return 0;
+    }
+
+    ok = do_commit ? commit (image, delta) : 1;
+    fclose (delta);
+    if (fclose (image) != 0)
+	ok = 0;
+    if (! ok)
+	return 1;
+    if (unlink (argv[3]) != 0) {
+	fprintf (stderr, "Can't remove %s.\n", argv[3]);
+	return 1;
+    }
+    return 0;
+}
@@ -35,6 +35,7 @@ extern uaecptr ROM_hardfile_init;
 extern uaecptr filesys_initcode;
 
 extern void hardfile_install (void);
+extern void hardfile_reset (void);
 extern void emulib_install (void);
 extern void expansion_init (void);
 extern void expansion_clear (void);
@@ -64,17 +64,42 @@ struct socketbase {
     void *hEvent;		/* thread event handle */
     unsigned int *mtable;	/* window messages allocated for asynchronous event notification */
 #else
-    uae_sem_t sem;		/* semaphore to notify the socket thread of work */
-    uae_thread_id thread;	/* socket thread */
-    int  sockabort[2];		/* pipe used to tell the thread to abort a select */
+    struct socketbase *nextjob;	/* queue of calls for the socket workers */
+    struct socketbase *nextwait;	/* calls waiting in the socket reactor */
+    int busy;			/* a call is queued, running or waiting */
+    int pending;		/* another call was made meanwhile */
+    int abort;			/* abort the current call */
+    int waiting;		/* waiting in the reactor for waitfd */
+    int idlewait;		/* someone waits on idle for busy to clear */
+    uae_sem_t idle;
+    int waitfd;
+    int timed;			/* ...or until deadline */
+    uae_u64 deadline;
+    int wake;			/* why the reactor handed the call back */
+    int again;			/* call is retried after a wait */
+    int epfd;			/* epoll set of the descriptors WaitSelect watches */
+    int epsize;			/* size of the tables below */
+    uae_u8 *epmask;		/* events registered, by native descriptor */
+    uae_u8 *epready;
+    void *epevents;
     int action;
+    int lookuptype;		/* host, service or protocol lookup */
+    int lookuplen;
+    char lookupkey[MAXADDRLEN];
+    void *lookup;		/* service or protocol entry found */
+    void *lookupjob;		/* key of the lookup for the resolvers */
     int s;			/* for accept */
     uae_u32 name;		/* For gethostbyname */
     uae_u32 a_addr;		/* gethostbyaddr, accept */
     uae_u32 a_addrlen;		/* for gethostbyaddr, accept */
     uae_u32 flags;
-    void *buf;
+    uae_u32 bufaddr;		/* send/recv buffer */
     uae_u32 len;
+    void *iov;			/* ...as host segments */
+    int niov;
+    int bounced;		/* ...or copied through bounce */
+    uae_u8 *bounce;
+    uae_u32 bouncesize;
     uae_u32 to, tolen, from, fromlen;
     int nfds;
     uae_u32 sets [3];
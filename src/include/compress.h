@@ -0,0 +1,11 @@
+ /*
+  * UAE - The Un*x Amiga Emulator
+  *
+  * Simple LZ77 block compression
+  */
+
+/* Blocks can't be bigger than this, since match offsets are 16 bits.  */
+#define LZ_MAX_BLOCK 65536
+
+extern int lz_compress (const uae_u8 *src, int len, uae_u8 *dst, int dstlen);
+extern int lz_decompress (const uae_u8 *src, int srclen, uae_u8 *dst, int dstlen);
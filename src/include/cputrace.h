@@ -0,0 +1,14 @@
+ /*
+  * UAE - The Un*x Amiga Emulator
+  *
+  * CPU execution trace recorder
+  */
+
+extern int cputrace_start (const char *name, int with_regs);
+extern void cputrace_stop (void);
+extern int cputrace_active (void);
+extern void cputrace_record (void);
+extern void cputrace_enter (void);
+
+extern void cputrace_decode (const char *name, uae_u32 first, uae_u32 count);
+extern void cputrace_histogram (const char *name, int count);
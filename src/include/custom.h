@@ -64,6 +64,8 @@ STATIC_INLINE int dmaen (unsigned int dmamask)
 #define SPCFLAG_EXEC 1024
 #define SPCFLAG_MODE_CHANGE 8192
 #define SPCFLAG_RESTORE_SANITY 16384
+#define SPCFLAG_BPCHECK 32768
+#define SPCFLAG_CPUTRACE 65536
 
 extern uae_u16 adkcon;
 
@@ -22,5 +22,6 @@ extern int exception_debugging;
 
 extern void debug(void);
 extern void activate_debugger(void);
+extern int debug_bpcheck (void);
 extern int notinrom (void);
 extern const char *debuginfo(int);
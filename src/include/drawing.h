@@ -243,6 +243,7 @@ extern int diwfirstword,diwlastword;
 #define IHF_QUIT_PROGRAM 1
 #define IHF_PICASSO 2
 #define IHF_SOUNDADJUST 3
+#define IHF_HEADLESS 4
 
 extern int inhibit_frame;
 
@@ -39,15 +39,19 @@ struct ev
 };
 
 enum {
-    ev_hsync, ev_copper, ev_audio, ev_cia, ev_blitter, ev_disk,
+    ev_hsync, ev_copper, ev_audio, ev_cia, ev_blitter, ev_disk, ev_profile,
     ev_max
 };
 
 extern struct ev eventtab[ev_max];
 
+/* Runs the handler, counting calls and time for the stats.  */
+extern void stats_run_event (int ev);
+
 extern void reset_frame_rate_hack (void);
 extern void compute_vsynctime (void);
 extern void time_vsync (void);
+extern time_t get_rtc_time (void);
 
 extern void init_gtod (void);
 
@@ -107,7 +111,7 @@ STATIC_INLINE void do_cycles_slow (unsigned long cycles_to_add)
 
 	for (i = 0; i < ev_max; i++) {
 	    if (eventtab[i].active && eventtab[i].evtime == currcycle) {
-		(*eventtab[i].handler)();
+		stats_run_event (i);
 	    }
 	}
 	events_schedule();
@@ -124,7 +128,7 @@ STATIC_INLINE void handle_active_events (void)
     int i;
     for (i = 0; i < ev_max; i++) {
 	if (eventtab[i].active && eventtab[i].evtime == currcycle) {
-	    (*eventtab[i].handler)();
+	    stats_run_event (i);
 	}
     }
 }
@@ -15,6 +15,10 @@ struct hardfiledata {
     int reservedblocks;
     int blocksize;
     FILE *fd;
+    /* Copy-on-write delta, if hardfile_overlay is set.  */
+    struct hdf_overlay *overlay;
+    /* Read-only mapping of the image, or 0.  */
+    uae_u8 *map;
 
     /* geometry from possible RDSK block */
     unsigned int cylinders;
@@ -29,6 +33,20 @@ struct hardfiledata {
 
 #define FILESYS_MAX_BLOCKSIZE 2048
 
+/* Delta file for a copy-on-write hardfile: a header, one bit per
+ * HDF_DELTA_BLOCK bytes of the image telling whether that block has been
+ * written, and then the blocks themselves at their image offset plus
+ * hdf_delta_data_offset.  Unwritten blocks are holes.
+ * Header: magic, block size (4 bytes), 4 spare, image size (8 bytes),
+ * all big endian.  */
+#define HDF_DELTA_MAGIC "UAEHDFD1"
+#define HDF_DELTA_HEADER 24
+#define HDF_DELTA_BLOCK 512
+#define hdf_delta_blocks(size) (((size) + HDF_DELTA_BLOCK - 1) / HDF_DELTA_BLOCK)
+#define hdf_delta_bitmap_size(size) ((hdf_delta_blocks (size) + 7) / 8)
+#define hdf_delta_data_offset(size) \
+    ((HDF_DELTA_HEADER + hdf_delta_bitmap_size (size) + 4095) & ~(uae_u64)4095)
+
 struct uaedev_mount_info;
 
 extern struct hardfiledata *get_hardfile_data (int nr);
@@ -66,5 +84,9 @@ extern void filesys_install (void);
 extern void filesys_install_code (void);
 extern void filesys_store_devinfo (uae_u8 *);
 
+extern int hdf_overlay_open (struct hardfiledata *hfd, const char *image, const char *dir);
+extern void hdf_overlay_close (struct hardfiledata *hfd);
+extern void hdf_map (struct hardfiledata *hfd);
+extern void hdf_unmap (struct hardfiledata *hfd);
 extern int hdf_read (struct hardfiledata *hfd, void *buffer, uae_u64 offset, int len);
 extern int hdf_write (struct hardfiledata *hfd, void *buffer, uae_u64 offset, int len);
@@ -60,6 +60,9 @@ typedef struct a_inode_struct {
     int amigaos_mode;
     /* Unique number for identification.  */
     uae_u32 uniq;
+    /* Hash chains: by uniq, by parent and AmigaOS name, by parent and
+     * host name.  */
+    struct a_inode_struct *uniq_hnext, *aname_hnext, *nname_hnext;
     /* For a directory that is being ExNext()ed, the number of child ainos
        which must be kept locked in core.  */
     unsigned long locked_children;
@@ -68,6 +71,16 @@ typedef struct a_inode_struct {
     /* AmigaOS locking bits.  */
     int shlock;
     long db_offset;
+    /* Changed whenever the file's contents may have changed; readahead
+     * buffers are only trusted while this stays the same.  */
+    unsigned int data_gen;
+    /* Host change notification watch on this directory, or 0.  */
+    int watch;
+    /* Cached host metadata; only trusted while the containing directory
+     * is watched.  */
+    off_t cached_size;
+    unsigned long cached_blocks;
+    time_t cached_mtime;
     unsigned int dir:1;
     unsigned int elock:1;
     /* Nonzero if this came from an entry in our database.  */
@@ -79,6 +92,12 @@ typedef struct a_inode_struct {
     /* If nonzero, this represents a deleted file; the corresponding
      * entry in the database must be cleared.  */
     unsigned int deleted:1;
+    /* The cached_* fields are valid.  */
+    unsigned int stat_cached:1;
+    /* For directories: every host entry has an a_inode among our children.  */
+    unsigned int listed:1;
+    /* For directories: the database file is known not to exist.  */
+    unsigned int fsdb_absent:1;
 } a_inode;
 
 extern char *nname_begin (char *);
@@ -69,12 +69,36 @@ typedef struct {
        for this particular bank. */
     uae_u8 *baseaddr;
     const char *name;
+    /* RAM banks keep one byte per page that is set whenever the page is
+       written, so that incremental savestates only need to store the pages
+       which changed since the last save.  Each user of the map clears its
+       own DIRTY_xxx bit.  */
+    uae_u8 *dirty;
 } addrbank;
 
+#define DIRTY_PAGE_SHIFT 12
+#define DIRTY_PAGE_SIZE (1 << DIRTY_PAGE_SHIFT)
+#define dirty_pages(size) (((size) + DIRTY_PAGE_SIZE - 1) >> DIRTY_PAGE_SHIFT)
+
+#define DIRTY_SAVESTATE 1
+#define DIRTY_REWIND 2
+#define DIRTY_ALL 0xff
+
+/* OFFSET is relative to the start of the bank.  The dirty map has a spare
+   entry at the end for accesses that straddle the end of the bank.  */
+STATIC_INLINE void mark_dirty (uae_u8 *dirty, uae_u32 offset, int size)
+{
+    dirty[offset >> DIRTY_PAGE_SHIFT] = DIRTY_ALL;
+    dirty[(offset + size - 1) >> DIRTY_PAGE_SHIFT] = DIRTY_ALL;
+}
+
 extern uae_u8 *filesysory;
 extern uae_u8 *rtarea;
 
 extern addrbank chipmem_bank;
+extern addrbank bogomem_bank;
+extern addrbank a3000lmem_bank;
+extern addrbank a3000hmem_bank;
 extern addrbank kickmem_bank;
 extern addrbank custom_bank;
 extern addrbank clock_bank;
@@ -82,6 +106,7 @@ extern addrbank cia_bank;
 extern addrbank rtarea_bank;
 extern addrbank expamem_bank;
 extern addrbank fastmem_bank;
+extern addrbank z3fastmem_bank;
 extern addrbank gfxmem_bank;
 extern addrbank gayle_bank;
 extern addrbank gayle2_bank;
@@ -96,6 +121,7 @@ extern void expamem_reset (void);
 extern uae_u32 gfxmem_start;
 extern uae_u8 *gfxmemory;
 extern uae_u32 gfxmem_mask;
+extern int gfxmem_shmid;
 extern int address_space_24;
 
 /* Default memory access functions */
@@ -279,6 +305,9 @@ extern uae_u8 *mapped_malloc (size_t, char *);
 extern void mapped_free (uae_u8 *);
 extern void memory_hardreset (void);
 
+extern uae_u8 *alloc_dirty_map (uae_u32 size);
+extern void memory_dirty (uaecptr addr, uae_u32 size);
+
 uaecptr strcpyha_safe (uaecptr dst, const char *src);
 uaecptr strncpyha_safe (uaecptr dst, const char *src, int size);
 extern char *strcpyah_safe (char *dst, uaecptr src);
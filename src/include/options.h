@@ -95,6 +95,13 @@ struct uae_prefs {
 
     KbdLang keyboard_lang;
     int allow_save;
+    int rewind_size;
+    int rewind_interval;
+    int statefile_compress;
+    char statefile[256];
+    int headless;
+    int headless_frames;
+    char stats_file[256];
     int emul_accuracy;
     int test_drawing_speed;
 
@@ -137,6 +144,8 @@ struct uae_prefs {
     char path_floppy[256];
     char path_hardfile[256];
     char path_rom[256];
+    char hardfile_overlay[256];
+    char ide_hardfile[2][256];
 
     int m68k_speed;
     int cpu_model;
@@ -0,0 +1,14 @@
+ /*
+  * UAE - The Un*x Amiga Emulator
+  *
+  * Sampling profiler for guest code
+  */
+
+extern void profiler_handler (void);
+
+extern int profiler_start (int interval);
+extern void profiler_stop (void);
+extern void profiler_reset (void);
+extern void profiler_flat (int count);
+extern int profiler_write_stacks (const char *name);
+extern int profiler_load_symbols (const char *name, const char *seglist);
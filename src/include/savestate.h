@@ -55,7 +55,7 @@ extern const uae_u8 *restore_custom (const uae_u8 *);
 extern uae_u8 *save_custom (int *, uae_u8 *, int);
 
 extern const uae_u8 *restore_custom_sprite (int num, const uae_u8 *src);
-extern uae_u8 *save_custom_sprite (int num, int *len);
+extern uae_u8 *save_custom_sprite (int num, int *len, uae_u8 *);
 
 extern const uae_u8 *restore_custom_agacolors (const uae_u8 *src);
 extern uae_u8 *save_custom_agacolors (int *len, uae_u8 *);
@@ -64,7 +64,7 @@ extern const uae_u8 *restore_custom_blitter (const uae_u8 *src);
 extern uae_u8 *save_custom_blitter (int *len);
 
 extern const uae_u8 *restore_audio (int, const uae_u8 *);
-extern uae_u8 *save_audio (int, int *);
+extern uae_u8 *save_audio (int, int *, uae_u8 *);
 
 extern const uae_u8 *restore_cia (int, const uae_u8 *);
 extern uae_u8 *save_cia (int, int *, uae_u8 *);
@@ -81,17 +81,24 @@ extern void restore_a3000hram (int, size_t);
 
 extern void restore_ram (size_t, uae_u8 *);
 
-extern uae_u8 *save_cram (int *);
-extern uae_u8 *save_bram (int *);
-extern uae_u8 *save_fram (int *);
-extern uae_u8 *save_zram (int *);
-extern uae_u8 *save_a3000lram (int *);
-extern uae_u8 *save_a3000hram (int *);
+extern uae_u8 *save_cram (int *, uae_u8 **);
+extern uae_u8 *save_bram (int *, uae_u8 **);
+extern uae_u8 *save_fram (int *, uae_u8 **);
+extern uae_u8 *save_zram (int *, uae_u8 **);
+extern uae_u8 *save_a3000lram (int *, uae_u8 **);
+extern uae_u8 *save_a3000hram (int *, uae_u8 **);
 
 extern const uae_u8 *restore_rom (const uae_u8 *);
 extern uae_u8 *save_rom (int, int *, uae_u8 *);
 
 extern void save_state (const char *filename, const char *description);
+extern void save_state_delta (const char *filename, const char *description);
+extern int savestate_flatten (const char *src, const char *dst);
+
+extern void savestate_capture (void);
+extern int savestate_dorewind (int n);
+extern void restore_rewind_state (void);
+extern int savestate_rewind_count (void);
 extern void restore_state (const char *filename);
 extern void savestate_restore_finish (void);
 
@@ -101,6 +108,9 @@ extern void custom_save_state (void);
 #define STATE_RESTORE 2
 #define STATE_DOSAVE 4
 #define STATE_DORESTORE 8
+#define STATE_DOSAVEDELTA 16
+#define STATE_DOREWIND 32
+#define STATE_REWIND 64
 
 extern int savestate_state;
 extern char *savestate_filename;
@@ -0,0 +1,55 @@
+ /*
+  * UAE - The Un*x Amiga Emulator
+  *
+  * Per-frame counters of where emulation time goes
+  */
+
+#define STATS_VERSION 1
+#define STATS_EVENTS 8
+#define STATS_BANKS 32
+
+/* The counters of one frame.  This is also the layout of the stats file
+ * (stats_file=...), which is mapped shared so that other processes can
+ * watch it: SEQ is odd while the emulator updates the page.  Times are
+ * in host ticks (the TSC on x86, microseconds elsewhere).  */
+struct uae_stats {
+    uae_u32 version, seq;
+    uae_u32 frame;
+    uae_u32 frames_skipped;		/* frames not drawn, 0 or 1 */
+    uae_u32 insns;
+    uae_u32 lines_drawn, lines_skipped;
+    uae_u32 nbanks;
+    uae_u32 event_calls[STATS_EVENTS];	/* hsync, copper, audio, CIA, blitter, disk, profiler */
+    uae_u64 event_ticks[STATS_EVENTS];	/* including the draw and wait below */
+    uae_u64 draw_ticks;			/* vsync_handle_redraw () */
+    uae_u64 wait_ticks;			/* time_vsync () */
+    uae_u64 frame_ticks;
+    struct {
+	char name[24];
+	uae_u32 reads, writes;
+    } banks[STATS_BANKS];		/* only while bank counting is on */
+};
+
+extern struct uae_stats stats_frame;
+
+STATIC_INLINE uae_u64 stats_ticks (void)
+{
+#if defined __GNUC__ && (defined __i386__ || defined __x86_64__)
+    uae_u32 lo, hi;
+    __asm__ __volatile__ ("rdtsc" : "=a" (lo), "=d" (hi));
+    return ((uae_u64)hi << 32) | lo;
+#else
+    struct timeval tv;
+    gettimeofday (&tv, NULL);
+    return (uae_u64)tv.tv_sec * 1000000 + tv.tv_usec;
+#endif
+}
+
+extern void stats_init (const char *filename);
+extern void stats_exit (void);
+extern void stats_vsync (void);
+extern void stats_reset (void);
+extern void stats_show (void);
+extern int stats_banks_on (void);
+extern void stats_banks_off (void);
+extern int stats_banks_active (void);
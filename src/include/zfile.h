@@ -9,9 +9,12 @@
 struct zfile;
 
 extern struct zfile *zfile_open (const char *, const char *);
+extern struct zfile *zfile_fopen_memory (uae_u8 *, long);
+extern struct zfile *zfile_fopen_growing (long);
+extern uae_u8 *zfile_getdata (struct zfile *z);
 extern int zfile_fclose (struct zfile *);
 extern int zfile_fseek (struct zfile *z, long offset, int mode);
 extern long zfile_ftell (struct zfile *z);
 extern size_t zfile_fread (void *b, size_t l1, size_t l2, struct zfile *z);
-extern size_t zfile_fwrite (void *b, size_t l1, size_t l2, struct zfile *z);
+extern size_t zfile_fwrite (const void *b, size_t l1, size_t l2, struct zfile *z);
 extern void zfile_exit (void);
@@ -1147,10 +1147,10 @@ void inputdevice_handle_inputcode (void)
     case AKS_INHIBITSCREEN:
 	toggle_inhibit_frame (IHF_SCROLLLOCK);
 	break;
-#if 0
     case AKS_STATEREWIND:
-	savestate_dorewind(1);
+	savestate_dorewind (1);
 	break;
+#if 0
     case AKS_VOLDOWN:
 	sound_volume (-1);
 	break;
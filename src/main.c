@@ -38,6 +38,9 @@
 #include "native2amiga.h"
 #include "scsidev.h"
 #include "romlist.h"
+#include "savestate.h"
+#include "cputrace.h"
+#include "stats.h"
 
 #ifdef USE_SDL
 #include "SDL.h"
@@ -188,6 +191,14 @@ void default_prefs (struct uae_prefs *p)
     p->start_gui = 1;
     p->start_debugger = 0;
 
+    p->rewind_size = 0;
+    p->rewind_interval = 50;
+    p->statefile_compress = 0;
+    p->statefile[0] = 0;
+    p->headless = 0;
+    p->headless_frames = 0;
+    p->stats_file[0] = 0;
+
     p->unknown_lines = 0;
     /* Note to porters: please don't change any of these options! UAE is supposed
      * to behave identically on all platforms if possible. */
@@ -265,6 +276,9 @@ void default_prefs (struct uae_prefs *p)
     strcpy (p->path_rom, "./");
     strcpy (p->path_floppy, "./");
     strcpy (p->path_hardfile, "./");
+    p->hardfile_overlay[0] = 0;
+    p->ide_hardfile[0][0] = 0;
+    p->ide_hardfile[1][0] = 0;
 
     strcpy (p->prtname, "");
     strcpy (p->sername, "");
@@ -417,6 +431,24 @@ static void fixup_prefs (struct uae_prefs *p)
 	p->collision_level = 1;
 	err = 1;
     }
+    if (p->rewind_size < 0 || p->rewind_interval < 1) {
+	write_log ("Invalid rewind buffer settings.  Rewinding disabled.\n");
+	p->rewind_size = 0;
+	p->rewind_interval = 50;
+	err = 1;
+    }
+    if (p->headless_frames < 0) {
+	write_log ("Invalid number of headless frames.  Running until the program quits.\n");
+	p->headless_frames = 0;
+	err = 1;
+    }
+    if (p->headless) {
+	/* Keep headless runs reproducible: the frame rate hack ties the
+	   CPU speed to the host, and Picasso96 needs a display.  */
+	if (p->m68k_speed == -1)
+	    p->m68k_speed = 0;
+	p->gfxmem_size = 0;
+    }
 
     fixup_sound (p);
 
@@ -518,6 +550,7 @@ void reset_all_systems (void)
 
     memory_reset ();
     bsdlib_reset ();
+    hardfile_reset ();
     filesys_reset ();
     filesys_start_threads ();
     scsidev_reset ();
@@ -548,10 +581,13 @@ void do_start_program (void)
 
 void do_leave_program (void)
 {
-    graphics_leave ();
+    if (! currprefs.headless)
+	graphics_leave ();
     inputdevice_close ();
     close_sound ();
     dump_counts ();
+    cputrace_stop ();
+    stats_exit ();
     serial_exit ();
     zfile_exit ();
     if (! no_gui)
@@ -592,20 +628,24 @@ void real_main (int argc, char **argv)
     gfx_windowed_modes = default_windowed_modes;
     n_windowed_modes = sizeof default_windowed_modes / sizeof *default_windowed_modes;
 
-    if (! graphics_setup ()) {
-	exit (1);
-    }
-
     rtarea_init ();
     hardfile_install ();
     scsidev_install ();
 
     parse_cmdline_and_init_file (argc, argv);
 
+    if (currprefs.headless) {
+	/* No window, no GUI and no sound.  */
+	currprefs.start_gui = 0;
+	currprefs.produce_sound = 0;
+    } else if (! graphics_setup ()) {
+	exit (1);
+    }
+
     machdep_init ();
     init_gtod ();
 
-    if (! setup_sound ()) {
+    if (! currprefs.headless && ! setup_sound ()) {
 	write_log ("Sound driver unavailable: Sound output disabled\n");
 	currprefs.produce_sound = 0;
     }
@@ -656,8 +696,23 @@ void real_main (int argc, char **argv)
     init_m68k(); /* must come after reset_frame_rate_hack (); */
 
     gui_update ();
+    stats_init (currprefs.stats_file);
+
+    if (currprefs.statefile[0]) {
+	struct zfile *f = zfile_open (currprefs.statefile, "rb");
+	if (f) {
+	    /* Restored by the reset that starts the emulation.  */
+	    zfile_fclose (f);
+	    savestate_filename = currprefs.statefile;
+	    savestate_state = STATE_RESTORE;
+	} else {
+	    write_log ("Can't open statefile %s\n", currprefs.statefile);
+	    if (currprefs.headless)
+		exit (1);
+	}
+    }
 
-    if (graphics_init ()) {
+    if (currprefs.headless || graphics_init ()) {
 	reset_drawing ();
 	setup_brkhandler ();
 	if (currprefs.start_debugger && debuggable ())
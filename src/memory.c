@@ -218,6 +218,7 @@ void REGPARAM2 chipmem_lput (uaecptr addr, uae_u32 l)
     addr -= chipmem_start & chipmem_mask;
     addr &= chipmem_mask;
     m = (uae_u32 *)(chipmemory + addr);
+    mark_dirty (chipmem_bank.dirty, addr, 4);
     do_put_mem_long (m, l);
 }
 
@@ -228,6 +229,7 @@ void REGPARAM2 chipmem_wput (uaecptr addr, uae_u32 w)
     addr -= chipmem_start & chipmem_mask;
     addr &= chipmem_mask;
     m = (uae_u16 *)(chipmemory + addr);
+    mark_dirty (chipmem_bank.dirty, addr, 2);
     do_put_mem_word (m, w);
 }
 
@@ -235,6 +237,7 @@ void REGPARAM2 chipmem_bput (uaecptr addr, uae_u32 b)
 {
     addr -= chipmem_start & chipmem_mask;
     addr &= chipmem_mask;
+    mark_dirty (chipmem_bank.dirty, addr, 1);
     chipmemory[addr] = b;
 }
 
@@ -255,6 +258,7 @@ void REGPARAM2 chipmem_agnus_wput (uaecptr addr, uae_u32 w)
     if (addr >= allocated_chipmem)
 	return;
     m = (uae_u16 *)(chipmemory + addr);
+    mark_dirty (chipmem_bank.dirty, addr, 2);
     do_put_mem_word (m, w);
 }
 
@@ -316,6 +320,7 @@ void REGPARAM2 bogomem_lput (uaecptr addr, uae_u32 l)
     addr -= bogomem_start & bogomem_mask;
     addr &= bogomem_mask;
     m = (uae_u32 *)(bogomemory + addr);
+    mark_dirty (bogomem_bank.dirty, addr, 4);
     do_put_mem_long (m, l);
 }
 
@@ -325,6 +330,7 @@ void REGPARAM2 bogomem_wput (uaecptr addr, uae_u32 w)
     addr -= bogomem_start & bogomem_mask;
     addr &= bogomem_mask;
     m = (uae_u16 *)(bogomemory + addr);
+    mark_dirty (bogomem_bank.dirty, addr, 2);
     do_put_mem_word (m, w);
 }
 
@@ -332,6 +338,7 @@ void REGPARAM2 bogomem_bput (uaecptr addr, uae_u32 b)
 {
     addr -= bogomem_start & bogomem_mask;
     addr &= bogomem_mask;
+    mark_dirty (bogomem_bank.dirty, addr, 1);
     bogomemory[addr] = b;
 }
 
@@ -388,6 +395,7 @@ static void REGPARAM2 a3000lmem_lput (uaecptr addr, uae_u32 l)
     uae_u32 *m;
     addr &= a3000lmem_mask;
     m = (uae_u32 *)(a3000lmemory + addr);
+    mark_dirty (a3000lmem_bank.dirty, addr, 4);
     do_put_mem_long (m, l);
 }
 
@@ -396,12 +404,14 @@ static void REGPARAM2 a3000lmem_wput (uaecptr addr, uae_u32 w)
     uae_u16 *m;
     addr &= a3000lmem_mask;
     m = (uae_u16 *)(a3000lmemory + addr);
+    mark_dirty (a3000lmem_bank.dirty, addr, 2);
     do_put_mem_word (m, w);
 }
 
 static void REGPARAM2 a3000lmem_bput (uaecptr addr, uae_u32 b)
 {
     addr &= a3000lmem_mask;
+    mark_dirty (a3000lmem_bank.dirty, addr, 1);
     a3000lmemory[addr] = b;
 }
 
@@ -453,6 +463,7 @@ static void REGPARAM2 a3000hmem_lput (uaecptr addr, uae_u32 l)
     uae_u32 *m;
     addr &= a3000hmem_mask;
     m = (uae_u32 *)(a3000hmemory + addr);
+    mark_dirty (a3000hmem_bank.dirty, addr, 4);
     do_put_mem_long (m, l);
 }
 
@@ -461,12 +472,14 @@ static void REGPARAM2 a3000hmem_wput (uaecptr addr, uae_u32 w)
     uae_u16 *m;
     addr &= a3000hmem_mask;
     m = (uae_u16 *)(a3000hmemory + addr);
+    mark_dirty (a3000hmem_bank.dirty, addr, 2);
     do_put_mem_word (m, w);
 }
 
 static void REGPARAM2 a3000hmem_bput (uaecptr addr, uae_u32 b)
 {
     addr &= a3000hmem_mask;
+    mark_dirty (a3000hmem_bank.dirty, addr, 1);
     a3000hmemory[addr] = b;
 }
 
@@ -719,43 +732,43 @@ uae_u8 REGPARAM2 *default_xlate (uaecptr a)
 addrbank dummy_bank = {
     dummy_lget, dummy_wget, dummy_bget,
     dummy_lput, dummy_wput, dummy_bput,
-    default_xlate, dummy_check, NULL, NULL
+    default_xlate, dummy_check, NULL, NULL, NULL
 };
 
 addrbank chipmem_bank = {
     chipmem_lget, chipmem_wget, chipmem_bget,
     chipmem_lput, chipmem_wput, chipmem_bput,
-    chipmem_xlate, chipmem_check, NULL, "Chip memory"
+    chipmem_xlate, chipmem_check, NULL, "Chip memory", NULL
 };
 
 addrbank bogomem_bank = {
     bogomem_lget, bogomem_wget, bogomem_bget,
     bogomem_lput, bogomem_wput, bogomem_bput,
-    bogomem_xlate, bogomem_check, NULL, "Slow memory"
+    bogomem_xlate, bogomem_check, NULL, "Slow memory", NULL
 };
 
 addrbank a3000lmem_bank = {
     a3000lmem_lget, a3000lmem_wget, a3000lmem_bget,
     a3000lmem_lput, a3000lmem_wput, a3000lmem_bput,
-    a3000lmem_xlate, a3000lmem_check, NULL, "RAMSEY memory (low)"
+    a3000lmem_xlate, a3000lmem_check, NULL, "RAMSEY memory (low)", NULL
 };
 
 addrbank a3000hmem_bank = {
     a3000hmem_lget, a3000hmem_wget, a3000hmem_bget,
     a3000hmem_lput, a3000hmem_wput, a3000hmem_bput,
-    a3000hmem_xlate, a3000hmem_check, NULL, "RAMSEY memory (high)"
+    a3000hmem_xlate, a3000hmem_check, NULL, "RAMSEY memory (high)", NULL
 };
 
 addrbank kickmem_bank = {
     kickmem_lget, kickmem_wget, kickmem_bget,
     kickmem_lput, kickmem_wput, kickmem_bput,
-    kickmem_xlate, kickmem_check, NULL, "Kickstart ROM"
+    kickmem_xlate, kickmem_check, NULL, "Kickstart ROM", NULL
 };
 
 addrbank extendedkickmem_bank = {
     extendedkickmem_lget, extendedkickmem_wget, extendedkickmem_bget,
     extendedkickmem_lput, extendedkickmem_wput, extendedkickmem_bput,
-    extendedkickmem_xlate, extendedkickmem_check, NULL, "Extended Kickstart ROM"
+    extendedkickmem_xlate, extendedkickmem_check, NULL, "Extended Kickstart ROM", NULL
 };
 
 static int kickstart_checksum (uae_u8 *mem, int size)
@@ -1180,6 +1193,35 @@ static void init_mem_banks (void)
 	put_mem_bank (i << 16, &dummy_bank, 0);
 }
 
+/* A freshly allocated bank has nothing in common with any earlier
+   savestate, so all of its pages start out dirty.  */
+uae_u8 *alloc_dirty_map (uae_u32 size)
+{
+    int n = dirty_pages (size) + 1;
+    uae_u8 *map = xmalloc (n);
+    memset (map, DIRTY_ALL, n);
+    return map;
+}
+
+/* Host code that writes to Amiga memory through a pointer obtained from
+   get_real_address must call this, since it bypasses the put handlers.  */
+void memory_dirty (uaecptr addr, uae_u32 size)
+{
+    while (size > 0) {
+	addrbank *ab = &get_mem_bank (addr);
+	uae_u32 n = DIRTY_PAGE_SIZE - (addr & (DIRTY_PAGE_SIZE - 1));
+
+	if (n > size)
+	    n = size;
+	/* Each page is looked up on its own, so that a range running past
+	   the end of a bank never marks pages beyond its map.  */
+	if (ab->dirty && ab->check (addr, 1))
+	    ab->dirty[(ab->xlateaddr (addr) - ab->baseaddr) >> DIRTY_PAGE_SHIFT] = DIRTY_ALL;
+	addr += n;
+	size -= n;
+    }
+}
+
 static void allocate_memory (void)
 {
     if (allocated_chipmem != currprefs.chipmem_size) {
@@ -1187,6 +1229,8 @@ static void allocate_memory (void)
 	if (chipmemory)
 	    mapped_free (chipmemory);
 	chipmemory = 0;
+	free (chipmem_bank.dirty);
+	chipmem_bank.dirty = 0;
 
 	memsize = allocated_chipmem = currprefs.chipmem_size;
 	chipmem_mask = allocated_chipmem - 1;
@@ -1194,6 +1238,7 @@ static void allocate_memory (void)
 	if (memsize < 0x100000)
 	    memsize = 0x100000;
 	chipmemory = mapped_malloc (memsize, "chip");
+	chipmem_bank.dirty = alloc_dirty_map (memsize);
 	if (chipmemory == 0) {
 	    write_log ("Fatal error: out of memory for chipmem.\n");
 	    allocated_chipmem = 0;
@@ -1212,12 +1257,15 @@ static void allocate_memory (void)
 	if (bogomemory)
 	    mapped_free (bogomemory);
 	bogomemory = 0;
+	free (bogomem_bank.dirty);
+	bogomem_bank.dirty = 0;
 
 	allocated_bogomem = currprefs.bogomem_size;
 	bogomem_mask = allocated_bogomem - 1;
 
 	if (allocated_bogomem) {
 	    bogomemory = mapped_malloc (allocated_bogomem, "bogo");
+	    bogomem_bank.dirty = alloc_dirty_map (allocated_bogomem);
 	    if (bogomemory == 0) {
 		write_log ("Out of memory for bogomem.\n");
 		allocated_bogomem = 0;
@@ -1230,12 +1278,15 @@ static void allocate_memory (void)
 	if (a3000lmemory)
 	    mapped_free (a3000lmemory);
 	a3000lmemory = 0;
+	free (a3000lmem_bank.dirty);
+	a3000lmem_bank.dirty = 0;
 
 	allocated_a3000lmem = currprefs.mbresmem_low_size;
 	a3000lmem_mask = allocated_a3000lmem - 1;
 	a3000lmem_start = 0x08000000 - allocated_a3000lmem;
 	if (allocated_a3000lmem) {
 	    a3000lmemory = mapped_malloc (allocated_a3000lmem, "ramsey_low");
+	    a3000lmem_bank.dirty = alloc_dirty_map (allocated_a3000lmem);
 	    if (a3000lmemory == 0) {
 		write_log ("Out of memory for a3000lowmem.\n");
 		allocated_a3000lmem = 0;
@@ -1248,12 +1299,15 @@ static void allocate_memory (void)
 	if (a3000hmemory)
 	    mapped_free (a3000hmemory);
 	a3000hmemory = 0;
+	free (a3000hmem_bank.dirty);
+	a3000hmem_bank.dirty = 0;
 
 	allocated_a3000hmem = currprefs.mbresmem_high_size;
 	a3000hmem_mask = allocated_a3000hmem - 1;
 	a3000hmem_start = 0x08000000;
 	if (allocated_a3000hmem) {
 	    a3000hmemory = mapped_malloc (allocated_a3000hmem, "ramsey_high");
+	    a3000hmem_bank.dirty = alloc_dirty_map (allocated_a3000hmem);
 	    if (a3000hmemory == 0) {
 		write_log ("Out of memory for a3000highmem.\n");
 		allocated_a3000hmem = 0;
@@ -1459,7 +1513,13 @@ void memory_cleanup (void)
 	free (a1000_bootrom);
     if (chipmemory)
 	mapped_free (chipmemory);
+    free (a3000lmem_bank.dirty);
+    free (a3000hmem_bank.dirty);
+    free (bogomem_bank.dirty);
+    free (chipmem_bank.dirty);
 
+    a3000lmem_bank.dirty = a3000hmem_bank.dirty = 0;
+    bogomem_bank.dirty = chipmem_bank.dirty = 0;
     a3000lmemory = a3000hmemory = 0;
     bogomemory = 0;
     kickmemory = 0;
@@ -1471,14 +1531,22 @@ void memory_hardreset (void)
 {
     if (savestate_state == STATE_RESTORE)
 	return;
-    if (chipmemory)
+    if (chipmemory) {
 	memset (chipmemory, 0, allocated_chipmem);
-    if (bogomemory)
+	memset (chipmem_bank.dirty, DIRTY_ALL, dirty_pages (allocated_chipmem));
+    }
+    if (bogomemory) {
 	memset (bogomemory, 0, allocated_bogomem);
-    if (a3000lmemory)
+	memset (bogomem_bank.dirty, DIRTY_ALL, dirty_pages (allocated_bogomem));
+    }
+    if (a3000lmemory) {
 	memset (a3000lmemory, 0, allocated_a3000lmem);
-    if (a3000hmemory)
+	memset (a3000lmem_bank.dirty, DIRTY_ALL, dirty_pages (allocated_a3000lmem));
+    }
+    if (a3000hmemory) {
 	memset (a3000hmemory, 0, allocated_a3000hmem);
+	memset (a3000hmem_bank.dirty, DIRTY_ALL, dirty_pages (allocated_a3000hmem));
+    }
     expansion_clear ();
 }
 
@@ -1542,27 +1610,31 @@ void map_banks (addrbank *bank, int start, int size, int realsize)
 
 /* memory save/restore code */
 
-uae_u8 *save_cram (int *len)
+uae_u8 *save_cram (int *len, uae_u8 **dirty)
 {
     *len = allocated_chipmem;
+    *dirty = chipmem_bank.dirty;
     return chipmemory;
 }
 
-uae_u8 *save_bram (int *len)
+uae_u8 *save_bram (int *len, uae_u8 **dirty)
 {
     *len = allocated_bogomem;
+    *dirty = bogomem_bank.dirty;
     return bogomemory;
 }
 
-uae_u8 *save_a3000lram (int *len)
+uae_u8 *save_a3000lram (int *len, uae_u8 **dirty)
 {
     *len = allocated_a3000lmem;
+    *dirty = a3000lmem_bank.dirty;
     return a3000lmemory;
 }
 
-uae_u8 *save_a3000hram (int *len)
+uae_u8 *save_a3000hram (int *len, uae_u8 **dirty)
 {
     *len = allocated_a3000hmem;
+    *dirty = a3000hmem_bank.dirty;
     return a3000hmemory;
 }
 
@@ -1677,32 +1749,63 @@ static int addr_valid (char *txt, uaecptr addr, uae_u32 len)
     return 1;
 }
 
+/* The bulk copies go one 64K bank at a time.  RAM banks (the ones
+   with a dirty map) are copied with memcpy, anything else byte by byte
+   through the bank's handlers.  */
+
+void memcpyha (uaecptr dst, const uae_u8 *src, int size)
+{
+    while (size > 0) {
+	addrbank *ab = &get_mem_bank (dst);
+	int n = 65536 - (dst & 0xffff);
+	if (n > size)
+	    n = size;
+	if (ab->dirty && ab->check (dst, n)) {
+	    memcpy (ab->xlateaddr (dst), src, n);
+	    memory_dirty (dst, n);
+	} else {
+	    int i;
+	    for (i = 0; i < n; i++)
+		put_byte (dst + i, src[i]);
+	}
+	dst += n;
+	src += n;
+	size -= n;
+    }
+}
+
 void memcpyha_safe (uaecptr dst, const uae_u8 *src, int size)
 {
     if (!addr_valid ("memcpyha", dst, size))
 	return;
-    while (size--)
-	put_byte (dst++, *src++);
+    memcpyha (dst, src, size);
 }
 
-void memcpyha (uaecptr dst, const uae_u8 *src, int size)
+void memcpyah (uae_u8 *dst, uaecptr src, int size)
 {
-    while (size--)
-	put_byte (dst++, *src++);
+    while (size > 0) {
+	addrbank *ab = &get_mem_bank (src);
+	int n = 65536 - (src & 0xffff);
+	if (n > size)
+	    n = size;
+	if (ab->check (src, n)) {
+	    memcpy (dst, ab->xlateaddr (src), n);
+	} else {
+	    int i;
+	    for (i = 0; i < n; i++)
+		dst[i] = get_byte (src + i);
+	}
+	dst += n;
+	src += n;
+	size -= n;
+    }
 }
 
 void memcpyah_safe (uae_u8 *dst, uaecptr src, int size)
 {
     if (!addr_valid ("memcpyah", src, size))
 	return;
-    while (size--)
-	*dst++ = get_byte (src++);
-}
-
-void memcpyah (uae_u8 *dst, uaecptr src, int size)
-{
-    while (size--)
-	*dst++ = get_byte (src++);
+    memcpyah (dst, src, size);
 }
 
 char *strcpyah_safe (char *dst, uaecptr src)
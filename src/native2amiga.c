@@ -25,6 +25,11 @@
 #include "native2amiga.h"
 
 smp_comm_pipe native2amiga_pending;
+#ifdef SUPPORT_THREADS
+/* The pipe only supports one writer at a time, but several threads send
+   messages through it.  */
+static uae_sem_t n2a_sem;
+#endif
 
 /*
  * to be called when setting up the hardware
@@ -33,6 +38,9 @@ smp_comm_pipe native2amiga_pending;
 void native2amiga_install (void)
 {
     init_comm_pipe (&native2amiga_pending, 10, 2);
+#ifdef SUPPORT_THREADS
+    uae_sem_init (&n2a_sem, 0, 1);
+#endif
 }
 
 /*
@@ -45,8 +53,10 @@ void native2amiga_startup (void)
 #ifdef SUPPORT_THREADS
 void uae_ReplyMsg (uaecptr msg)
 {
+    uae_sem_wait (&n2a_sem);
     write_comm_pipe_int (&native2amiga_pending, 2, 0);
     write_comm_pipe_u32 (&native2amiga_pending, msg, 1);
+    uae_sem_post (&n2a_sem);
 
     uae_int_requested = 1;
 }
@@ -55,18 +65,22 @@ void uae_PutMsg (uaecptr port, uaecptr msg)
 {
     uae_pt data;
     data.i = 1;
+    uae_sem_wait (&n2a_sem);
     write_comm_pipe_int (&native2amiga_pending, 1, 0);
     write_comm_pipe_u32 (&native2amiga_pending, port, 0);
     write_comm_pipe_u32 (&native2amiga_pending, msg, 1);
+    uae_sem_post (&n2a_sem);
 
     uae_int_requested = 1;
 }
 
 void uae_Signal (uaecptr task, uae_u32 mask)
 {
+    uae_sem_wait (&n2a_sem);
     write_comm_pipe_int (&native2amiga_pending, 0, 0);
     write_comm_pipe_u32 (&native2amiga_pending, task, 0);
     write_comm_pipe_int (&native2amiga_pending, mask, 1);
+    uae_sem_post (&n2a_sem);
 
     uae_int_requested = 1;
 }
@@ -22,6 +22,8 @@
 #include "gui.h"
 #include "savestate.h"
 #include "blitter.h"
+#include "cputrace.h"
+#include "stats.h"
 
 /* Opcode of faulting instruction */
 static uae_u16 last_op_for_exception_3;
@@ -1302,7 +1304,8 @@ void m68k_reset (void)
     }
 
     regs.kick_mask = 0x00F80000;
-    regs.spcflags = 0;
+    /* Breakpoint checks and tracing survive a reset.  */
+    regs.spcflags &= SPCFLAG_BPCHECK | SPCFLAG_CPUTRACE;
     if (savestate_state == STATE_RESTORE) {
 	m68k_setpc (regs.pc);
 	/* MakeFromSR() must not swap stack pointer */
@@ -1693,6 +1696,10 @@ static int do_specialties (int cycles)
 	unset_special (SPCFLAG_INT);
 	set_special (SPCFLAG_DOINT);
     }
+    if (regs.spcflags & SPCFLAG_CPUTRACE)
+	cputrace_record ();
+    if ((regs.spcflags & SPCFLAG_BPCHECK) && debug_bpcheck ())
+	set_special (SPCFLAG_BRK);
     if (regs.spcflags & (SPCFLAG_BRK | SPCFLAG_MODE_CHANGE)) {
 	unset_special (SPCFLAG_BRK | SPCFLAG_MODE_CHANGE);
 	return 1;
@@ -1717,7 +1724,7 @@ static void m68k_run_1 (void)
 	instrcount[opcode]++;
 #endif
 	cycles = (*cpufunctbl[opcode])(opcode);
-	/*n_insns++;*/
+	stats_frame.insns++;
 	cycles &= cycles_mask;
 	cycles |= cycles_val;
 	do_cycles (cycles);
@@ -1746,8 +1753,7 @@ static void m68k_run_2 (void)
 	instrcount[opcode]++;
 #endif
 	cycles = (*cpufunctbl[opcode])(opcode);
-
-	/*n_insns++;*/
+	stats_frame.insns++;
 	cycles &= cycles_mask;
 	cycles |= cycles_val;
 	do_cycles (cycles);
@@ -1792,7 +1798,8 @@ void m68k_go (int may_quit)
 #if 0
 		activate_debugger ();
 #endif
-	    }
+	    } else if (savestate_state == STATE_REWIND)
+		restore_rewind_state ();
 	    reset_all_systems ();
 	    customreset ();
 	    m68k_reset ();
@@ -1822,6 +1829,8 @@ void m68k_go (int may_quit)
 		uae_reset (1);
 	    }
 	}
+	if (regs.spcflags & SPCFLAG_CPUTRACE)
+	    cputrace_enter ();
 	m68k_run1 (currprefs.cpu_model == 68000 ? m68k_run_1 : m68k_run_2);
     }
     in_m68k_go--;
@@ -60,10 +60,6 @@ static void gfxmem_bput (uaecptr, uae_u32) REGPARAM;
 static int gfxmem_check (uaecptr addr, uae_u32 size) REGPARAM;
 static uae_u8 *gfxmem_xlate (uaecptr addr) REGPARAM;
 
-static void write_gfx_long (uaecptr addr, uae_u32 value);
-static void write_gfx_word (uaecptr addr, uae_u16 value);
-static void write_gfx_byte (uaecptr addr, uae_u8 value);
-
 static uae_u8 all_ones_bitmap, all_zeros_bitmap;
 
 struct picasso96_state_struct picasso96_state;
@@ -94,6 +90,8 @@ static uaecptr oldscr;
 int screen_is_picasso;
 
 static uae_u32 p2ctab[256][2];
+/* expand8[b] has byte i set to 0xFF if bit 7 - i of b is set.  */
+static uae_u64 expand8[256];
 
 /*
  * Screen handling.
@@ -119,12 +117,14 @@ void gfx_set_picasso_modeinfo (int w, int h, int depth, int rgbfmt)
 
     if (screen_is_picasso
 	&& picasso_vidinfo.width == w
-	&& picasso_vidinfo.height == h)
+	&& picasso_vidinfo.height == h
+	&& picasso_vidinfo.selected_rgbformat == (uae_u32)rgbfmt)
 	return;
 
     picasso_vidinfo.width = w;
     picasso_vidinfo.height = h;
     picasso_vidinfo.depth = depth;
+    picasso_vidinfo.selected_rgbformat = rgbfmt;
     if (screen_is_picasso)
 	set_window_for_picasso ();
 }
@@ -442,6 +442,71 @@ static void AmigaListAddTail (uaecptr list, uaecptr node)
     }
 }
 
+/*
+ * CPU writes to the visible screen are not copied out one by one.  They
+ * only mark tiles of P96_TILE_W bytes by P96_TILE_H rows dirty, and once
+ * per vsync the dirty tiles are merged into rectangles and blitted.
+ * Screens whose format differs from the host's are handled the same way
+ * for the blitter primitives, so that each pixel is converted at most
+ * once per frame.
+ */
+
+#define P96_TILE_W 64
+#define P96_TILE_H 8
+
+static uae_u8 *p96_dirty;
+static int p96_dirty_cols, p96_dirty_rows;
+static int p96_dirty_any;
+/* Set while the dirty tiles are blitted, to make do_blit convert them.  */
+static int p96_flushing;
+
+/* The row that was written last, to save a division per write.  */
+static uae_u32 wgfx_linestart = 0xFFFFFFFF;
+static uae_u32 wgfx_rowbytes;
+static int wgfx_y;
+
+static void p96_dirty_clear (void)
+{
+    if (p96_dirty)
+	memset (p96_dirty, 0, p96_dirty_cols * p96_dirty_rows);
+    p96_dirty_any = 0;
+    wgfx_linestart = 0xFFFFFFFF;
+}
+
+/* Size the tile map for the current screen.  */
+static void p96_dirty_alloc (void)
+{
+    int cols = (picasso96_state.BytesPerRow + P96_TILE_W - 1) / P96_TILE_W;
+    int rows = (picasso96_state.VirtualHeight + P96_TILE_H - 1) / P96_TILE_H;
+
+    if (cols * rows != p96_dirty_cols * p96_dirty_rows) {
+	free (p96_dirty);
+	p96_dirty = cols > 0 && rows > 0 ? (uae_u8 *)xmalloc (cols * rows) : 0;
+    }
+    p96_dirty_cols = cols;
+    p96_dirty_rows = rows;
+    p96_dirty_clear ();
+}
+
+/* Mark a rectangle of the frame buffer, in pixels from its start, dirty.  */
+static void p96_dirty_rect (int x, int y, int width, int height)
+{
+    int Bpp = picasso96_state.BytesPerPixel;
+    int c0 = x * Bpp / P96_TILE_W, c1 = ((x + width) * Bpp - 1) / P96_TILE_W;
+    int r0 = y / P96_TILE_H, r1 = (y + height - 1) / P96_TILE_H;
+
+    if (!p96_dirty || width <= 0 || height <= 0)
+	return;
+    if (c1 >= p96_dirty_cols)
+	c1 = p96_dirty_cols - 1;
+    if (r1 >= p96_dirty_rows)
+	r1 = p96_dirty_rows - 1;
+    for (; r0 <= r1; r0++)
+	if (c0 <= c1)
+	    memset (p96_dirty + r0 * p96_dirty_cols + c0, 1, c1 - c0 + 1);
+    p96_dirty_any = 1;
+}
+
 /*
  * Functions to perform an action on the real screen
  */
@@ -477,6 +542,10 @@ static void do_fillrect (uae_u8 * src, int x, int y, int width, int height,
 
     /* Try OS specific fillrect function here; and return if successful.  */
 
+    if (picasso_vidinfo.extra_mem && picasso_vidinfo.rgbformat != picasso96_state.RGBFormat) {
+	p96_dirty_rect (x + picasso96_state.XOffset, y + picasso96_state.YOffset, width, height);
+	return;
+    }
     DX_Invalidate (y, y + height - 1);
     if (!picasso_vidinfo.extra_mem)
 	return;
@@ -576,6 +645,13 @@ static void do_blit (struct RenderInfo *ri, int Bpp, int srcx, int srcy,
 	 */
     }
 
+    if (picasso_vidinfo.extra_mem && picasso_vidinfo.rgbformat != picasso96_state.RGBFormat
+	&& !p96_flushing)
+    {
+	p96_dirty_rect (dstx + xoff, dsty + yoff, width, height);
+	return;
+    }
+
     /* If no OS blit available, we do a copy from the P96 framebuffer in Amiga
        memory to the host's frame buffer.  */
     DX_Invalidate (dsty, dsty + height - 1);
@@ -657,80 +733,57 @@ static void do_invertrect (struct RenderInfo *ri, int Bpp, int x, int y, int wid
     do_blit (ri, Bpp, x, y, x, y, width, height, BLIT_SRC, 0);
 }
 
-static uaecptr wgfx_linestart;
-static uaecptr wgfx_lineend;
-static uaecptr wgfx_min, wgfx_max;
-static long wgfx_y;
-
-static void wgfx_do_flushline (void)
+static void p96_flush_rect (int c0, int c1, int r0, int r1)
 {
-    int src_y = wgfx_y;
-    long x0, x1, width;
-    uae_u8 *src, *dstp;
-    int Bpp = GetBytesPerPixel (picasso_vidinfo.rgbformat);
-    int fb_bpp = picasso96_state.BytesPerPixel;
-
-    wgfx_y -= picasso96_state.YOffset;
-    if (wgfx_y < 0 || wgfx_y >= picasso96_state.Height)
-	goto out1;
-
-    DX_Invalidate (wgfx_y, wgfx_y);
-    if (!picasso_vidinfo.extra_mem)
-	goto out1;
-
-    x0 = wgfx_min - wgfx_linestart;
-    width = wgfx_max - wgfx_min;
-    x0 -= picasso96_state.XOffset * fb_bpp;
-    if (x0 < 0) {
-	width += x0;
-	wgfx_min += x0;
-	x0 = 0;
-    }
-    if (x0 + width > picasso96_state.Width * fb_bpp)
-	width = picasso96_state.Width * fb_bpp - x0;
-
-    dstp = gfx_lock_picasso ();
-    if (dstp == 0)
-	goto out;
-
-    //    P96TRACE(("flushing %d\n", wgfx_y));
-    src = gfxmemory + wgfx_min;
-
-    if (picasso_vidinfo.rgbformat == picasso96_state.RGBFormat) {
-	dstp += wgfx_y * picasso_vidinfo.rowbytes + x0;
-	memcpy (dstp, src, width);
-    } else {
-	int i;
-
-	if (picasso96_state.RGBFormat != RGBFB_CHUNKY)
-	    abort ();
-
-	dstp += wgfx_y * picasso_vidinfo.rowbytes + x0 * Bpp;
-	switch (Bpp) {
-	case 2:
-	    for (i = 0; i < width; i++)
-		*((uae_u16 *) dstp + i) = picasso_vidinfo.clut[src[i]];
-	    break;
-	case 4:
-	    for (i = 0; i < width; i++)
-		*((uae_u32 *) dstp + i) = picasso_vidinfo.clut[src[i]];
-	    break;
-	default:
-	    abort ();
-	}
-    }
+    struct RenderInfo ri;
+    int Bpp = picasso96_state.BytesPerPixel;
+    int x0 = c0 * P96_TILE_W / Bpp;
+    int x1 = (c1 * P96_TILE_W + Bpp - 1) / Bpp;
+    int y0 = r0 * P96_TILE_H;
+    int y1 = r1 * P96_TILE_H;
 
-  out:
-    gfx_unlock_picasso ();
-  out1:
-    wgfx_linestart = 0xFFFFFFFF;
+    if (x1 > picasso96_state.BytesPerRow / Bpp)
+	x1 = picasso96_state.BytesPerRow / Bpp;
+    if (y1 > picasso96_state.VirtualHeight)
+	y1 = picasso96_state.VirtualHeight;
+    ri.Memory = gfxmemory + (picasso96_state.Address - gfxmem_start);
+    ri.BytesPerRow = picasso96_state.BytesPerRow;
+    ri.RGBFormat = picasso96_state.RGBFormat;
+    do_blit (&ri, Bpp, x0, y0, x0, y0, x1 - x0, y1 - y0, BLIT_SRC, 0);
 }
 
-STATIC_INLINE void wgfx_flushline (void)
+/* Blit the dirty tiles.  Each run of dirty tiles in a tile row is grown
+   downwards for as long as the rows below have the same run dirty.  */
+static void p96_flush_dirty (void)
 {
-    if (wgfx_linestart == 0xFFFFFFFF || !picasso_on)
+    int r, c;
+
+    if (!p96_dirty_any || !p96_dirty)
 	return;
-    wgfx_do_flushline ();
+    p96_flushing = 1;
+    for (r = 0; r < p96_dirty_rows; r++) {
+	uae_u8 *row = p96_dirty + r * p96_dirty_cols;
+	for (c = 0; c < p96_dirty_cols; c++) {
+	    int c1, r1;
+	    if (!row[c])
+		continue;
+	    for (c1 = c; c1 < p96_dirty_cols && row[c1]; c1++)
+		row[c1] = 0;
+	    for (r1 = r + 1; r1 < p96_dirty_rows; r1++) {
+		uae_u8 *below = p96_dirty + r1 * p96_dirty_cols;
+		int i;
+		for (i = c; i < c1 && below[i]; i++)
+		    ;
+		if (i < c1)
+		    break;
+		memset (below + c, 0, c1 - c);
+	    }
+	    p96_flush_rect (c, c1, r, r1);
+	    c = c1;
+	}
+    }
+    p96_dirty_any = 0;
+    p96_flushing = 0;
 }
 
 static int renderinfo_is_current_screen (struct RenderInfo *ri)
@@ -756,6 +809,7 @@ void picasso_refresh (void)
     if (!picasso_on)
 	return;
 
+    p96_dirty_clear ();
     /* Make sure that the first time we show a Picasso video mode, we don't blit any crap.
      * We can do this by checking if we have an Address yet.  */
     if (picasso96_state.Address) {
@@ -989,7 +1043,6 @@ uae_u32 picasso_SetSwitch (void)
 
 void picasso_enablescreen (int on)
 {
-    wgfx_linestart = 0xFFFFFFFF;
     picasso_refresh ();
 #if 1
     write_log ("SetSwitch() - showing %s screen\n", on ? "picasso96" : "amiga");
@@ -1010,6 +1063,8 @@ void picasso_handle_vsync (void)
 
     first_color_changed = 256;
     last_color_changed = -1;
+
+    p96_flush_dirty ();
 }
 
 void picasso_clip_mouse (int *px, int *py)
@@ -1109,7 +1164,7 @@ static void init_picasso_screen (void)
     gfx_set_picasso_modeinfo (width, height, picasso96_state.GC_Depth, picasso96_state.RGBFormat);
     DX_SetPalette (0, 256);
 
-    wgfx_linestart = 0xFFFFFFFF;
+    p96_dirty_alloc ();
     picasso_refresh ();
 }
 
@@ -1204,33 +1259,118 @@ uae_u32 picasso_SetPanning (void)
     return 1;
 }
 
+/*
+ * The helpers below work on eight pixel bytes at a time.  Loads and stores
+ * go through memcpy, so the pointers need no particular alignment.
+ */
+
+#define REPLICATE8(b) ((uae_u64)(uae_u8)(b) * 0x0101010101010101ULL)
+
+STATIC_INLINE uae_u64 load8 (const uae_u8 *p)
+{
+    uae_u64 v;
+    memcpy (&v, p, 8);
+    return v;
+}
+
+STATIC_INLINE void store8 (uae_u8 *p, uae_u64 v)
+{
+    memcpy (p, &v, 8);
+}
+
 static void do_xor8 (uae_u8 * ptr, long len, uae_u32 val)
 {
-    int i;
-#if 0 && defined ALIGN_POINTER_TO32
-    int align_adjust = ALIGN_POINTER_TO32 (ptr);
-    int len2;
+    uae_u64 v = REPLICATE8 (val);
 
-    len -= align_adjust;
-    while (align_adjust) {
+    for (; len >= 8; len -= 8, ptr += 8)
+	store8 (ptr, load8 (ptr) ^ v);
+    for (; len > 0; len--, ptr++)
 	*ptr ^= val;
-	ptr++;
-	align_adjust--;
+}
+
+/*
+ * Combine a row of LEN bytes from SRC into DST with one of the 16 BLIT_xxx
+ * minterms.  Only the bits set in MASK are changed.  SRC and DST must not
+ * overlap.
+ */
+static void rop_row (uae_u8 *dst, const uae_u8 *src, long len, BLIT_OPCODE op, uae_u8 mask)
+{
+    uae_u64 m = REPLICATE8 (mask);
+    long i = 0;
+
+#define ROP_ROW(expr) \
+    for (; i + 8 <= len; i += 8) { \
+	uae_u64 s = load8 (src + i), d = load8 (dst + i); \
+	store8 (dst + i, (d & ~m) | ((expr) & m)); \
+    } \
+    for (; i < len; i++) { \
+	uae_u64 s = src[i], d = dst[i]; \
+	dst[i] = (d & ~m) | ((expr) & m); \
+    } \
+    break;
+
+    switch (op) {
+    case BLIT_FALSE: ROP_ROW (0)
+    case BLIT_NOR: ROP_ROW (~(s | d))
+    case BLIT_ONLYDST: ROP_ROW (d & ~s)
+    case BLIT_NOTSRC: ROP_ROW (~s)
+    case BLIT_ONLYSRC: ROP_ROW (s & ~d)
+    case BLIT_NOTDST: ROP_ROW (~d)
+    case BLIT_EOR: ROP_ROW (s ^ d)
+    case BLIT_NAND: ROP_ROW (~(s & d))
+    case BLIT_AND: ROP_ROW (s & d)
+    case BLIT_NEOR: ROP_ROW (~(s ^ d))
+    case BLIT_DST: break;
+    case BLIT_NOTONLYSRC: ROP_ROW (~s | d)
+    case BLIT_SRC: ROP_ROW (s)
+    case BLIT_NOTONLYDST: ROP_ROW (~d | s)
+    case BLIT_OR: ROP_ROW (s | d)
+    case BLIT_TRUE: ROP_ROW (~(uae_u64)0)
+    default: break;
     }
-    len2 = len >> 2;
-    len -= len2 << 2;
-    for (i = 0; i < len2; i++, ptr += 4) {
-	*(uae_u32 *) ptr ^= val;
+#undef ROP_ROW
+}
+
+/*
+ * Expand the top N (at most 8) bits of BITS into 8-bit pixels at DST, for
+ * BlitTemplate and BlitPattern.  Only the bits of the pixels set in MASK
+ * are changed, except in COMP mode.
+ */
+STATIC_INLINE void expand_row8 (uae_u8 *dst, unsigned int bits, int n, int drawmode,
+				int inversion, uae_u8 fgpen, uae_u8 bgpen, uae_u8 mask)
+{
+    uae_u64 m = expand8[bits & 0xFF];
+    uae_u64 tail = expand8[(0xFF00 >> n) & 0xFF];
+    uae_u64 pm = REPLICATE8 (mask) & tail;
+    uae_u64 fg = REPLICATE8 (fgpen), d;
+    uae_u8 tmp[8];
+
+    if (n == 8)
+	d = load8 (dst);
+    else {
+	memcpy (tmp, dst, n);
+	memset (tmp + n, 0, 8 - n);
+	d = load8 (tmp);
     }
-    while (len) {
-	*ptr ^= val;
-	ptr++;
-	len--;
+    if (inversion && drawmode != COMP)
+	m = ~m;
+    switch (drawmode) {
+    case JAM1:
+	m &= pm;
+	d = (d & ~m) | (fg & m);
+	break;
+    case JAM2:
+	d = (d & ~pm) | (((fg & m) | (REPLICATE8 (bgpen) & ~m)) & pm);
+	break;
+    case COMP:
+	d ^= fg & m & tail;
+	break;
     }
-    return;
-#endif
-    for (i = 0; i < len; i++, ptr++) {
-	do_put_mem_byte (ptr, do_get_mem_byte (ptr) ^ val);
+    if (n == 8)
+	store8 (dst, d);
+    else {
+	store8 (tmp, d);
+	memcpy (dst, tmp, n);
     }
 }
 
@@ -1265,8 +1405,6 @@ uae_u32 picasso_InvertRect (void)
     uae_u8 *uae_mem;
     unsigned long width_in_bytes;
 
-    wgfx_flushline ();
-
     if (!CopyRenderInfoStructureA2U (renderinfo, &ri))
 	return 0;
 
@@ -1307,36 +1445,33 @@ STATIC_INLINE void do_fillrect_frame_buffer (struct RenderInfo *ri, int X, int Y
 					     RGBFTYPE RGBFormat)
 {
     uae_u8 *start, *oldstart, *dst;
-    long lines, cols;
+    long lines;
 
     /* Do our virtual frame-buffer memory.  First, we do a single line fill by hand */
     oldstart = start = ri->Memory + Y * ri->BytesPerRow + X * Bpp;
+    if (Width <= 0 || Height <= 0)
+	return;
     switch (Bpp) {
     case 1:
 	memset (start, Pen, Width);
 	break;
     case 2:
-	for (cols = 0; cols < Width; cols++) {
-	    do_put_mem_word ((uae_u16 *) start, Pen);
-	    start += 2;
-	}
+	do_put_mem_word ((uae_u16 *) start, Pen);
 	break;
     case 3:
-	for (cols = 0; cols < Width; cols++) {
-	    do_put_mem_byte (start, Pen & 0x000000FF);
-	    start++;
-	    *(uae_u16 *) (start) = (Pen & 0x00FFFF00) >> 8;
-	    start += 2;
-	}
+	do_put_mem_byte (start, Pen & 0x000000FF);
+	*(uae_u16 *) (start + 1) = (Pen & 0x00FFFF00) >> 8;
 	break;
     case 4:
-	for (cols = 0; cols < Width; cols++) {
-	    /**start = Pen; */
-	    do_put_mem_long ((uae_u32 *) start, Pen);
-	    start += 4;
-	}
+	do_put_mem_long ((uae_u32 *) start, Pen);
 	break;
     }
+    /* Fill the rest of the line by doubling what is already there.  */
+    if (Bpp > 1) {
+	long done, total = Width * Bpp;
+	for (done = Bpp; done < total; done *= 2)
+	    memcpy (start + done, start, done < total - done ? done : total - done);
+    }
 
     dst = oldstart + ri->BytesPerRow;
     /* next, we do the remaining line fills via memcpy() for > 1 BPP, otherwise some more memset() calls */
@@ -1377,8 +1512,6 @@ uae_u32 picasso_FillRect (void)
     int Bpp;
     struct RenderInfo ri;
 
-    wgfx_flushline ();
-
     if (!CopyRenderInfoStructureA2U (renderinfo, &ri) || Y == 0xFFFF)
 	return 0;
 
@@ -1408,19 +1541,18 @@ uae_u32 picasso_FillRect (void)
 	write_log ("Picasso: mask != 0xFF in truecolor mode!\n");
 	return 0;
     }
-    Pen &= Mask;
-    Mask = ~Mask;
-
     {
 	uae_u8 *start = ri.Memory + Y * ri.BytesPerRow + X * Bpp;
 	uae_u8 *end = start + Height * ri.BytesPerRow;
+	uae_u64 m = REPLICATE8 (Mask);
+	uae_u64 pen = REPLICATE8 (Pen) & m;
 	for (; start != end; start += ri.BytesPerRow) {
 	    uae_u8 *p = start;
 	    unsigned long cols;
-	    for (cols = 0; cols < Width; cols++) {
-		uae_u32 tmpval = do_get_mem_byte (p + cols) & Mask;
-		do_put_mem_byte (p + cols, Pen | tmpval);
-	    }
+	    for (cols = 0; cols + 8 <= Width; cols += 8, p += 8)
+		store8 (p, (load8 (p) & ~m) | pen);
+	    for (; cols < Width; cols++, p++)
+		*p = (*p & ~Mask) | (Pen & Mask);
 	}
     }
 
@@ -1465,8 +1597,12 @@ static void BlitRect (struct RenderInfo *ri, struct RenderInfo *dstri,
     blitsrc = dst;
     if (mask != 0xFF && Bpp > 1)
 	write_log ("ERROR - not obeying BlitRect() mask 0x%x properly with Bpp %d.\n", mask, Bpp);
+    if (opcode == BLIT_DST)
+	return;
 
-    if (mask == 0xFF || Bpp > 1) {
+    if (Bpp > 1)
+	mask = 0xFF;
+    if (mask == 0xFF && opcode == BLIT_SRC) {
 	/* handle normal case efficiently */
 	if (ri->Memory == dstri->Memory && dsty == srcy) {
 	    unsigned long i;
@@ -1499,14 +1635,9 @@ static void BlitRect (struct RenderInfo *ri, struct RenderInfo *dstri,
 	memcpy (tmp2, src, total_width);
     }
 
-    /* copy the temporary buffer to the destination */
-    for (lines = 0; lines < height; lines++, dst += dstri->BytesPerRow, tmp += linewidth) {
-	unsigned long cols;
-	for (cols = 0; cols < width; cols++) {
-	    dst[cols] &= ~mask;
-	    dst[cols] |= tmp[cols] & mask;
-	}
-    }
+    /* combine the temporary buffer with the destination */
+    for (lines = 0; lines < height; lines++, dst += dstri->BytesPerRow, tmp += linewidth)
+	rop_row (dst, tmp, total_width, opcode, mask);
     if (renderinfo_is_current_screen (dstri))
 	do_blit (dstri, Bpp, dstx, dsty, dstx, dsty, width, height, opcode, 0);
 
@@ -1542,8 +1673,6 @@ uae_u32 picasso_BlitRect (void)
 
     struct RenderInfo ri;
 
-    wgfx_flushline ();
-
     if (!CopyRenderInfoStructureA2U (renderinfo, &ri))
 	return 0;
 
@@ -1586,8 +1715,6 @@ uae_u32 picasso_BlitRectNoMaskComplete (void)
     uae_u32 RGBFmt = m68k_dreg (regs, 7);
     struct RenderInfo src_ri, dst_ri;
 
-    wgfx_flushline ();
-
     if (!CopyRenderInfoStructureA2U (srcri, &src_ri)
 	|| !CopyRenderInfoStructureA2U (dstri, &dst_ri))
 	return 0;
@@ -1595,15 +1722,10 @@ uae_u32 picasso_BlitRectNoMaskComplete (void)
     P96TRACE(("BlitRectNoMaskComplete() op 0x%2x, xy(%4d,%4d) --> xy(%4d,%4d), wh(%4d,%4d)\n",
 	OpCode, srcx, srcy, dstx, dsty, width, height));
 
-    switch (OpCode) {
-    case 0x0C:
-	BlitRect (&src_ri, &dst_ri, srcx, srcy, dstx, dsty, width, height, 0xFF, OpCode);
-	return 1;
-
-    default:
-	/* FOR NOW! */
+    if (OpCode >= BLIT_LAST)
 	return 0;
-    }
+    BlitRect (&src_ri, &dst_ri, srcx, srcy, dstx, dsty, width, height, 0xFF, OpCode);
+    return 1;
 }
 
 /* This utility function is used both by BlitTemplate() and BlitPattern() */
@@ -1694,8 +1816,6 @@ uae_u32 picasso_BlitPattern (void)
     int xshift;
     unsigned long ysize_mask;
 
-    wgfx_flushline ();
-
     if (! CopyRenderInfoStructureA2U (rinf, &ri)
 	|| !CopyPatternStructureA2U (pinf, &pattern))
 	return 0;
@@ -1741,6 +1861,14 @@ uae_u32 picasso_BlitPattern (void)
 	    if (max > 16)
 		max = 16;
 
+	    if (Bpp == 1) {
+		expand_row8 (uae_mem2, data >> 8, max > 8 ? 8 : max, pattern.DrawMode, inversion,
+			     pattern.FgPen, pattern.BgPen, Mask);
+		if (max > 8)
+		    expand_row8 (uae_mem2 + 8, data, max - 8, pattern.DrawMode, inversion,
+				 pattern.FgPen, pattern.BgPen, Mask);
+		continue;
+	    }
 	    for (bits = 0; bits < max; bits++) {
 		int bit_set = data & 0x8000;
 		data <<= 1;
@@ -1839,8 +1967,6 @@ uae_u32 picasso_BlitTemplate (void)
     uae_u8 *uae_mem, Bpp;
     uae_u8 *tmpl_base;
 
-    wgfx_flushline ();
-
     if (!CopyRenderInfoStructureA2U (rinf, &ri)
 	|| !CopyTemplateStructureA2U (tmpl, &tmp))
 	return 0;
@@ -1891,6 +2017,10 @@ uae_u32 picasso_BlitTemplate (void)
 
 	    byte = data >> (8 - bitoffset);
 
+	    if (Bpp == 1) {
+		expand_row8 (uae_mem2, byte, max, tmp.DrawMode, inversion, tmp.FgPen, tmp.BgPen, Mask);
+		continue;
+	    }
 	    for (bits = 0; bits < max; bits++) {
 		int bit_set = (byte & 0x80);
 		byte <<= 1;
@@ -2101,8 +2231,6 @@ uae_u32 picasso_BlitPlanar2Chunky (void)
     struct RenderInfo local_ri;
     struct BitMap local_bm;
 
-    wgfx_flushline ();
-
     if (minterm != 0x0C) {
 	write_log ("ERROR - BlitPlanar2Chunky() has minterm 0x%x, which I don't handle. Using fall-back routine.\n", minterm);
 	return 0;
@@ -2240,8 +2368,6 @@ uae_u32 picasso_BlitPlanar2Direct (void)
     struct BitMap local_bm;
     struct ColorIndexMapping local_cim;
 
-    wgfx_flushline ();
-
     if (minterm != 0x0C) {
 	write_log ("ERROR - BlitPlanar2Direct() has op-code 0x%x, which I don't handle. Using fall-back routine.\n", minterm);
 	return 0;
@@ -2263,130 +2389,48 @@ uae_u32 picasso_BlitPlanar2Direct (void)
     return 1;
 }
 
-/* @@@ - Work to be done here!
- *
+/*
  * The address is the offset into our Picasso96 frame-buffer (pointed to by gfxmem_start)
- * where the value was put.
- *
- * Porting work: on some machines you may not need these functions, ie. if the memory for the
- * Picasso96 frame-buffer is directly viewable or directly blittable.  On Win32 with DirectX,
- * this is not the case.  So I provide some write-through functions (as per Mathias' orders!)
+ * where SIZE bytes were put.  If that is on the visible screen, mark it dirty; it goes
+ * out to the display at the next vsync.
  */
-static void write_gfx_long (uaecptr addr, uae_u32 value)
-{
-    uaecptr oldaddr = addr;
-    int x, xbytes, y;
-    uae_u8 *dst;
-
-    if (!picasso_on)
-	return;
-
-    /*
-     * Several writes to successive memory locations are a common access pattern.
-     * Try to optimize it.
-     */
-    if (addr >= wgfx_linestart && addr + 4 <= wgfx_lineend) {
-	if (addr < wgfx_min)
-	    wgfx_min = addr;
-	if (addr + 4 > wgfx_max)
-	    wgfx_max = addr + 4;
-	return;
-    } else
-	wgfx_flushline ();
-
-    addr += gfxmem_start;
-    /* Check to see if this needs to be written through to the display, or was it an "offscreen" area? */
-    if (addr < picasso96_state.Address || addr + 4 > picasso96_state.Extent)
-	return;
-
-    addr -= picasso96_state.Address;
-    y = addr / picasso96_state.BytesPerRow;
-
-    if (y >= picasso96_state.VirtualHeight)
-	return;
-    wgfx_linestart = picasso96_state.Address - gfxmem_start + y * picasso96_state.BytesPerRow;
-    wgfx_lineend = wgfx_linestart + picasso96_state.BytesPerRow;
-    wgfx_y = y;
-    wgfx_min = oldaddr;
-    wgfx_max = oldaddr + 4;
-}
-
-static void write_gfx_word (uaecptr addr, uae_u16 value)
-{
-    uaecptr oldaddr = addr;
-    int x, xbytes, y;
-    uae_u8 *dst;
-
-    if (!picasso_on)
-	return;
-
-    /*
-     * Several writes to successive memory locations are a common access pattern.
-     * Try to optimize it.
-     */
-    if (addr >= wgfx_linestart && addr + 2 <= wgfx_lineend) {
-	if (addr < wgfx_min)
-	    wgfx_min = addr;
-	if (addr + 2 > wgfx_max)
-	    wgfx_max = addr + 2;
-	return;
-    } else
-	wgfx_flushline ();
-
-    addr += gfxmem_start;
-    /* Check to see if this needs to be written through to the display, or was it an "offscreen" area? */
-    if (addr < picasso96_state.Address || addr + 2 > picasso96_state.Extent)
-	return;
-
-    addr -= picasso96_state.Address;
-    y = addr / picasso96_state.BytesPerRow;
-
-    if (y >= picasso96_state.VirtualHeight)
-	return;
-    wgfx_linestart = picasso96_state.Address - gfxmem_start + y * picasso96_state.BytesPerRow;
-    wgfx_lineend = wgfx_linestart + picasso96_state.BytesPerRow;
-    wgfx_y = y;
-    wgfx_min = oldaddr;
-    wgfx_max = oldaddr + 2;
-}
-
-static void write_gfx_byte (uaecptr addr, uae_u8 value)
+STATIC_INLINE void write_gfx (uaecptr addr, int size)
 {
-    uaecptr oldaddr = addr;
-    int x, xbytes, y;
-    uae_u8 *dst;
+    uae_u32 x;
+    int t;
 
-    if (!picasso_on)
+    if (!picasso_on || !p96_dirty)
 	return;
 
-    /*
-     * Several writes to successive memory locations are a common access pattern.
-     * Try to optimize it.
-     */
-    if (addr >= wgfx_linestart && addr + 4 <= wgfx_lineend) {
-	if (addr < wgfx_min)
-	    wgfx_min = addr;
-	if (addr + 1 > wgfx_max)
-	    wgfx_max = addr + 1;
-	return;
-    } else
-	wgfx_flushline ();
-
-    addr += gfxmem_start;
-    /* Check to see if this needs to be written through to the display, or was it an "offscreen" area? */
-    if (addr < picasso96_state.Address || addr + 1 > picasso96_state.Extent)
-	return;
-
-    addr -= picasso96_state.Address;
-    y = addr / picasso96_state.BytesPerRow;
-
-    if (y >= picasso96_state.VirtualHeight)
-	return;
-    wgfx_linestart = picasso96_state.Address - gfxmem_start + y * picasso96_state.BytesPerRow;
-    wgfx_lineend = wgfx_linestart + picasso96_state.BytesPerRow;
-    wgfx_y = y;
-    wgfx_min = oldaddr;
-    wgfx_max = oldaddr + 1;
+    /* Successive writes to the same row are a common access pattern.  */
+    x = addr - wgfx_linestart;
+    if (wgfx_linestart == 0xFFFFFFFF || x + size > wgfx_rowbytes) {
+	uae_u32 off;
+
+	addr += gfxmem_start;
+	/* Check to see if this needs to be written through to the display, or was it an "offscreen" area? */
+	if (addr < picasso96_state.Address || addr + size > picasso96_state.Extent)
+	    return;
+	off = addr - picasso96_state.Address;
+	wgfx_y = off / picasso96_state.BytesPerRow;
+	x = off - wgfx_y * picasso96_state.BytesPerRow;
+	/* The tile map is sized when the screen is set up; don't trust it
+	   for anything outside.  */
+	wgfx_rowbytes = p96_dirty_cols * P96_TILE_W;
+	if (wgfx_rowbytes > (uae_u32)picasso96_state.BytesPerRow)
+	    wgfx_rowbytes = picasso96_state.BytesPerRow;
+	if (wgfx_y >= p96_dirty_rows * P96_TILE_H || x + size > wgfx_rowbytes) {
+	    wgfx_linestart = 0xFFFFFFFF;
+	    return;
+	}
+	wgfx_linestart = picasso96_state.Address - gfxmem_start + wgfx_y * picasso96_state.BytesPerRow;
+    }
+    t = (wgfx_y / P96_TILE_H) * p96_dirty_cols + x / P96_TILE_W;
+    p96_dirty[t] = 1;
+    /* A write may straddle two tiles.  */
+    if (x % P96_TILE_W + size > P96_TILE_W)
+	p96_dirty[t + 1] = 1;
+    p96_dirty_any = 1;
 }
 
 static uae_u32 REGPARAM2 gfxmem_lget (uaecptr addr)
@@ -2423,7 +2467,7 @@ static void REGPARAM2 gfxmem_lput (uaecptr addr, uae_u32 l)
     do_put_mem_long (m, l);
 
     /* write the long-word to our displayable memory */
-    write_gfx_long (addr, l);
+    write_gfx (addr, 4);
 }
 
 static void REGPARAM2 gfxmem_wput (uaecptr addr, uae_u32 w)
@@ -2435,7 +2479,7 @@ static void REGPARAM2 gfxmem_wput (uaecptr addr, uae_u32 w)
     do_put_mem_word (m, (uae_u16) w);
 
     /* write the word to our displayable memory */
-    write_gfx_word (addr, (uae_u16) w);
+    write_gfx (addr, 2);
 }
 
 static void REGPARAM2 gfxmem_bput (uaecptr addr, uae_u32 b)
@@ -2445,7 +2489,7 @@ static void REGPARAM2 gfxmem_bput (uaecptr addr, uae_u32 b)
     gfxmemory[addr] = b;
 
     /* write the byte to our displayable memory */
-    write_gfx_byte (addr, (uae_u8) b);
+    write_gfx (addr, 1);
 }
 
 static int REGPARAM2 gfxmem_check (uaecptr addr, uae_u32 size)
@@ -2519,6 +2563,13 @@ void InitPicasso96 (void)
 			    | ((i & 2) ? 0x0100 : 0)
 			    | ((i & 1) ? 0x01 : 0));
 	}
+	for (i = 0; i < 256; i++) {
+	    uae_u8 tmp[8];
+	    int j;
+	    for (j = 0; j < 8; j++)
+		tmp[j] = (i & (0x80 >> j)) ? 0xFF : 0;
+	    memcpy (&expand8[i], tmp, 8);
+	}
 	mode_count = DX_FillResolutions (&picasso96_pixel_format);
 	qsort (DisplayModes, mode_count, sizeof (struct PicassoResolution), resolution_compare);
 
@@ -0,0 +1,582 @@
+ /*
+  * UAE - The Un*x Amiga Emulator
+  *
+  * Sampling profiler for guest code
+  *
+  * While the profiler runs, the ev_profile event fires every N cycles.
+  * Each sample takes the PC and a short call stack: the return address
+  * at (A7), if there is one, and then the chain of LINK A5 frames.  A
+  * longword only counts as a return address if the instruction in front
+  * of it is a JSR or BSR, which keeps data on the stack out of the
+  * profile.  Identical stacks are counted together.
+  *
+  * Addresses are turned into names with the symbols from Amiga hunk
+  * executables.  "profiler_load_symbols" reads the HUNK_SYMBOL (and
+  * HUNK_EXT definitions) of a file and places the hunks where the
+  * segments of its seglist are in memory; the seglist is given as a
+  * BPTR or found from the name of the process running it.
+  *
+  * Results come as a flat profile on the console, or as collapsed
+  * stacks ("caller;callee count" per line), the format flamegraph.pl,
+  * speedscope and the perf/pprof converters take.
+  */
+
+#include "sysconfig.h"
+#include "sysdeps.h"
+
+#include <ctype.h>
+
+#include "options.h"
+#include "uae.h"
+#include "memory.h"
+#include "custom.h"
+#include "events.h"
+#include "newcpu.h"
+#include "profiler.h"
+
+#define PROFILE_DEPTH 16
+#define PROFILE_MAXSTACKS 65536
+#define PROFILE_HASH 16384
+
+struct profile_stack {
+    uae_u32 pc[PROFILE_DEPTH];
+    int depth;
+    int next;
+    unsigned long count;
+};
+
+static struct profile_stack *stacks;
+static int nstacks, maxstacks;
+static int stackhash[PROFILE_HASH];
+static unsigned long profile_samples, profile_lost;
+static int profile_interval, profile_running;
+
+struct profile_sym {
+    uae_u32 addr, end;
+    char *name;
+};
+
+static struct profile_sym *syms;
+static int nsyms, maxsyms;
+
+/* Stack reads go straight to memory, so that they neither trigger
+   memwatch points nor touch custom registers.  */
+static int read_long (uaecptr addr, uae_u32 *v)
+{
+    if ((addr & 1) || !valid_address (addr, 4))
+	return 0;
+    *v = do_get_mem_long ((uae_u32 *)get_real_address (addr));
+    return 1;
+}
+
+static int read_word (uaecptr addr)
+{
+    return do_get_mem_word ((uae_u16 *)get_real_address (addr));
+}
+
+/* Is ADDR just behind a JSR or BSR?  */
+static int is_return (uaecptr addr)
+{
+    uae_u16 w;
+
+    if ((addr & 1) || addr < 6 || !valid_address (addr - 6, 6))
+	return 0;
+    w = read_word (addr - 2);
+    if ((w & 0xfff8) == 0x4e90 || ((w & 0xff00) == 0x6100 && (w & 0xff) != 0 && (w & 0xff) != 0xff))
+	return 1;
+    w = read_word (addr - 4);
+    if ((w & 0xfff8) == 0x4ea8 || (w & 0xfff8) == 0x4eb0 || w == 0x4eb8 || w == 0x4eba || w == 0x6100)
+	return 1;
+    w = read_word (addr - 6);
+    return w == 0x4eb9 || w == 0x61ff;
+}
+
+static void profile_sample (void)
+{
+    uae_u32 pc[PROFILE_DEPTH];
+    uae_u32 fp, next, ret, a7 = m68k_areg (regs, 7), h;
+    struct profile_stack *s;
+    int n = 0, i;
+
+    pc[n++] = m68k_getpc ();
+    if (read_long (a7, &ret) && is_return (ret))
+	pc[n++] = ret;
+    fp = m68k_areg (regs, 5);
+    while (n < PROFILE_DEPTH && fp >= a7 && read_long (fp, &next) && read_long (fp + 4, &ret)) {
+	if (!is_return (ret))
+	    break;
+	if (ret != pc[n - 1])
+	    pc[n++] = ret;
+	if (next <= fp)
+	    break;
+	fp = next;
+    }
+
+    profile_samples++;
+    h = n;
+    for (i = 0; i < n; i++)
+	h = h * 31 + pc[i];
+    h = (h ^ (h >> 14)) & (PROFILE_HASH - 1);
+    for (i = stackhash[h]; i >= 0; i = s->next) {
+	s = &stacks[i];
+	if (s->depth == n && memcmp (s->pc, pc, n * sizeof *pc) == 0) {
+	    s->count++;
+	    return;
+	}
+    }
+    if (nstacks == maxstacks) {
+	if (maxstacks == PROFILE_MAXSTACKS) {
+	    profile_lost++;
+	    return;
+	}
+	maxstacks = maxstacks ? maxstacks * 2 : 1024;
+	stacks = realloc (stacks, maxstacks * sizeof *stacks);
+    }
+    s = &stacks[nstacks];
+    memcpy (s->pc, pc, n * sizeof *pc);
+    s->depth = n;
+    s->count = 1;
+    s->next = stackhash[h];
+    stackhash[h] = nstacks++;
+}
+
+void profiler_handler (void)
+{
+    eventtab[ev_profile].oldcycles = get_cycles ();
+    eventtab[ev_profile].evtime = get_cycles () + profile_interval * CYCLE_UNIT;
+    profile_sample ();
+}
+
+int profiler_start (int interval)
+{
+    int i;
+
+    if (interval <= 0)
+	interval = 1000;
+    nstacks = 0;
+    for (i = 0; i < PROFILE_HASH; i++)
+	stackhash[i] = -1;
+    profile_samples = profile_lost = 0;
+    profile_interval = interval;
+    profile_running = 1;
+    eventtab[ev_profile].active = 1;
+    eventtab[ev_profile].oldcycles = get_cycles ();
+    eventtab[ev_profile].evtime = get_cycles () + interval * CYCLE_UNIT;
+    events_schedule ();
+    write_log ("Profiling, one sample every %d cycles\n", interval);
+    return 1;
+}
+
+void profiler_stop (void)
+{
+    if (!profile_running)
+	return;
+    profile_running = 0;
+    eventtab[ev_profile].active = 0;
+    events_schedule ();
+    write_log ("Profiler stopped: %lu samples, %d different stacks\n", profile_samples, nstacks);
+}
+
+/* A reset starts the cycle count again from zero.  */
+void profiler_reset (void)
+{
+    if (!profile_running)
+	return;
+    eventtab[ev_profile].active = 1;
+    eventtab[ev_profile].oldcycles = get_cycles ();
+    eventtab[ev_profile].evtime = get_cycles () + profile_interval * CYCLE_UNIT;
+    events_schedule ();
+}
+
+/* Symbols.  */
+
+static int sym_cmp (const void *a, const void *b)
+{
+    uae_u32 aa = ((const struct profile_sym *)a)->addr;
+    uae_u32 ba = ((const struct profile_sym *)b)->addr;
+    return aa < ba ? -1 : aa > ba ? 1 : 0;
+}
+
+static void add_sym (uae_u32 addr, uae_u32 end, const char *name)
+{
+    if (nsyms == maxsyms) {
+	maxsyms = maxsyms ? maxsyms * 2 : 256;
+	syms = realloc (syms, maxsyms * sizeof *syms);
+    }
+    syms[nsyms].addr = addr;
+    syms[nsyms].end = end;
+    syms[nsyms].name = my_strdup (name);
+    nsyms++;
+}
+
+static struct profile_sym *find_sym (uae_u32 pc)
+{
+    int lo = 0, hi = nsyms - 1, best = -1;
+
+    while (lo <= hi) {
+	int mid = (lo + hi) / 2;
+	if (syms[mid].addr <= pc) {
+	    best = mid;
+	    lo = mid + 1;
+	} else
+	    hi = mid - 1;
+    }
+    if (best < 0 || pc >= syms[best].end)
+	return 0;
+    return &syms[best];
+}
+
+/* The function a PC belongs to: its symbol's address, or the PC itself
+   if there is none.  */
+static uae_u32 func_key (uae_u32 pc)
+{
+    struct profile_sym *s = find_sym (pc);
+    return s ? s->addr : pc;
+}
+
+static const char *func_name (uae_u32 pc, char *buf)
+{
+    struct profile_sym *s = find_sym (pc);
+    if (s)
+	return s->name;
+    sprintf (buf, "0x%08x", pc);
+    return buf;
+}
+
+static uae_u32 hunk_long (const uae_u8 *p)
+{
+    return (p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+/* Does the BSTR at ADDR name NAME, ignoring any path in front?  */
+static int bstr_is (uaecptr addr, const char *name)
+{
+    char tmp[256];
+    int len, i;
+    char *p;
+
+    if (!valid_address (addr, 1))
+	return 0;
+    len = *get_real_address (addr);
+    if (!valid_address (addr, len + 1))
+	return 0;
+    memcpy (tmp, get_real_address (addr + 1), len);
+    tmp[len] = 0;
+    p = tmp;
+    for (i = 0; i < len; i++) {
+	if (tmp[i] == ':' || tmp[i] == '/')
+	    p = tmp + i + 1;
+    }
+    return strcmp (p, name) == 0;
+}
+
+/* The seglist of TASK if it is a process called NAME, or a CLI running
+   the command NAME: the CLI module if there is a CLI, otherwise the
+   third entry of pr_SegList.  */
+static uae_u32 task_seglist (uaecptr task, const char *name)
+{
+    uae_u32 nameptr, cli = 0, arr, seg;
+    int match;
+
+    if (!valid_address (task, 176) || *get_real_address (task + 8) != 13)
+	return 0;
+    match = read_long (task + 10, &nameptr) && valid_address (nameptr, 1)
+	&& strcmp ((char *)get_real_address (nameptr), name) == 0;
+    if (read_long (task + 172, &cli) && cli) {
+	if (!match && (!read_long ((cli << 2) + 16, &nameptr) || !bstr_is (nameptr << 2, name)))
+	    return 0;
+	return read_long ((cli << 2) + 60, &seg) ? seg : 0;
+    }
+    if (match && read_long (task + 128, &arr) && arr && read_long ((arr << 2) + 12, &seg))
+	return seg;
+    return 0;
+}
+
+static uae_u32 process_seglist (const char *name)
+{
+    uae_u32 execbase, node, next, seg;
+    int i;
+
+    if (!read_long (4, &execbase))
+	return 0;
+    if (read_long (execbase + 276, &node) && (seg = task_seglist (node, name)))
+	return seg;
+    for (i = 0; i < 2; i++) {
+	if (!read_long (execbase + (i ? 420 : 406), &node))
+	    continue;
+	while (read_long (node, &next) && next) {
+	    if ((seg = task_seglist (node, name)))
+		return seg;
+	    node = next;
+	}
+    }
+    return 0;
+}
+
+#define HUNK_CODE 0x3e9
+#define HUNK_DATA 0x3ea
+#define HUNK_BSS 0x3eb
+#define HUNK_RELOC32 0x3ec
+#define HUNK_RELOC16 0x3ed
+#define HUNK_RELOC8 0x3ee
+#define HUNK_EXT 0x3ef
+#define HUNK_SYMBOL 0x3f0
+#define HUNK_DEBUG 0x3f1
+#define HUNK_END 0x3f2
+#define HUNK_HEADER 0x3f3
+#define HUNK_DREL32 0x3f7
+#define HUNK_RELOC32SHORT 0x3fc
+
+#define MAX_HUNKS 256
+
+int profiler_load_symbols (const char *name, const char *seglist)
+{
+    uae_u32 base[MAX_HUNKS], size[MAX_HUNKS];
+    uae_u8 *buf, *p, *end;
+    const char *file = strrchr (name, '/');
+    char tmp[300];
+    uae_u32 seg, n, type;
+    int nhunks = 0, hunk = 0, added = 0, i, j;
+    long len;
+    FILE *f;
+
+    seg = process_seglist (seglist);
+    if (!seg) {
+	char *e;
+	seg = strtoul (seglist, &e, 16);
+	if (*e) {
+	    write_log ("No process '%s' found\n", seglist);
+	    return 0;
+	}
+    }
+    while (seg && nhunks < MAX_HUNKS) {
+	uae_u32 next;
+	if (!read_long ((seg << 2) - 4, &size[nhunks]) || !read_long (seg << 2, &next))
+	    break;
+	base[nhunks] = (seg << 2) + 4;
+	size[nhunks] -= 8;
+	nhunks++;
+	seg = next;
+    }
+    if (!nhunks) {
+	write_log ("Seglist %s is not in memory\n", seglist);
+	return 0;
+    }
+
+    f = fopen (name, "rb");
+    if (!f) {
+	write_log ("Couldn't open '%s'\n", name);
+	return 0;
+    }
+    fseek (f, 0, SEEK_END);
+    len = ftell (f);
+    fseek (f, 0, SEEK_SET);
+    buf = xmalloc (len + 4);
+    if (fread (buf, 1, len, f) != (size_t)len)
+	len = 0;
+    fclose (f);
+    file = file ? file + 1 : name;
+    p = buf;
+    end = buf + (len & ~3);
+
+    if (end - p < 20 || hunk_long (p) != HUNK_HEADER)
+	goto bad;
+    p += 4;
+    /* Resident library names, then the hunk table.  */
+    while ((n = hunk_long (p)) != 0) {
+	p += 4 + n * 4;
+	if (p >= end)
+	    goto bad;
+    }
+    p += 8;
+    i = hunk_long (p);
+    j = hunk_long (p + 4);
+    p += 8;
+    for (n = i; (int)n <= j; n++) {
+	if (p >= end)
+	    goto bad;
+	p += (hunk_long (p) & 0xc0000000) == 0xc0000000 ? 8 : 4;
+    }
+
+    /* Every hunk gets an entry of its own, for addresses no symbol
+       covers.  */
+    for (i = 0; i < nhunks; i++) {
+	sprintf (tmp, "%s:hunk%d", file, i);
+	add_sym (base[i], base[i] + size[i], tmp);
+    }
+
+    while (p + 4 <= end) {
+	type = hunk_long (p) & 0x3fffffff;
+	p += 4;
+	switch (type) {
+	case HUNK_CODE:
+	case HUNK_DATA:
+	case HUNK_DEBUG:
+	    p += 4 + hunk_long (p) * 4;
+	    break;
+	case HUNK_BSS:
+	    p += 4;
+	    break;
+	case HUNK_RELOC32:
+	case HUNK_RELOC16:
+	case HUNK_RELOC8:
+	    while (p < end && (n = hunk_long (p)) != 0)
+		p += 8 + n * 4;
+	    p += 4;
+	    break;
+	case HUNK_DREL32:
+	case HUNK_RELOC32SHORT:
+	    while (p + 2 <= end && (n = (p[0] << 8) | p[1]) != 0)
+		p += 4 + n * 2;
+	    p += 2;
+	    p = buf + ((p - buf + 3) & ~3);
+	    break;
+	case HUNK_SYMBOL:
+	case HUNK_EXT:
+	    while (p < end && (n = hunk_long (p)) != 0) {
+		int ext = n >> 24;
+		char *s = (char *)p + 4;
+		uae_u32 nlen = (n & 0xffffff) * 4;
+
+		if (p + 4 + nlen + 4 > end)
+		    goto bad;
+		p += 4 + nlen;
+		if (type == HUNK_SYMBOL || ext == 1 || ext == 2 || ext == 3) {
+		    uae_u32 v = hunk_long (p);
+		    p += 4;
+		    if (hunk < nhunks && v < size[hunk] && (type == HUNK_SYMBOL || ext == 1)) {
+			if (nlen > sizeof tmp - 1)
+			    nlen = sizeof tmp - 1;
+			memcpy (tmp, s, nlen);
+			tmp[nlen] = 0;
+			add_sym (base[hunk] + v, base[hunk] + size[hunk], tmp);
+			added++;
+		    }
+		} else if (ext == 130) {
+		    /* ext_common: size, then references */
+		    p += 4;
+		    p += 4 + hunk_long (p) * 4;
+		} else {
+		    /* references: count and offsets */
+		    p += 4 + hunk_long (p) * 4;
+		}
+	    }
+	    p += 4;
+	    break;
+	case HUNK_END:
+	    hunk++;
+	    break;
+	default:
+	    /* Overlays and anything unknown end the scan.  */
+	    p = end;
+	    break;
+	}
+    }
+    free (buf);
+
+    qsort (syms, nsyms, sizeof *syms, sym_cmp);
+    /* A symbol reaches up to the next one in the same hunk.  */
+    for (i = 0; i + 1 < nsyms; i++) {
+	if (syms[i + 1].addr < syms[i].end && syms[i + 1].end == syms[i].end)
+	    syms[i].end = syms[i + 1].addr;
+    }
+    write_log ("%d symbols for %d hunks of '%s'\n", added, nhunks, file);
+    return 1;
+
+  bad:
+    free (buf);
+    write_log ("'%s' is not an Amiga executable\n", name);
+    return 0;
+}
+
+/* Reports.  */
+
+struct flat_entry {
+    uae_u32 key;
+    unsigned long self, total;
+    int used;
+};
+
+static int flat_cmp (const void *a, const void *b)
+{
+    unsigned long sa = ((const struct flat_entry *)a)->self;
+    unsigned long sb = ((const struct flat_entry *)b)->self;
+    return sa < sb ? 1 : sa > sb ? -1 : 0;
+}
+
+static struct flat_entry *flat_get (struct flat_entry *tab, int size, uae_u32 key)
+{
+    int i = (key * 0x9E3779B1u) >> 8 & (size - 1);
+    while (tab[i].used && tab[i].key != key)
+	i = (i + 1) & (size - 1);
+    tab[i].used = 1;
+    tab[i].key = key;
+    return &tab[i];
+}
+
+void profiler_flat (int count)
+{
+    struct flat_entry *tab;
+    char tmp[20];
+    int size = 64, i, j, k, n;
+
+    if (!profile_samples) {
+	console_out ("No samples\n");
+	return;
+    }
+    while (size < nstacks * PROFILE_DEPTH * 2)
+	size *= 2;
+    tab = xcalloc (size, sizeof *tab);
+    for (i = 0; i < nstacks; i++) {
+	struct profile_stack *s = &stacks[i];
+	uae_u32 keys[PROFILE_DEPTH];
+
+	for (j = 0; j < s->depth; j++) {
+	    keys[j] = func_key (s->pc[j]);
+	    /* Recursion counts once towards the total.  */
+	    for (k = 0; k < j; k++) {
+		if (keys[k] == keys[j])
+		    break;
+	    }
+	    if (k == j)
+		flat_get (tab, size, keys[j])->total += s->count;
+	}
+	flat_get (tab, size, keys[0])->self += s->count;
+    }
+    for (i = n = 0; i < size; i++) {
+	if (tab[i].used)
+	    tab[n++] = tab[i];
+    }
+    qsort (tab, n, sizeof *tab, flat_cmp);
+    console_out ("%lu samples every %d cycles, %d stacks", profile_samples, profile_interval, nstacks);
+    if (profile_lost)
+	console_out (", %lu samples lost", profile_lost);
+    console_out ("\n    self          total\n");
+    for (i = 0; i < n && i < count && tab[i].self; i++) {
+	console_out ("%5.1f%% %6lu %5.1f%% %6lu  %s\n",
+		     tab[i].self * 100.0 / profile_samples, tab[i].self,
+		     tab[i].total * 100.0 / profile_samples, tab[i].total,
+		     func_name (tab[i].key, tmp));
+    }
+    free (tab);
+}
+
+int profiler_write_stacks (const char *name)
+{
+    char tmp[20];
+    FILE *f;
+    int i, j;
+
+    f = fopen (name, "w");
+    if (!f) {
+	write_log ("Couldn't open '%s'\n", name);
+	return 0;
+    }
+    for (i = 0; i < nstacks; i++) {
+	struct profile_stack *s = &stacks[i];
+	for (j = s->depth - 1; j >= 0; j--)
+	    fprintf (f, "%s%s", func_name (s->pc[j], tmp), j ? ";" : "");
+	fprintf (f, " %lu\n", s->count);
+    }
+    return fclose (f) == 0;
+}
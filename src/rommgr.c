@@ -10,6 +10,7 @@
 #include "sysdeps.h"
 
 #include "options.h"
+#include "threaddep/thread.h"
 #include "uae.h"
 #include "memory.h"
 #include "romlist.h"
@@ -623,14 +624,273 @@ void romwarning(int *ids)
 }
 #endif
 
+/* The ROM index remembers, for every file scan_roms has looked at, what
+ * it was, so that unchanged files need not be read and hashed again on
+ * the next start.  Entries are keyed by path, size and mtime; one line
+ * each of
+ *   <kind> <romdata id> <size> <mtime> <path>
+ * where kind is R for a known ROM, E for an encrypted one and N for
+ * anything else.  Keys and encrypted ROMs that couldn't be decoded are
+ * always read again, since the result depends on the keys found, and
+ * files that couldn't be read get no entry.  */
+
+#define ROMINDEX_MAGIC "UAE ROM index 1"
+
+struct romindex {
+    char *path;
+    long size, mtime;
+    char kind;
+    int id;
+    int seen;
+};
+
+static struct romindex *romindex;
+static int romindex_cnt, romindex_loaded, romindex_changed;
+static char romindex_file[256];
+
+static int count_roms (void)
+{
+    int i = 0;
+    while (roms[i].name)
+	i++;
+    return i;
+}
+
+static struct romindex *romindex_find (const char *path)
+{
+    int i;
+    for (i = 0; i < romindex_cnt; i++) {
+	if (!strcmp (romindex[i].path, path))
+	    return romindex + i;
+    }
+    return 0;
+}
+
+static void romindex_set (const char *path, long size, long mtime, char kind, int id)
+{
+    struct romindex *ri = romindex_find (path);
+
+    if (!ri) {
+	romindex = realloc (romindex, sizeof (struct romindex) * (romindex_cnt + 1));
+	ri = romindex + romindex_cnt++;
+	ri->path = my_strdup (path);
+    } else if (ri->size == size && ri->mtime == mtime && ri->kind == kind && ri->id == id) {
+	ri->seen = 1;
+	return;
+    }
+    ri->size = size;
+    ri->mtime = mtime;
+    ri->kind = kind;
+    ri->id = id;
+    ri->seen = 1;
+    romindex_changed = 1;
+}
+
+static void romindex_load (void)
+{
+    FILE *f;
+    char line[1024], magic[64];
+    int i;
+
+    romindex_loaded = 1;
+#ifdef OPTIONS_IN_HOME
+    char *home = getenv ("HOME");
+    if (!home || strlen (home) > sizeof romindex_file - 20)
+	return;
+    sprintf (romindex_file, "%s/.uaeroms", home);
+#else
+    strcpy (romindex_file, "uaeroms.idx");
+#endif
+    f = fopen (romindex_file, "r");
+    if (!f)
+	return;
+    /* A different ROM table may identify files differently.  */
+    sprintf (magic, "%s %d\n", ROMINDEX_MAGIC, count_roms ());
+    if (fgets (line, sizeof line, f) && !strcmp (line, magic)) {
+	while (fgets (line, sizeof line, f)) {
+	    char kind;
+	    int id, pos;
+	    long size, mtime;
+
+	    line[strcspn (line, "\n")] = 0;
+	    if (sscanf (line, "%c %d %ld %ld %n", &kind, &id, &size, &mtime, &pos) != 4
+		|| !line[pos])
+		continue;
+	    romindex_set (line + pos, size, mtime, kind, id);
+	}
+    }
+    fclose (f);
+    for (i = 0; i < romindex_cnt; i++)
+	romindex[i].seen = 0;
+    romindex_changed = 0;
+}
+
+static void romindex_save (void)
+{
+    FILE *f;
+    int i;
+
+    if (!romindex_changed || !romindex_file[0])
+	return;
+    f = fopen (romindex_file, "w");
+    if (!f) {
+	write_log ("Can't write ROM index '%s'\n", romindex_file);
+	return;
+    }
+    fprintf (f, "%s %d\n", ROMINDEX_MAGIC, count_roms ());
+    for (i = 0; i < romindex_cnt; i++) {
+	struct romindex *ri = romindex + i;
+	fprintf (f, "%c %d %ld %ld %s\n", ri->kind, ri->id, ri->size, ri->mtime, ri->path);
+    }
+    fclose (f);
+    romindex_changed = 0;
+}
+
+/* Forget files of directory PATH that are gone.  */
+static void romindex_prune (const char *path)
+{
+    int i, j, len = strlen (path);
+
+    for (i = j = 0; i < romindex_cnt; i++) {
+	struct romindex *ri = romindex + i;
+	if (!ri->seen && !strncmp (ri->path, path, len) && !strchr (ri->path + len, '/')) {
+	    free (ri->path);
+	    romindex_changed = 1;
+	    continue;
+	}
+	ri->seen = 0;
+	romindex[j++] = *ri;
+    }
+    romindex_cnt = j;
+}
+
+/* Files that have to be read are hashed by a few threads at once.  */
+
+#define SCAN_MAX_THREADS 8
+
+struct romscan {
+    char *path;
+    long size, mtime;
+    uae_u8 *data;	/* kept for keys and encrypted ROMs */
+    int datasize;
+    int encrypted;
+    int checked;	/* contents were read, or the size rules it out */
+    struct romdata *rd;
+};
+
+static struct romscan *scan_items;
+static int scan_count, scan_next;
+#ifdef SUPPORT_THREADS
+/* Guards scan_next and the zfile list, which isn't thread-safe.  */
+static uae_sem_t scan_lock;
+#define SCAN_LOCK() uae_sem_wait (&scan_lock)
+#define SCAN_UNLOCK() uae_sem_post (&scan_lock)
+#else
+#define SCAN_LOCK()
+#define SCAN_UNLOCK()
+#endif
+
+static void scan_one (struct romscan *rs)
+{
+    struct zfile *f;
+    long size;
+    uae_u8 *data;
+
+    SCAN_LOCK ();
+    f = zfile_open (rs->path, "rb");
+    SCAN_UNLOCK ();
+    if (!f)
+	return;
+    zfile_fseek (f, 0, SEEK_END);
+    size = zfile_ftell (f);
+    data = 0;
+    /* Weed out too-large files to save time.  */
+    if (size > 0 && size <= 1024 * 1024) {
+	data = malloc (size);
+	zfile_fseek (f, 0, SEEK_SET);
+	if (data && zfile_fread (data, 1, size, f) != (size_t)size) {
+	    free (data);
+	    data = 0;
+	}
+    } else
+	rs->checked = 1;
+    SCAN_LOCK ();
+    zfile_fclose (f);
+    SCAN_UNLOCK ();
+    if (!data)
+	return;
+    rs->checked = 1;
+
+    /* Decoding needs the keys, which are only complete once all files
+       have been read.  */
+    if (is_encrypted_rom (data, size)) {
+	rs->encrypted = 1;
+	rs->data = data;
+	rs->datasize = size;
+	return;
+    }
+    rs->rd = getromdatabydata (data, size);
+    if (rs->rd && rs->rd->type == ROMTYPE_KEY) {
+	rs->data = data;
+	rs->datasize = size;
+    } else
+	free (data);
+}
+
+static void *scan_thread (void *unused)
+{
+    for (;;) {
+	int i;
+
+	SCAN_LOCK ();
+	i = scan_next++;
+	SCAN_UNLOCK ();
+	if (i >= scan_count)
+	    break;
+	scan_one (scan_items + i);
+    }
+    return 0;
+}
+
+static void scan_files (void)
+{
+    scan_next = 0;
+#ifdef SUPPORT_THREADS
+    {
+	uae_thread_id tids[SCAN_MAX_THREADS];
+	int i, n = 1;
+
+#ifdef _SC_NPROCESSORS_ONLN
+	n = sysconf (_SC_NPROCESSORS_ONLN);
+#endif
+	if (n > SCAN_MAX_THREADS)
+	    n = SCAN_MAX_THREADS;
+	if (n > scan_count)
+	    n = scan_count;
+	uae_sem_init (&scan_lock, 0, 1);
+	/* This thread works too.  */
+	for (i = 0; i < n - 1; i++) {
+	    if (uae_start_thread (scan_thread, 0, &tids[i]) != 0)
+		break;
+	}
+	scan_thread (0);
+	while (i-- > 0)
+	    uae_wait_thread (tids[i]);
+	uae_sem_destroy (&scan_lock);
+    }
+#else
+    scan_thread (0);
+#endif
+}
+
 void scan_roms (const char *path, int loc)
 {
     DIR *dir;
     int pathlen = strlen (path);
     int bufsz = pathlen + 256;
     char *buffer;
-    uae_u8 *data;
     int keys_added = 0;
+    int i;
 
     dir = opendir (path);
     if (!dir)
@@ -639,20 +899,19 @@ void scan_roms (const char *path, int loc)
     buffer = malloc (bufsz);
     if (!buffer)
 	goto out;
-    data = malloc (1024 * 1024);
-    if (!data)
-	goto out1;
+    if (!romindex_loaded)
+	romindex_load ();
     romlist_clear (loc);
 
     strcpy (buffer, path);
     buffer[pathlen++] = '/';
     buffer[pathlen] = '\0';
+    scan_count = 0;
     for (;;) {
-	struct zfile *f;
 	struct dirent *ent = readdir (dir);
+	struct romindex *ri;
+	struct stat st;
 	int len;
-	struct romdata *rd;
-	long size;
 
 	if (!ent)
 	    break;
@@ -666,37 +925,60 @@ void scan_roms (const char *path, int loc)
 	    }
 	}
 	strcpy (buffer + pathlen, ent->d_name);
-	f = zfile_open (buffer, "rb");
-	if (!f)
+	if (stat (buffer, &st) != 0 || !S_ISREG (st.st_mode))
 	    continue;
 
-	zfile_fseek (f, 0, SEEK_END);
-	size = zfile_ftell (f);
-
-	/* Weed out too-large files to save time.  */
-	if (size > 1024 * 1024) {
-	    zfile_fclose (f);
+	ri = romindex_find (buffer);
+	if (ri && ri->size == (long)st.st_size && ri->mtime == (long)st.st_mtime
+	    && (ri->kind == 'N' || (ri->kind != 'K' && ri->id >= 0)))
+	{
+	    ri->seen = 1;
+	    if (ri->kind != 'N')
+		romlist_add (buffer, getromdatabyid (ri->id), loc);
 	    continue;
 	}
-	zfile_fseek (f, 0, SEEK_SET);
-	zfile_fread (data, 1, size, f);
-
-	rd = getromdatabydata (data, size);
-	zfile_fclose (f);
+	scan_items = realloc (scan_items, sizeof (struct romscan) * (scan_count + 1));
+	memset (scan_items + scan_count, 0, sizeof (struct romscan));
+	scan_items[scan_count].path = my_strdup (buffer);
+	scan_items[scan_count].size = st.st_size;
+	scan_items[scan_count].mtime = st.st_mtime;
+	scan_count++;
+    }
 
-	/* Add encrypted ROMs even if we don't have the key yet.  */
-	if (!rd && !is_encrypted_rom (data, size))
-	    continue;
+    if (scan_count)
+	scan_files ();
 
-	if (rd && rd->type == ROMTYPE_KEY) {
-	    if (addkey (data, size, ent->d_name))
+    for (i = 0; i < scan_count; i++) {
+	struct romscan *rs = scan_items + i;
+	if (rs->rd && rs->rd->type == ROMTYPE_KEY) {
+	    if (addkey (rs->data, rs->datasize, rs->path + pathlen))
 		keys_added = 1;
-	} else
-	    romlist_add (buffer, rd, loc);
+	}
+    }
+    for (i = 0; i < scan_count; i++) {
+	struct romscan *rs = scan_items + i;
+
+	if (rs->encrypted) {
+	    /* Add encrypted ROMs even if we don't have the key yet.  */
+	    rs->rd = getromdatabydata (rs->data, rs->datasize);
+	    romlist_add (rs->path, rs->rd, loc);
+	    romindex_set (rs->path, rs->size, rs->mtime, 'E', rs->rd ? rs->rd->id : -1);
+	} else if (rs->rd && rs->rd->type == ROMTYPE_KEY) {
+	    romindex_set (rs->path, rs->size, rs->mtime, 'K', rs->rd->id);
+	} else if (rs->rd) {
+	    romlist_add (rs->path, rs->rd, loc);
+	    romindex_set (rs->path, rs->size, rs->mtime, 'R', rs->rd->id);
+	} else if (rs->checked)
+	    romindex_set (rs->path, rs->size, rs->mtime, 'N', -1);
+	free (rs->data);
+	free (rs->path);
     }
-    /* Now, if we added any keys, reexamine all encrypted ROMs.  */
+    free (scan_items);
+    scan_items = 0;
+    scan_count = 0;
+
+    /* Now, if we added any keys, reexamine encrypted ROMs found earlier.  */
     if (keys_added) {
-	int i;
 	for (i = 0; i < romlist_cnt; i++) {
 	    struct romlist *rl = list_of_roms + i;
 	    if (rl->rd)
@@ -708,11 +990,12 @@ void scan_roms (const char *path, int loc)
 	    zfile_fclose (f);
 	}
     }
+    buffer[pathlen] = '\0';
+    romindex_prune (buffer);
+    romindex_save ();
     sort_romlist ();
     gui_romlist_changed ();
 
-    free (data);
-  out1:
     free (buffer);
   out:
     closedir (dir);
@@ -16,6 +16,8 @@
   * - only Chip-ram and Bogo-ram are saved and restored.
   * - disk drive type, imagefile, track and motor state
   * - Kickstart ROM version, address and size is saved. This data is not used during restore yet.
+  * - incremental statefiles that only contain the RAM pages changed since the
+  *   previous save or restore
   */
 
  /* Notes:
@@ -40,15 +42,31 @@
   *
   * set savestate_state = STATE_DORESTORE, savestate_filename = "..."
   *
+  * incremental save:
+  *
+  * set savestate_state = STATE_DOSAVEDELTA, savestate_filename = "..."
+  *
+  * The new statefile refers to the one last saved or restored by name, so
+  * that file must be kept.  savestate_flatten () turns such a chain back
+  * into a single statefile.
+  *
+  * rewind:
+  *
+  * savestate_capture () is called every frame and keeps snapshots in
+  * memory, savestate_dorewind (n) goes back n snapshots.
+  *
   */
 
 #include "sysconfig.h"
 #include "sysdeps.h"
 
 #include "options.h"
+#include "threaddep/thread.h"
 #include "memory.h"
+#include "custom.h"
 #include "zfile.h"
 #include "savestate.h"
+#include "compress.h"
 #include "gui.h"
 
 int savestate_state;
@@ -56,6 +74,91 @@ int savestate_state;
 char *savestate_filename;
 struct zfile *savestate_file;
 
+/* Chunk flags */
+#define CHUNK_FLAG_ZLIB 1
+#define CHUNK_FLAG_DELTA 2
+#define CHUNK_FLAG_LZ 0x100
+
+/* Compressed RAM chunks are split into blocks of this size, which are
+   compressed independently.  */
+#define COMPRESS_BLOCK LZ_MAX_BLOCK
+/* Block length flag for blocks that didn't compress.  */
+#define BLOCK_STORED 0x80000000
+
+static const struct ramchunk {
+    const char *name;
+    uae_u8 *(*save) (int *, uae_u8 **);
+} ramchunks[] = {
+    { "CRAM", save_cram },
+    { "BRAM", save_bram },
+    { "A3K1", save_a3000lram },
+    { "A3K2", save_a3000hram },
+    { "FRAM", save_fram },
+    { "ZRAM", save_zram },
+    { 0, 0 }
+};
+#define NUM_RAMCHUNKS 6
+
+/* The statefile that matches the current contents of the dirty maps, i.e.
+   the one last saved or restored, and the sizes of its RAM chunks.  An
+   incremental save refers to it.  */
+static char *savestate_base;
+static int savestate_base_ramsize[NUM_RAMCHUNKS];
+
+/* The statefile being restored, followed by the chain of statefiles it is
+   based on.  */
+#define MAX_DELTA_CHAIN 64
+static struct zfile *savestate_chain[MAX_DELTA_CHAIN];
+static int savestate_chain_len;
+
+/* Scratch space for the chunk writers, so that saving doesn't need to
+   allocate memory for each chunk.  AGAC is the largest one.  */
+static uae_u8 chunkbuf[2048];
+
+/* The rewind buffer.  Every currprefs.rewind_interval frames a snapshot
+   is written into a ring buffer of currprefs.rewind_size megabytes.  Only
+   every REWIND_KEYFRAME'th snapshot stores all of RAM, the others only
+   the pages changed since the previous snapshot, and restoring one chains
+   back to its keyframe just like incremental statefiles do.  */
+#define MAX_REWIND 256
+#define REWIND_KEYFRAME 16
+
+static struct rewind_snapshot {
+    uae_u8 *data;
+    long size;
+    int keyframe;
+} rewind_ring[MAX_REWIND];
+
+static uae_u8 *rewind_buffer;
+static long rewind_buffer_size;
+/* Snapshots are written here first, and then copied into the ring once
+   their size is known.  */
+static struct zfile *rewind_staging;
+static int rewind_first, rewind_count, rewind_deltas, rewind_frames;
+static int rewind_ramsize[NUM_RAMCHUNKS];
+static int rewind_target, restoring_rewind;
+
+#define REWIND_SNAP(n) (&rewind_ring[(rewind_first + (n)) % MAX_REWIND])
+
+/* Blocks of a compressed chunk are handed out to worker threads in
+   batches of COMPRESS_BATCH.  */
+#define COMPRESS_THREADS 4
+#define COMPRESS_BATCH 16
+
+static struct compress_job {
+    const uae_u8 *src;
+    int len;
+    uae_u8 *out;
+    /* 0 for all-zero blocks, BLOCK_STORED | len if it didn't compress */
+    uae_u32 outlen;
+} compress_jobs[COMPRESS_BATCH];
+static uae_u8 *compress_buffer;
+
+#ifdef SUPPORT_THREADS
+static uae_sem_t compress_lock, compress_work, compress_done;
+static int compress_next, compress_threads = -1;
+#endif
+
 /* functions for reading/writing bytes, shorts and longs in big-endian
  * format independent of host machine's endianess */
 
@@ -144,6 +247,15 @@ char *restore_string_func (const uae_u8 **dstp)
     return to;
 }
 
+static int ramchunk_index (const char *name)
+{
+    int i;
+    for (i = 0; ramchunks[i].name; i++)
+	if (!strcmp (ramchunks[i].name, name))
+	    return i;
+    return -1;
+}
+
 /* read and write IFF-style hunks */
 
 static void save_chunk (struct zfile *f, uae_u8 *chunk, long len, const char *name)
@@ -172,6 +284,170 @@ static void save_chunk (struct zfile *f, uae_u8 *chunk, long len, const char *na
 	zfile_fwrite (zero, 1, len, f);
 }
 
+static void compress_block (struct compress_job *j)
+{
+    int i;
+
+    for (i = 0; i < j->len && !j->src[i]; i++)
+	;
+    if (i == j->len) {
+	j->outlen = 0;
+	return;
+    }
+    j->outlen = lz_compress (j->src, j->len, j->out, j->len - 1);
+    if (!j->outlen)
+	j->outlen = BLOCK_STORED | j->len;
+}
+
+#ifdef SUPPORT_THREADS
+static void *compress_thread (void *unused)
+{
+    for (;;) {
+	int n;
+
+	uae_sem_wait (&compress_work);
+	uae_sem_wait (&compress_lock);
+	n = compress_next++;
+	uae_sem_post (&compress_lock);
+	compress_block (&compress_jobs[n]);
+	uae_sem_post (&compress_done);
+    }
+    return 0;
+}
+#endif
+
+/* Compress the first N blocks of compress_jobs.  */
+static void run_compress_jobs (int n)
+{
+    int i;
+
+#ifdef SUPPORT_THREADS
+    if (compress_threads < 0) {
+	uae_thread_id tid;
+
+	uae_sem_init (&compress_lock, 0, 1);
+	uae_sem_init (&compress_work, 0, 0);
+	uae_sem_init (&compress_done, 0, 0);
+	for (compress_threads = 0; compress_threads < COMPRESS_THREADS; compress_threads++) {
+	    if (uae_start_thread (compress_thread, 0, &tid) != 0)
+		break;
+	}
+    }
+    if (compress_threads > 0) {
+	compress_next = 0;
+	for (i = 0; i < n; i++)
+	    uae_sem_post (&compress_work);
+	for (i = 0; i < n; i++)
+	    uae_sem_wait (&compress_done);
+	return;
+    }
+#endif
+    for (i = 0; i < n; i++)
+	compress_block (&compress_jobs[i]);
+}
+
+/* Write a compressed RAM chunk: the RAM size, the block size, and then
+   every block preceded by its compressed length.  */
+static void save_chunk_compressed (struct zfile *f, uae_u8 *mem, long len, const char *name)
+{
+    uae_u8 tmp[12], *dst;
+    uae_u8 zero[4]= { 0, 0, 0, 0 };
+    long start, end, size, pos;
+    int i, n;
+
+    if (!compress_buffer)
+	compress_buffer = xmalloc (COMPRESS_BATCH * COMPRESS_BLOCK);
+
+    /* chunk name, flags, RAM size and block size, the chunk size is
+       filled in at the end */
+    start = zfile_ftell (f);
+    zfile_fwrite (name, 1, 4, f);
+    dst = &tmp[0];
+    save_u32 (0);
+    save_u32 (CHUNK_FLAG_LZ);
+    save_u32 (len);
+    zfile_fwrite (&tmp[0], 1, 12, f);
+    dst = &tmp[0];
+    save_u32 (COMPRESS_BLOCK);
+    zfile_fwrite (&tmp[0], 1, 4, f);
+    size = 4 + 4;
+
+    for (pos = 0; pos < len; pos += n * COMPRESS_BLOCK) {
+	n = (len - pos + COMPRESS_BLOCK - 1) / COMPRESS_BLOCK;
+	if (n > COMPRESS_BATCH)
+	    n = COMPRESS_BATCH;
+	for (i = 0; i < n; i++) {
+	    struct compress_job *j = &compress_jobs[i];
+	    long offs = pos + i * COMPRESS_BLOCK;
+
+	    j->src = mem + offs;
+	    j->len = len - offs < COMPRESS_BLOCK ? len - offs : COMPRESS_BLOCK;
+	    j->out = compress_buffer + i * COMPRESS_BLOCK;
+	}
+	run_compress_jobs (n);
+	for (i = 0; i < n; i++) {
+	    struct compress_job *j = &compress_jobs[i];
+
+	    dst = &tmp[0];
+	    save_u32 (j->outlen);
+	    zfile_fwrite (&tmp[0], 1, 4, f);
+	    size += 4;
+	    if (j->outlen & BLOCK_STORED) {
+		zfile_fwrite ((uae_u8 *)j->src, 1, j->len, f);
+		size += j->len;
+	    } else if (j->outlen) {
+		zfile_fwrite (j->out, 1, j->outlen, f);
+		size += j->outlen;
+	    }
+	}
+    }
+    /* alignment */
+    zfile_fwrite (zero, 1, 4 - (size & 3), f);
+
+    end = zfile_ftell (f);
+    zfile_fseek (f, start + 4, SEEK_SET);
+    dst = &tmp[0];
+    save_u32 (size + 4 + 4 + 4);
+    zfile_fwrite (&tmp[0], 1, 4, f);
+    zfile_fseek (f, end, SEEK_SET);
+}
+
+/* Write a RAM chunk that only contains the pages marked in DIRTY, each
+   preceded by its page number.  The rest comes from the base statefile.  */
+static void save_chunk_delta (struct zfile *f, uae_u8 *mem, long len, uae_u8 *dirty, uae_u8 mask, const char *name)
+{
+    uae_u8 tmp[12], *dst;
+    uae_u8 zero[4]= { 0, 0, 0, 0 };
+    int i, pages = dirty_pages (len), count = 0;
+    long size;
+
+    for (i = 0; i < pages; i++)
+	count += (dirty[i] & mask) != 0;
+    size = 4 + 4 + count * (4 + DIRTY_PAGE_SIZE);
+
+    /* chunk name */
+    zfile_fwrite (name, 1, 4, f);
+    /* chunk size, flags, RAM size and page size */
+    dst = &tmp[0];
+    save_u32 (size + 4 + 4 + 4);
+    save_u32 (CHUNK_FLAG_DELTA);
+    save_u32 (len);
+    zfile_fwrite (&tmp[0], 1, 12, f);
+    dst = &tmp[0];
+    save_u32 (DIRTY_PAGE_SIZE);
+    zfile_fwrite (&tmp[0], 1, 4, f);
+    for (i = 0; i < pages; i++) {
+	if (!(dirty[i] & mask))
+	    continue;
+	dst = &tmp[0];
+	save_u32 (i);
+	zfile_fwrite (&tmp[0], 1, 4, f);
+	zfile_fwrite (mem + i * DIRTY_PAGE_SIZE, 1, DIRTY_PAGE_SIZE, f);
+    }
+    /* alignment */
+    zfile_fwrite (zero, 1, 4 - (size & 3), f);
+}
+
 static uae_u8 *restore_chunk (struct zfile *f, char *name, long *len, long *filepos)
 {
     uae_u8 tmp[4], dummy[4], *mem;
@@ -201,15 +477,16 @@ static uae_u8 *restore_chunk (struct zfile *f, char *name, long *len, long *file
 
     /* chunk data.  RAM contents will be loaded during the reset phase,
        no need to malloc multiple megabytes here.  */
-    if (strcmp (name, "CRAM") != 0
-	&& strcmp (name, "BRAM") != 0
-	&& strcmp (name, "FRAM") != 0
-	&& strcmp (name, "ZRAM") != 0
-	&& strcmp (name, "A3K1") != 0
-	&& strcmp (name, "A3K2") != 0)
-    {
+    if (ramchunk_index (name) < 0) {
 	mem = malloc (len2);
 	zfile_fread (mem, 1, len2, f);
+    } else if (flags & (CHUNK_FLAG_ZLIB | CHUNK_FLAG_DELTA | CHUNK_FLAG_LZ)) {
+	/* Report the size of the whole RAM bank, not of the chunk.  */
+	mem = 0;
+	zfile_fread (tmp, 1, 4, f);
+	src = tmp;
+	*len = restore_u32 ();
+	zfile_fseek (f, len2 - 4, SEEK_CUR);
     } else {
 	mem = 0;
 	zfile_fseek (f, len2, SEEK_CUR);
@@ -222,19 +499,242 @@ static uae_u8 *restore_chunk (struct zfile *f, char *name, long *len, long *file
     return mem;
 }
 
-void restore_ram (size_t filepos, uae_u8 *memory)
+/* Return the position of chunk NAME in F in the same form restore_chunk
+   reports it, or -1 if there is no such chunk.  */
+static long find_chunk (struct zfile *f, const char *name)
 {
     uae_u8 tmp[8];
-    uae_u8 *src = tmp;
-    int size, fullsize;
-    uae_u32 flags;
+    const uae_u8 *src;
+    long len;
+
+    zfile_fseek (f, 0, SEEK_SET);
+    for (;;) {
+	if (zfile_fread (tmp, 1, 8, f) != 8)
+	    return -1;
+	src = tmp + 4;
+	len = restore_u32 () - 4 - 4 - 4;
+	if (!memcmp (tmp, name, 4))
+	    return zfile_ftell (f) - 4;
+	if (!memcmp (tmp, "END ", 4) || len < 0)
+	    return -1;
+	/* skip flags, data and alignment */
+	zfile_fseek (f, 4 + len + 4 - (len & 3), SEEK_CUR);
+    }
+}
+
+/* Return the name of the statefile F is based on, or 0 if F is complete.  */
+static char *read_base_name (struct zfile *f)
+{
+    uae_u8 tmp[8];
+    const uae_u8 *src = tmp;
+    long pos = find_chunk (f, "BASE");
+    long len;
+    char *name;
+
+    if (pos < 0)
+	return 0;
+    zfile_fseek (f, pos, SEEK_SET);
+    zfile_fread (tmp, 1, sizeof tmp, f);
+    len = restore_u32 () - 4 - 4 - 4;
+    name = malloc (len + 1);
+    zfile_fread (name, 1, len, f);
+    name[len] = 0;
+    return name;
+}
+
+static void close_base_chain (void)
+{
+    int i;
+    for (i = 1; i < savestate_chain_len; i++)
+	zfile_fclose (savestate_chain[i]);
+    savestate_chain_len = 0;
+}
+
+/* Open all statefiles that F depends on.  */
+static int open_base_chain (struct zfile *f)
+{
+    char *base;
+
+    savestate_chain[0] = f;
+    savestate_chain_len = 1;
+    while ((base = read_base_name (savestate_chain[savestate_chain_len - 1]))) {
+	struct zfile *bf;
+
+	if (savestate_chain_len == MAX_DELTA_CHAIN) {
+	    write_log ("Too many incremental statefiles based on '%s'\n", base);
+	    free (base);
+	    return 0;
+	}
+	bf = zfile_open (base, "rb");
+	if (!bf) {
+	    write_log ("Can't open base statefile '%s'\n", base);
+	    free (base);
+	    return 0;
+	}
+	write_log ("Statefile is based on '%s'\n", base);
+	free (base);
+	savestate_chain[savestate_chain_len++] = bf;
+    }
+    return 1;
+}
+
+/* Decompress a RAM chunk of SIZE bytes from F.  */
+static void restore_ram_compressed (struct zfile *f, const char *name, long size,
+				    uae_u8 *memory, uae_u32 maxsize)
+{
+    static uae_u8 inbuf[COMPRESS_BLOCK], outbuf[COMPRESS_BLOCK];
+    uae_u8 tmp[8];
+    const uae_u8 *src;
+    uae_u32 origsize, ramsize, blocksize, blen, pos, n, full;
+
+    zfile_fread (tmp, 1, 8, f);
+    src = tmp;
+    origsize = ramsize = restore_u32 ();
+    blocksize = restore_u32 ();
+    size -= 8;
+    if (blocksize == 0 || blocksize > COMPRESS_BLOCK) {
+	write_log ("Chunk '%s' has an unsupported block size %d\n", name, blocksize);
+	return;
+    }
+    if (maxsize && ramsize > maxsize)
+	ramsize = maxsize;
+
+    for (pos = 0; pos < ramsize; pos += blocksize) {
+	/* FULL is the size of the block, N how much of it we want */
+	full = origsize - pos < blocksize ? origsize - pos : blocksize;
+	n = ramsize - pos < full ? ramsize - pos : full;
+	if (size < 4)
+	    goto bad;
+	zfile_fread (tmp, 1, 4, f);
+	src = tmp;
+	blen = restore_u32 ();
+	size -= 4;
+	if (blen == 0) {
+	    memset (memory + pos, 0, n);
+	    continue;
+	}
+	if ((blen & ~BLOCK_STORED) > full || (blen & ~BLOCK_STORED) > size)
+	    goto bad;
+	size -= blen & ~BLOCK_STORED;
+	if (blen & BLOCK_STORED) {
+	    blen &= ~BLOCK_STORED;
+	    if (n == blen) {
+		zfile_fread (memory + pos, 1, n, f);
+	    } else {
+		zfile_fread (outbuf, 1, blen, f);
+		memcpy (memory + pos, outbuf, n);
+	    }
+	    continue;
+	}
+	zfile_fread (inbuf, 1, blen, f);
+	if (n == full) {
+	    if (lz_decompress (inbuf, blen, memory + pos, n) != (int)n)
+		goto bad;
+	} else {
+	    if (lz_decompress (inbuf, blen, outbuf, full) != (int)full)
+		goto bad;
+	    memcpy (memory + pos, outbuf, n);
+	}
+    }
+    return;
+
+  bad:
+    write_log ("Chunk '%s' is corrupt at offset %d\n", name, pos);
+}
 
-    zfile_fseek (savestate_file, filepos, SEEK_SET);
-    zfile_fread (tmp, 1, sizeof(tmp), savestate_file);
-    size = restore_u32 ();
+/* Load the RAM chunk at FILEPOS in the LEVELth statefile of the chain.
+   A delta chunk first loads the same chunk from the next statefile in the
+   chain and then applies its own pages on top.  MAXSIZE guards against
+   base statefiles with a different RAM size, 0 means no limit.  */
+static void restore_ram_1 (int level, long filepos, uae_u8 *memory, uae_u32 maxsize)
+{
+    struct zfile *f = savestate_chain[level];
+    uae_u8 tmp[12];
+    const uae_u8 *src;
+    char name[5];
+    uae_u32 size, flags, ramsize, pagesize, page;
+    long basepos;
+
+    zfile_fseek (f, filepos - 4, SEEK_SET);
+    zfile_fread (tmp, 1, sizeof tmp, f);
+    memcpy (name, tmp, 4);
+    name[4] = 0;
+    src = tmp + 4;
+    size = restore_u32 () - 4 - 4 - 4;
     flags = restore_u32 ();
-    size -= 4 + 4 + 4;
-    zfile_fread (memory, 1, size, savestate_file);
+    if (flags & CHUNK_FLAG_ZLIB) {
+	write_log ("Chunk '%s' is compressed with zlib, which isn't supported\n", name);
+	return;
+    }
+    if (flags & CHUNK_FLAG_LZ) {
+	restore_ram_compressed (f, name, size, memory, maxsize);
+	return;
+    }
+    if (!(flags & CHUNK_FLAG_DELTA)) {
+	if (maxsize && size > maxsize)
+	    size = maxsize;
+	zfile_fread (memory, 1, size, f);
+	return;
+    }
+
+    zfile_fread (tmp, 1, 8, f);
+    src = tmp;
+    ramsize = restore_u32 ();
+    pagesize = restore_u32 ();
+    size -= 8;
+    if (maxsize && ramsize > maxsize)
+	ramsize = maxsize;
+
+    basepos = -1;
+    if (level + 1 < savestate_chain_len)
+	basepos = find_chunk (savestate_chain[level + 1], name);
+    if (basepos < 0)
+	write_log ("Base statefile has no '%s' chunk!\n", name);
+    else
+	restore_ram_1 (level + 1, basepos, memory, ramsize);
+
+    while (size >= 4 + pagesize) {
+	zfile_fread (tmp, 1, 4, f);
+	src = tmp;
+	page = restore_u32 ();
+	if ((page + 1) * pagesize > ramsize) {
+	    write_log ("Chunk '%s' has a bad page number %d\n", name, page);
+	    break;
+	}
+	zfile_fread (memory + page * pagesize, 1, pagesize, f);
+	size -= 4 + pagesize;
+    }
+}
+
+void restore_ram (size_t filepos, uae_u8 *memory)
+{
+    restore_ram_1 (0, filepos, memory, 0);
+}
+
+/* Clear MASK in the dirty maps of all RAM banks and record their sizes
+   in RAMSIZE.  */
+static void clear_dirty (uae_u8 mask, int *ramsize)
+{
+    int i, j, len;
+    uae_u8 *dirty;
+
+    for (i = 0; ramchunks[i].name; i++) {
+	ramchunks[i].save (&len, &dirty);
+	ramsize[i] = len;
+	if (!dirty)
+	    continue;
+	for (j = 0; j < dirty_pages (len); j++)
+	    dirty[j] &= ~mask;
+    }
+}
+
+/* Remember FILENAME as the base for the next incremental save.  The RAM
+   contents match it now, so all pages become clean.  */
+static void set_savestate_base (const char *filename)
+{
+    free (savestate_base);
+    savestate_base = my_strdup (filename);
+    clear_dirty (DIRTY_SAVESTATE, savestate_base_ramsize);
 }
 
 static void restore_header (const uae_u8 *src)
@@ -254,19 +754,15 @@ static void restore_header (const uae_u8 *src)
 
 /* restore all subsystems */
 
-void restore_state (const char *filename)
+/* Restore from F, the first statefile of savestate_chain.  */
+static void restore_state_1 (struct zfile *f, const char *filename)
 {
-    struct zfile *f;
-    const uae_u8 *chunk, *end;
+    uae_u8 *chunk;
+    const uae_u8 *end;
     char name[5];
     long len;
     long filepos;
 
-    chunk = 0;
-    f = zfile_open (filename, "rb");
-    if (!f)
-	goto error;
-
     chunk = restore_chunk (f, name, &len, &filepos);
     if (!chunk || memcmp (name, "ASF ", 4)) {
 	write_log ("%s is not an AmigaStateFile\n",filename);
@@ -288,6 +784,11 @@ void restore_state (const char *filename)
 	write_log ("Chunk '%s' size %d\n", name, len);
 	if (!strcmp (name, "END "))
 	    break;
+	if (!strcmp (name, "BASE")) {
+	    /* already handled by open_base_chain */
+	    free (chunk);
+	    continue;
+	}
 	if (!strcmp (name, "CRAM")) {
 	    restore_cram (len, filepos);
 	    continue;
@@ -360,8 +861,10 @@ void restore_state (const char *filename)
 	    end = restore_expansion (chunk);
 	else if (!strcmp (name, "ROM "))
 	    end = restore_rom (chunk);
-	else
+	else {
 	    write_log ("unknown chunk '%s' size %d bytes\n", name, len);
+	    end = chunk + len;
+	}
 	if (len != end - chunk)
 	    write_log ("Chunk '%s' total size %d bytes but read %d bytes!\n",
 		       name, len, end - chunk);
@@ -371,38 +874,69 @@ void restore_state (const char *filename)
     return;
 
     error:
+    close_base_chain ();
+    restoring_rewind = 0;
     savestate_state = 0;
     savestate_file = 0;
     if (chunk)
 	free (chunk);
-    if (f)
+    zfile_fclose (f);
+}
+
+void restore_state (const char *filename)
+{
+    struct zfile *f;
+
+    f = zfile_open (filename, "rb");
+    if (!f) {
+	savestate_state = 0;
+	return;
+    }
+    if (!open_base_chain (f)) {
+	close_base_chain ();
 	zfile_fclose (f);
+	savestate_state = 0;
+	return;
+    }
+    /* The snapshots in the rewind buffer belong to another timeline.  */
+    rewind_count = 0;
+    zfile_fseek (f, 0, SEEK_SET);
+    restore_state_1 (f, filename);
 }
 
 void savestate_restore_finish (void)
 {
     if (savestate_state != STATE_RESTORE)
 	return;
+    close_base_chain ();
     zfile_fclose (savestate_file);
     savestate_file = 0;
     savestate_state = 0;
+    if (restoring_rewind) {
+	/* RAM no longer matches the last statefile.  */
+	free (savestate_base);
+	savestate_base = 0;
+	clear_dirty (DIRTY_REWIND, rewind_ramsize);
+	restoring_rewind = 0;
+    } else {
+	set_savestate_base (savestate_filename);
+    }
 }
 
-/* Save all subsystems  */
+/* Save all subsystems into F.  BASE names the statefile F is based on, if
+   any.  RAM chunks whose size matches BASESIZE only store the pages which
+   have MASK set in their dirty map; without BASESIZE everything is saved.
+   Other RAM chunks are compressed if COMPRESS is set.  */
 
-void save_state (const char *filename, const char *description)
+static void save_state_internal (struct zfile *f, const char *description,
+				 const char *base, const int *basesize, uae_u8 mask,
+				 int compress)
 {
     uae_u8 header[1000];
-    char tmp[100];
-    uae_u8 *dst;
-    struct zfile *f;
+    uae_u8 *dst, *dirty;
     int len,i;
     char name[5];
 
-    f = zfile_open (filename, "wb");
-    if (!f)
-	return;
-
     dst = header;
     save_u32 (0);
     save_string ("UAE");
@@ -410,26 +944,25 @@ void save_state (const char *filename, const char *description)
     save_string (description);
     save_chunk (f, header, dst-header, "ASF ");
 
-    dst = save_cpu (&len, 0);
+    if (base)
+	save_chunk (f, (uae_u8 *)base, strlen (base) + 1, "BASE");
+
+    dst = save_cpu (&len, chunkbuf);
     save_chunk (f, dst, len, "CPU ");
-    free (dst);
 
     strcpy (name, "DSKx");
     for (i = 0; i < 4; i++) {
-	dst = save_disk (i, &len, 0);
+	dst = save_disk (i, &len, chunkbuf);
 	if (dst) {
 	    name[3] = i + '0';
 	    save_chunk (f, dst, len, name);
-	    free (dst);
 	}
     }
-    dst = save_floppy (&len, 0);
+    dst = save_floppy (&len, chunkbuf);
     save_chunk (f, dst, len, "DISK");
-    free (dst);
 
-    dst = save_custom (&len, 0, 0);
+    dst = save_custom (&len, chunkbuf, 0);
     save_chunk (f, dst, len, "CHIP");
-    free (dst);
 
 #if 0
     dst = save_custom_blitter (&len);
@@ -437,61 +970,272 @@ void save_state (const char *filename, const char *description)
     free (dst);
 #endif
 
-    dst = save_custom_agacolors (&len, 0);
+    dst = save_custom_agacolors (&len, chunkbuf);
     save_chunk (f, dst, len, "AGAC");
-    free (dst);
 
     strcpy (name, "SPRx");
     for (i = 0; i < 8; i++) {
-	dst = save_custom_sprite (i, &len);
+	dst = save_custom_sprite (i, &len, chunkbuf);
 	name[3] = i + '0';
 	save_chunk (f, dst, len, name);
-	free (dst);
     }
 
     strcpy (name, "AUDx");
     for (i = 0; i < 4; i++) {
-	dst = save_audio (i, &len);
+	dst = save_audio (i, &len, chunkbuf);
 	name[3] = i + '0';
 	save_chunk (f, dst, len, name);
-	free (dst);
     }
 
-    dst = save_cia (0, &len, 0);
+    dst = save_cia (0, &len, chunkbuf);
     save_chunk (f, dst, len, "CIAA");
-    free (dst);
 
-    dst = save_cia (1, &len, 0);
+    dst = save_cia (1, &len, chunkbuf);
     save_chunk (f, dst, len, "CIAB");
-    free (dst);
 
-    dst = save_expansion (&len, 0);
+    dst = save_expansion (&len, chunkbuf);
     save_chunk (f, dst, len, "EXPA");
-    dst = save_cram (&len);
-    save_chunk (f, dst, len, "CRAM");
-    dst = save_bram (&len);
-    save_chunk (f, dst, len, "BRAM");
-    dst = save_a3000lram (&len);
-    save_chunk (f, dst, len, "A3K1");
-    dst = save_a3000hram (&len);
-    save_chunk (f, dst, len, "A3K2");
-    dst = save_fram (&len);
-    save_chunk (f, dst, len, "FRAM");
-    dst = save_zram (&len);
-    save_chunk (f, dst, len, "ZRAM");
-
-    dst = save_rom (1, &len, 0);
-    do {
+    for (i = 0; ramchunks[i].name; i++) {
+	dst = ramchunks[i].save (&len, &dirty);
 	if (!dst)
-	    break;
-	save_chunk (f, dst, len, "ROM ");
-	free (dst);
-    } while ((dst = save_rom (0, &len, 0)));
+	    continue;
+	if (basesize && dirty && len == basesize[i])
+	    save_chunk_delta (f, dst, len, dirty, mask, ramchunks[i].name);
+	else if (compress)
+	    save_chunk_compressed (f, dst, len, ramchunks[i].name);
+	else
+	    save_chunk (f, dst, len, ramchunks[i].name);
+    }
+
+    /* The ROM chunk isn't used during restore, so don't checksum the
+       Kickstart for every rewind snapshot.  */
+    if (mask != DIRTY_REWIND) {
+	dst = save_rom (1, &len, chunkbuf);
+	do {
+	    if (!dst)
+		break;
+	    save_chunk (f, dst, len, "ROM ");
+	} while ((dst = save_rom (0, &len, chunkbuf)));
+    }
 
     zfile_fwrite ("END ", 1, 4, f);
     zfile_fwrite ("\0\0\0\08", 1, 4, f);
+}
+
+/* If DELTA is set and the RAM layout hasn't changed since the last save
+   or restore, only store the changed RAM pages.  */
+
+static void save_state_1 (const char *filename, const char *description, int delta)
+{
+    struct zfile *f;
+    const char *base = 0;
+
+    if (delta && savestate_base && strcmp (savestate_base, filename) != 0)
+	base = savestate_base;
+
+    f = zfile_open (filename, "wb");
+    if (!f)
+	return;
+    save_state_internal (f, description, base, base ? savestate_base_ramsize : 0, DIRTY_SAVESTATE,
+			 currprefs.statefile_compress);
     write_log ("Save of '%s' complete\n", filename);
     zfile_fclose (f);
+    set_savestate_base (filename);
+}
+
+void save_state (const char *filename, const char *description)
+{
+    save_state_1 (filename, description, 0);
+}
+
+void save_state_delta (const char *filename, const char *description)
+{
+    save_state_1 (filename, description, 1);
+}
+
+/* Drop the oldest snapshot from the rewind buffer, along with the deltas
+   that depend on it.  */
+static void rewind_drop_oldest (void)
+{
+    do {
+	rewind_first = (rewind_first + 1) % MAX_REWIND;
+	rewind_count--;
+    } while (rewind_count > 0 && !REWIND_SNAP (0)->keyframe);
+}
+
+static int rewind_alloc (void)
+{
+    long size = (long)currprefs.rewind_size * 1024 * 1024;
+
+    if (size == rewind_buffer_size)
+	return rewind_buffer != 0;
+    free (rewind_buffer);
+    rewind_buffer_size = size;
+    rewind_count = 0;
+    rewind_buffer = 0;
+    if (!size)
+	return 0;
+    rewind_buffer = malloc (size);
+    if (!rewind_buffer) {
+	write_log ("Can't allocate %d MB for the rewind buffer\n", currprefs.rewind_size);
+	return 0;
+    }
+    return 1;
+}
+
+/* Called at the end of every frame; takes a snapshot for the rewind
+   buffer every currprefs.rewind_interval frames.  */
+void savestate_capture (void)
+{
+    struct rewind_snapshot *snap;
+    uae_u8 *pos;
+    long size;
+    int keyframe;
+
+    if (savestate_state || ++rewind_frames < currprefs.rewind_interval)
+	return;
+    rewind_frames = 0;
+    if (!rewind_alloc ())
+	return;
+    if (!rewind_staging) {
+	rewind_staging = zfile_fopen_growing (65536);
+	if (!rewind_staging)
+	    return;
+    }
+
+    custom_prepare_savestate ();
+    keyframe = rewind_count == 0 || rewind_deltas >= REWIND_KEYFRAME;
+  again:
+    zfile_fseek (rewind_staging, 0, SEEK_SET);
+    save_state_internal (rewind_staging, "rewind", 0, keyframe ? 0 : rewind_ramsize, DIRTY_REWIND, 0);
+    size = zfile_ftell (rewind_staging);
+    if (size > rewind_buffer_size) {
+	write_log ("Rewind buffer is too small for a %ld byte snapshot\n", size);
+	rewind_count = 0;
+	return;
+    }
+
+    /* Make room for it after the newest one.  */
+    pos = rewind_buffer;
+    if (rewind_count > 0) {
+	snap = REWIND_SNAP (rewind_count - 1);
+	pos = snap->data + snap->size;
+	if (pos + size > rewind_buffer + rewind_buffer_size)
+	    pos = rewind_buffer;
+    }
+    if (rewind_count == MAX_REWIND)
+	rewind_drop_oldest ();
+    while (rewind_count > 0) {
+	snap = REWIND_SNAP (0);
+	if (snap->data >= pos + size || snap->data + snap->size <= pos)
+	    break;
+	rewind_drop_oldest ();
+    }
+    if (rewind_count == 0 && !keyframe) {
+	/* The snapshot this delta was based on is gone.  */
+	keyframe = 1;
+	goto again;
+    }
+
+    memcpy (pos, zfile_getdata (rewind_staging), size);
+    snap = REWIND_SNAP (rewind_count);
+    snap->data = pos;
+    snap->size = size;
+    snap->keyframe = keyframe;
+    rewind_count++;
+    rewind_deltas = keyframe ? 1 : rewind_deltas + 1;
+    clear_dirty (DIRTY_REWIND, rewind_ramsize);
+}
+
+/* Go back N snapshots at the next vsync, 1 being the most recent one.
+   Returns 0 if there aren't that many.  */
+int savestate_dorewind (int n)
+{
+    if (savestate_state || n < 1 || n > rewind_count)
+	return 0;
+    rewind_target = rewind_count - n;
+    savestate_state = STATE_DOREWIND;
+    return 1;
+}
+
+/* Called instead of restore_state () when rewinding.  */
+void restore_rewind_state (void)
+{
+    struct rewind_snapshot *snap;
+    int n;
+
+    savestate_chain_len = 0;
+    for (n = rewind_target; ; n--) {
+	snap = REWIND_SNAP (n);
+	savestate_chain[savestate_chain_len++] = zfile_fopen_memory (snap->data, snap->size);
+	if (snap->keyframe)
+	    break;
+    }
+    /* Everything after the snapshot we return to is forgotten.  */
+    rewind_count = rewind_target + 1;
+    rewind_deltas = savestate_chain_len;
+    rewind_frames = 0;
+    restoring_rewind = 1;
+    restore_state_1 (savestate_chain[0], "rewind buffer");
+}
+
+int savestate_rewind_count (void)
+{
+    return rewind_count;
+}
+
+/* Write DST as a complete statefile with the same contents as SRC, which
+   may be an incremental statefile.  */
+int savestate_flatten (const char *src, const char *dst)
+{
+    struct zfile *f, *out;
+    uae_u8 *chunk, *mem;
+    char name[5];
+    long len, filepos, pos;
+
+    if (savestate_state == STATE_RESTORE)
+	return 0;
+    f = zfile_open (src, "rb");
+    if (!f)
+	return 0;
+    out = 0;
+    if (!open_base_chain (f))
+	goto end;
+    out = zfile_open (dst, "wb");
+    if (!out)
+	goto end;
+
+    zfile_fseek (f, 0, SEEK_SET);
+    for (;;) {
+	chunk = restore_chunk (f, name, &len, &filepos);
+	if (!strcmp (name, "END "))
+	    break;
+	if (ramchunk_index (name) >= 0) {
+	    pos = zfile_ftell (f);
+	    mem = xcalloc (len, 1);
+	    restore_ram_1 (0, filepos, mem, len);
+	    if (currprefs.statefile_compress)
+		save_chunk_compressed (out, mem, len, name);
+	    else
+		save_chunk (out, mem, len, name);
+	    free (mem);
+	    zfile_fseek (f, pos, SEEK_SET);
+	} else if (strcmp (name, "BASE") != 0) {
+	    save_chunk (out, chunk, len, name);
+	}
+	free (chunk);
+    }
+    zfile_fwrite ("END ", 1, 4, out);
+    zfile_fwrite ("\0\0\0\08", 1, 4, out);
+    write_log ("Flattened '%s' into '%s'\n", src, dst);
+
+  end:
+    close_base_chain ();
+    zfile_fclose (f);
+    if (!out)
+	return 0;
+    zfile_fclose (out);
+    return 1;
 }
 
 /*
@@ -513,7 +1257,12 @@ HUNK HEADER (beginning of every hunk)
 	hunk size (including header)
 	hunk flags
 
-	bit 0 = chunk contents are compressed with zlib (maybe RAM chunks only?)
+	bit 0 = RAM chunk contents are compressed with zlib (not
+		supported by this version)
+	bit 1 = RAM chunk only contains the pages that changed relative
+		to the statefile named in the BASE hunk (see below)
+	bit 8 = RAM chunk contents are compressed with the LZ codec in
+		compress.c (see below)
 
 HEADER
 
@@ -702,6 +1451,31 @@ RAM SPACE
 	RAM flags               4
 	RAM "bank" contents
 
+	LZ compressed RAM hunks (flag bit 8) contain instead
+
+	RAM "bank" size         4
+	block size              4 (at most 65536)
+	blocks                  compressed length (4) and data, for every
+				block of the bank.  Length 0 means the block
+				is all zeros, bit 31 set means it is stored
+				uncompressed.  The format is described in
+				compress.c.
+
+	Delta RAM hunks (flag bit 1) contain instead
+
+	RAM "bank" size         4
+	page size               4
+	changed pages           page number (4) and page contents,
+				repeated until the end of the hunk
+
+BASE
+
+	"BASE"
+
+	file name of the statefile this one is based on, null-terminated.
+	Only present in incremental statefiles.  The base statefile may
+	itself be incremental.
+
 ROM SPACE
 
 	"ROM "
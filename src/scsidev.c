@@ -332,6 +332,8 @@ static void scsidev_do_scsi (struct scsidevdata *sdd, uaecptr request)
 
 	 scmd->timeout = 80 * 60; /* the Amiga does not tell us how long the timeout shall be, so make it _very_ long (specified in seconds) */
     scmd->addr = bank_data->xlateaddr (scsi_data);
+    if (scsi_flags & 1)
+	memory_dirty (scsi_data, scsi_len);
     scmd->size = scsi_len;
     scmd->flags = ((scsi_flags & 1) ? SCG_RECV_DATA : 0) | SCG_DISRE_ENA;
     scmd->cdb_len = scsi_cmd_len;
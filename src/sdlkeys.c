@@ -397,6 +397,7 @@ static struct uae_hotkeyseq sdl_hotkeys[] =
     { MAKE_HOTKEYSEQ (SDLK_F12, SDLK_LSHIFT, SDLK_F4, -1, INPUTEVENT_SPC_EFLOPPY3) },
     { MAKE_HOTKEYSEQ (SDLK_F12, SDLK_RETURN, -1, -1,      INPUTEVENT_SPC_ENTERGUI) },
     { MAKE_HOTKEYSEQ (SDLK_F12, SDLK_f, -1, -1,		  INPUTEVENT_SPC_FREEZEBUTTON) },
+    { MAKE_HOTKEYSEQ (SDLK_F12, SDLK_BACKSPACE, -1, -1,   INPUTEVENT_SPC_STATEREWIND) },
     { HOTKEYS_END }
 };
 
@@ -428,6 +429,7 @@ static struct uae_hotkeyseq sdl_quartz_hotkeys[] =
     { MAKE_HOTKEYSEQ (SDLK_F11, SDLK_LSHIFT, SDLK_F4, -1, INPUTEVENT_SPC_EFLOPPY3) },
     { MAKE_HOTKEYSEQ (SDLK_F11, SDLK_RETURN, -1, -1,      INPUTEVENT_SPC_ENTERGUI) },
     { MAKE_HOTKEYSEQ (SDLK_F11, SDLK_f, -1, -1,		  INPUTEVENT_SPC_FREEZEBUTTON) },
+    { MAKE_HOTKEYSEQ (SDLK_F11, SDLK_BACKSPACE, -1, -1,   INPUTEVENT_SPC_STATEREWIND) },
     { HOTKEYS_END }
 };
 
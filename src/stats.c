@@ -0,0 +1,330 @@
+ /*
+  * UAE - The Un*x Amiga Emulator
+  *
+  * Per-frame counters of where emulation time goes
+  *
+  * stats_frame collects the counters of the current frame: instructions
+  * from the CPU loop, calls and host time of every event handler (which
+  * covers the copper, blitter, audio, disk and CIA emulation, and the
+  * hsync handler with the drawing and frame throttling inside it), and
+  * lines drawn or skipped.  The frame is closed once the hsync handler
+  * that ran the vsync has returned, so that all of its time is counted in
+  * that frame; the debugger's "stats" command shows the last one and the
+  * average since a reset, and with stats_file set the last frame also
+  * goes to a shared mapping of that file.
+  *
+  * Bank counting is off by default since it puts a wrapper in front of
+  * every memory access: "stats b" points each mem_banks[] slot at a copy
+  * of its addrbank whose functions count and pass the call on.
+  */
+
+#include "sysconfig.h"
+#include "sysdeps.h"
+
+#include "options.h"
+#include "memory.h"
+#include "custom.h"
+#include "events.h"
+#include "stats.h"
+
+#if defined _POSIX_MAPPED_FILES && _POSIX_MAPPED_FILES > 0
+#include <sys/mman.h>
+#define STATS_MMAP
+#endif
+
+/* Averages are taken over the last second or so.  */
+#define STATS_HISTORY 50
+
+struct uae_stats stats_frame;
+static struct uae_stats stats_history[STATS_HISTORY];
+static int history_count, frame_count;
+static int frame_done;
+static uae_u64 frame_start;
+static struct uae_stats *stats_page;
+
+#ifdef __GNUC__
+#define STATS_BARRIER() __sync_synchronize ()
+#else
+#define STATS_BARRIER()
+#endif
+
+static const char *event_names[STATS_EVENTS] = {
+    "hsync", "copper", "audio", "CIA", "blitter", "disk", "profiler", "?"
+};
+
+/* Bank counting.  */
+static uae_u8 *stats_slot;
+static addrbank *bank_orig[STATS_BANKS];
+static addrbank bank_wrap[STATS_BANKS];
+static uae_u32 bank_reads[STATS_BANKS], bank_writes[STATS_BANKS];
+static int stats_nbanks;
+
+#define NO_BANK 0xff
+
+static uae_u32 REGPARAM2 stats_lget (uaecptr addr)
+{
+    int i = stats_slot[bankindex (addr)];
+    bank_reads[i]++;
+    return bank_orig[i]->lget (addr);
+}
+static uae_u32 REGPARAM2 stats_wget (uaecptr addr)
+{
+    int i = stats_slot[bankindex (addr)];
+    bank_reads[i]++;
+    return bank_orig[i]->wget (addr);
+}
+static uae_u32 REGPARAM2 stats_bget (uaecptr addr)
+{
+    int i = stats_slot[bankindex (addr)];
+    bank_reads[i]++;
+    return bank_orig[i]->bget (addr);
+}
+static void REGPARAM2 stats_lput (uaecptr addr, uae_u32 v)
+{
+    int i = stats_slot[bankindex (addr)];
+    bank_writes[i]++;
+    bank_orig[i]->lput (addr, v);
+}
+static void REGPARAM2 stats_wput (uaecptr addr, uae_u32 v)
+{
+    int i = stats_slot[bankindex (addr)];
+    bank_writes[i]++;
+    bank_orig[i]->wput (addr, v);
+}
+static void REGPARAM2 stats_bput (uaecptr addr, uae_u32 v)
+{
+    int i = stats_slot[bankindex (addr)];
+    bank_writes[i]++;
+    bank_orig[i]->bput (addr, v);
+}
+
+int stats_banks_active (void)
+{
+    return stats_slot != 0;
+}
+
+int stats_banks_on (void)
+{
+    int s, i;
+
+    if (stats_slot)
+	return 1;
+    stats_slot = xmalloc (65536);
+    stats_nbanks = 0;
+    for (s = 0; s < 65536; s++) {
+	addrbank *b = mem_banks[s];
+
+	for (i = 0; i < stats_nbanks; i++) {
+	    if (bank_orig[i] == b)
+		break;
+	}
+	if (i == stats_nbanks) {
+	    if (stats_nbanks == STATS_BANKS) {
+		stats_slot[s] = NO_BANK;
+		continue;
+	    }
+	    bank_orig[i] = b;
+	    bank_wrap[i] = *b;
+	    bank_wrap[i].lget = stats_lget;
+	    bank_wrap[i].wget = stats_wget;
+	    bank_wrap[i].bget = stats_bget;
+	    bank_wrap[i].lput = stats_lput;
+	    bank_wrap[i].wput = stats_wput;
+	    bank_wrap[i].bput = stats_bput;
+	    bank_reads[i] = bank_writes[i] = 0;
+	    stats_nbanks++;
+	}
+	stats_slot[s] = i;
+	mem_banks[s] = &bank_wrap[i];
+    }
+    return 1;
+}
+
+void stats_banks_off (void)
+{
+    int s;
+
+    if (!stats_slot)
+	return;
+    /* Slots that were mapped anew meanwhile are left alone.  */
+    for (s = 0; s < 65536; s++) {
+	int i = stats_slot[s];
+	if (i != NO_BANK && mem_banks[s] == &bank_wrap[i])
+	    mem_banks[s] = bank_orig[i];
+    }
+    free (stats_slot);
+    stats_slot = 0;
+    stats_nbanks = 0;
+}
+
+static void stats_add (struct uae_stats *sum, const struct uae_stats *f)
+{
+    int i;
+
+    sum->frame++;
+    sum->frames_skipped += f->frames_skipped;
+    sum->insns += f->insns;
+    sum->lines_drawn += f->lines_drawn;
+    sum->lines_skipped += f->lines_skipped;
+    for (i = 0; i < STATS_EVENTS; i++) {
+	sum->event_calls[i] += f->event_calls[i];
+	sum->event_ticks[i] += f->event_ticks[i];
+    }
+    sum->draw_ticks += f->draw_ticks;
+    sum->wait_ticks += f->wait_ticks;
+    sum->frame_ticks += f->frame_ticks;
+    sum->nbanks = f->nbanks;
+    for (i = 0; i < (int)f->nbanks; i++) {
+	strcpy (sum->banks[i].name, f->banks[i].name);
+	sum->banks[i].reads += f->banks[i].reads;
+	sum->banks[i].writes += f->banks[i].writes;
+    }
+}
+
+/* Close the current frame.  */
+static void close_frame (uae_u64 now)
+{
+    int i;
+
+    stats_frame.version = STATS_VERSION;
+    stats_frame.frame = ++frame_count;
+    stats_frame.frame_ticks = now - frame_start;
+    frame_start = now;
+    stats_frame.nbanks = stats_nbanks;
+    for (i = 0; i < stats_nbanks; i++) {
+	strncpy (stats_frame.banks[i].name, bank_orig[i]->name ? bank_orig[i]->name : "?",
+		 sizeof stats_frame.banks[i].name - 1);
+	stats_frame.banks[i].reads = bank_reads[i];
+	stats_frame.banks[i].writes = bank_writes[i];
+	bank_reads[i] = bank_writes[i] = 0;
+    }
+    stats_history[frame_count % STATS_HISTORY] = stats_frame;
+    if (history_count < STATS_HISTORY)
+	history_count++;
+
+    if (stats_page) {
+	uae_u32 seq = stats_page->seq + 1;
+	stats_page->seq = seq;
+	STATS_BARRIER ();
+	stats_frame.seq = seq;
+	memcpy (stats_page, &stats_frame, sizeof stats_frame);
+	STATS_BARRIER ();
+	stats_page->seq = seq + 1;
+    }
+    memset (&stats_frame, 0, sizeof stats_frame);
+}
+
+/* Called from within the hsync handler, see stats_run_event.  */
+void stats_vsync (void)
+{
+    frame_done = 1;
+}
+
+void stats_run_event (int ev)
+{
+    uae_u64 t = stats_ticks (), now;
+
+    stats_frame.event_calls[ev]++;
+    (*eventtab[ev].handler) ();
+    now = stats_ticks ();
+    stats_frame.event_ticks[ev] += now - t;
+    if (frame_done) {
+	frame_done = 0;
+	close_frame (now);
+    }
+}
+
+void stats_reset (void)
+{
+    history_count = 0;
+}
+
+static void show_frame (const struct uae_stats *s, int n)
+{
+    double ticks = s->frame_ticks ? (double)s->frame_ticks : 1.0;
+    uae_u64 events = 0;
+    int i;
+
+    console_out ("  instructions %10.0f\n", (double)s->insns / n);
+    console_out ("  lines drawn  %10.1f  skipped %.1f   frames skipped %.0f%%\n",
+		 (double)s->lines_drawn / n, (double)s->lines_skipped / n,
+		 s->frames_skipped * 100.0 / n);
+    console_out ("  host ticks   %10.0f\n", (double)s->frame_ticks / n);
+    for (i = 0; i < STATS_EVENTS; i++) {
+	events += s->event_ticks[i];
+	if (!s->event_calls[i])
+	    continue;
+	console_out ("  %-10s %8.1f calls %5.1f%%\n", event_names[i],
+		     (double)s->event_calls[i] / n, s->event_ticks[i] * 100.0 / ticks);
+    }
+    console_out ("    drawing                %5.1f%%\n", s->draw_ticks * 100.0 / ticks);
+    console_out ("    waiting                %5.1f%%\n", s->wait_ticks * 100.0 / ticks);
+    console_out ("  CPU and rest             %5.1f%%\n",
+		 events < s->frame_ticks ? (s->frame_ticks - events) * 100.0 / ticks : 0.0);
+    for (i = 0; i < (int)s->nbanks; i++) {
+	if (!s->banks[i].reads && !s->banks[i].writes)
+	    continue;
+	console_out ("  %-22s %10.0f reads %10.0f writes\n", s->banks[i].name,
+		     (double)s->banks[i].reads / n, (double)s->banks[i].writes / n);
+    }
+}
+
+void stats_show (void)
+{
+    struct uae_stats sum;
+    int i;
+
+    if (!history_count) {
+	console_out ("No frame finished yet\n");
+	return;
+    }
+    console_out ("Frame %d:\n", frame_count);
+    show_frame (&stats_history[frame_count % STATS_HISTORY], 1);
+    if (history_count < 2)
+	return;
+    memset (&sum, 0, sizeof sum);
+    for (i = 0; i < history_count; i++)
+	stats_add (&sum, &stats_history[(frame_count - i) % STATS_HISTORY]);
+    console_out ("Average of the last %d frames:\n", history_count);
+    show_frame (&sum, history_count);
+}
+
+void stats_init (const char *filename)
+{
+    frame_start = stats_ticks ();
+    if (!filename || !filename[0])
+	return;
+#ifdef STATS_MMAP
+    {
+	FILE *f = fopen (filename, "w+b");
+	void *p;
+
+	if (!f || ftruncate (fileno (f), sizeof *stats_page) != 0) {
+	    write_log ("Can't create stats file '%s'\n", filename);
+	    if (f)
+		fclose (f);
+	    return;
+	}
+	p = mmap (0, sizeof *stats_page, PROT_READ | PROT_WRITE, MAP_SHARED, fileno (f), 0);
+	fclose (f);
+	if (p == MAP_FAILED) {
+	    write_log ("Can't map stats file '%s'\n", filename);
+	    return;
+	}
+	stats_page = (struct uae_stats *)p;
+	stats_page->version = STATS_VERSION;
+    }
+#else
+    write_log ("No shared stats page on this system\n");
+#endif
+}
+
+void stats_exit (void)
+{
+    stats_banks_off ();
+#ifdef STATS_MMAP
+    if (stats_page)
+	munmap ((void *)stats_page, sizeof *stats_page);
+#endif
+    stats_page = 0;
+}
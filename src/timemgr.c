@@ -63,6 +63,20 @@ volatile int delaying_for_sound;
 
 unsigned long gtod_resolution, gtod_secs;
 
+/* Frames emulated so far in headless mode.  */
+static int headless_frames_done;
+
+/* Headless runs must not depend on the host clock, so their RTC starts
+   at 2000-01-01 00:00:00 UTC and advances with the emulated frames.  */
+#define HEADLESS_EPOCH 946684800
+
+time_t get_rtc_time (void)
+{
+    if (currprefs.headless)
+	return HEADLESS_EPOCH + headless_frames_done / vblank_hz;
+    return time (0);
+}
+
 void init_gtod (void)
 {
     struct timeval tv1, tv2;
@@ -108,6 +122,14 @@ void compute_vsynctime (void)
 
 void time_vsync (void)
 {
+    if (currprefs.headless) {
+	/* Never wait; just stop after the requested number of frames.  */
+	if (++headless_frames_done == currprefs.headless_frames) {
+	    write_log ("Headless run finished after %d frames\n", headless_frames_done);
+	    uae_quit ();
+	}
+	return;
+    }
     if (sync_with_sound) {
 	/* We don't strictly need it, but keep vsyncmintime accurate.  */
 	if (use_gtod) {
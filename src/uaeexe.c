@@ -110,6 +110,7 @@ static uae_u32 uaeexe_server (TrapContext *dummy)
     dst = (char *) get_real_address (ARG (0));
     len = ARG (1);
     strncpy (dst, cmd, len);
+    memory_dirty (ARG (0), len);
     printf ("Sending '%s' to remote cli\n", cmd); /**/
     free (cmd);
     return ARG (0);
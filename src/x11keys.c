@@ -413,6 +413,7 @@ static struct uae_hotkeyseq x11_hotkeys[] =
     { MAKE_HOTKEYSEQ (XK_F12, XK_Shift_L, XK_F4, -1,  INPUTEVENT_SPC_EFLOPPY3) },
     { MAKE_HOTKEYSEQ (XK_F12, XK_Return, -1, -1,      INPUTEVENT_SPC_ENTERGUI) },
     { MAKE_HOTKEYSEQ (XK_F12, XK_f, -1, -1,           INPUTEVENT_SPC_FREEZEBUTTON) },
+    { MAKE_HOTKEYSEQ (XK_F12, XK_BackSpace, -1, -1,   INPUTEVENT_SPC_STATEREWIND) },
     { HOTKEYS_END }
 };
 
@@ -108,6 +108,7 @@ void setup_brkhandler (void)
 struct disp_info {
     XImage *ximg;
     char *image_mem;
+    int shared; /* ximg->data points into gfxmemory */
 #if SHM_SUPPORT_LINKS == 1
     XShmSegmentInfo shminfo;
 #endif
@@ -239,6 +240,71 @@ static void get_image (int w, int h, struct disp_info *dispi)
     dispi->ximg = new_img;
 }
 
+/*
+ * If the Picasso96 screen has the pixel format of our visual, build its
+ * image over the board memory, so that the server reads the screen from
+ * there and nothing has to be copied.  The image is pointed at the
+ * visible part of the screen before each update.
+ */
+static int get_shared_picasso_image (int w, int h, struct disp_info *dispi)
+{
+    XImage *new_img;
+
+    if (picasso96_state.RGBFormat != picasso_vidinfo.rgbformat || !gfxmemory)
+	return 0;
+
+#if SHM_SUPPORT_LINKS == 1
+    if (currprefs.x11_use_mitshm && shmavail) {
+	XShmSegmentInfo *shminfo = &dispi->shminfo;
+
+	if (gfxmem_shmid == -1)
+	    return 0;
+	new_img = XShmCreateImage (display, vis, bitdepth, ZPixmap, (char *)gfxmemory, shminfo, w, h);
+	if (new_img == 0)
+	    return 0;
+	shminfo->shmid = gfxmem_shmid;
+	shminfo->shmaddr = (char *)gfxmemory;
+	shminfo->readOnly = True;
+	shmerror = 0;
+	oldshmerrorhandler = XSetErrorHandler (shmerrorhandler);
+	XShmAttach (display, shminfo);
+	XSync (display, 0);
+	XSetErrorHandler (oldshmerrorhandler);
+	if (shmerror) {
+	    new_img->data = 0;
+	    XDestroyImage (new_img);
+	    shminfo->shmid = -1;
+	    write_log ("Can't share the Picasso96 screen with the X server.\n");
+	    return 0;
+	}
+    } else
+#endif
+	new_img = XCreateImage (display, vis, bitdepth, ZPixmap, 0, (char *)gfxmemory,
+				w, h, 32, 0);
+
+    dispi->ximg = new_img;
+    dispi->image_mem = 0;
+    dispi->shared = 1;
+    write_log ("Sharing the Picasso96 screen with the X server.\n");
+    return 1;
+}
+
+static int update_shared_picasso_image (void)
+{
+    uae_u32 bpr = picasso96_state.BytesPerRow;
+    uae_u32 off = picasso96_state.Address - gfxmem_start;
+
+    off += picasso96_state.YOffset * bpr + picasso96_state.XOffset * picasso96_state.BytesPerPixel;
+    if (picasso96_state.Address < gfxmem_start || bpr == 0
+	|| off + picasso_vidinfo.height * bpr > allocated_gfxmem)
+	return 0;
+    /* MIT-SHM derives the stride from the width, so make them agree.  */
+    pic_dinfo.ximg->width = bpr / picasso96_state.BytesPerPixel;
+    pic_dinfo.ximg->bytes_per_line = bpr;
+    pic_dinfo.ximg->data = (char *)gfxmemory + off;
+    return 1;
+}
+
 #ifdef USE_VIDMODE_EXTENSION
 static XF86VidModeModeInfo **allmodes;
 static int vidmodecount;
@@ -714,6 +780,7 @@ static void init_dispinfo (struct disp_info *disp)
     disp->shminfo.shmid = -1;
 #endif
     disp->ximg = 0;
+    disp->shared = 0;
 }
 
 static void reset_cursor (void)
@@ -802,6 +869,8 @@ int graphics_subinit (void)
     XSync (display, 0);
     mygc = XCreateGC (display, mywin, 0, 0);
 
+    picasso_vidinfo.extra_mem = 1;
+
     if (dgamode) {
 #ifdef USE_DGA_EXTENSION
 	enter_dga_mode ();
@@ -811,13 +880,15 @@ int graphics_subinit (void)
     } else {
 	get_image (current_width, current_height, &ami_dinfo);
 	if (screen_is_picasso) {
-	    get_image (current_width, current_height, &pic_dinfo);
-	    picasso_vidinfo.rowbytes = pic_dinfo.ximg->bytes_per_line;
+	    if (get_shared_picasso_image (current_width, current_height, &pic_dinfo))
+		picasso_vidinfo.extra_mem = 0;
+	    else {
+		get_image (current_width, current_height, &pic_dinfo);
+		picasso_vidinfo.rowbytes = pic_dinfo.ximg->bytes_per_line;
+	    }
 	}
     }
 
-    picasso_vidinfo.extra_mem = 1;
-
     if (need_dither) {
 	gfxvidinfo.maxblocklines = 0;
 	gfxvidinfo.rowbytes = gfxvidinfo.pixbytes * current_width;
@@ -986,10 +1057,17 @@ static void destroy_dinfo (struct disp_info *dinfo)
     if (dinfo->ximg == NULL)
 	return;
 #if SHM_SUPPORT_LINKS == 1
-    if (dinfo->shminfo.shmid != -1)
-	shmdt (dinfo->shminfo.shmaddr);
+    if (dinfo->shminfo.shmid != -1) {
+	if (dinfo->shared)
+	    XShmDetach (display, &dinfo->shminfo);
+	else
+	    shmdt (dinfo->shminfo.shmaddr);
+    }
     dinfo->shminfo.shmid = -1;
 #endif
+    if (dinfo->shared)
+	dinfo->ximg->data = 0;
+    dinfo->shared = 0;
     XDestroyImage (dinfo->ximg);
     dinfo->ximg = NULL;
 }
@@ -1180,7 +1258,7 @@ void handle_events (void)
     }
 
 #if defined PICASSO96
-    if (! dgamode) {
+    if (! dgamode && (! pic_dinfo.shared || update_shared_picasso_image ())) {
 	if (screen_is_picasso && refresh_necessary) {
 	    DO_PUTIMAGE (pic_dinfo.ximg, 0, 0, 0, 0,
 			 picasso_vidinfo.width, picasso_vidinfo.height);
@@ -24,6 +24,11 @@ struct zfile
     struct zfile **pprev;
     FILE *f;
     char name[L_tmpnam];
+    /* memory files, f is NULL for these */
+    uae_u8 *data;
+    long size, seek;
+    /* Size of DATA for files that grow, 0 for the others.  */
+    long alloc;
 };
 
 static struct zfile *zlist = 0;
@@ -37,8 +42,11 @@ void zfile_exit (void)
 
     while ((l = zlist)) {
 	zlist = l->next;
-	fclose (l->f);
+	if (l->f)
+	    fclose (l->f);
 	unlink (l->name); /* sam: in case unlink () after fopen () fails */
+	if (l->alloc)
+	    free (l->data);
 	free (l);
     }
 }
@@ -53,7 +61,13 @@ int zfile_fclose (struct zfile *f)
     if (f->next)
 	f->next->pprev = f->pprev;
     (*f->pprev) = f->next;
-    
+
+    if (!f->f) {
+	if (f->alloc)
+	    free (f->data);
+	free (f);
+	return 0;
+    }
     ret = fclose (f->f);
     unlink (f->name);
 
@@ -64,22 +78,71 @@ int zfile_fclose (struct zfile *f)
 
 int zfile_fseek (struct zfile *z, long offset, int mode)
 {
-    return fseek (z->f, offset, mode);
+    if (z->f)
+	return fseek (z->f, offset, mode);
+    if (mode == SEEK_CUR)
+	offset += z->seek;
+    else if (mode == SEEK_END)
+	offset += z->size;
+    if (offset < 0 || (z->data && offset > z->size))
+	return -1;
+    z->seek = offset;
+    return 0;
 }
 
 long zfile_ftell (struct zfile *z)
 {
-    return ftell (z->f);
+    if (z->f)
+	return ftell (z->f);
+    return z->seek;
 }
 
 size_t zfile_fread (void *b, size_t l1, size_t l2, struct zfile *z)
 {
-    return fread (b, l1, l2, z->f);
+    long avail;
+
+    if (z->f)
+	return fread (b, l1, l2, z->f);
+    avail = z->data && z->seek < z->size ? z->size - z->seek : 0;
+    if (l1 == 0 || l1 * l2 > (size_t)avail)
+	l2 = l1 ? avail / l1 : 0;
+    memcpy (b, z->data + z->seek, l1 * l2);
+    z->seek += l1 * l2;
+    return l2;
 }
 
-size_t zfile_fwrite (void *b, size_t l1, size_t l2, struct zfile *z)
+size_t zfile_fwrite (const void *b, size_t l1, size_t l2, struct zfile *z)
 {
-    return fwrite (b, l1, l2, z->f);
+    if (z->f)
+	return fwrite (b, l1, l2, z->f);
+    if (z->alloc) {
+	long end = z->seek + l1 * l2;
+	if (end > z->alloc) {
+	    long n = z->alloc * 2 > end ? z->alloc * 2 : end;
+	    uae_u8 *p = realloc (z->data, n);
+	    if (!p)
+		return 0;
+	    z->data = p;
+	    z->alloc = n;
+	}
+	memcpy (z->data + z->seek, b, l1 * l2);
+	z->seek = end;
+	if (z->seek > z->size)
+	    z->size = z->seek;
+	return l2;
+    }
+    if (!z->data) {
+	/* Only count the bytes.  */
+	z->seek += l1 * l2;
+	if (z->seek > z->size)
+	    z->size = z->seek;
+	return l2;
+    }
+    if (l1 == 0 || z->seek + l1 * l2 > (size_t)z->size)
+	l2 = l1 ? (z->size - z->seek) / l1 : 0;
+    memcpy (z->data + z->seek, b, l1 * l2);
+    z->seek += l1 * l2;
+    return l2;
 }
 
 /*
@@ -255,3 +318,57 @@ struct zfile *zfile_open (const char *name, const char *mode)
 
     return l;
 }
+
+/*
+ * Access SIZE bytes at DATA like a file.  Writes can't grow the buffer.
+ * If DATA is NULL nothing is stored; the file only keeps track of how
+ * much was written, which can be used to find out how big a buffer
+ * needs to be.
+ */
+struct zfile *zfile_fopen_memory (uae_u8 *data, long size)
+{
+    struct zfile *l = malloc (sizeof *l);
+
+    if (! l)
+	return NULL;
+    strcpy (l->name, "");
+    l->f = NULL;
+    l->data = data;
+    l->size = data ? size : 0;
+    l->seek = 0;
+    l->alloc = 0;
+
+    l->pprev = &zlist;
+    l->next = zlist;
+    if (l->next)
+	l->next->pprev = &l->next;
+    zlist = l;
+
+    return l;
+}
+
+/*
+ * A memory file whose buffer grows as needed, starting at SIZE bytes.
+ * The buffer is kept when seeking back, so a file that is rewritten
+ * from the start over and over only allocates while it gets bigger.
+ */
+struct zfile *zfile_fopen_growing (long size)
+{
+    uae_u8 *data = malloc (size);
+    struct zfile *l;
+
+    if (! data)
+	return NULL;
+    l = zfile_fopen_memory (data, 0);
+    if (! l) {
+	free (data);
+	return NULL;
+    }
+    l->alloc = size;
+    return l;
+}
+
+uae_u8 *zfile_getdata (struct zfile *z)
+{
+    return z->data;
+}